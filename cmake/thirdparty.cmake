@@ -65,3 +65,25 @@ CPMAddPackage(
   GITHUB_REPOSITORY Naios/function2
   GIT_TAG 4.2.4
 )
+
+# Basis Universal transcoder for KHR_texture_basisu textures
+CPMAddPackage(
+  NAME basisu
+  GITHUB_REPOSITORY BinomialLLC/basis_universal
+  GIT_TAG v1_50_0_2
+  DOWNLOAD_ONLY YES
+)
+
+if (basisu_ADDED)
+  # UASTC textures are usually zstd supercompressed, the zstd decoder is a single C file
+  enable_language(C)
+
+  add_library(basisu_transcoder
+    ${basisu_SOURCE_DIR}/transcoder/basisu_transcoder.cpp
+    ${basisu_SOURCE_DIR}/zstd/zstddeclib.c)
+
+  set_property(TARGET basisu_transcoder PROPERTY CXX_STANDARD 20)
+
+  target_include_directories(basisu_transcoder PUBLIC ${basisu_SOURCE_DIR}/transcoder)
+  target_compile_definitions(basisu_transcoder PUBLIC BASISD_SUPPORT_KTX2_ZSTD=1)
+endif ()
@@ -0,0 +1,72 @@
+#include "DynamicResolution.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+
+// Frame times between these fractions of the target keep the current scale
+constexpr float LOWER_THRESHOLD = 0.85f;
+constexpr float UPPER_THRESHOLD = 1.0f;
+// The scale aims for a frame time slightly below the target, so that it isn't left right away
+constexpr float AIM = 0.92f;
+
+constexpr float MAX_SCALE_DECREASE = 0.1f;
+constexpr float MAX_SCALE_INCREASE = 0.02f;
+
+constexpr float FRAME_TIME_SMOOTHING = 0.2f;
+// Longer than the latency of the timings, which is the number of frames in flight
+constexpr uint32_t COOLDOWN_FRAMES = 8;
+
+DynamicResolution::DynamicResolution(CreateInfo info)
+  : targetFrameMs(info.targetFrameMs)
+  , minScale(info.minScale)
+  , maxScale(info.maxScale)
+  , scale(info.maxScale)
+{
+}
+
+float DynamicResolution::update(float frame_ms)
+{
+  scale = std::clamp(scale, minScale, maxScale);
+
+  if (frame_ms <= 0.0f)
+    return scale;
+
+  smoothedFrameMs = smoothedFrameMs < 0.0f
+    ? frame_ms
+    : smoothedFrameMs + (frame_ms - smoothedFrameMs) * FRAME_TIME_SMOOTHING;
+
+  if (cooldownFrames > 0)
+  {
+    --cooldownFrames;
+    return scale;
+  }
+
+  const bool overBudget = smoothedFrameMs > UPPER_THRESHOLD * targetFrameMs;
+  const bool underBudget = smoothedFrameMs < LOWER_THRESHOLD * targetFrameMs;
+  if (!overBudget && !underBudget)
+    return scale;
+
+  const float idealScale = scale * std::sqrt(AIM * targetFrameMs / smoothedFrameMs);
+  const float newScale = std::clamp(
+    std::clamp(idealScale, scale - MAX_SCALE_DECREASE, scale + MAX_SCALE_INCREASE),
+    minScale,
+    maxScale);
+
+  if (newScale != scale)
+  {
+    scale = newScale;
+    cooldownFrames = COOLDOWN_FRAMES;
+    // The old times describe the old scale
+    smoothedFrameMs = -1.0f;
+  }
+
+  return scale;
+}
+
+void DynamicResolution::reset()
+{
+  scale = maxScale;
+  smoothedFrameMs = -1.0f;
+  cooldownFrames = 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+
+/**
+ * Picks the render scale of the next frame so that the GPU frame time stays at a target.
+ *
+ * The cost of a frame is assumed to be proportional to the number of rendered pixels, i.e. to the
+ * square of the scale. Frame times are smoothed, and the scale is only changed when the smoothed
+ * time leaves a band around the target. As timings arrive a few frames late, every change is
+ * followed by a cooldown, so that the controller doesn't react to frames rendered before it.
+ * Lowering the scale is done in larger steps than raising it, spikes are worse than blur.
+ */
+class DynamicResolution
+{
+public:
+  struct CreateInfo
+  {
+    float targetFrameMs = 16.0f;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+  };
+
+  explicit DynamicResolution(CreateInfo info);
+
+  // Feeds the GPU time of a finished frame, non-positive times are ignored. Returns the scale to
+  // render the next frame at.
+  float update(float frame_ms);
+  // Drops the history, e.g. after the targets were reallocated
+  void reset();
+
+  float getScale() const { return scale; }
+  float getSmoothedFrameMs() const { return smoothedFrameMs; }
+
+  float& getTargetFrameMs() { return targetFrameMs; }
+  float& getMinScale() { return minScale; }
+  float& getMaxScale() { return maxScale; }
+
+private:
+  float targetFrameMs;
+  float minScale;
+  float maxScale;
+
+  float scale;
+  float smoothedFrameMs = -1.0f;
+  uint32_t cooldownFrames = 0;
+};
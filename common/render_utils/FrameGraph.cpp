@@ -0,0 +1,467 @@
+#include "FrameGraph.hpp"
+
+#include <algorithm>
+#include <tuple>
+
+#include <fmt/format.h>
+#include <etna/GlobalContext.hpp>
+#include <etna/Etna.hpp>
+
+
+static void add_unique(std::vector<uint32_t>& values, uint32_t value)
+{
+  if (std::find(values.begin(), values.end(), value) == values.end())
+    values.push_back(value);
+}
+
+bool FrameGraph::Usage::isRead() const
+{
+  constexpr vk::AccessFlags2 READ_ACCESS = vk::AccessFlagBits2::eShaderRead |
+    vk::AccessFlagBits2::eShaderSampledRead | vk::AccessFlagBits2::eShaderStorageRead |
+    vk::AccessFlagBits2::eColorAttachmentRead | vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+    vk::AccessFlagBits2::eInputAttachmentRead | vk::AccessFlagBits2::eTransferRead |
+    vk::AccessFlagBits2::eHostRead | vk::AccessFlagBits2::eMemoryRead;
+
+  return static_cast<bool>(access & READ_ACCESS);
+}
+
+bool FrameGraph::Usage::isWrite() const
+{
+  constexpr vk::AccessFlags2 WRITE_ACCESS = vk::AccessFlagBits2::eShaderWrite |
+    vk::AccessFlagBits2::eShaderStorageWrite | vk::AccessFlagBits2::eColorAttachmentWrite |
+    vk::AccessFlagBits2::eDepthStencilAttachmentWrite | vk::AccessFlagBits2::eTransferWrite |
+    vk::AccessFlagBits2::eHostWrite | vk::AccessFlagBits2::eMemoryWrite;
+
+  return static_cast<bool>(access & WRITE_ACCESS);
+}
+
+FrameGraph::PassBuilder::PassBuilder(FrameGraph& frame_graph, uint32_t pass_idx)
+  : graph(frame_graph)
+  , passIdx(pass_idx)
+{
+}
+
+FrameGraph::PassBuilder& FrameGraph::PassBuilder::read(ResourceId image, const Usage& usage)
+{
+  graph.addAccess(passIdx, image, AccessType::eRead, usage);
+  return *this;
+}
+
+FrameGraph::PassBuilder& FrameGraph::PassBuilder::write(ResourceId image, const Usage& usage)
+{
+  graph.addAccess(passIdx, image, AccessType::eWrite, usage);
+  return *this;
+}
+
+FrameGraph::PassBuilder& FrameGraph::PassBuilder::writeUntracked(ResourceId image)
+{
+  graph.addAccess(passIdx, image, AccessType::eWriteUntracked, {});
+  return *this;
+}
+
+FrameGraph::PassBuilder& FrameGraph::PassBuilder::leaves(ResourceId image, const Usage& usage)
+{
+  graph.passes[passIdx].exitStates.emplace_back(image, usage);
+  return *this;
+}
+
+FrameGraph::PassBuilder& FrameGraph::PassBuilder::sideEffect()
+{
+  graph.passes[passIdx].sideEffect = true;
+  return *this;
+}
+
+FrameGraph::PassBuilder& FrameGraph::PassBuilder::computeOnly()
+{
+  graph.passes[passIdx].computeOnly = true;
+  return *this;
+}
+
+FrameGraph::FrameGraph()
+  : timer(MAX_TIMED_PASSES + 1)
+  , timedPassNames(
+      etna::get_context().getMainWorkCount(),
+      [](std::size_t) { return std::vector<std::string>{}; })
+{
+}
+
+void FrameGraph::reset()
+{
+  images.clear();
+  passes.clear();
+  schedule.clear();
+  compiled = false;
+}
+
+FrameGraph::ResourceId FrameGraph::importImage(
+  std::string_view name, vk::Image image, vk::ImageAspectFlags aspect)
+{
+  auto it = std::find_if(
+    images.begin(), images.end(), [image](const Image& other) { return other.image == image; });
+
+  if (it != images.end())
+  {
+    ETNA_VERIFY(it->aspect == aspect);
+    if (it->name.find(name) == std::string::npos)
+      it->name += fmt::format(" / {}", name);
+    return static_cast<ResourceId>(it - images.begin());
+  }
+
+  images.push_back(Image{
+    .name = std::string(name),
+    .image = image,
+    .aspect = aspect,
+  });
+  return static_cast<ResourceId>(images.size() - 1);
+}
+
+void FrameGraph::exportImage(ResourceId image)
+{
+  images[image].exported = true;
+}
+
+FrameGraph::PassBuilder FrameGraph::addPass(std::string_view name, ExecuteFn execute)
+{
+  auto& pass = passes.emplace_back();
+  pass.name = name;
+  pass.execute = std::move(execute);
+  compiled = false;
+
+  return PassBuilder(*this, static_cast<uint32_t>(passes.size() - 1));
+}
+
+void FrameGraph::addAccess(uint32_t pass_idx, ResourceId image, AccessType type, const Usage& usage)
+{
+  auto& accesses = passes[pass_idx].accesses;
+
+  // A pass using an image several times is given a single state for it
+  auto it = std::find_if(accesses.begin(), accesses.end(), [image](const Access& other) {
+    return other.image == image;
+  });
+  if (it == accesses.end())
+  {
+    accesses.push_back(Access{image, type, usage});
+    return;
+  }
+
+  if (type == AccessType::eWriteUntracked || it->type == AccessType::eWriteUntracked)
+  {
+    it->type = AccessType::eWriteUntracked;
+    return;
+  }
+
+  // Different layouts in a single pass can't be expressed with one barrier
+  ETNA_VERIFY(it->usage.layout == usage.layout);
+  it->type = std::max(it->type, type);
+  it->usage.stage |= usage.stage;
+  it->usage.access |= usage.access;
+}
+
+void FrameGraph::compile()
+{
+  if (compiled)
+    return;
+  compiled = true;
+
+  buildDependencies();
+  cullPasses();
+  schedulePasses();
+}
+
+void FrameGraph::buildDependencies()
+{
+  struct History
+  {
+    std::optional<uint32_t> lastWriter;
+    std::vector<uint32_t> readers;
+    vk::ImageLayout readLayout = vk::ImageLayout::eUndefined;
+  };
+  std::vector<History> histories(images.size());
+
+  for (uint32_t passIdx = 0; passIdx < passes.size(); ++passIdx)
+  {
+    auto& pass = passes[passIdx];
+    pass.dependencies.clear();
+    pass.producers.clear();
+
+    for (const auto& access : pass.accesses)
+    {
+      auto& history = histories[access.image];
+
+      const bool joinsReaders = access.type == AccessType::eRead &&
+        (history.readers.empty() || history.readLayout == access.usage.layout);
+
+      // Only writes without any read access, like storage writes and blits, discard the contents
+      const bool needsContents = access.type != AccessType::eWrite || access.usage.isRead();
+
+      if (history.lastWriter)
+      {
+        add_unique(pass.dependencies, *history.lastWriter);
+        if (needsContents)
+          add_unique(pass.producers, *history.lastWriter);
+      }
+
+      if (joinsReaders)
+      {
+        history.readLayout = access.usage.layout;
+        history.readers.push_back(passIdx);
+        continue;
+      }
+
+      // Writes and layout transitions wait for all earlier readers
+      for (const uint32_t reader : history.readers)
+        if (reader != passIdx)
+          add_unique(pass.dependencies, reader);
+      history.readers.clear();
+
+      if (access.type == AccessType::eRead)
+      {
+        history.readLayout = access.usage.layout;
+        history.readers.push_back(passIdx);
+      }
+      else
+        history.lastWriter = passIdx;
+    }
+  }
+}
+
+void FrameGraph::cullPasses()
+{
+  for (auto& pass : passes)
+  {
+    pass.culled = !pass.sideEffect &&
+      std::none_of(pass.accesses.begin(), pass.accesses.end(), [this](const Access& access) {
+        return access.type != AccessType::eRead && images[access.image].exported;
+      });
+  }
+
+  // Producers are always added before their consumers, so a single backwards sweep suffices
+  for (uint32_t passIdx = static_cast<uint32_t>(passes.size()); passIdx-- > 0;)
+  {
+    if (passes[passIdx].culled)
+      continue;
+    for (const uint32_t producer : passes[passIdx].producers)
+      passes[producer].culled = false;
+  }
+}
+
+void FrameGraph::schedulePasses()
+{
+  schedule.clear();
+
+  std::vector<std::optional<uint32_t>> positions(passes.size());
+  auto isReady = [&](const Pass& pass) {
+    return std::all_of(pass.dependencies.begin(), pass.dependencies.end(), [&](uint32_t dep) {
+      return passes[dep].culled || positions[dep].has_value();
+    });
+  };
+  // Position of the last scheduled dependency plus one, zero for passes without dependencies
+  auto readySince = [&](const Pass& pass) {
+    uint32_t since = 0;
+    for (const uint32_t dep : pass.dependencies)
+      if (!passes[dep].culled)
+        since = std::max(since, *positions[dep] + 1);
+    return since;
+  };
+
+  stats = Stats{};
+  for (const auto& pass : passes)
+    (pass.culled ? stats.culled : stats.passes)++;
+
+  // Compute only next to a rasterization pass it doesn't depend on, or the other way around
+  auto interleavesPrevious = [&](const Pass& pass) {
+    if (schedule.empty())
+      return false;
+
+    const uint32_t previous = schedule.back();
+    return passes[previous].computeOnly != pass.computeOnly &&
+      std::find(pass.dependencies.begin(), pass.dependencies.end(), previous) ==
+      pass.dependencies.end();
+  };
+
+  // Kahn's algorithm. Passes which interleave with the previous one go first, then the ones whose
+  // inputs were produced the longest time ago, so that the barriers in front of them have the most
+  // work to hide behind. Ties keep the declared order.
+  while (schedule.size() < stats.passes)
+  {
+    std::optional<uint32_t> best;
+    std::tuple<bool, uint32_t> bestKey;
+    for (uint32_t passIdx = 0; passIdx < passes.size(); ++passIdx)
+    {
+      const auto& pass = passes[passIdx];
+      if (pass.culled || positions[passIdx] || !isReady(pass))
+        continue;
+
+      const std::tuple<bool, uint32_t> key{!interleavesPrevious(pass), readySince(pass)};
+      if (!best || key < bestKey)
+      {
+        best = passIdx;
+        bestKey = key;
+      }
+    }
+
+    // Dependencies only point to earlier passes, so there is always a ready one
+    ETNA_VERIFY(best.has_value());
+    if (!std::get<0>(bestKey))
+      ++stats.interleavedPasses;
+
+    positions[*best] = static_cast<uint32_t>(schedule.size());
+    schedule.push_back(*best);
+  }
+}
+
+void FrameGraph::execute(vk::CommandBuffer cmd_buf)
+{
+  ETNA_VERIFY(compiled);
+
+  stats.transitions = 0;
+  stats.droppedTransitions = 0;
+  stats.barrierBatches = 0;
+
+  // States set by the graph during this frame, unknown until the first use
+  std::vector<std::optional<Usage>> states(images.size());
+
+  timer.beginFrame(cmd_buf);
+  readTimings();
+
+  auto& passNames = timedPassNames.get();
+  passNames.clear();
+
+  const uint32_t frameScope = timer.begin(cmd_buf);
+
+  for (const uint32_t passIdx : schedule)
+  {
+    const auto& pass = passes[passIdx];
+
+    bool transitioned = false;
+    for (const auto& access : pass.accesses)
+    {
+      const auto& image = images[access.image];
+      auto& state = states[access.image];
+
+      if (access.type == AccessType::eWriteUntracked)
+      {
+        state.reset();
+        continue;
+      }
+
+      if (state == access.usage && !access.usage.isWrite())
+      {
+        ++stats.droppedTransitions;
+        continue;
+      }
+
+      etna::set_state(
+        cmd_buf,
+        image.image,
+        access.usage.stage,
+        access.usage.access,
+        access.usage.layout,
+        image.aspect);
+      state = access.usage;
+
+      ++stats.transitions;
+      transitioned = true;
+    }
+
+    if (transitioned)
+    {
+      etna::flush_barriers(cmd_buf);
+      ++stats.barrierBatches;
+    }
+
+    if (passNames.size() < MAX_TIMED_PASSES)
+    {
+      const uint32_t scope = timer.begin(cmd_buf);
+      pass.execute(cmd_buf);
+      timer.end(cmd_buf, scope);
+      passNames.push_back(pass.name);
+    }
+    else
+      pass.execute(cmd_buf);
+
+    for (const auto& [image, usage] : pass.exitStates)
+    {
+      etna::set_state_external(images[image].image, usage.stage, usage.access, usage.layout);
+      states[image] = usage;
+    }
+  }
+
+  timer.end(cmd_buf, frameScope);
+}
+
+void FrameGraph::readTimings()
+{
+  // The results belong to the passes recorded the last time this frame slot was used, the frame
+  // scope is begun before all of them
+  const auto& passNames = timedPassNames.get();
+  const auto timings = timer.getResults();
+  if (timings.size() != passNames.size() + 1)
+    return;
+
+  gpuTimeMs = timings[0];
+  passTimings.clear();
+  for (size_t i = 0; i < passNames.size(); ++i)
+    passTimings.push_back(PassTiming{.name = passNames[i], .ms = timings[i + 1]});
+}
+
+std::string FrameGraph::dump() const
+{
+  std::string result = fmt::format(
+    "FrameGraph: {} passes, {} culled, {} interleaved, {} transitions in {} batches, {} dropped\n",
+    stats.passes,
+    stats.culled,
+    stats.interleavedPasses,
+    stats.transitions,
+    stats.barrierBatches,
+    stats.droppedTransitions);
+
+  auto dumpPass = [&](uint32_t passIdx) {
+    const auto& pass = passes[passIdx];
+    result += fmt::format(
+      "  {}{}{}\n",
+      pass.name,
+      pass.computeOnly ? " (compute only)" : "",
+      pass.sideEffect ? " (side effect)" : "");
+
+    std::string after;
+    for (const uint32_t dep : pass.dependencies)
+      if (!passes[dep].culled)
+        after += fmt::format("{}{}", after.empty() ? "" : ", ", passes[dep].name);
+    if (!after.empty())
+      result += fmt::format("    after {}\n", after);
+
+    for (const auto& access : pass.accesses)
+    {
+      const auto& image = images[access.image];
+      if (access.type == AccessType::eWriteUntracked)
+      {
+        result += fmt::format("    write {} (untracked)\n", image.name);
+        continue;
+      }
+
+      result += fmt::format(
+        "    {} {}{} as {}, {}\n",
+        access.type == AccessType::eRead ? "read" : "write",
+        image.name,
+        image.exported ? " (exported)" : "",
+        vk::to_string(access.usage.layout),
+        vk::to_string(access.usage.access));
+    }
+
+    for (const auto& [image, usage] : pass.exitStates)
+      result +=
+        fmt::format("    leaves {} as {}\n", images[image].name, vk::to_string(usage.layout));
+  };
+
+  for (const uint32_t passIdx : schedule)
+    dumpPass(passIdx);
+
+  if (stats.culled > 0)
+    result += "culled:\n";
+  for (uint32_t passIdx = 0; passIdx < passes.size(); ++passIdx)
+    if (passes[passIdx].culled)
+      dumpPass(passIdx);
+
+  return result;
+}
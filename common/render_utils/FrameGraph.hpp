@@ -0,0 +1,222 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <etna/Vulkan.hpp>
+#include <etna/GpuSharedResource.hpp>
+
+#include "GpuTimer.hpp"
+
+
+/**
+ * Schedules the passes of a frame from the images they declare to read and write.
+ *
+ * The graph is rebuilt every frame. Passes are added in an order which is valid on its own, then
+ * compile culls the passes that contribute nothing to an exported image or side effect, and
+ * reorders the rest so that consumers are placed as far from their producers as the dependencies
+ * allow. Two reads of an image in different layouts are ordered like writes, as the transition
+ * between them is one.
+ *
+ * Before every pass, the states of all images it declared are requested from the etna state
+ * tracker at once and flushed as a single batch. Requests which can't change anything, like
+ * reading an image again in the state it was read in, are dropped. Passes must not leave the
+ * images in other states than they declared, unless they say so with leaves.
+ *
+ * Passes which only dispatch compute work can be marked as compute only. Everything is recorded
+ * into one command buffer for etna's single universal queue, the scheduler merely interleaves
+ * compute only passes with rasterization passes they don't depend on. Whether the GPU then overlaps
+ * neighbouring passes is up to it and to the barriers in front of the second one.
+ *
+ * Execute measures the GPU time of every pass and of the whole frame with timestamp queries.
+ *
+ * Buffers are not tracked, passes keep placing their own buffer barriers.
+ */
+class FrameGraph
+{
+public:
+  using ResourceId = uint32_t;
+  using ExecuteFn = std::function<void(vk::CommandBuffer)>;
+
+  // The arguments of etna::set_state
+  struct Usage
+  {
+    vk::PipelineStageFlags2 stage;
+    vk::AccessFlags2 access;
+    vk::ImageLayout layout;
+
+    bool isRead() const;
+    bool isWrite() const;
+    bool operator==(const Usage&) const = default;
+  };
+
+  constexpr static Usage SAMPLED_COMPUTE{
+    vk::PipelineStageFlagBits2::eComputeShader,
+    vk::AccessFlagBits2::eShaderSampledRead,
+    vk::ImageLayout::eShaderReadOnlyOptimal,
+  };
+  constexpr static Usage SAMPLED_FRAGMENT{
+    vk::PipelineStageFlagBits2::eFragmentShader,
+    vk::AccessFlagBits2::eShaderSampledRead,
+    vk::ImageLayout::eShaderReadOnlyOptimal,
+  };
+  constexpr static Usage STORAGE_WRITE_COMPUTE{
+    vk::PipelineStageFlagBits2::eComputeShader,
+    vk::AccessFlagBits2::eShaderStorageWrite,
+    vk::ImageLayout::eGeneral,
+  };
+  constexpr static Usage COLOR_ATTACHMENT{
+    vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+    vk::AccessFlagBits2::eColorAttachmentRead | vk::AccessFlagBits2::eColorAttachmentWrite,
+    vk::ImageLayout::eColorAttachmentOptimal,
+  };
+  constexpr static Usage DEPTH_ATTACHMENT{
+    vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+      vk::PipelineStageFlagBits2::eLateFragmentTests,
+    vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+      vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+    vk::ImageLayout::eDepthStencilAttachmentOptimal,
+  };
+  constexpr static Usage TRANSFER_SRC{
+    vk::PipelineStageFlagBits2::eTransfer,
+    vk::AccessFlagBits2::eTransferRead,
+    vk::ImageLayout::eTransferSrcOptimal,
+  };
+  constexpr static Usage TRANSFER_DST{
+    vk::PipelineStageFlagBits2::eTransfer,
+    vk::AccessFlagBits2::eTransferWrite,
+    vk::ImageLayout::eTransferDstOptimal,
+  };
+
+  class PassBuilder
+  {
+  public:
+    PassBuilder& read(ResourceId image, const Usage& usage);
+    PassBuilder& write(ResourceId image, const Usage& usage);
+    // Orders the pass like a write of the image, but leaves its transitions to the pass itself
+    PassBuilder& writeUntracked(ResourceId image);
+    // The state the pass leaves the image in when it differs from the declared one, e.g. after
+    // transitioning single mips with raw barriers
+    PassBuilder& leaves(ResourceId image, const Usage& usage);
+    // Keeps the pass even if nothing reads what it writes, e.g. when it updates persistent data
+    PassBuilder& sideEffect();
+    // The pass only dispatches compute work, it is interleaved with rasterization when scheduled
+    PassBuilder& computeOnly();
+
+  private:
+    friend class FrameGraph;
+
+    PassBuilder(FrameGraph& frame_graph, uint32_t pass_idx);
+
+    FrameGraph& graph;
+    uint32_t passIdx;
+  };
+
+  FrameGraph();
+
+  // Drops the passes and images of the previous frame
+  void reset();
+
+  // Importing the same image twice returns the same resource, so images shared by several users
+  // are ordered correctly. Different names are joined for the dump.
+  ResourceId importImage(std::string_view name, vk::Image image, vk::ImageAspectFlags aspect);
+  // Passes writing the image are never culled
+  void exportImage(ResourceId image);
+
+  PassBuilder addPass(std::string_view name, ExecuteFn execute);
+
+  void compile();
+  void execute(vk::CommandBuffer cmd_buf);
+
+  struct Stats
+  {
+    uint32_t passes = 0;
+    uint32_t culled = 0;
+    uint32_t transitions = 0;
+    uint32_t droppedTransitions = 0;
+    uint32_t barrierBatches = 0;
+    // Passes scheduled right after an independent pass of the other kind
+    uint32_t interleavedPasses = 0;
+  };
+  // Transitions are counted by execute
+  Stats getStats() const { return stats; }
+
+  struct PassTiming
+  {
+    std::string name;
+    float ms;
+  };
+  // Timings come back with the latency of the frames in flight. Passes which the GPU overlaps
+  // are each timed in full, so the sum of their times may exceed the time of the frame.
+  std::span<const PassTiming> getPassTimings() const { return passTimings; }
+  // From the first barrier to the end of the last pass, negative until measured
+  float getGpuTimeMs() const { return gpuTimeMs; }
+
+  // The compiled schedule with the accesses and dependencies of every pass
+  std::string dump() const;
+
+private:
+  enum class AccessType : uint32_t
+  {
+    eRead,
+    eWrite,
+    eWriteUntracked,
+  };
+
+  struct Access
+  {
+    ResourceId image;
+    AccessType type;
+    Usage usage;
+  };
+
+  struct Pass
+  {
+    std::string name;
+    ExecuteFn execute;
+    std::vector<Access> accesses;
+    std::vector<std::pair<ResourceId, Usage>> exitStates;
+    bool sideEffect = false;
+    bool computeOnly = false;
+
+    // Filled by compile
+    std::vector<uint32_t> dependencies;
+    std::vector<uint32_t> producers;
+    bool culled = false;
+  };
+
+  struct Image
+  {
+    std::string name;
+    vk::Image image;
+    vk::ImageAspectFlags aspect;
+    bool exported = false;
+  };
+
+  void addAccess(uint32_t pass_idx, ResourceId image, AccessType type, const Usage& usage);
+  void buildDependencies();
+  void cullPasses();
+  void schedulePasses();
+  void readTimings();
+
+private:
+  std::vector<Image> images;
+  std::vector<Pass> passes;
+  std::vector<uint32_t> schedule;
+  bool compiled = false;
+
+  Stats stats;
+
+  // Passes beyond this are not timed individually
+  constexpr static uint32_t MAX_TIMED_PASSES = 32;
+  GpuTimer timer;
+  etna::GpuSharedResource<std::vector<std::string>> timedPassNames;
+  std::vector<PassTiming> passTimings;
+  float gpuTimeMs = -1.0f;
+};
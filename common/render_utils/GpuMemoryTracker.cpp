@@ -0,0 +1,198 @@
+#include "GpuMemoryTracker.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+#include <spdlog/spdlog.h>
+#include <etna/GlobalContext.hpp>
+#include <etna/Etna.hpp>
+
+
+static std::string escape_json(std::string_view str)
+{
+  std::string result;
+  result.reserve(str.size());
+  for (const char c : str)
+  {
+    if (c == '"' || c == '\\')
+      result += '\\';
+    if (static_cast<unsigned char>(c) < 0x20)
+      result += ' ';
+    else
+      result += c;
+  }
+  return result;
+}
+
+const char* GpuMemoryTracker::getCategoryName(Category category)
+{
+  switch (category)
+  {
+  case Category::eScene:
+    return "Scene";
+  case Category::eEnvironment:
+    return "Environment";
+  case Category::ePasses:
+    return "Passes";
+  case Category::eStaging:
+    return "Staging";
+  }
+  return "Unknown";
+}
+
+GpuMemoryTracker::Collector::Collector(vk::Device dev)
+  : device(dev)
+{
+}
+
+void GpuMemoryTracker::Collector::add(
+  Category category, std::string_view name, const etna::Image& image)
+{
+  if (!image.get())
+    return;
+
+  allocations.push_back(Allocation{
+    .name = std::string(name),
+    .category = category,
+    .size = device.getImageMemoryRequirements(image.get()).size,
+  });
+}
+
+void GpuMemoryTracker::Collector::add(
+  Category category, std::string_view name, const etna::Buffer& buffer, uint32_t copies)
+{
+  if (!buffer.get())
+    return;
+
+  allocations.push_back(Allocation{
+    .name = std::string(name),
+    .category = category,
+    .size = device.getBufferMemoryRequirements(buffer.get()).size * copies,
+  });
+}
+
+GpuMemoryTracker::GpuMemoryTracker(bool memory_budget_supported)
+  : memoryBudgetSupported(memory_budget_supported)
+{
+  if (!memoryBudgetSupported)
+    spdlog::warn("GpuMemoryTracker: {} is not supported", VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+}
+
+void GpuMemoryTracker::addSource(Source source)
+{
+  sources.push_back(std::move(source));
+}
+
+void GpuMemoryTracker::update()
+{
+  auto& ctx = etna::get_context();
+
+  Collector collector(ctx.getDevice());
+  for (const auto& source : sources)
+    source(collector);
+
+  snapshot = {};
+  snapshot.allocations = std::move(collector.allocations);
+  std::sort(
+    snapshot.allocations.begin(),
+    snapshot.allocations.end(),
+    [](const Allocation& a, const Allocation& b) { return a.size > b.size; });
+
+  for (const auto& allocation : snapshot.allocations)
+  {
+    snapshot.totals[static_cast<uint32_t>(allocation.category)] += allocation.size;
+    snapshot.tracked += allocation.size;
+  }
+
+  for (uint32_t category = 0; category < CATEGORY_COUNT; ++category)
+    peaks[category] = std::max(peaks[category], snapshot.totals[category]);
+  peakTracked = std::max(peakTracked, snapshot.tracked);
+
+  const auto physicalDevice = ctx.getPhysicalDevice();
+
+  vk::PhysicalDeviceMemoryProperties properties;
+  vk::PhysicalDeviceMemoryBudgetPropertiesEXT budget;
+  if (memoryBudgetSupported)
+  {
+    const auto chain = physicalDevice.getMemoryProperties2<
+      vk::PhysicalDeviceMemoryProperties2,
+      vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+    properties = chain.get<vk::PhysicalDeviceMemoryProperties2>().memoryProperties;
+    budget = chain.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+  }
+  else
+    properties = physicalDevice.getMemoryProperties();
+
+  vk::DeviceSize usage = 0;
+  for (uint32_t heapIdx = 0; heapIdx < properties.memoryHeapCount; ++heapIdx)
+  {
+    const auto& heap = properties.memoryHeaps[heapIdx];
+    snapshot.heaps.push_back(Heap{
+      .size = heap.size,
+      .usage = budget.heapUsage[heapIdx],
+      .budget = budget.heapBudget[heapIdx],
+      .deviceLocal = static_cast<bool>(heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal),
+    });
+    usage += budget.heapUsage[heapIdx];
+  }
+
+  // Heap usage counts whole memory blocks, so it is above the tracked sizes even without leaks
+  if (memoryBudgetSupported)
+    snapshot.untracked = usage > snapshot.tracked ? usage - snapshot.tracked : 0;
+}
+
+bool GpuMemoryTracker::writeReport(const std::filesystem::path& path) const
+{
+  std::ofstream file(path);
+  if (!file)
+  {
+    spdlog::error("GpuMemoryTracker: Failed to open '{}' for writing", path.string());
+    return false;
+  }
+
+  file << "{\n";
+  file << "  \"memoryBudgetSupported\": " << (memoryBudgetSupported ? "true" : "false") << ",\n";
+  file << "  \"tracked\": " << snapshot.tracked << ",\n";
+  file << "  \"peakTracked\": " << peakTracked << ",\n";
+  file << "  \"untracked\": " << snapshot.untracked << ",\n";
+
+  file << "  \"categories\": [\n";
+  for (uint32_t category = 0; category < CATEGORY_COUNT; ++category)
+  {
+    file << "    {\"name\": \"" << getCategoryName(static_cast<Category>(category))
+         << "\", \"total\": " << snapshot.totals[category] << ", \"peak\": " << peaks[category]
+         << "}" << (category + 1 < CATEGORY_COUNT ? "," : "") << "\n";
+  }
+  file << "  ],\n";
+
+  file << "  \"heaps\": [\n";
+  for (std::size_t heapIdx = 0; heapIdx < snapshot.heaps.size(); ++heapIdx)
+  {
+    const auto& heap = snapshot.heaps[heapIdx];
+    file << "    {\"size\": " << heap.size << ", \"usage\": " << heap.usage
+         << ", \"budget\": " << heap.budget
+         << ", \"deviceLocal\": " << (heap.deviceLocal ? "true" : "false") << "}"
+         << (heapIdx + 1 < snapshot.heaps.size() ? "," : "") << "\n";
+  }
+  file << "  ],\n";
+
+  file << "  \"allocations\": [\n";
+  for (std::size_t i = 0; i < snapshot.allocations.size(); ++i)
+  {
+    const auto& allocation = snapshot.allocations[i];
+    file << "    {\"name\": \"" << escape_json(allocation.name) << "\", \"category\": \""
+         << getCategoryName(allocation.category) << "\", \"size\": " << allocation.size << "}"
+         << (i + 1 < snapshot.allocations.size() ? "," : "") << "\n";
+  }
+  file << "  ]\n";
+  file << "}\n";
+
+  if (!file)
+  {
+    spdlog::error("GpuMemoryTracker: Failed to write '{}'", path.string());
+    return false;
+  }
+
+  spdlog::info("GpuMemoryTracker: Wrote the memory report to '{}'", path.string());
+  return true;
+}
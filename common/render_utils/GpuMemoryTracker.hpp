@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <etna/Vulkan.hpp>
+#include <etna/Buffer.hpp>
+#include <etna/Image.hpp>
+
+
+/**
+ * Accounts the GPU memory of the images and buffers owned by each subsystem, next to the heap
+ * usage and budget reported by VK_EXT_memory_budget.
+ *
+ * Subsystems don't register allocations as they create them. Instead, every source lists what it
+ * owns when a snapshot is taken, so destroyed resources can't be forgotten by the tracker. Memory
+ * which the heaps report but no source lists shows up as untracked, which is where leaks and the
+ * internal allocations of etna end up.
+ */
+class GpuMemoryTracker
+{
+public:
+  enum class Category : uint32_t
+  {
+    eScene,        // scene textures and geometry
+    eEnvironment,  // environment maps and reflection probes
+    ePasses,       // render targets and per-frame buffers of the render passes
+    eStaging,      // host visible buffers for uploads and readbacks
+  };
+
+  constexpr static uint32_t CATEGORY_COUNT = 4;
+  static const char* getCategoryName(Category category);
+
+  struct Allocation
+  {
+    std::string name;
+    Category category;
+    vk::DeviceSize size;
+  };
+
+  class Collector
+  {
+  public:
+    // Sizes are the memory requirements of the resource, without the alignment of its placement.
+    // Resources duplicated for every frame in flight are listed once with their copy count.
+    void add(Category category, std::string_view name, const etna::Image& image);
+    void add(
+      Category category, std::string_view name, const etna::Buffer& buffer, uint32_t copies = 1);
+
+  private:
+    friend class GpuMemoryTracker;
+
+    explicit Collector(vk::Device dev);
+
+    vk::Device device;
+    std::vector<Allocation> allocations;
+  };
+
+  // Lists the resources a subsystem currently owns
+  using Source = std::function<void(Collector&)>;
+
+  struct Heap
+  {
+    vk::DeviceSize size = 0;
+    // Only known with VK_EXT_memory_budget
+    vk::DeviceSize usage = 0;
+    vk::DeviceSize budget = 0;
+    bool deviceLocal = false;
+  };
+
+  struct Snapshot
+  {
+    std::vector<Allocation> allocations;
+    std::array<vk::DeviceSize, CATEGORY_COUNT> totals{};
+    vk::DeviceSize tracked = 0;
+    // Heap usage minus the tracked allocations, zero without VK_EXT_memory_budget
+    vk::DeviceSize untracked = 0;
+    std::vector<Heap> heaps;
+  };
+
+  // Heap usage and budgets are only queried when VK_EXT_memory_budget is enabled on the device
+  explicit GpuMemoryTracker(bool memory_budget_supported);
+
+  void addSource(Source source);
+
+  // Collects the allocations of all sources and queries the heaps, updating the peaks
+  void update();
+
+  const Snapshot& getSnapshot() const { return snapshot; }
+  const std::array<vk::DeviceSize, CATEGORY_COUNT>& getPeaks() const { return peaks; }
+  vk::DeviceSize getPeakTracked() const { return peakTracked; }
+  bool hasMemoryBudget() const { return memoryBudgetSupported; }
+
+  // Writes the last snapshot with every allocation and the peaks as JSON
+  bool writeReport(const std::filesystem::path& path) const;
+
+private:
+  bool memoryBudgetSupported;
+  std::vector<Source> sources;
+
+  Snapshot snapshot;
+  std::array<vk::DeviceSize, CATEGORY_COUNT> peaks{};
+  vk::DeviceSize peakTracked = 0;
+};
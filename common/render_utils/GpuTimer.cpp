@@ -0,0 +1,79 @@
+#include "GpuTimer.hpp"
+
+#include <etna/GlobalContext.hpp>
+
+
+GpuTimer::GpuTimer(uint32_t max_scopes_per_frame)
+  : maxScopes(max_scopes_per_frame)
+  , timestampPeriodMs(
+      etna::get_context().getPhysicalDevice().getProperties().limits.timestampPeriod * 1e-6f)
+  , frames(etna::get_context().getMainWorkCount(), [max_scopes_per_frame](std::size_t) {
+    const vk::QueryPoolCreateInfo createInfo{
+      .queryType = vk::QueryType::eTimestamp,
+      .queryCount = 2 * max_scopes_per_frame,
+    };
+
+    return Frame{
+      .pool = etna::unwrap_vk_result(
+        etna::get_context().getDevice().createQueryPoolUnique(createInfo)),
+      .scopeCount = 0,
+    };
+  })
+{
+  results.reserve(maxScopes);
+}
+
+void GpuTimer::beginFrame(vk::CommandBuffer cmd_buf)
+{
+  auto& frame = frames.get();
+
+  results.clear();
+  if (frame.scopeCount > 0)
+  {
+    std::vector<uint64_t> timestamps(2 * frame.scopeCount);
+
+    // The frame that recorded these has already finished, as its slot is being reused
+    const auto result = etna::get_context().getDevice().getQueryPoolResults(
+      frame.pool.get(),
+      0,
+      2 * frame.scopeCount,
+      timestamps.size() * sizeof(uint64_t),
+      timestamps.data(),
+      sizeof(uint64_t),
+      vk::QueryResultFlagBits::e64);
+
+    if (result == vk::Result::eSuccess)
+    {
+      for (uint32_t scope = 0; scope < frame.scopeCount; ++scope)
+      {
+        const uint64_t ticks = timestamps[2 * scope + 1] - timestamps[2 * scope];
+        results.push_back(static_cast<float>(ticks) * timestampPeriodMs);
+      }
+    }
+  }
+
+  cmd_buf.resetQueryPool(frame.pool.get(), 0, 2 * maxScopes);
+  frame.scopeCount = 0;
+}
+
+uint32_t GpuTimer::begin(vk::CommandBuffer cmd_buf)
+{
+  auto& frame = frames.get();
+  ETNA_VERIFY(frame.scopeCount < maxScopes);
+
+  const uint32_t scope = frame.scopeCount++;
+  cmd_buf.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, frame.pool.get(), 2 * scope);
+
+  return scope;
+}
+
+void GpuTimer::end(vk::CommandBuffer cmd_buf, uint32_t scope)
+{
+  cmd_buf.writeTimestamp(
+    vk::PipelineStageFlagBits::eBottomOfPipe, frames.get().pool.get(), 2 * scope + 1);
+}
+
+std::span<const float> GpuTimer::getResults() const
+{
+  return results;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include <etna/Vulkan.hpp>
+#include <etna/GpuSharedResource.hpp>
+
+
+/**
+ * Measures the GPU time of command buffer ranges with timestamp queries, e.g. to drive a per-frame
+ * GPU time budget. Each frame in flight has its own query pool, so results of a frame become
+ * available once its slot comes around again, i.e. with a latency of the frames in flight.
+ */
+class GpuTimer
+{
+public:
+  explicit GpuTimer(uint32_t max_scopes_per_frame);
+
+  // Reads back the results previously recorded into the current frame slot and resets it.
+  // Must be called once per frame before any begin/end.
+  void beginFrame(vk::CommandBuffer cmd_buf);
+
+  // Returns the index of the scope, results are reported in the same order
+  uint32_t begin(vk::CommandBuffer cmd_buf);
+  void end(vk::CommandBuffer cmd_buf, uint32_t scope);
+
+  // Durations in ms of the scopes recorded the last time the current slot was used. Empty if the
+  // results were not available yet.
+  std::span<const float> getResults() const;
+
+private:
+  struct Frame
+  {
+    vk::UniqueQueryPool pool;
+    uint32_t scopeCount = 0;
+  };
+
+  uint32_t maxScopes;
+  float timestampPeriodMs;
+
+  etna::GpuSharedResource<Frame> frames;
+  std::vector<float> results;
+};
@@ -0,0 +1,159 @@
+#include "MipGenerator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <etna/GlobalContext.hpp>
+#include <etna/Etna.hpp>
+#include <etna/PipelineManager.hpp>
+#include <etna/DescriptorSet.hpp>
+#include <etna/Profiling.hpp>
+
+#include "Utils.hpp"
+
+
+namespace
+{
+
+// Must match TILE_SIZE in downsample_mips.comp
+constexpr uint32_t TILE_SIZE = 64;
+
+} // namespace
+
+MipGenerator::MipGenerator()
+{
+  programId = etna::get_program_id("downsample_mips");
+
+  if (programId == etna::ShaderProgramId::Invalid)
+    programId = etna::create_program(
+      "downsample_mips", {RENDER_UTILS_SHADERS_ROOT "downsample_mips.comp.spv"});
+
+  pipeline =
+    etna::get_context().getPipelineManager().createComputePipeline("downsample_mips", {});
+
+  pointSampler = etna::Sampler(etna::Sampler::CreateInfo{
+    .filter = vk::Filter::eNearest,
+    .addressMode = vk::SamplerAddressMode::eClampToEdge,
+    .name = "MipGenerator::pointSampler",
+    .minLod = 0.0f,
+    .maxLod = 0.0f,
+  });
+}
+
+bool MipGenerator::supportsFormat(vk::Format format)
+{
+  const auto properties = etna::get_context().getPhysicalDevice().getFormatProperties(format);
+  return static_cast<bool>(
+    properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eStorageImage);
+}
+
+void MipGenerator::generate(
+  vk::CommandBuffer cmd_buf, etna::Image& image, uint32_t layers, Filter filter, Method method)
+{
+  ETNA_PROFILE_GPU(cmd_buf, generateMips);
+
+  if (method == Method::eBlit || !supportsFormat(image.getFormat()))
+  {
+    generate_mips(cmd_buf, image, layers);
+    return;
+  }
+
+  const auto extent = image.getExtent();
+  const auto mips =
+    static_cast<uint32_t>(std::floor(std::log2(std::max(extent.width, extent.height)))) + 1;
+
+  if (mips == 1)
+    return;
+
+  /* Mips are read and written in place, so the whole image stays in general layout */
+  etna::set_state(
+    cmd_buf,
+    image.get(),
+    vk::PipelineStageFlagBits2::eComputeShader,
+    vk::AccessFlagBits2::eShaderSampledRead | vk::AccessFlagBits2::eShaderStorageWrite,
+    vk::ImageLayout::eGeneral,
+    vk::ImageAspectFlagBits::eColor);
+  etna::flush_barriers(cmd_buf);
+
+  auto programInfo = etna::get_shader_program(programId);
+  cmd_buf.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.getVkPipeline());
+
+  for (uint32_t srcMip = 0; srcMip + 1 < mips; srcMip += MIPS_PER_DISPATCH)
+  {
+    const uint32_t mipCount = std::min(MIPS_PER_DISPATCH, mips - 1 - srcMip);
+
+    const auto mipView = [layers](uint32_t mip) {
+      return etna::Image::ViewParams{mip, 1, 0, layers, {}, vk::ImageViewType::e2DArray};
+    };
+
+    std::vector<etna::Binding> bindings;
+    bindings.emplace_back(
+      0, image.genBinding(pointSampler.get(), vk::ImageLayout::eGeneral, mipView(srcMip)));
+
+    // Slots past the last mip of this dispatch are never written, but still have to be bound
+    for (uint32_t slot = 1; slot <= MIPS_PER_DISPATCH; ++slot)
+      bindings.emplace_back(
+        slot,
+        image.genBinding(
+          nullptr, vk::ImageLayout::eGeneral, mipView(srcMip + std::min(slot, mipCount))));
+
+    auto descriptorSet = etna::create_descriptor_set(
+      programInfo.getDescriptorLayoutId(0),
+      cmd_buf,
+      std::move(bindings),
+      BarrierBehavoir::eSuppressBarriers);
+
+    cmd_buf.bindDescriptorSets(
+      vk::PipelineBindPoint::eCompute,
+      pipeline.getVkPipelineLayout(),
+      0,
+      {descriptorSet.getVkSet()},
+      {});
+
+    const uint32_t srcWidth = std::max(extent.width >> srcMip, 1u);
+    const uint32_t srcHeight = std::max(extent.height >> srcMip, 1u);
+
+    struct PushConstant
+    {
+      int32_t srcWidth;
+      int32_t srcHeight;
+      uint32_t mipCount;
+      uint32_t filter;
+    } pushConst{
+      .srcWidth = static_cast<int32_t>(srcWidth),
+      .srcHeight = static_cast<int32_t>(srcHeight),
+      .mipCount = mipCount,
+      .filter = static_cast<uint32_t>(filter),
+    };
+
+    cmd_buf.pushConstants<PushConstant>(
+      programInfo.getPipelineLayout(), vk::ShaderStageFlagBits::eCompute, 0, {pushConst});
+
+    cmd_buf.dispatch(
+      (srcWidth + TILE_SIZE - 1) / TILE_SIZE, (srcHeight + TILE_SIZE - 1) / TILE_SIZE, layers);
+
+    if (srcMip + MIPS_PER_DISPATCH + 1 >= mips)
+      break;
+
+    /* The last mip written is the source of the next dispatch */
+    vk::MemoryBarrier barrier;
+    barrier.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite);
+    barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+
+    cmd_buf.pipelineBarrier(
+      vk::PipelineStageFlagBits::eComputeShader,
+      vk::PipelineStageFlagBits::eComputeShader,
+      {},
+      barrier,
+      {},
+      {});
+  }
+
+  /* Let the state tracking know about the writes, so that the next set_state waits for them */
+  etna::set_state_external(
+    image.get(),
+    vk::PipelineStageFlagBits2::eComputeShader,
+    vk::AccessFlagBits2::eShaderStorageWrite,
+    vk::ImageLayout::eGeneral);
+}
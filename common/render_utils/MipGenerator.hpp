@@ -0,0 +1,57 @@
+#pragma once
+
+#include <etna/Vulkan.hpp>
+#include <etna/ComputePipeline.hpp>
+#include <etna/Image.hpp>
+#include <etna/Sampler.hpp>
+
+
+/**
+ * Generates the mip chain of an image with downsample_mips.comp, which reduces up to
+ * MIPS_PER_DISPATCH mips per dispatch through shared memory. The blit chain of generate_mips
+ * needs one blit and one barrier per mip instead, which leaves the GPU idle for small mips.
+ *
+ * The image must have storage usage and a format with storage support, otherwise it silently
+ * falls back to generate_mips. sRGB formats never have storage support, the eSrgb filter is meant
+ * for UNORM images holding sRGB encoded data.
+ */
+class MipGenerator
+{
+public:
+  // Must match FILTER_* in downsample_mips.comp
+  enum class Filter : uint32_t
+  {
+    eLinear,  // all channels are averaged as is
+    eSrgb,    // rgb is sRGB encoded and averaged in linear space
+    eNormal,  // rgb is a normal encoded into [0, 1], renormalized after averaging
+  };
+
+  enum class Method
+  {
+    eCompute,
+    eBlit,  // generate_mips, kept around for comparison
+  };
+
+  constexpr static uint32_t MIPS_PER_DISPATCH = 6;
+
+  MipGenerator();
+
+  // Mip 0 of every layer is the source. The image is left in eGeneral after the compute path and
+  // in eTransferSrcOptimal after the blit one.
+  void generate(
+    vk::CommandBuffer cmd_buf,
+    etna::Image& image,
+    uint32_t layers = 1,
+    Filter filter = Filter::eLinear,
+    Method method = Method::eCompute);
+
+  static bool supportsFormat(vk::Format format);
+
+private:
+  etna::ComputePipeline pipeline;
+  etna::ShaderProgramId programId;
+  etna::Sampler pointSampler;
+
+  MipGenerator(const MipGenerator&) = delete;
+  MipGenerator& operator=(const MipGenerator&) = delete;
+};
@@ -0,0 +1,130 @@
+#include "PipelinePermutations.hpp"
+
+#include <fstream>
+#include <vector>
+
+#include <etna/Assert.hpp>
+#include <etna/GlobalContext.hpp>
+#include <etna/Etna.hpp>
+#include <spdlog/spdlog.h>
+
+
+static std::shared_ptr<vk::UniqueShaderModule> load_shader_module(
+  const std::filesystem::path& path)
+{
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file)
+  {
+    spdlog::error("PipelinePermutations: failed to open '{}'", path);
+    return nullptr;
+  }
+
+  std::vector<uint32_t> code(static_cast<size_t>(file.tellg()) / sizeof(uint32_t));
+  file.seekg(0);
+  file.read(
+    reinterpret_cast<char*>(code.data()),
+    static_cast<std::streamsize>(code.size() * sizeof(uint32_t)));
+  if (!file)
+  {
+    spdlog::error("PipelinePermutations: failed to read '{}'", path);
+    return nullptr;
+  }
+
+  return std::make_shared<vk::UniqueShaderModule>(
+    etna::unwrap_vk_result(
+      etna::get_context().getDevice().createShaderModuleUnique(vk::ShaderModuleCreateInfo{
+        .codeSize = code.size() * sizeof(uint32_t),
+        .pCode = code.data(),
+      })));
+}
+
+PipelinePermutations::PipelinePermutations(
+  std::string program_name, const std::filesystem::path& spirv_path, uint32_t toggle_count)
+  : programName(std::move(program_name))
+  , toggleCount(toggle_count)
+  , shaderModule(load_shader_module(spirv_path))
+{
+  // One more constant marks the shader as specialized
+  ETNA_VERIFY(toggle_count < 32);
+}
+
+vk::Pipeline PipelinePermutations::get(uint32_t toggles, vk::Pipeline fallback)
+{
+  if (auto it = pipelines.find(toggles); it != pipelines.end())
+    return it->second.get();
+
+  request(toggles);
+
+  auto it = pending.find(toggles);
+  if (it == pending.end() ||
+      it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    return fallback;
+
+  const vk::Pipeline pipeline =
+    pipelines.emplace(toggles, it->second.get()).first->second.get();
+  pending.erase(it);
+  return pipeline;
+}
+
+void PipelinePermutations::prewarm(std::span<const uint32_t> toggles)
+{
+  for (const uint32_t permutation : toggles)
+    request(permutation);
+}
+
+void PipelinePermutations::waitPending()
+{
+  for (auto& [toggles, future] : pending)
+    pipelines.emplace(toggles, future.get());
+  pending.clear();
+}
+
+void PipelinePermutations::request(uint32_t toggles)
+{
+  if (shaderModule == nullptr || pipelines.contains(toggles) || pending.contains(toggles))
+    return;
+
+  // The layout is looked up here, as etna recreates it when the shaders are reloaded
+  const vk::PipelineLayout layout = etna::get_shader_program(programName).getPipelineLayout();
+
+  std::vector<vk::Bool32> values(toggleCount + 1, vk::True);
+  for (uint32_t i = 0; i < toggleCount; ++i)
+    values[i] = static_cast<vk::Bool32>((toggles >> i) & 1U);
+
+  pending.emplace(
+    toggles,
+    std::async(
+      std::launch::async, [module = shaderModule, layout, values = std::move(values)]() {
+        std::vector<vk::SpecializationMapEntry> entries(values.size());
+        for (uint32_t i = 0; i < entries.size(); ++i)
+        {
+          entries[i] = vk::SpecializationMapEntry{
+            .constantID = i,
+            .offset = static_cast<uint32_t>(i * sizeof(vk::Bool32)),
+            .size = sizeof(vk::Bool32),
+          };
+        }
+
+        const vk::SpecializationInfo specialization{
+          .mapEntryCount = static_cast<uint32_t>(entries.size()),
+          .pMapEntries = entries.data(),
+          .dataSize = values.size() * sizeof(vk::Bool32),
+          .pData = values.data(),
+        };
+
+        // Pipeline creation is free-threaded, only a shared pipeline cache would need a lock
+        return etna::unwrap_vk_result(
+          etna::get_context().getDevice().createComputePipelineUnique(
+            nullptr,
+            vk::ComputePipelineCreateInfo{
+              .stage =
+                vk::PipelineShaderStageCreateInfo{
+                  .stage = vk::ShaderStageFlagBits::eCompute,
+                  .module = module->get(),
+                  .pName = "main",
+                  .pSpecializationInfo = &specialization,
+                },
+              .layout = layout,
+            }));
+      }));
+}
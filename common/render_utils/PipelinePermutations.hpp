@@ -0,0 +1,58 @@
+#pragma once
+
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <span>
+#include <string>
+#include <unordered_map>
+
+#include <etna/Vulkan.hpp>
+
+
+/**
+ * Versions of a compute shader specialized for combinations of boolean toggles, so that the
+ * branches of the disabled features are compiled out.
+ *
+ * Toggle i is the specialization constant with id i, the constant with the id right after the last
+ * toggle tells the shader that the toggles are specialized at all. The pipeline etna creates from
+ * the same SPIR-V leaves it false, so the shader has to read the toggles from its push constants
+ * there, which makes it the fallback for every combination.
+ *
+ * Permutations are compiled on a worker thread the first time they are requested, the caller keeps
+ * dispatching its fallback until they are done, so flipping a toggle never stalls a frame. They
+ * share the pipeline layout of the etna program, so descriptor sets and push constants stay bound
+ * when switching between them and the fallback.
+ */
+class PipelinePermutations
+{
+public:
+  PipelinePermutations() = default;
+  // The program must have been created with etna::create_program from the same SPIR-V
+  PipelinePermutations(
+    std::string program_name, const std::filesystem::path& spirv_path, uint32_t toggle_count);
+
+  // The pipeline specialized for the toggles, or the fallback until it is compiled
+  vk::Pipeline get(uint32_t toggles, vk::Pipeline fallback);
+  // Starts compiling permutations ahead of their first use
+  void prewarm(std::span<const uint32_t> toggles);
+  // Blocks until every requested permutation is compiled, the workers use the layout of the etna
+  // program, so this has to be called before etna::reload_shaders destroys it
+  void waitPending();
+
+  uint32_t getCompiledCount() const { return static_cast<uint32_t>(pipelines.size()); }
+  uint32_t getPendingCount() const { return static_cast<uint32_t>(pending.size()); }
+
+private:
+  void request(uint32_t toggles);
+
+private:
+  std::string programName;
+  uint32_t toggleCount = 0;
+
+  // Shared with the workers, which may outlive a reassignment of the cache
+  std::shared_ptr<vk::UniqueShaderModule> shaderModule;
+
+  std::unordered_map<uint32_t, vk::UniquePipeline> pipelines;
+  std::unordered_map<uint32_t, std::future<vk::UniquePipeline>> pending;
+};
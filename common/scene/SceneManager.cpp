@@ -1,8 +1,14 @@
 #include "SceneManager.hpp"
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <memory>
 #include <stack>
-
-#include "render_utils/Utils.cpp"
+#include <thread>
 
 #include <spdlog/spdlog.h>
 #include <fmt/std.h>
@@ -12,59 +18,161 @@
 #include <etna/GlobalContext.hpp>
 #include <etna/OneShotCmdMgr.hpp>
 #include <etna/Etna.hpp>
-
-SceneManager::SceneManager()
-  : oneShotCommands{etna::get_context().createOneShotCmdMgr()}
-  , transferHelper{etna::BlockingTransferHelper::CreateInfo{.stagingSize = 4096 * 4096 * 4}}
+#include <stb_image.h>
+
+#include "TextureUploader.hpp"
+#include "texture_compression/BasisTranscoder.hpp"
+#include "texture_compression/Ktx2.hpp"
+#include "texture_compression/MipChain.hpp"
+
+// Images are decoded by processMaterials on worker threads, tinygltf only keeps the encoded bytes
+static bool keep_encoded_image(
+  tinygltf::Image* image,
+  const int /*image_idx*/,
+  std::string* /*error*/,
+  std::string* /*warning*/,
+  int /*req_width*/,
+  int /*req_height*/,
+  const unsigned char* bytes,
+  int size,
+  void* /*user_data*/)
 {
+  image->image.assign(bytes, bytes + size);
+  image->as_is = true;
+  return true;
 }
 
-etna::Image SceneManager::createAndUploadImage(const tinygltf::Image& src, vk::Format format)
+static TextureData decode_image(const tinygltf::Image& src, vk::Format format)
 {
-  auto mips = static_cast<uint32_t>(std::floor(std::log2(std::max(src.width, src.height)))) + 1;
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  stbi_uc* data = stbi_load_from_memory(
+    src.image.data(), static_cast<int>(src.image.size()), &width, &height, &channels, 4);
 
-  auto& ctx = etna::get_context();
+  if (data == nullptr)
+  {
+    spdlog::error("glTF: Failed to decode image '{}': {}", src.name, stbi_failure_reason());
+
+    // Keep the material usable with a single white texel
+    return TextureData{
+      .format = format,
+      .width = 1,
+      .height = 1,
+      .mips = {std::vector<std::byte>(4, std::byte{0xff})},
+    };
+  }
 
-  auto img = ctx.createImage(etna::Image::CreateInfo{
-    .extent = vk::Extent3D{static_cast<uint32_t>(src.width), static_cast<uint32_t>(src.height), 1},
-    .name = src.name,
+  TextureData result{
     .format = format,
-    .imageUsage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc |
-      vk::ImageUsageFlagBits::eTransferDst,
-    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
-    .tiling = vk::ImageTiling::eOptimal,
-    .layers = 1,
-    .mipLevels = mips,
-    .samples = vk::SampleCountFlagBits::e1,
-  });
+    .width = static_cast<uint32_t>(width),
+    .height = static_cast<uint32_t>(height),
+    .mips = {std::vector<std::byte>(static_cast<size_t>(width) * height * 4)},
+  };
+  std::memcpy(result.mips[0].data(), data, result.mips[0].size());
+  stbi_image_free(data);
+
+  return result;
+}
+
+// Block compressed copies with precomputed mips are written next to the source images by the
+// texture_compressor tool. They are ignored once the source image is modified.
+static std::optional<TextureData> load_compressed_image(
+  const std::filesystem::path& scene_dir, const tinygltf::Image& src)
+{
+  if (src.uri.empty() || src.uri.starts_with("data:"))
+    return std::nullopt;
+
+  const auto sourcePath = scene_dir / src.uri;
+  auto compressedPath = sourcePath;
+  compressedPath += ".ktx2";
+
+  std::error_code error;
+  const auto compressedTime = std::filesystem::last_write_time(compressedPath, error);
+  if (error)
+    return std::nullopt;
+
+  const auto sourceTime = std::filesystem::last_write_time(sourcePath, error);
+  if (!error && sourceTime > compressedTime)
+  {
+    spdlog::warn("glTF: '{}' is older than its source image, ignoring it", compressedPath);
+    return std::nullopt;
+  }
+
+  return read_ktx2(compressedPath);
+}
+
+enum class ImageSource : uint32_t
+{
+  Decoded,
+  Prebuilt,
+  Transcoded,
+};
 
-  transferHelper.uploadImage(
-    *oneShotCommands,
-    img,
-    0,
-    0,
-    std::span<std::byte const>(
-      reinterpret_cast<const std::byte*>(src.image.data()), src.image.size()));
+constexpr std::size_t IMAGE_SOURCE_COUNT = 3;
 
-  auto cmdBuffer = oneShotCommands->start();
-  ETNA_CHECK_VK_RESULT(cmdBuffer.begin(vk::CommandBufferBeginInfo{}));
+struct LoadedImage
+{
+  TextureData texture;
+  ImageSource source;
+};
+
+struct ImageUsage
+{
+  vk::Format format = vk::Format::eUndefined;
+  MipChainSettings mips;
+};
+
+// Images referenced by KHR_texture_basisu and KTX2 files prepared by the texture_compressor tool
+// come with their mips, everything else is decoded from PNG/JPEG and gets its mips on the CPU
+static LoadedImage load_image(
+  const std::filesystem::path& scene_dir,
+  const tinygltf::Image& src,
+  const ImageUsage& usage,
+  bool bc_supported)
+{
+  const auto format = usage.format;
+  const auto bytes = std::as_bytes(std::span(src.image));
 
-  generate_mips(cmdBuffer, img);
+  if (is_basis_ktx2(bytes))
+  {
+    if (auto texture = transcode_basis_ktx2(bytes, src.name, format, bc_supported))
+      return {std::move(*texture), ImageSource::Transcoded};
+  }
+  else if (bc_supported && is_ktx2(bytes))
+  {
+    if (auto texture = parse_ktx2(bytes, src.name))
+      return {std::move(*texture), ImageSource::Prebuilt};
+  }
+  else if (bc_supported)
+  {
+    if (auto texture = load_compressed_image(scene_dir, src))
+      return {std::move(*texture), ImageSource::Prebuilt};
+  }
 
-  etna::set_state(
-    cmdBuffer,
-    img.get(),
-    vk::PipelineStageFlagBits2::eFragmentShader,
-    vk::AccessFlagBits2::eShaderRead,
-    vk::ImageLayout::eShaderReadOnlyOptimal,
-    vk::ImageAspectFlagBits::eColor);
+  auto texture = decode_image(src, format);
+  texture.mips = generate_mip_chain(texture.mips[0], texture.width, texture.height, usage.mips);
+  return {std::move(texture), ImageSource::Decoded};
+}
 
-  etna::flush_barriers(cmdBuffer);
+// KHR_texture_basisu points to a KTX2 image through an extension, the plain source is a fallback
+static int get_texture_source(const tinygltf::Texture& texture)
+{
+  if (auto it = texture.extensions.find("KHR_texture_basisu"); it != texture.extensions.end())
+    if (const auto& source = it->second.Get("source"); source.IsInt())
+      return source.GetNumberAsInt();
 
-  ETNA_CHECK_VK_RESULT(cmdBuffer.end());
-  oneShotCommands->submitAndWait(std::move(cmdBuffer));
+  return texture.source;
+}
 
-  return img;
+SceneManager::SceneManager()
+  : oneShotCommands{etna::get_context().createOneShotCmdMgr()}
+  , transferHelper{etna::BlockingTransferHelper::CreateInfo{.stagingSize = 4096 * 4096 * 4}}
+  , textureCompressionBC{
+      etna::get_context().getPhysicalDevice().getFeatures().textureCompressionBC == vk::True}
+  , textureStreamer({})
+{
+  loader.SetImageLoader(&keep_encoded_image, nullptr);
 }
 
 std::optional<tinygltf::Model> SceneManager::loadModel(std::filesystem::path path)
@@ -97,17 +205,180 @@ std::optional<tinygltf::Model> SceneManager::loadModel(std::filesystem::path pat
   if (!warning.empty())
     spdlog::warn("glTF: {}", warning);
 
-  if (
-    !model.extensions.empty() || !model.extensionsRequired.empty() || !model.extensionsUsed.empty())
-    spdlog::warn("glTF: No glTF extensions are currently implemented!");
+  for (const auto& extension : model.extensionsUsed)
+    if (extension != "KHR_texture_basisu")
+      spdlog::warn("glTF: Extension '{}' is not implemented!", extension);
 
   return model;
 }
 
-SceneManager::ProcessedMaterials SceneManager::processMaterials(const tinygltf::Model& model)
+SceneManager::ProcessedMaterials SceneManager::processMaterials(
+  const tinygltf::Model& model, const std::filesystem::path& scene_dir)
 {
   SceneManager::ProcessedMaterials result;
-  result.textures.resize(model.images.size());
+
+  const auto imageCount = model.images.size();
+
+  const auto threadCount = static_cast<uint32_t>(std::clamp<std::size_t>(
+    std::thread::hardware_concurrency(), 1, std::max<std::size_t>(imageCount, 1)));
+
+  // Scenes with fewer images than cores also split the mip generation of every image by rows
+  const uint32_t mipThreadCount = std::max(std::thread::hardware_concurrency() / threadCount, 1u);
+
+  // The first material referencing an image decides its format and how its mips are filtered
+  std::vector<ImageUsage> imageUsages(imageCount);
+  {
+    const auto useImage = [&model, &imageUsages, mipThreadCount](
+                            std::size_t texture_idx, vk::Format format, MipChainSettings mips) {
+      auto& usage = imageUsages[get_texture_source(model.textures[texture_idx])];
+      if (usage.format != vk::Format::eUndefined)
+        return;
+
+      usage.format = format;
+      usage.mips = mips;
+      usage.mips.threadCount = mipThreadCount;
+    };
+
+    for (const auto& srcMat : model.materials)
+    {
+      const auto& pbr = srcMat.pbrMetallicRoughness;
+
+      // Alpha tested materials keep their coverage in distant mips
+      const float alphaCutoff =
+        srcMat.alphaMode == "MASK" ? static_cast<float>(srcMat.alphaCutoff) : -1.0f;
+
+      useImage(
+        pbr.baseColorTexture.index,
+        vk::Format::eR8G8B8A8Srgb,
+        {.filter = MipFilter::Color, .alphaCutoff = alphaCutoff});
+      useImage(
+        pbr.metallicRoughnessTexture.index,
+        vk::Format::eR8G8B8A8Unorm,
+        {.filter = MipFilter::Linear});
+      useImage(
+        srcMat.normalTexture.index, vk::Format::eR8G8B8A8Unorm, {.filter = MipFilter::Normal});
+      useImage(
+        srcMat.emissiveTexture.index, vk::Format::eR8G8B8A8Srgb, {.filter = MipFilter::Color});
+    }
+  }
+
+  // Finer mips are streamed in by reloading the image on a worker thread, which needs its own
+  // copy of the encoded images as the model goes away after loading
+  {
+    auto encodedImages = std::make_shared<std::vector<tinygltf::Image>>(model.images);
+    auto streamedUsages = imageUsages;
+    for (auto& usage : streamedUsages)
+      usage.mips.threadCount = 1;
+
+    textureStreamer.reset(
+      static_cast<uint32_t>(imageCount),
+      [encodedImages, streamedUsages, scene_dir, bc = textureCompressionBC](uint32_t image_idx) {
+        const auto& image = (*encodedImages)[image_idx];
+        return load_image(scene_dir, image, streamedUsages[image_idx], bc).texture;
+      });
+  }
+
+  // Decode on a pool of workers, while this thread uploads the images in order as they come in.
+  // Uploads are batched by the TextureUploader, so the GPU is only waited on when its staging ring
+  // wraps around. Every image is uploaded with its coarse mips only, so no blits are recorded.
+  std::vector<etna::Image*> textures(imageCount, nullptr);
+  {
+    const auto startTime = std::chrono::steady_clock::now();
+
+    std::vector<std::promise<TextureData>> decodedPromises(imageCount);
+    std::vector<std::future<TextureData>> decodedImages;
+    decodedImages.reserve(imageCount);
+    for (auto& promise : decodedPromises)
+      decodedImages.push_back(promise.get_future());
+
+    std::vector<std::array<float, IMAGE_SOURCE_COUNT>> threadLoadMs(threadCount);
+    std::array<std::atomic<uint32_t>, IMAGE_SOURCE_COUNT> sourceCounts{};
+    std::atomic<std::size_t> nextImage = 0;
+
+    const auto decodeImages = [&](uint32_t thread_idx) {
+      for (std::size_t imageIdx = nextImage++; imageIdx < imageCount; imageIdx = nextImage++)
+      {
+        if (imageUsages[imageIdx].format == vk::Format::eUndefined)
+        {
+          decodedPromises[imageIdx].set_value(TextureData{});
+          continue;
+        }
+
+        const auto loadStart = std::chrono::steady_clock::now();
+        auto [texture, source] = load_image(
+          scene_dir, model.images[imageIdx], imageUsages[imageIdx], textureCompressionBC);
+        decodedPromises[imageIdx].set_value(std::move(texture));
+
+        const auto sourceIdx = static_cast<std::size_t>(source);
+        ++sourceCounts[sourceIdx];
+        threadLoadMs[thread_idx][sourceIdx] += std::chrono::duration<float, std::milli>(
+                                                 std::chrono::steady_clock::now() - loadStart)
+                                                 .count();
+      }
+    };
+
+    float decodeWaitMs = 0.0f;
+    TextureUploader::Stats uploadStats;
+
+    {
+      std::vector<std::jthread> workers;
+      workers.reserve(threadCount);
+      for (uint32_t threadIdx = 0; threadIdx < threadCount; ++threadIdx)
+        workers.emplace_back(decodeImages, threadIdx);
+
+      TextureUploader uploader({});
+      for (std::size_t imageIdx = 0; imageIdx < imageCount; ++imageIdx)
+      {
+        if (imageUsages[imageIdx].format == vk::Format::eUndefined)
+          continue;
+
+        const auto waitStart = std::chrono::steady_clock::now();
+        auto decoded = decodedImages[imageIdx].get();
+        decodeWaitMs += std::chrono::duration<float, std::milli>(
+                          std::chrono::steady_clock::now() - waitStart)
+                          .count();
+
+        textures[imageIdx] = textureStreamer.initTexture(
+          static_cast<uint32_t>(imageIdx),
+          model.images[imageIdx].name,
+          std::move(decoded),
+          uploader);
+      }
+
+      uploader.flush();
+      uploadStats = uploader.getStats();
+    }
+
+    std::array<float, IMAGE_SOURCE_COUNT> loadMs{};
+    for (const auto& threadMs : threadLoadMs)
+      for (std::size_t i = 0; i < IMAGE_SOURCE_COUNT; ++i)
+        loadMs[i] += threadMs[i];
+
+    const auto totalMs =
+      std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime);
+    spdlog::info(
+      "glTF: Loaded {} images in {:.1f} ms on {} threads, waited {:.1f} ms for loading and "
+      "{:.1f} ms for the GPU over {} submits with {} copies",
+      imageCount,
+      totalMs.count(),
+      threadCount,
+      decodeWaitMs,
+      uploadStats.waitMs,
+      uploadStats.submits,
+      uploadStats.copies);
+    spdlog::info(
+      "glTF: Decoded {} PNG/JPEG images in {:.1f} ms, read {} prebuilt KTX2 images in {:.1f} ms, "
+      "transcoded {} Basis images in {:.1f} ms",
+      sourceCounts[0].load(),
+      loadMs[0],
+      sourceCounts[1].load(),
+      loadMs[1],
+      sourceCounts[2].load(),
+      loadMs[2]);
+  }
+
+  std::vector<std::array<uint32_t, TextureStreamer::TEXTURES_PER_MATERIAL>> materialTextures;
+  materialTextures.reserve(model.materials.size());
 
   result.materials.reserve(model.materials.size());
   for (const auto& srcMat : model.materials)
@@ -117,28 +388,31 @@ SceneManager::ProcessedMaterials SceneManager::processMaterials(const tinygltf::
     auto& mat = result.materials.emplace_back();
     mat.name = srcMat.name;
 
-    const auto setTexture =
-      [this, &result, &model](std::size_t texture_idx, vk::Format format) -> etna::Image* {
-      std::size_t imageIdx = model.textures[texture_idx].source;
-      if (result.textures[imageIdx].get() == nullptr)
-      {
-        result.textures[imageIdx] = this->createAndUploadImage(model.images[imageIdx], format);
-      }
+    const auto getImage = [&model](std::size_t texture_idx) {
+      return static_cast<uint32_t>(get_texture_source(model.textures[texture_idx]));
+    };
 
-      return &result.textures[imageIdx];
+    // Must match the order of the material bindings, which share the streaming feedback
+    const std::array<uint32_t, TextureStreamer::TEXTURES_PER_MATERIAL> images{
+      getImage(pbr.baseColorTexture.index),
+      getImage(pbr.metallicRoughnessTexture.index),
+      getImage(srcMat.normalTexture.index),
+      getImage(srcMat.emissiveTexture.index),
     };
+    materialTextures.push_back(images);
 
-    mat.texAlbedo = setTexture(pbr.baseColorTexture.index, vk::Format::eR8G8B8A8Srgb);
-    mat.texMetalnessRoughness =
-      setTexture(pbr.metallicRoughnessTexture.index, vk::Format::eR8G8B8A8Unorm);
-    mat.texNorm = setTexture(srcMat.normalTexture.index, vk::Format::eR8G8B8A8Unorm);
-    mat.texEmissive = setTexture(srcMat.emissiveTexture.index, vk::Format::eR8G8B8A8Srgb);
+    mat.texAlbedo = textures[images[0]];
+    mat.texMetalnessRoughness = textures[images[1]];
+    mat.texNorm = textures[images[2]];
+    mat.texEmissive = textures[images[3]];
 
     mat.albedo = glm::make_vec3(pbr.baseColorFactor.data());
     mat.metalness = static_cast<float>(pbr.metallicFactor);
     mat.roughness = static_cast<float>(pbr.roughnessFactor);
   }
 
+  textureStreamer.setMaterials(std::move(materialTextures));
+
   return result;
 }
 
@@ -390,6 +664,7 @@ SceneManager::ProcessedMeshes SceneManager::processMeshes(const tinygltf::Model&
         glm::vec3 tangent{0};
         glm::vec2 texcoord{0};
         std::memcpy(&pos, ptrs[1], sizeof(pos));
+        result.meshes.back().bounds.extend(pos);
 
         // NOTE: it's faster to do a template here with specializations for all combinations than to
         // do ifs at runtime. Also, SIMD should be used. Try implementing this!
@@ -475,8 +750,7 @@ void SceneManager::selectScene(std::filesystem::path path)
   // we guarantee that we don't forget to clear something
   // when re-loading a scene.
 
-  auto [texs, mats] = processMaterials(model);
-  textures = std::move(texs);
+  auto [mats] = processMaterials(model, path.parent_path());
   materials = std::move(mats);
 
   // NOTE: you might want to store these on the GPU for GPU-driven rendering.
@@ -490,9 +764,34 @@ void SceneManager::selectScene(std::filesystem::path path)
   renderElements = std::move(relems);
   meshes = std::move(meshs);
 
+  sceneBounds = {};
+  for (std::size_t i = 0; i < instanceMatrices.size(); ++i)
+  {
+    const auto& bounds = meshes[instanceMeshes[i]].bounds;
+    if (bounds.isEmpty())
+      continue;
+
+    for (std::uint32_t corner = 0; corner < 8; ++corner)
+    {
+      const glm::vec3 point{
+        (corner & 1U) != 0 ? bounds.max.x : bounds.min.x,
+        (corner & 2U) != 0 ? bounds.max.y : bounds.min.y,
+        (corner & 4U) != 0 ? bounds.max.z : bounds.min.z,
+      };
+      sceneBounds.extend(glm::vec3(instanceMatrices[i] * glm::vec4(point, 1.0f)));
+    }
+  }
+
   uploadMeshes(verts, inds);
 }
 
+void SceneManager::reportMemory(GpuMemoryTracker::Collector& collector)
+{
+  textureStreamer.reportMemory(collector);
+  collector.add(GpuMemoryTracker::Category::eScene, "SceneManager::unifiedVbuf", unifiedVbuf);
+  collector.add(GpuMemoryTracker::Category::eScene, "SceneManager::unifiedIbuf", unifiedIbuf);
+}
+
 etna::VertexByteStreamFormatDescription SceneManager::getVertexFormatDescription()
 {
   return etna::VertexByteStreamFormatDescription{
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <filesystem>
+#include <limits>
 
 #include <glm/glm.hpp>
 #include <tiny_gltf.h>
@@ -9,6 +10,9 @@
 #include <etna/VertexInput.hpp>
 #include <etna/Sampler.hpp>
 
+#include "render_utils/GpuMemoryTracker.hpp"
+#include "TextureStreamer.hpp"
+
 struct Material
 {
   std::string name;
@@ -34,6 +38,20 @@ struct RenderElement
   const Material* material;
 };
 
+// Axis aligned, empty boxes have min greater than max
+struct BoundingBox
+{
+  glm::vec3 min{std::numeric_limits<float>::max()};
+  glm::vec3 max{std::numeric_limits<float>::lowest()};
+
+  bool isEmpty() const { return min.x > max.x; }
+  void extend(glm::vec3 point)
+  {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+};
+
 // A mesh is a collection of relems. A scene may have the same mesh
 // located in several different places, so a scene consists of **instances**,
 // not meshes.
@@ -41,6 +59,8 @@ struct Mesh
 {
   std::uint32_t firstRelem;
   std::uint32_t relemCount;
+  // In the space of the mesh, instance matrices are not applied
+  BoundingBox bounds;
 };
 
 class SceneManager
@@ -59,27 +79,35 @@ public:
   // Every mesh is a collection of relems
   std::span<const Mesh> getMeshes() { return meshes; }
 
+  // Bounds of all instances in world space
+  const BoundingBox& getSceneBounds() const { return sceneBounds; }
+
   // Every relem is a single draw call
   std::span<const RenderElement> getRenderElements() { return renderElements; }
 
   std::span<Material> getMaterials() { return materials; }
 
+  // Material textures only have their coarse mips resident until the geometry pass asks for more
+  TextureStreamer& getTextureStreamer() { return textureStreamer; }
+
   vk::Buffer getVertexBuffer() { return unifiedVbuf.get(); }
   vk::Buffer getIndexBuffer() { return unifiedIbuf.get(); }
 
   etna::VertexByteStreamFormatDescription getVertexFormatDescription();
 
-private:
-  etna::Image createAndUploadImage(const tinygltf::Image& src, vk::Format format);
+  // The staging buffer of the transfer helper is not accessible, it shows up as untracked memory
+  void reportMemory(GpuMemoryTracker::Collector& collector);
 
+private:
   std::optional<tinygltf::Model> loadModel(std::filesystem::path path);
 
+  // Textures are owned by the textureStreamer
   struct ProcessedMaterials
   {
-    std::vector<etna::Image> textures;
     std::vector<Material> materials;
   };
-  ProcessedMaterials processMaterials(const tinygltf::Model& model);
+  ProcessedMaterials processMaterials(
+    const tinygltf::Model& model, const std::filesystem::path& scene_dir);
 
   struct ProcessedInstances
   {
@@ -113,8 +141,10 @@ private:
   tinygltf::TinyGLTF loader;
   std::unique_ptr<etna::OneShotCmdMgr> oneShotCommands;
   etna::BlockingTransferHelper transferHelper;
+  // BC textures are only loaded when the device supports them, the app has to enable the feature
+  bool textureCompressionBC;
 
-  std::vector<etna::Image> textures;
+  TextureStreamer textureStreamer;
   std::vector<Material> materials;
 
   std::vector<RenderElement> renderElements;
@@ -122,6 +152,7 @@ private:
   std::vector<glm::mat4x4> instanceMatrices;
   std::vector<std::uint32_t> instanceMeshes;
   std::vector<std::string> instanceNames;
+  BoundingBox sceneBounds;
 
   etna::Buffer unifiedVbuf;
   etna::Buffer unifiedIbuf;
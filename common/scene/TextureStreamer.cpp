@@ -0,0 +1,421 @@
+#include "TextureStreamer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+#include <etna/GlobalContext.hpp>
+#include <etna/Etna.hpp>
+
+#include "texture_compression/BlockCompression.hpp"
+
+
+static etna::Image create_texture(
+  const std::string& name, uint32_t width, uint32_t height, vk::Format format, uint32_t mips)
+{
+  return etna::get_context().createImage(etna::Image::CreateInfo{
+    .extent = vk::Extent3D{width, height, 1},
+    .name = name,
+    .format = format,
+    .imageUsage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc |
+      vk::ImageUsageFlagBits::eTransferDst,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+    .tiling = vk::ImageTiling::eOptimal,
+    .layers = 1,
+    .mipLevels = mips,
+    .samples = vk::SampleCountFlagBits::e1,
+  });
+}
+
+TextureStreamer::TextureStreamer(CreateInfo info)
+  : memoryBudget(info.memoryBudget)
+  , minResidentSize(info.minResidentSize)
+  , maxPendingLoads(info.maxPendingLoads)
+  , maxUploadBytesPerFrame(info.maxUploadBytesPerFrame)
+  // A frame uploads into about one segment, so the ring only wraps onto finished frames
+  , uploader({.stagingSize = 4 * info.maxUploadBytesPerFrame, .segmentCount = 4})
+{
+  setMaterials({});
+}
+
+TextureStreamer::~TextureStreamer()
+{
+  // Pending loads capture the scene, they have to finish before it goes away
+  for (auto& slot : slots)
+    if (slot.pending.valid())
+      slot.pending.wait();
+}
+
+void TextureStreamer::reset(uint32_t texture_count, LoadFn load_fn)
+{
+  for (auto& slot : slots)
+  {
+    if (slot.pending.valid())
+      slot.pending.wait();
+    if (slot.image.get())
+      retired.push_back({std::move(slot.image), frameIdx});
+  }
+
+  slots.clear();
+  slots.resize(texture_count);
+  loadFn = std::move(load_fn);
+  setMaterials({});
+  stats = {};
+}
+
+etna::Image* TextureStreamer::initTexture(
+  uint32_t texture_idx, std::string name, TextureData texture, TextureUploader& scene_uploader)
+{
+  auto& slot = slots[texture_idx];
+  slot.name = std::move(name);
+  slot.format = texture.format;
+  slot.width = texture.width;
+  slot.height = texture.height;
+  slot.mipCount = static_cast<uint32_t>(texture.mips.size());
+
+  slot.tailMip = 0;
+  while (
+    slot.tailMip + 1 < slot.mipCount &&
+    std::max(slot.width >> slot.tailMip, slot.height >> slot.tailMip) > minResidentSize)
+    ++slot.tailMip;
+
+  slot.requestedMip = slot.tailMip;
+
+  std::vector<std::vector<std::byte>> mips(
+    std::make_move_iterator(texture.mips.begin() + slot.tailMip),
+    std::make_move_iterator(texture.mips.end()));
+
+  const uint32_t tailWidth = std::max(slot.width >> slot.tailMip, 1u);
+  const uint32_t tailHeight = std::max(slot.height >> slot.tailMip, 1u);
+  slot.image =
+    create_texture(slot.name, tailWidth, tailHeight, slot.format, slot.mipCount - slot.tailMip);
+  scene_uploader.uploadMips(slot.image, mips);
+
+  slot.residentMip = slot.tailMip;
+  slot.residentData = std::move(mips);
+  stats.residentBytes += getMipsByteSize(slot, slot.tailMip);
+
+  return &slot.image;
+}
+
+void TextureStreamer::setMaterials(
+  std::vector<std::array<uint32_t, TEXTURES_PER_MATERIAL>> material_textures)
+{
+  materialTextures = std::move(material_textures);
+
+  const auto size = getFeedbackByteSize();
+  feedback = etna::get_context().createBuffer(etna::Buffer::CreateInfo{
+    .size = size,
+    .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer |
+      vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+    .name = "textureFeedback",
+  });
+
+  feedbackReadback.emplace(etna::get_context().getMainWorkCount(), [size](std::size_t fif) {
+    auto buffer = etna::get_context().createBuffer(etna::Buffer::CreateInfo{
+      .size = size,
+      .bufferUsage = vk::BufferUsageFlagBits::eTransferDst,
+      .memoryUsage = VMA_MEMORY_USAGE_GPU_TO_CPU,
+      .name = "textureFeedbackReadback[fif = " + std::to_string(fif) + "]",
+    });
+
+    // Nothing has been rendered with the new materials yet
+    std::memset(buffer.map(), 0xff, size);
+    return buffer;
+  });
+}
+
+void TextureStreamer::beginFrame(vk::CommandBuffer cmd_buf)
+{
+  ++frameIdx;
+
+  // The uploader records barriers of its own, which must not pick up the ones of this frame
+  etna::flush_barriers(cmd_buf);
+
+  readFeedback();
+  finishLoads();
+  evictTextures();
+  startLoads();
+
+  const uint64_t framesInFlight = etna::get_context().getMainWorkCount().multiBufferingCount();
+  std::erase_if(retired, [this, framesInFlight](const RetiredImage& image) {
+    return frameIdx > image.frame + framesInFlight;
+  });
+
+  // Uploads are submitted ahead of this frame, so it samples the new images
+  uploader.submit();
+
+  // The previous frame copies the feedback out before it is cleared
+  vk::BufferMemoryBarrier clearBarrier;
+  clearBarrier.setSrcAccessMask(vk::AccessFlagBits::eTransferRead);
+  clearBarrier.setDstAccessMask(vk::AccessFlagBits::eTransferWrite);
+  clearBarrier.setBuffer(feedback.get());
+  clearBarrier.setSize(vk::WholeSize);
+
+  cmd_buf.pipelineBarrier(
+    vk::PipelineStageFlagBits::eTransfer,
+    vk::PipelineStageFlagBits::eTransfer,
+    {},
+    {},
+    clearBarrier,
+    {});
+
+  cmd_buf.fillBuffer(feedback.get(), 0, vk::WholeSize, FEEDBACK_EMPTY);
+
+  vk::BufferMemoryBarrier barrier;
+  barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
+  barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+  barrier.setBuffer(feedback.get());
+  barrier.setSize(vk::WholeSize);
+
+  cmd_buf.pipelineBarrier(
+    vk::PipelineStageFlagBits::eTransfer,
+    vk::PipelineStageFlagBits::eFragmentShader,
+    {},
+    {},
+    barrier,
+    {});
+}
+
+void TextureStreamer::endFrame(vk::CommandBuffer cmd_buf)
+{
+  vk::BufferMemoryBarrier copyBarrier;
+  copyBarrier.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite);
+  copyBarrier.setDstAccessMask(vk::AccessFlagBits::eTransferRead);
+  copyBarrier.setBuffer(feedback.get());
+  copyBarrier.setSize(vk::WholeSize);
+
+  cmd_buf.pipelineBarrier(
+    vk::PipelineStageFlagBits::eFragmentShader,
+    vk::PipelineStageFlagBits::eTransfer,
+    {},
+    {},
+    copyBarrier,
+    {});
+
+  auto& readback = feedbackReadback->get();
+  cmd_buf.copyBuffer(feedback.get(), readback.get(), vk::BufferCopy{.size = getFeedbackByteSize()});
+
+  vk::BufferMemoryBarrier readBarrier;
+  readBarrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
+  readBarrier.setDstAccessMask(vk::AccessFlagBits::eHostRead);
+  readBarrier.setBuffer(readback.get());
+  readBarrier.setSize(vk::WholeSize);
+
+  cmd_buf.pipelineBarrier(
+    vk::PipelineStageFlagBits::eTransfer,
+    vk::PipelineStageFlagBits::eHost,
+    {},
+    {},
+    readBarrier,
+    {});
+}
+
+etna::Buffer& TextureStreamer::getFeedbackBuffer()
+{
+  return feedback;
+}
+
+TextureStreamer::Stats TextureStreamer::getStats() const
+{
+  auto result = stats;
+  result.pendingLoads = static_cast<uint32_t>(std::count_if(
+    slots.begin(), slots.end(), [](const Slot& slot) { return slot.pending.valid(); }));
+  return result;
+}
+
+vk::DeviceSize& TextureStreamer::getMemoryBudget()
+{
+  return memoryBudget;
+}
+
+void TextureStreamer::reportMemory(GpuMemoryTracker::Collector& collector)
+{
+  using Category = GpuMemoryTracker::Category;
+
+  for (const auto& slot : slots)
+    collector.add(Category::eScene, slot.name, slot.image);
+  for (const auto& image : retired)
+    collector.add(Category::eScene, "TextureStreamer::retired", image.image);
+
+  collector.add(Category::ePasses, "TextureStreamer::feedback", feedback);
+  collector.add(
+    Category::eStaging,
+    "TextureStreamer::feedbackReadback",
+    feedbackReadback->get(),
+    static_cast<uint32_t>(etna::get_context().getMainWorkCount().multiBufferingCount()));
+  uploader.reportMemory(collector);
+}
+
+void TextureStreamer::readFeedback()
+{
+  // The frame that used this slot has finished, as the slot is being reused. Buffers written by no
+  // frame yet are filled with FEEDBACK_EMPTY.
+  const auto* requestedLods = reinterpret_cast<const uint32_t*>(feedbackReadback->get().data());
+
+  for (auto& slot : slots)
+    slot.requestedMip = slot.tailMip;
+
+  for (std::size_t materialIdx = 0; materialIdx < materialTextures.size(); ++materialIdx)
+  {
+    const uint32_t value = requestedLods[materialIdx];
+    if (value == FEEDBACK_EMPTY)
+      continue;
+
+    const float lod = static_cast<float>(value) / FEEDBACK_LOD_SCALE - FEEDBACK_LOD_OFFSET;
+
+    for (const uint32_t textureIdx : materialTextures[materialIdx])
+    {
+      if (textureIdx == NO_TEXTURE || slots[textureIdx].mipCount == 0)
+        continue;
+
+      auto& slot = slots[textureIdx];
+      const float size = static_cast<float>(std::max(slot.width, slot.height));
+      const float mip = std::floor(lod + std::log2(size));
+      const auto requested =
+        static_cast<uint32_t>(std::clamp(mip, 0.0f, static_cast<float>(slot.tailMip)));
+
+      slot.requestedMip = std::min(slot.requestedMip, requested);
+      slot.lastRequestedFrame = frameIdx;
+    }
+  }
+}
+
+void TextureStreamer::finishLoads()
+{
+  vk::DeviceSize uploadedBytes = 0;
+
+  for (auto& slot : slots)
+  {
+    if (!slot.pending.valid() || uploadedBytes >= maxUploadBytesPerFrame)
+      continue;
+    if (slot.pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      continue;
+
+    auto texture = slot.pending.get();
+    if (
+      texture.format != slot.format || texture.width != slot.width ||
+      texture.height != slot.height || texture.mips.size() != slot.mipCount)
+    {
+      spdlog::warn(
+        "TextureStreamer: '{}' changed since it was loaded, not streaming it", slot.name);
+      slot.failed = true;
+      continue;
+    }
+
+    texture.mips.erase(texture.mips.begin(), texture.mips.begin() + slot.pendingMip);
+
+    uploadedBytes += getMipsByteSize(slot, slot.pendingMip);
+    setResidentMips(slot, slot.pendingMip, std::move(texture.mips));
+    ++stats.loads;
+  }
+}
+
+void TextureStreamer::evictTextures()
+{
+  if (stats.residentBytes <= memoryBudget)
+    return;
+
+  // Only mips finer than the last request are dropped, least recently requested textures first
+  std::vector<Slot*> candidates;
+  for (auto& slot : slots)
+    if (slot.residentMip < slot.requestedMip)
+      candidates.push_back(&slot);
+
+  std::sort(candidates.begin(), candidates.end(), [](const Slot* a, const Slot* b) {
+    return a->lastRequestedFrame < b->lastRequestedFrame;
+  });
+
+  for (auto* slot : candidates)
+  {
+    if (stats.residentBytes <= memoryBudget)
+      break;
+
+    const uint32_t dropped = slot->requestedMip - slot->residentMip;
+    std::vector<std::vector<std::byte>> mips(
+      std::make_move_iterator(slot->residentData.begin() + dropped),
+      std::make_move_iterator(slot->residentData.end()));
+
+    setResidentMips(*slot, slot->requestedMip, std::move(mips));
+    ++stats.evictions;
+  }
+}
+
+void TextureStreamer::startLoads()
+{
+  vk::DeviceSize reservedBytes = stats.residentBytes;
+  uint32_t pendingLoads = 0;
+  for (const auto& slot : slots)
+    if (slot.pending.valid())
+    {
+      reservedBytes +=
+        getMipsByteSize(slot, slot.pendingMip) - getMipsByteSize(slot, slot.residentMip);
+      ++pendingLoads;
+    }
+
+  // Textures missing the most mips go first
+  std::vector<Slot*> candidates;
+  for (auto& slot : slots)
+    if (slot.requestedMip < slot.residentMip && !slot.pending.valid() && !slot.failed)
+      candidates.push_back(&slot);
+
+  std::sort(candidates.begin(), candidates.end(), [](const Slot* a, const Slot* b) {
+    return a->residentMip - a->requestedMip > b->residentMip - b->requestedMip;
+  });
+
+  for (auto* slot : candidates)
+  {
+    if (pendingLoads >= maxPendingLoads)
+      break;
+
+    const vk::DeviceSize extraBytes =
+      getMipsByteSize(*slot, slot->requestedMip) - getMipsByteSize(*slot, slot->residentMip);
+    if (reservedBytes + extraBytes > memoryBudget)
+      continue;
+
+    const auto textureIdx = static_cast<uint32_t>(slot - slots.data());
+    slot->pending = std::async(std::launch::async, loadFn, textureIdx);
+    slot->pendingMip = slot->requestedMip;
+
+    reservedBytes += extraBytes;
+    ++pendingLoads;
+  }
+}
+
+void TextureStreamer::setResidentMips(
+  Slot& slot, uint32_t first_mip, std::vector<std::vector<std::byte>> mips)
+{
+  auto image = create_texture(
+    slot.name,
+    std::max(slot.width >> first_mip, 1u),
+    std::max(slot.height >> first_mip, 1u),
+    slot.format,
+    slot.mipCount - first_mip);
+  uploader.uploadMips(image, mips);
+
+  // Frames in flight might still sample the old image
+  retired.push_back({std::move(slot.image), frameIdx});
+  slot.image = std::move(image);
+
+  stats.residentBytes += getMipsByteSize(slot, first_mip);
+  stats.residentBytes -= getMipsByteSize(slot, slot.residentMip);
+  slot.residentMip = first_mip;
+  slot.residentData = std::move(mips);
+}
+
+vk::DeviceSize TextureStreamer::getMipsByteSize(const Slot& slot, uint32_t first_mip) const
+{
+  vk::DeviceSize size = 0;
+  for (uint32_t mip = first_mip; mip < slot.mipCount; ++mip)
+    size += get_mip_byte_size(
+      slot.format, std::max(slot.width >> mip, 1u), std::max(slot.height >> mip, 1u));
+  return size;
+}
+
+vk::DeviceSize TextureStreamer::getFeedbackByteSize() const
+{
+  return std::max<vk::DeviceSize>(materialTextures.size(), 1) * sizeof(uint32_t);
+}
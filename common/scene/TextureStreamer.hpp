@@ -0,0 +1,163 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <etna/Vulkan.hpp>
+#include <etna/Buffer.hpp>
+#include <etna/GpuSharedResource.hpp>
+#include <etna/Image.hpp>
+
+#include "texture_compression/TextureData.hpp"
+#include "render_utils/GpuMemoryTracker.hpp"
+#include "TextureUploader.hpp"
+
+
+/**
+ * Streams the finer mips of material textures in and out under a memory budget.
+ *
+ * Every texture starts with only its mips up to minResidentSize texels resident. The geometry
+ * pass reports the finest mip each material needs into a device local feedback buffer, which is
+ * copied into a small per-frame readback buffer and read once the frame that copied it has
+ * finished. Textures that need finer mips are reloaded on worker threads and their image is
+ * recreated with the requested mips. Once the resident size exceeds the budget, the least recently
+ * requested textures lose their finer mips again.
+ *
+ * An image only ever contains the resident mips of its texture, so samplers are clamped to the
+ * resident mip level for free. Replaced images are kept alive until the frames in flight that
+ * could sample them have finished. A CPU copy of the resident mips is kept for evictions, as
+ * images can't be copied from while frames in flight sample them.
+ */
+class TextureStreamer
+{
+public:
+  // Loads the whole mip chain of a texture, called on worker threads
+  using LoadFn = std::function<TextureData(uint32_t texture_idx)>;
+
+  struct CreateInfo
+  {
+    vk::DeviceSize memoryBudget = 512ULL << 20;
+    // Mips up to this size are always resident
+    uint32_t minResidentSize = 128;
+    uint32_t maxPendingLoads = 4;
+    // Finished loads over this are uploaded in the following frames
+    vk::DeviceSize maxUploadBytesPerFrame = 32ULL << 20;
+  };
+
+  constexpr static uint32_t TEXTURES_PER_MATERIAL = 4;
+  constexpr static uint32_t NO_TEXTURE = UINT32_MAX;
+
+  // Must match FEEDBACK_* in geometry_pass.frag. Materials report the mip level of a 1x1 texture,
+  // which is offset and scaled into a uint so that the finest one wins an atomicMin.
+  constexpr static uint32_t FEEDBACK_EMPTY = UINT32_MAX;
+  constexpr static float FEEDBACK_LOD_OFFSET = 32.0f;
+  constexpr static float FEEDBACK_LOD_SCALE = 16.0f;
+
+  explicit TextureStreamer(CreateInfo info);
+  ~TextureStreamer();
+
+  TextureStreamer(const TextureStreamer&) = delete;
+  TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+  // Forgets all textures, waiting for the pending loads. Images which frames in flight might
+  // sample are destroyed later.
+  void reset(uint32_t texture_count, LoadFn load_fn);
+
+  // Creates the image of a texture with only its coarse mips resident, uploaded through the
+  // uploader of the scene loading. The returned image stays valid until the next reset, while the
+  // mips it holds change as they stream in and out.
+  etna::Image* initTexture(
+    uint32_t texture_idx, std::string name, TextureData texture, TextureUploader& scene_uploader);
+
+  // Textures sampled by each material, which are requested through the material feedback slot
+  void setMaterials(std::vector<std::array<uint32_t, TEXTURES_PER_MATERIAL>> material_textures);
+
+  // Reads back the feedback of the frame that last used this frame slot, uploads finished loads,
+  // evicts textures over the budget and starts new loads. Clears the feedback buffer, so it has to
+  // be called before any geometry pass.
+  void beginFrame(vk::CommandBuffer cmd_buf);
+
+  // Copies the feedback written by the geometry passes into the readback buffer of this frame
+  void endFrame(vk::CommandBuffer cmd_buf);
+
+  // One uint per material, written by geometry_pass.frag
+  etna::Buffer& getFeedbackBuffer();
+
+  struct Stats
+  {
+    vk::DeviceSize residentBytes = 0;
+    uint32_t pendingLoads = 0;
+    uint32_t loads = 0;
+    uint32_t evictions = 0;
+  };
+  Stats getStats() const;
+
+  vk::DeviceSize& getMemoryBudget();
+
+  void reportMemory(GpuMemoryTracker::Collector& collector);
+
+private:
+  struct Slot
+  {
+    std::string name;
+    vk::Format format = vk::Format::eUndefined;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mipCount = 0;
+    // Coarsest mip a texture is ever trimmed to
+    uint32_t tailMip = 0;
+
+    // Mips [residentMip, mipCount) are in the image and in residentData
+    etna::Image image;
+    uint32_t residentMip = 0;
+    std::vector<std::vector<std::byte>> residentData;
+
+    std::future<TextureData> pending;
+    uint32_t pendingMip = 0;
+    // Reloading produced something else than the initial load, e.g. the file was changed
+    bool failed = false;
+
+    uint32_t requestedMip = 0;
+    uint64_t lastRequestedFrame = 0;
+  };
+
+  struct RetiredImage
+  {
+    etna::Image image;
+    uint64_t frame;
+  };
+
+  void readFeedback();
+  void finishLoads();
+  void evictTextures();
+  void startLoads();
+
+  void setResidentMips(Slot& slot, uint32_t first_mip, std::vector<std::vector<std::byte>> mips);
+  vk::DeviceSize getMipsByteSize(const Slot& slot, uint32_t first_mip) const;
+  vk::DeviceSize getFeedbackByteSize() const;
+
+private:
+  vk::DeviceSize memoryBudget;
+  uint32_t minResidentSize;
+  uint32_t maxPendingLoads;
+  vk::DeviceSize maxUploadBytesPerFrame;
+
+  LoadFn loadFn;
+  std::vector<Slot> slots;
+  std::vector<std::array<uint32_t, TEXTURES_PER_MATERIAL>> materialTextures;
+
+  // Recreated by setMaterials, as they hold one uint per material. The feedback is cleared at the
+  // start of every frame, so a single one is shared by the frames in flight.
+  etna::Buffer feedback;
+  std::optional<etna::GpuSharedResource<etna::Buffer>> feedbackReadback;
+  std::vector<RetiredImage> retired;
+  TextureUploader uploader;
+
+  uint64_t frameIdx = 0;
+  Stats stats;
+};
@@ -0,0 +1,274 @@
+#include "TextureUploader.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include <etna/GlobalContext.hpp>
+#include <etna/Etna.hpp>
+
+#include "render_utils/Utils.hpp"
+
+
+// Covers the texel size of any uncompressed format, as required for buffer to image copies
+constexpr vk::DeviceSize STAGING_ALIGNMENT = 16;
+
+TextureUploader::TextureUploader(CreateInfo info)
+  : segmentSize(info.stagingSize / info.segmentCount / STAGING_ALIGNMENT * STAGING_ALIGNMENT)
+{
+  auto& ctx = etna::get_context();
+  auto device = ctx.getDevice();
+
+  staging = ctx.createBuffer(etna::Buffer::CreateInfo{
+    .size = segmentSize * info.segmentCount,
+    .bufferUsage = vk::BufferUsageFlagBits::eTransferSrc,
+    .memoryUsage = VMA_MEMORY_USAGE_CPU_ONLY,
+    .name = "TextureUploader::staging",
+  });
+  stagingData = staging.map();
+
+  commandPool = etna::unwrap_vk_result(device.createCommandPoolUnique(vk::CommandPoolCreateInfo{
+    .flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+    .queueFamilyIndex = ctx.getQueueFamilyIdx(),
+  }));
+
+  auto cmds = etna::unwrap_vk_result(device.allocateCommandBuffersUnique(
+    vk::CommandBufferAllocateInfo{
+      .commandPool = commandPool.get(),
+      .level = vk::CommandBufferLevel::ePrimary,
+      .commandBufferCount = info.segmentCount,
+    }));
+
+  segments.resize(info.segmentCount);
+  for (uint32_t i = 0; i < info.segmentCount; ++i)
+  {
+    segments[i].cmd = std::move(cmds[i]);
+    segments[i].fence = etna::unwrap_vk_result(device.createFenceUnique(vk::FenceCreateInfo{}));
+  }
+}
+
+TextureUploader::~TextureUploader()
+{
+  flush();
+  staging.unmap();
+}
+
+void TextureUploader::upload(etna::Image& image, std::span<const std::byte> texels)
+{
+  uploadMip(image, 0, texels);
+  finish(image, true);
+}
+
+void TextureUploader::uploadMip(etna::Image& image, uint32_t mip, std::span<const std::byte> texels)
+{
+  const auto extent = image.getExtent();
+  const uint32_t width = std::max(extent.width >> mip, 1u);
+  const uint32_t height = std::max(extent.height >> mip, 1u);
+
+  // A row of 4x4 blocks is copied as a whole for block compressed formats
+  const uint32_t blockHeight = vk::blockExtent(image.getFormat())[1];
+  const uint32_t blockRows = (height + blockHeight - 1) / blockHeight;
+  const vk::DeviceSize rowPitch = texels.size() / blockRows;
+
+  uint32_t row = 0;
+  while (row < blockRows)
+  {
+    auto cmd = acquireSegment();
+
+    // Rows which fit into the rest of the segment
+    auto rows = static_cast<uint32_t>((segmentSize - segmentOffset) / rowPitch);
+    if (rows == 0)
+    {
+      ETNA_VERIFY(segmentOffset > 0);
+      submitSegment();
+      continue;
+    }
+    rows = std::min(rows, blockRows - row);
+
+    const vk::DeviceSize offset = currentSegment * segmentSize + segmentOffset;
+    const vk::DeviceSize size = rows * rowPitch;
+    std::memcpy(stagingData + offset, texels.data() + row * rowPitch, size);
+
+    if (mip == 0 && row == 0)
+    {
+      etna::set_state(
+        cmd,
+        image.get(),
+        vk::PipelineStageFlagBits2::eTransfer,
+        vk::AccessFlagBits2::eTransferWrite,
+        vk::ImageLayout::eTransferDstOptimal,
+        vk::ImageAspectFlagBits::eColor);
+      etna::flush_barriers(cmd);
+    }
+
+    const uint32_t firstTexelRow = row * blockHeight;
+    cmd.copyBufferToImage(
+      staging.get(),
+      image.get(),
+      vk::ImageLayout::eTransferDstOptimal,
+      vk::BufferImageCopy{
+        .bufferOffset = offset,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {vk::ImageAspectFlagBits::eColor, mip, 0, 1},
+        .imageOffset = {0, static_cast<int32_t>(firstTexelRow), 0},
+        .imageExtent = {width, std::min(rows * blockHeight, height - firstTexelRow), 1},
+      });
+    ++stats.copies;
+
+    segmentOffset += (size + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+    row += rows;
+  }
+}
+
+void TextureUploader::finish(etna::Image& image, bool gen_mips)
+{
+  // Mips are generated in the same submission as the last rows of mip 0
+  auto cmd = acquireSegment();
+
+  if (gen_mips)
+    generate_mips(cmd, image);
+
+  etna::set_state(
+    cmd,
+    image.get(),
+    vk::PipelineStageFlagBits2::eFragmentShader,
+    vk::AccessFlagBits2::eShaderRead,
+    vk::ImageLayout::eShaderReadOnlyOptimal,
+    vk::ImageAspectFlagBits::eColor);
+
+  etna::flush_barriers(cmd);
+}
+
+void TextureUploader::uploadMips(
+  etna::Image& image, std::span<const std::vector<std::byte>> mips)
+{
+  const auto align = [](vk::DeviceSize size) {
+    return (size + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+  };
+
+  vk::DeviceSize totalSize = 0;
+  for (const auto& mip : mips)
+    totalSize += align(mip.size());
+
+  if (totalSize > segmentSize)
+  {
+    for (uint32_t mip = 0; mip < mips.size(); ++mip)
+      uploadMip(image, mip, mips[mip]);
+    finish(image, false);
+    return;
+  }
+
+  if (segments[currentSegment].recording && segmentSize - segmentOffset < totalSize)
+    submitSegment();
+  auto cmd = acquireSegment();
+
+  etna::set_state(
+    cmd,
+    image.get(),
+    vk::PipelineStageFlagBits2::eTransfer,
+    vk::AccessFlagBits2::eTransferWrite,
+    vk::ImageLayout::eTransferDstOptimal,
+    vk::ImageAspectFlagBits::eColor);
+  etna::flush_barriers(cmd);
+
+  const auto extent = image.getExtent();
+  std::vector<vk::BufferImageCopy> regions;
+  regions.reserve(mips.size());
+  for (uint32_t mip = 0; mip < mips.size(); ++mip)
+  {
+    const vk::DeviceSize offset = currentSegment * segmentSize + segmentOffset;
+    std::memcpy(stagingData + offset, mips[mip].data(), mips[mip].size());
+
+    regions.push_back(vk::BufferImageCopy{
+      .bufferOffset = offset,
+      .bufferRowLength = 0,
+      .bufferImageHeight = 0,
+      .imageSubresource = {vk::ImageAspectFlagBits::eColor, mip, 0, 1},
+      .imageOffset = {0, 0, 0},
+      .imageExtent = {std::max(extent.width >> mip, 1u), std::max(extent.height >> mip, 1u), 1},
+    });
+
+    segmentOffset += align(mips[mip].size());
+  }
+
+  cmd.copyBufferToImage(staging.get(), image.get(), vk::ImageLayout::eTransferDstOptimal, regions);
+  ++stats.copies;
+
+  finish(image, false);
+}
+
+void TextureUploader::submit()
+{
+  if (segments[currentSegment].recording)
+    submitSegment();
+}
+
+void TextureUploader::flush()
+{
+  submit();
+
+  for (auto& segment : segments)
+    waitSegment(segment);
+}
+
+void TextureUploader::reportMemory(GpuMemoryTracker::Collector& collector) const
+{
+  collector.add(GpuMemoryTracker::Category::eStaging, "TextureUploader::staging", staging);
+}
+
+vk::CommandBuffer TextureUploader::acquireSegment()
+{
+  auto& segment = segments[currentSegment];
+  if (!segment.recording)
+  {
+    waitSegment(segment);
+
+    ETNA_CHECK_VK_RESULT(segment.cmd->reset());
+    ETNA_CHECK_VK_RESULT(segment.cmd->begin(vk::CommandBufferBeginInfo{
+      .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+    }));
+
+    segment.recording = true;
+    segmentOffset = 0;
+  }
+
+  return segment.cmd.get();
+}
+
+void TextureUploader::submitSegment()
+{
+  auto& segment = segments[currentSegment];
+  ETNA_CHECK_VK_RESULT(segment.cmd->end());
+
+  const vk::CommandBuffer cmd = segment.cmd.get();
+  ETNA_CHECK_VK_RESULT(etna::get_context().getQueue().submit(
+    vk::SubmitInfo{
+      .commandBufferCount = 1,
+      .pCommandBuffers = &cmd,
+    },
+    segment.fence.get()));
+
+  segment.recording = false;
+  segment.inFlight = true;
+  ++stats.submits;
+
+  currentSegment = (currentSegment + 1) % static_cast<uint32_t>(segments.size());
+  segmentOffset = 0;
+}
+
+void TextureUploader::waitSegment(Segment& segment)
+{
+  if (!segment.inFlight)
+    return;
+
+  auto device = etna::get_context().getDevice();
+
+  const auto startTime = std::chrono::steady_clock::now();
+  ETNA_CHECK_VK_RESULT(device.waitForFences({segment.fence.get()}, vk::True, UINT64_MAX));
+  ETNA_CHECK_VK_RESULT(device.resetFences({segment.fence.get()}));
+  stats.waitMs +=
+    std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+  segment.inFlight = false;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include <etna/Vulkan.hpp>
+#include <etna/Buffer.hpp>
+#include <etna/Image.hpp>
+
+#include "render_utils/GpuMemoryTracker.hpp"
+
+
+/**
+ * Uploads many textures with few GPU round trips.
+ *
+ * Texels are copied into a persistently mapped staging ring, which is split into segments. The
+ * copies and mip generation of consecutive textures are recorded into the command buffer of the
+ * current segment, which is submitted once the segment is full. The CPU only waits when the ring
+ * wraps around onto a segment which is still in flight, so decoding the next textures overlaps
+ * with the GPU work. Textures larger than a segment are split by rows.
+ */
+class TextureUploader
+{
+public:
+  struct CreateInfo
+  {
+    vk::DeviceSize stagingSize = 64ULL << 20;
+    uint32_t segmentCount = 4;
+  };
+
+  explicit TextureUploader(CreateInfo info);
+  ~TextureUploader();
+
+  TextureUploader(const TextureUploader&) = delete;
+  TextureUploader& operator=(const TextureUploader&) = delete;
+
+  // Uploads tightly packed texels of mip 0 and generates the rest of the mips. The image is in
+  // the shader read only layout once the upload is flushed.
+  void upload(etna::Image& image, std::span<const std::byte> texels);
+
+  // Uploads tightly packed texels of a single mip, block compressed mips are split by block rows.
+  // Mip 0 must come first, as it transitions the whole image for the transfer.
+  void uploadMip(etna::Image& image, uint32_t mip, std::span<const std::byte> texels);
+
+  // Optionally generates mips from mip 0 and transitions the image for sampling
+  void finish(etna::Image& image, bool gen_mips);
+
+  // Uploads a whole prebuilt mip chain and transitions the image for sampling. The chain is copied
+  // with a single command when it fits into a segment.
+  void uploadMips(etna::Image& image, std::span<const std::vector<std::byte>> mips);
+
+  // Submits the pending work without waiting for it. Work submitted later to the same queue sees
+  // the uploaded images in the shader read only layout.
+  void submit();
+
+  // Submits the pending work and waits for all of it
+  void flush();
+
+  struct Stats
+  {
+    uint32_t submits = 0;
+    uint32_t copies = 0;
+    float waitMs = 0.0f;  // Time spent waiting for segments still in flight
+  };
+  Stats getStats() const { return stats; }
+
+  void reportMemory(GpuMemoryTracker::Collector& collector) const;
+
+private:
+  struct Segment
+  {
+    vk::UniqueCommandBuffer cmd;
+    vk::UniqueFence fence;
+    bool recording = false;
+    bool inFlight = false;
+  };
+
+  vk::CommandBuffer acquireSegment();
+  void submitSegment();
+  void waitSegment(Segment& segment);
+
+private:
+  vk::DeviceSize segmentSize;
+
+  etna::Buffer staging;
+  std::byte* stagingData;
+
+  vk::UniqueCommandPool commandPool;
+  std::vector<Segment> segments;
+
+  uint32_t currentSegment = 0;
+  vk::DeviceSize segmentOffset = 0;
+
+  Stats stats;
+};
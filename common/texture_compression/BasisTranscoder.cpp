@@ -0,0 +1,70 @@
+#include "BasisTranscoder.hpp"
+
+#include <mutex>
+
+#include <spdlog/spdlog.h>
+#include <basisu_transcoder.h>
+
+#include "BlockCompression.hpp"
+
+
+std::optional<TextureData> transcode_basis_ktx2(
+  std::span<const std::byte> data, std::string_view name, vk::Format rgba8_format, bool use_bc7)
+{
+  static std::once_flag initialized;
+  std::call_once(initialized, [] { basist::basisu_transcoder_init(); });
+
+  basist::ktx2_transcoder transcoder;
+  if (!transcoder.init(data.data(), static_cast<uint32_t>(data.size())))
+  {
+    spdlog::warn("Basis: '{}' is not a valid Basis Universal KTX2 file", name);
+    return std::nullopt;
+  }
+
+  if (transcoder.get_faces() != 1 || transcoder.get_layers() > 1)
+  {
+    spdlog::warn("Basis: '{}' is a cubemap or an array, which is not supported", name);
+    return std::nullopt;
+  }
+
+  if (!transcoder.start_transcoding())
+  {
+    spdlog::warn("Basis: failed to start transcoding '{}'", name);
+    return std::nullopt;
+  }
+
+  const auto targetFormat = use_bc7 ? basist::transcoder_texture_format::cTFBC7_RGBA
+                                    : basist::transcoder_texture_format::cTFRGBA32;
+
+  TextureData texture{
+    .format = rgba8_format,
+    .width = transcoder.get_width(),
+    .height = transcoder.get_height(),
+    .mips = {},
+  };
+  if (use_bc7)
+    texture.format = rgba8_format == vk::Format::eR8G8B8A8Srgb ? vk::Format::eBc7SrgbBlock
+                                                              : vk::Format::eBc7UnormBlock;
+
+  texture.mips.resize(transcoder.get_levels());
+  for (uint32_t level = 0; level < texture.mips.size(); ++level)
+  {
+    basist::ktx2_image_level_info info;
+    if (!transcoder.get_image_level_info(info, level, 0, 0))
+      return std::nullopt;
+
+    auto& mip = texture.mips[level];
+    mip.resize(get_mip_byte_size(texture.format, info.m_orig_width, info.m_orig_height));
+
+    // The output size is in blocks for BC formats and in pixels for uncompressed ones
+    const uint32_t outputSize =
+      use_bc7 ? info.m_total_blocks : info.m_orig_width * info.m_orig_height;
+    if (!transcoder.transcode_image_level(level, 0, 0, mip.data(), outputSize, targetFormat))
+    {
+      spdlog::warn("Basis: failed to transcode mip {} of '{}'", level, name);
+      return std::nullopt;
+    }
+  }
+
+  return texture;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <optional>
+#include <span>
+#include <string_view>
+
+#include "TextureData.hpp"
+
+
+/**
+ * Transcodes every mip of a KTX2 file with a Basis Universal payload (ETC1S or UASTC, as used by
+ * KHR_texture_basisu) into BC7 with the sRGB-ness of rgba8_format, or into rgba8_format itself
+ * when BC formats can't be sampled. Thread safe, so it is meant to be called from loader workers.
+ */
+std::optional<TextureData> transcode_basis_ktx2(
+  std::span<const std::byte> data, std::string_view name, vk::Format rgba8_format, bool use_bc7);
@@ -0,0 +1,423 @@
+#include "BlockCompression.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <etna/Assert.hpp>
+
+
+namespace
+{
+
+template <size_t N>
+using Color = std::array<float, N>;
+
+template <size_t N>
+struct Endpoints
+{
+  Color<N> low;
+  Color<N> high;
+};
+
+// Fits a line through the texels along their principal axis and returns the extreme points of
+// their projections onto it, slightly inset to reduce the error of the interior texels
+template <size_t N>
+Endpoints<N> fit_endpoints(const ColorBlock& block)
+{
+  Color<N> mean{};
+  for (const auto& texel : block)
+    for (size_t c = 0; c < N; ++c)
+      mean[c] += static_cast<float>(texel[c]) / 16.0f;
+
+  std::array<Color<N>, N> covariance{};
+  for (const auto& texel : block)
+    for (size_t a = 0; a < N; ++a)
+      for (size_t b = 0; b < N; ++b)
+        covariance[a][b] +=
+          (static_cast<float>(texel[a]) - mean[a]) * (static_cast<float>(texel[b]) - mean[b]);
+
+  // Power iteration converges quickly enough for a 4x4 block
+  Color<N> axis;
+  axis.fill(1.0f);
+  for (int iteration = 0; iteration < 8; ++iteration)
+  {
+    Color<N> next{};
+    for (size_t a = 0; a < N; ++a)
+      for (size_t b = 0; b < N; ++b)
+        next[a] += covariance[a][b] * axis[b];
+
+    float maxComponent = 0.0f;
+    for (float value : next)
+      maxComponent = std::max(maxComponent, std::abs(value));
+
+    if (maxComponent == 0.0f)
+      return {mean, mean};
+
+    for (size_t c = 0; c < N; ++c)
+      axis[c] = next[c] / maxComponent;
+  }
+
+  float length = 0.0f;
+  for (float value : axis)
+    length += value * value;
+  length = std::sqrt(length);
+  for (float& value : axis)
+    value /= length;
+
+  float minProjection = 0.0f;
+  float maxProjection = 0.0f;
+  for (const auto& texel : block)
+  {
+    float projection = 0.0f;
+    for (size_t c = 0; c < N; ++c)
+      projection += (static_cast<float>(texel[c]) - mean[c]) * axis[c];
+
+    minProjection = std::min(minProjection, projection);
+    maxProjection = std::max(maxProjection, projection);
+  }
+
+  const float inset = (maxProjection - minProjection) / 32.0f;
+  minProjection += inset;
+  maxProjection -= inset;
+
+  Endpoints<N> result;
+  for (size_t c = 0; c < N; ++c)
+  {
+    result.low[c] = std::clamp(mean[c] + axis[c] * minProjection, 0.0f, 255.0f);
+    result.high[c] = std::clamp(mean[c] + axis[c] * maxProjection, 0.0f, 255.0f);
+  }
+
+  return result;
+}
+
+template <size_t N, size_t M>
+uint32_t find_nearest(const std::array<uint8_t, 4>& texel, const std::array<Color<N>, M>& palette)
+{
+  uint32_t best = 0;
+  float bestError = std::numeric_limits<float>::max();
+  for (uint32_t i = 0; i < M; ++i)
+  {
+    float error = 0.0f;
+    for (size_t c = 0; c < N; ++c)
+    {
+      const float diff = static_cast<float>(texel[c]) - palette[i][c];
+      error += diff * diff;
+    }
+
+    if (error < bestError)
+    {
+      bestError = error;
+      best = i;
+    }
+  }
+
+  return best;
+}
+
+template <size_t BYTES>
+void store_le(std::span<std::byte> dst, uint64_t value)
+{
+  for (size_t i = 0; i < BYTES; ++i)
+    dst[i] = static_cast<std::byte>((value >> (8 * i)) & 0xff);
+}
+
+uint16_t pack_565(const Color<3>& color)
+{
+  const auto quantize = [](float value, float max) {
+    return static_cast<uint16_t>(std::lround(value * max / 255.0f));
+  };
+
+  return static_cast<uint16_t>(
+    (quantize(color[0], 31.0f) << 11) | (quantize(color[1], 63.0f) << 5) |
+    quantize(color[2], 31.0f));
+}
+
+Color<3> unpack_565(uint16_t packed)
+{
+  const uint32_t r = (packed >> 11) & 31;
+  const uint32_t g = (packed >> 5) & 63;
+  const uint32_t b = packed & 31;
+
+  return {
+    static_cast<float>((r << 3) | (r >> 2)),
+    static_cast<float>((g << 2) | (g >> 4)),
+    static_cast<float>((b << 3) | (b >> 2)),
+  };
+}
+
+// 128 bit little endian bit stream, as BC7 blocks are laid out
+class BitWriter
+{
+public:
+  void put(uint32_t value, uint32_t bit_count)
+  {
+    for (uint32_t i = 0; i < bit_count; ++i, ++position)
+      if ((value >> i) & 1)
+        bytes[position / 8] |= static_cast<uint8_t>(1 << (position % 8));
+  }
+
+  void store(std::span<std::byte, 16> dst) const
+  {
+    for (size_t i = 0; i < 16; ++i)
+      dst[i] = static_cast<std::byte>(bytes[i]);
+  }
+
+private:
+  std::array<uint8_t, 16> bytes{};
+  uint32_t position = 0;
+};
+
+constexpr std::array<uint32_t, 16> BC7_WEIGHTS_4 = {
+  0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+struct Bc7Endpoint
+{
+  std::array<uint8_t, 4> quantized;  // 7 bits per channel
+  uint8_t pBit;
+
+  uint8_t get(size_t channel) const
+  {
+    return static_cast<uint8_t>((quantized[channel] << 1) | pBit);
+  }
+};
+
+// Mode 6 endpoints are 7 bits per channel plus a p-bit shared by all channels
+Bc7Endpoint quantize_bc7_endpoint(const Color<4>& color)
+{
+  Bc7Endpoint best{};
+  float bestError = std::numeric_limits<float>::max();
+  for (uint8_t pBit = 0; pBit < 2; ++pBit)
+  {
+    Bc7Endpoint candidate{.quantized = {}, .pBit = pBit};
+    float error = 0.0f;
+    for (size_t c = 0; c < 4; ++c)
+    {
+      const auto q = std::clamp(std::lround((color[c] - pBit) / 2.0f), 0L, 127L);
+      candidate.quantized[c] = static_cast<uint8_t>(q);
+
+      const float diff = static_cast<float>(candidate.get(c)) - color[c];
+      error += diff * diff;
+    }
+
+    if (error < bestError)
+    {
+      bestError = error;
+      best = candidate;
+    }
+  }
+
+  return best;
+}
+
+size_t get_block_byte_size(vk::Format format)
+{
+  switch (format)
+  {
+  case vk::Format::eBc1RgbUnormBlock:
+  case vk::Format::eBc1RgbSrgbBlock:
+  case vk::Format::eBc1RgbaUnormBlock:
+  case vk::Format::eBc1RgbaSrgbBlock:
+  case vk::Format::eBc4UnormBlock:
+    return 8;
+  case vk::Format::eBc3UnormBlock:
+  case vk::Format::eBc3SrgbBlock:
+  case vk::Format::eBc5UnormBlock:
+  case vk::Format::eBc7UnormBlock:
+  case vk::Format::eBc7SrgbBlock:
+    return 16;
+  default:
+    return 0;
+  }
+}
+
+} // namespace
+
+void encode_bc1_block(const ColorBlock& block, std::span<std::byte, 8> dst)
+{
+  const auto [low, high] = fit_endpoints<3>(block);
+
+  uint16_t color0 = pack_565(high);
+  uint16_t color1 = pack_565(low);
+
+  // color0 > color1 selects the 4 color mode, equal endpoints only need index 0
+  if (color0 < color1)
+    std::swap(color0, color1);
+
+  uint32_t indices = 0;
+  if (color0 != color1)
+  {
+    const auto p0 = unpack_565(color0);
+    const auto p1 = unpack_565(color1);
+
+    std::array<Color<3>, 4> palette{p0, p1};
+    for (size_t c = 0; c < 3; ++c)
+    {
+      palette[2][c] = std::floor((2.0f * p0[c] + p1[c]) / 3.0f);
+      palette[3][c] = std::floor((p0[c] + 2.0f * p1[c]) / 3.0f);
+    }
+
+    for (uint32_t i = 0; i < 16; ++i)
+      indices |= find_nearest(block[i], palette) << (2 * i);
+  }
+
+  store_le<2>(dst.subspan(0, 2), color0);
+  store_le<2>(dst.subspan(2, 2), color1);
+  store_le<4>(dst.subspan(4, 4), indices);
+}
+
+void encode_bc3_block(const ColorBlock& block, std::span<std::byte, 16> dst)
+{
+  encode_bc4_block(block, 3, dst.subspan<0, 8>());
+  encode_bc1_block(block, dst.subspan<8, 8>());
+}
+
+void encode_bc4_block(const ColorBlock& block, uint32_t channel, std::span<std::byte, 8> dst)
+{
+  uint8_t red0 = 0;
+  uint8_t red1 = 255;
+  for (const auto& texel : block)
+  {
+    red0 = std::max(red0, texel[channel]);
+    red1 = std::min(red1, texel[channel]);
+  }
+
+  // red0 > red1 selects the mode with 6 interpolated values
+  uint64_t indices = 0;
+  if (red0 != red1)
+  {
+    std::array<Color<1>, 8> palette{};
+    palette[0][0] = red0;
+    palette[1][0] = red1;
+    for (uint32_t i = 2; i < 8; ++i)
+      palette[i][0] = static_cast<float>(((8 - i) * red0 + (i - 1) * red1) / 7);
+
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+      const std::array<uint8_t, 4> value = {block[i][channel], 0, 0, 0};
+      indices |= static_cast<uint64_t>(find_nearest(value, palette)) << (3 * i);
+    }
+  }
+
+  dst[0] = static_cast<std::byte>(red0);
+  dst[1] = static_cast<std::byte>(red1);
+  store_le<6>(dst.subspan(2, 6), indices);
+}
+
+void encode_bc5_block(const ColorBlock& block, std::span<std::byte, 16> dst)
+{
+  encode_bc4_block(block, 0, dst.subspan<0, 8>());
+  encode_bc4_block(block, 1, dst.subspan<8, 8>());
+}
+
+void encode_bc7_block(const ColorBlock& block, std::span<std::byte, 16> dst)
+{
+  const auto [low, high] = fit_endpoints<4>(block);
+
+  auto endpoint0 = quantize_bc7_endpoint(low);
+  auto endpoint1 = quantize_bc7_endpoint(high);
+
+  std::array<Color<4>, 16> palette;
+  for (size_t i = 0; i < 16; ++i)
+    for (size_t c = 0; c < 4; ++c)
+      palette[i][c] = static_cast<float>(
+        ((64 - BC7_WEIGHTS_4[i]) * endpoint0.get(c) + BC7_WEIGHTS_4[i] * endpoint1.get(c) + 32) >>
+        6);
+
+  std::array<uint32_t, 16> indices;
+  for (size_t i = 0; i < 16; ++i)
+    indices[i] = find_nearest(block[i], palette);
+
+  // The MSB of the first index is implicitly zero, flip the endpoints if it isn't
+  if (indices[0] >= 8)
+  {
+    std::swap(endpoint0, endpoint1);
+    for (auto& index : indices)
+      index = 15 - index;
+  }
+
+  BitWriter writer;
+  writer.put(1 << 6, 7);
+  for (size_t c = 0; c < 4; ++c)
+  {
+    writer.put(endpoint0.quantized[c], 7);
+    writer.put(endpoint1.quantized[c], 7);
+  }
+  writer.put(endpoint0.pBit, 1);
+  writer.put(endpoint1.pBit, 1);
+
+  writer.put(indices[0], 3);
+  for (size_t i = 1; i < 16; ++i)
+    writer.put(indices[i], 4);
+
+  writer.store(dst);
+}
+
+bool is_block_compressed(vk::Format format)
+{
+  return get_block_byte_size(format) != 0;
+}
+
+size_t get_mip_byte_size(vk::Format format, uint32_t width, uint32_t height)
+{
+  if (const size_t blockBytes = get_block_byte_size(format); blockBytes != 0)
+    return size_t{(width + 3) / 4} * ((height + 3) / 4) * blockBytes;
+
+  return size_t{width} * height * vk::blockSize(format);
+}
+
+std::vector<std::byte> compress_rgba8(
+  vk::Format format, std::span<const std::byte> texels, uint32_t width, uint32_t height)
+{
+  const size_t blockBytes = get_block_byte_size(format);
+  ETNA_VERIFY(blockBytes != 0);
+  ETNA_VERIFY(texels.size() == size_t{width} * height * 4);
+
+  std::vector<std::byte> result(get_mip_byte_size(format, width, height));
+
+  const uint32_t blocksX = (width + 3) / 4;
+  const uint32_t blocksY = (height + 3) / 4;
+  for (uint32_t by = 0; by < blocksY; ++by)
+  {
+    for (uint32_t bx = 0; bx < blocksX; ++bx)
+    {
+      ColorBlock block;
+      for (uint32_t i = 0; i < 16; ++i)
+      {
+        const uint32_t x = std::min(bx * 4 + i % 4, width - 1);
+        const uint32_t y = std::min(by * 4 + i / 4, height - 1);
+        const auto* texel = &texels[(size_t{y} * width + x) * 4];
+        for (size_t c = 0; c < 4; ++c)
+          block[i][c] = static_cast<uint8_t>(texel[c]);
+      }
+
+      const auto dst =
+        std::span(result).subspan((size_t{by} * blocksX + bx) * blockBytes, blockBytes);
+
+      switch (format)
+      {
+      case vk::Format::eBc1RgbUnormBlock:
+      case vk::Format::eBc1RgbSrgbBlock:
+      case vk::Format::eBc1RgbaUnormBlock:
+      case vk::Format::eBc1RgbaSrgbBlock:
+        encode_bc1_block(block, dst.first<8>());
+        break;
+      case vk::Format::eBc3UnormBlock:
+      case vk::Format::eBc3SrgbBlock:
+        encode_bc3_block(block, dst.first<16>());
+        break;
+      case vk::Format::eBc4UnormBlock:
+        encode_bc4_block(block, 0, dst.first<8>());
+        break;
+      case vk::Format::eBc5UnormBlock:
+        encode_bc5_block(block, dst.first<16>());
+        break;
+      default:
+        encode_bc7_block(block, dst.first<16>());
+        break;
+      }
+    }
+  }
+
+  return result;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <etna/Vulkan.hpp>
+
+
+/**
+ * CPU encoders for the BC formats used by material textures. They favour speed and simplicity
+ * over the last bit of quality: endpoints are fitted along the principal axis of each block and
+ * indices are chosen by the nearest palette entry. BC7 only uses mode 6, a single RGBA subset with
+ * 16 interpolation steps, which already beats BC1/BC3 noticeably on gradients.
+ */
+
+// 4x4 texels in row-major order, RGBA8
+using ColorBlock = std::array<std::array<uint8_t, 4>, 16>;
+
+void encode_bc1_block(const ColorBlock& block, std::span<std::byte, 8> dst);
+void encode_bc3_block(const ColorBlock& block, std::span<std::byte, 16> dst);
+void encode_bc4_block(const ColorBlock& block, uint32_t channel, std::span<std::byte, 8> dst);
+void encode_bc5_block(const ColorBlock& block, std::span<std::byte, 16> dst);
+void encode_bc7_block(const ColorBlock& block, std::span<std::byte, 16> dst);
+
+bool is_block_compressed(vk::Format format);
+
+// Size of a tightly packed mip in bytes, for both plain RGBA8 and the supported BC formats
+size_t get_mip_byte_size(vk::Format format, uint32_t width, uint32_t height);
+
+// Compresses tightly packed RGBA8 texels into one of the BC1/BC3/BC4/BC5/BC7 formats. Partial
+// blocks at the right and bottom edges replicate the edge texels.
+std::vector<std::byte> compress_rgba8(
+  vk::Format format, std::span<const std::byte> texels, uint32_t width, uint32_t height);
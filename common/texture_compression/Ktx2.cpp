@@ -0,0 +1,324 @@
+#include "Ktx2.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+
+#include <spdlog/spdlog.h>
+#include <fmt/std.h>
+#include <etna/Assert.hpp>
+
+#include "BlockCompression.hpp"
+
+
+namespace
+{
+
+constexpr std::array<uint8_t, 12> IDENTIFIER = {
+  0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+struct Header
+{
+  std::array<uint8_t, 12> identifier;
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t layerCount;
+  uint32_t faceCount;
+  uint32_t levelCount;
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset;
+  uint32_t dfdByteLength;
+  uint32_t kvdByteOffset;
+  uint32_t kvdByteLength;
+  uint64_t sgdByteOffset;
+  uint64_t sgdByteLength;
+};
+
+static_assert(sizeof(Header) == 80);
+
+struct LevelIndex
+{
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+// Khronos Data Format basic descriptor block, followed by its samples
+struct DfdBlockHeader
+{
+  uint32_t vendorAndDescriptorType;
+  uint16_t versionNumber;
+  uint16_t descriptorBlockSize;
+  uint8_t colorModel;
+  uint8_t colorPrimaries;
+  uint8_t transferFunction;
+  uint8_t flags;
+  std::array<uint8_t, 4> texelBlockDimension;
+  std::array<uint8_t, 8> bytesPlane;
+};
+
+struct DfdSample
+{
+  uint16_t bitOffset;
+  uint8_t bitLength;  // Minus one
+  uint8_t channelType;
+  std::array<uint8_t, 4> samplePosition;
+  uint32_t sampleLower;
+  uint32_t sampleUpper;
+};
+
+static_assert(sizeof(DfdBlockHeader) == 24 && sizeof(DfdSample) == 16);
+
+constexpr uint16_t DFD_VERSION_1_3 = 2;
+constexpr uint8_t DFD_PRIMARIES_BT709 = 1;
+constexpr uint8_t DFD_TRANSFER_LINEAR = 1;
+constexpr uint8_t DFD_TRANSFER_SRGB = 2;
+constexpr uint8_t DFD_SAMPLE_LINEAR = 1 << 4;
+
+struct FormatDescription
+{
+  uint8_t colorModel;
+  uint8_t blockBytes;
+  std::vector<DfdSample> samples;
+};
+
+DfdSample make_sample(uint16_t bit_offset, uint16_t bit_length, uint8_t channel_type)
+{
+  return DfdSample{
+    .bitOffset = bit_offset,
+    .bitLength = static_cast<uint8_t>(bit_length - 1),
+    .channelType = channel_type,
+    .samplePosition = {},
+    .sampleLower = 0,
+    .sampleUpper = UINT32_MAX,
+  };
+}
+
+bool is_srgb(vk::Format format)
+{
+  return format == vk::Format::eBc1RgbSrgbBlock || format == vk::Format::eBc1RgbaSrgbBlock ||
+    format == vk::Format::eBc3SrgbBlock || format == vk::Format::eBc7SrgbBlock;
+}
+
+FormatDescription describe_format(vk::Format format)
+{
+  // Alpha of sRGB formats is always linear
+  const uint8_t alpha = 15 | (is_srgb(format) ? DFD_SAMPLE_LINEAR : 0);
+
+  switch (format)
+  {
+  case vk::Format::eBc1RgbUnormBlock:
+  case vk::Format::eBc1RgbSrgbBlock:
+    return {128, 8, {make_sample(0, 64, 0)}};
+  case vk::Format::eBc1RgbaUnormBlock:
+  case vk::Format::eBc1RgbaSrgbBlock:
+    return {128, 8, {make_sample(0, 64, 1)}};
+  case vk::Format::eBc3UnormBlock:
+  case vk::Format::eBc3SrgbBlock:
+    return {130, 16, {make_sample(0, 64, alpha), make_sample(64, 64, 0)}};
+  case vk::Format::eBc4UnormBlock:
+    return {131, 8, {make_sample(0, 64, 0)}};
+  case vk::Format::eBc5UnormBlock:
+    return {132, 16, {make_sample(0, 64, 0), make_sample(64, 64, 1)}};
+  default:
+    return {134, 16, {make_sample(0, 128, 0)}};
+  }
+}
+
+template <typename T>
+bool read_pod(std::span<const std::byte> data, size_t offset, T& value)
+{
+  if (offset > data.size() || data.size() - offset < sizeof(T))
+    return false;
+
+  std::memcpy(&value, data.data() + offset, sizeof(T));
+  return true;
+}
+
+template <typename T>
+void write_pod(std::ostream& stream, const T& value)
+{
+  stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+} // namespace
+
+bool is_ktx2(std::span<const std::byte> data)
+{
+  Header header;
+  return read_pod(data, 0, header) && header.identifier == IDENTIFIER;
+}
+
+bool is_basis_ktx2(std::span<const std::byte> data)
+{
+  // Basis Universal payloads don't have a Vulkan format, they are transcoded into one at load time
+  Header header;
+  return read_pod(data, 0, header) && header.identifier == IDENTIFIER &&
+    header.vkFormat == static_cast<uint32_t>(vk::Format::eUndefined);
+}
+
+std::optional<TextureData> parse_ktx2(std::span<const std::byte> data, std::string_view name)
+{
+  Header header;
+  if (!read_pod(data, 0, header) || header.identifier != IDENTIFIER)
+  {
+    spdlog::warn("KTX2: '{}' is not a KTX2 file", name);
+    return std::nullopt;
+  }
+
+  TextureData texture{
+    .format = static_cast<vk::Format>(header.vkFormat),
+    .width = header.pixelWidth,
+    .height = header.pixelHeight,
+    .mips = {},
+  };
+
+  if (!is_block_compressed(texture.format) || header.supercompressionScheme != 0 ||
+      header.pixelDepth != 0 || header.layerCount != 0 || header.faceCount != 1 ||
+      header.levelCount == 0)
+  {
+    spdlog::warn(
+      "KTX2: '{}' uses unsupported features (format {}, supercompression {})",
+      name,
+      vk::to_string(texture.format),
+      header.supercompressionScheme);
+    return std::nullopt;
+  }
+
+  texture.mips.resize(header.levelCount);
+  for (uint32_t i = 0; i < header.levelCount; ++i)
+  {
+    LevelIndex level;
+    const size_t expectedSize = get_mip_byte_size(
+      texture.format, std::max(texture.width >> i, 1u), std::max(texture.height >> i, 1u));
+    if (!read_pod(data, sizeof(Header) + i * sizeof(LevelIndex), level) ||
+        level.byteLength != expectedSize || level.byteOffset > data.size() ||
+        data.size() - level.byteOffset < expectedSize)
+    {
+      spdlog::warn("KTX2: '{}' has a truncated or malformed mip {}", name, i);
+      return std::nullopt;
+    }
+
+    const auto mip = data.subspan(level.byteOffset, expectedSize);
+    texture.mips[i].assign(mip.begin(), mip.end());
+  }
+
+  return texture;
+}
+
+std::optional<TextureData> read_ktx2(const std::filesystem::path& path)
+{
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file)
+    return std::nullopt;
+
+  std::vector<std::byte> data(static_cast<size_t>(file.tellg()));
+  file.seekg(0);
+  file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+  if (!file)
+  {
+    spdlog::warn("KTX2: failed to read '{}'", path);
+    return std::nullopt;
+  }
+
+  return parse_ktx2(data, path.string());
+}
+
+bool write_ktx2(const std::filesystem::path& path, const TextureData& texture)
+{
+  ETNA_VERIFY(is_block_compressed(texture.format) && !texture.mips.empty());
+
+  const auto description = describe_format(texture.format);
+
+  const auto levelCount = static_cast<uint32_t>(texture.mips.size());
+  const auto dfdOffset = static_cast<uint32_t>(sizeof(Header) + levelCount * sizeof(LevelIndex));
+  const auto dfdLength = static_cast<uint32_t>(
+    sizeof(uint32_t) + sizeof(DfdBlockHeader) + description.samples.size() * sizeof(DfdSample));
+
+  // Mips are stored from the smallest to the largest one, so that streaming readers can show
+  // something early. Every mip is aligned to the block size.
+  std::vector<LevelIndex> levels(levelCount);
+  const uint64_t alignment = description.blockBytes;
+  uint64_t offset = dfdOffset + dfdLength;
+  for (uint32_t i = levelCount; i-- > 0;)
+  {
+    offset = (offset + alignment - 1) / alignment * alignment;
+    levels[i] = LevelIndex{
+      .byteOffset = offset,
+      .byteLength = texture.mips[i].size(),
+      .uncompressedByteLength = texture.mips[i].size(),
+    };
+    offset += texture.mips[i].size();
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file)
+  {
+    spdlog::warn("KTX2: failed to open '{}' for writing", path);
+    return false;
+  }
+
+  write_pod(
+    file,
+    Header{
+      .identifier = IDENTIFIER,
+      .vkFormat = static_cast<uint32_t>(texture.format),
+      .typeSize = 1,
+      .pixelWidth = texture.width,
+      .pixelHeight = texture.height,
+      .pixelDepth = 0,
+      .layerCount = 0,
+      .faceCount = 1,
+      .levelCount = levelCount,
+      .supercompressionScheme = 0,
+      .dfdByteOffset = dfdOffset,
+      .dfdByteLength = dfdLength,
+      .kvdByteOffset = 0,
+      .kvdByteLength = 0,
+      .sgdByteOffset = 0,
+      .sgdByteLength = 0,
+    });
+
+  for (const auto& level : levels)
+    write_pod(file, level);
+
+  write_pod(file, dfdLength);
+  write_pod(
+    file,
+    DfdBlockHeader{
+      .vendorAndDescriptorType = 0,
+      .versionNumber = DFD_VERSION_1_3,
+      .descriptorBlockSize = static_cast<uint16_t>(dfdLength - sizeof(uint32_t)),
+      .colorModel = description.colorModel,
+      .colorPrimaries = DFD_PRIMARIES_BT709,
+      .transferFunction = is_srgb(texture.format) ? DFD_TRANSFER_SRGB : DFD_TRANSFER_LINEAR,
+      .flags = 0,
+      .texelBlockDimension = {3, 3, 0, 0},
+      .bytesPlane = {description.blockBytes, 0, 0, 0, 0, 0, 0, 0},
+    });
+  for (const auto& sample : description.samples)
+    write_pod(file, sample);
+
+  for (uint32_t i = levelCount; i-- > 0;)
+  {
+    const auto padding = levels[i].byteOffset - static_cast<uint64_t>(file.tellp());
+    for (uint64_t j = 0; j < padding; ++j)
+      file.put(0);
+
+    file.write(
+      reinterpret_cast<const char*>(texture.mips[i].data()),
+      static_cast<std::streamsize>(texture.mips[i].size()));
+  }
+
+  if (!file)
+  {
+    spdlog::warn("KTX2: failed to write '{}'", path);
+    return false;
+  }
+
+  return true;
+}
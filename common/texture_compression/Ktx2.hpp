@@ -0,0 +1,24 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string_view>
+
+#include "TextureData.hpp"
+
+
+/**
+ * Minimal KTX2 support for 2D textures with a mip chain in one of the formats produced by
+ * compress_rgba8. Supercompression, arrays, cubemaps and key/value data are not supported. The
+ * format is taken from the vkFormat field of the header, the data format descriptor is only
+ * written for the sake of other tools. Basis Universal payloads go through transcode_basis_ktx2.
+ */
+std::optional<TextureData> read_ktx2(const std::filesystem::path& path);
+std::optional<TextureData> parse_ktx2(std::span<const std::byte> data, std::string_view name);
+bool write_ktx2(const std::filesystem::path& path, const TextureData& texture);
+
+bool is_ktx2(std::span<const std::byte> data);
+
+// KTX2 files with a Basis Universal payload, see transcode_basis_ktx2
+bool is_basis_ktx2(std::span<const std::byte> data);
@@ -0,0 +1,350 @@
+#include "MipChain.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numbers>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define MIP_CHAIN_USE_SSE 1
+#else
+#define MIP_CHAIN_USE_SSE 0
+#endif
+
+
+namespace
+{
+
+constexpr float KAISER_RADIUS = 3.0f;
+constexpr float KAISER_ALPHA = 4.0f;
+
+// RGBA float texels, 4 floats each
+struct Plane
+{
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<float> texels;
+
+  float* row(uint32_t y) { return texels.data() + size_t{y} * width * 4; }
+  const float* row(uint32_t y) const { return texels.data() + size_t{y} * width * 4; }
+};
+
+// Filter taps of every destination texel along one axis, tapCount per texel
+struct AxisWeights
+{
+  uint32_t tapCount = 0;
+  std::vector<uint32_t> indices;
+  std::vector<float> weights;
+};
+
+float srgb_to_linear(float value)
+{
+  return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+float linear_to_srgb(float value)
+{
+  return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+const std::array<float, 256>& get_srgb_to_linear_table()
+{
+  static const auto table = [] {
+    std::array<float, 256> result;
+    for (size_t i = 0; i < result.size(); ++i)
+      result[i] = srgb_to_linear(static_cast<float>(i) / 255.0f);
+    return result;
+  }();
+  return table;
+}
+
+float bessel_i0(float x)
+{
+  float sum = 1.0f;
+  float term = 1.0f;
+  for (int k = 1; k < 16; ++k)
+  {
+    const float factor = x / (2.0f * static_cast<float>(k));
+    term *= factor * factor;
+    sum += term;
+  }
+  return sum;
+}
+
+// Distance is in destination texels
+float evaluate_kernel(MipKernel kernel, float distance)
+{
+  const float t = std::abs(distance);
+
+  if (kernel == MipKernel::Box)
+    return t < 0.5f ? 1.0f : 0.0f;
+
+  if (t >= KAISER_RADIUS)
+    return 0.0f;
+
+  constexpr float PI = std::numbers::pi_v<float>;
+  const float sinc = t < 1e-5f ? 1.0f : std::sin(PI * t) / (PI * t);
+  const float ratio = t / KAISER_RADIUS;
+  return sinc * bessel_i0(KAISER_ALPHA * std::sqrt(1.0f - ratio * ratio)) /
+    bessel_i0(KAISER_ALPHA);
+}
+
+AxisWeights compute_axis_weights(uint32_t src_size, uint32_t dst_size, MipKernel kernel, bool wrap)
+{
+  const float scale = static_cast<float>(src_size) / static_cast<float>(dst_size);
+  const float support = (kernel == MipKernel::Box ? 0.5f : KAISER_RADIUS) * scale;
+
+  AxisWeights result;
+  result.tapCount = static_cast<uint32_t>(std::ceil(2.0f * support)) + 1;
+  result.indices.resize(size_t{dst_size} * result.tapCount);
+  result.weights.resize(size_t{dst_size} * result.tapCount);
+
+  const auto size = static_cast<int64_t>(src_size);
+  for (uint32_t dst = 0; dst < dst_size; ++dst)
+  {
+    const float center = (static_cast<float>(dst) + 0.5f) * scale;
+    const auto first = static_cast<int64_t>(std::floor(center - support));
+    const size_t base = size_t{dst} * result.tapCount;
+
+    float sum = 0.0f;
+    for (uint32_t tap = 0; tap < result.tapCount; ++tap)
+    {
+      const int64_t src = first + tap;
+      const float weight =
+        evaluate_kernel(kernel, (static_cast<float>(src) + 0.5f - center) / scale);
+
+      const int64_t address =
+        wrap ? (src % size + size) % size : std::clamp<int64_t>(src, 0, size - 1);
+      result.indices[base + tap] = static_cast<uint32_t>(address);
+      result.weights[base + tap] = weight;
+      sum += weight;
+    }
+
+    for (uint32_t tap = 0; tap < result.tapCount; ++tap)
+      result.weights[base + tap] /= sum;
+  }
+
+  return result;
+}
+
+// Runs func(begin, end) over [0, count) split into contiguous ranges, one per thread
+template <typename Func>
+void parallel_for(uint32_t count, uint32_t thread_count, const Func& func)
+{
+  // Spawning threads costs more than filtering a few rows of a small mip
+  constexpr uint32_t MIN_ROWS_PER_THREAD = 32;
+  thread_count = std::clamp(count / MIN_ROWS_PER_THREAD, 1u, std::max(thread_count, 1u));
+
+  if (thread_count == 1)
+  {
+    func(0u, count);
+    return;
+  }
+
+  std::vector<std::jthread> workers;
+  workers.reserve(thread_count);
+  for (uint32_t i = 0; i < thread_count; ++i)
+    workers.emplace_back(
+      [&func, begin = count * i / thread_count, end = count * (i + 1) / thread_count] {
+        func(begin, end);
+      });
+}
+
+void filter_horizontal(
+  const Plane& src, Plane& dst, const AxisWeights& axis, uint32_t row_begin, uint32_t row_end)
+{
+  for (uint32_t y = row_begin; y < row_end; ++y)
+  {
+    const float* srcRow = src.row(y);
+    float* dstRow = dst.row(y);
+
+    for (uint32_t x = 0; x < dst.width; ++x)
+    {
+      const uint32_t* indices = &axis.indices[size_t{x} * axis.tapCount];
+      const float* weights = &axis.weights[size_t{x} * axis.tapCount];
+
+      // A texel is exactly one SSE register
+#if MIP_CHAIN_USE_SSE
+      __m128 sum = _mm_setzero_ps();
+      for (uint32_t tap = 0; tap < axis.tapCount; ++tap)
+        sum = _mm_add_ps(
+          sum, _mm_mul_ps(_mm_loadu_ps(srcRow + indices[tap] * 4), _mm_set1_ps(weights[tap])));
+      _mm_storeu_ps(dstRow + x * 4, sum);
+#else
+      std::array<float, 4> sum{};
+      for (uint32_t tap = 0; tap < axis.tapCount; ++tap)
+        for (uint32_t c = 0; c < 4; ++c)
+          sum[c] += srcRow[indices[tap] * 4 + c] * weights[tap];
+      std::copy(sum.begin(), sum.end(), dstRow + x * 4);
+#endif
+    }
+  }
+}
+
+void filter_vertical(
+  const Plane& src, Plane& dst, const AxisWeights& axis, uint32_t row_begin, uint32_t row_end)
+{
+  const size_t rowFloats = size_t{dst.width} * 4;
+
+  for (uint32_t y = row_begin; y < row_end; ++y)
+  {
+    float* dstRow = dst.row(y);
+    std::fill_n(dstRow, rowFloats, 0.0f);
+
+    // Whole rows are accumulated at once, which keeps the loads contiguous
+    for (uint32_t tap = 0; tap < axis.tapCount; ++tap)
+    {
+      const float* srcRow = src.row(axis.indices[size_t{y} * axis.tapCount + tap]);
+      const float weight = axis.weights[size_t{y} * axis.tapCount + tap];
+
+      size_t i = 0;
+#if MIP_CHAIN_USE_SSE
+      const __m128 weights = _mm_set1_ps(weight);
+      for (; i < rowFloats; i += 4)
+        _mm_storeu_ps(
+          dstRow + i,
+          _mm_add_ps(_mm_loadu_ps(dstRow + i), _mm_mul_ps(_mm_loadu_ps(srcRow + i), weights)));
+#endif
+      for (; i < rowFloats; ++i)
+        dstRow[i] += srcRow[i] * weight;
+    }
+  }
+}
+
+Plane decode(std::span<const std::byte> texels, uint32_t width, uint32_t height, MipFilter filter)
+{
+  Plane plane{.width = width, .height = height, .texels = std::vector<float>(texels.size())};
+  const auto& srgbTable = get_srgb_to_linear_table();
+
+  for (size_t i = 0; i < texels.size(); ++i)
+  {
+    const auto value = static_cast<uint8_t>(texels[i]);
+
+    if (i % 4 == 3 || filter == MipFilter::Linear)
+      plane.texels[i] = static_cast<float>(value) / 255.0f;
+    else if (filter == MipFilter::Color)
+      plane.texels[i] = srgbTable[value];
+    else
+      // Same mapping as PerturbNormal, which decodes 128 as exactly zero
+      plane.texels[i] = (static_cast<float>(value) - 128.0f) / 127.0f;
+  }
+
+  return plane;
+}
+
+float get_alpha_coverage(const Plane& plane, float cutoff, float scale)
+{
+  size_t covered = 0;
+  for (size_t i = 3; i < plane.texels.size(); i += 4)
+    if (plane.texels[i] * scale > cutoff)
+      ++covered;
+
+  return static_cast<float>(covered) / static_cast<float>(plane.texels.size() / 4);
+}
+
+// Finds the smallest alpha scale which keeps the alpha test coverage of a mip at the target
+float fit_alpha_scale(const Plane& plane, float cutoff, float target_coverage)
+{
+  float low = 0.0f;
+  float high = 4.0f;
+  for (int iteration = 0; iteration < 10; ++iteration)
+  {
+    const float mid = 0.5f * (low + high);
+    if (get_alpha_coverage(plane, cutoff, mid) < target_coverage)
+      low = mid;
+    else
+      high = mid;
+  }
+  return high;
+}
+
+std::vector<std::byte> encode(const Plane& plane, MipFilter filter, float alpha_scale)
+{
+  const auto quantize = [](float value) {
+    return static_cast<std::byte>(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+  };
+
+  std::vector<std::byte> result(plane.texels.size());
+  for (size_t i = 0; i < plane.texels.size(); i += 4)
+  {
+    const float* texel = &plane.texels[i];
+
+    if (filter == MipFilter::Normal)
+    {
+      const float length =
+        std::sqrt(texel[0] * texel[0] + texel[1] * texel[1] + texel[2] * texel[2]);
+      for (size_t c = 0; c < 3; ++c)
+      {
+        const float unit = length > 0.0f ? texel[c] / length : (c == 2 ? 1.0f : 0.0f);
+        result[i + c] = quantize((unit * 127.0f + 128.0f) / 255.0f);
+      }
+    }
+    else
+    {
+      for (size_t c = 0; c < 3; ++c)
+        result[i + c] = quantize(filter == MipFilter::Color ? linear_to_srgb(texel[c]) : texel[c]);
+    }
+
+    result[i + 3] = quantize(texel[3] * alpha_scale);
+  }
+
+  return result;
+}
+
+} // namespace
+
+std::vector<std::vector<std::byte>> generate_mip_chain(
+  std::span<const std::byte> texels,
+  uint32_t width,
+  uint32_t height,
+  const MipChainSettings& settings)
+{
+  std::vector<std::vector<std::byte>> mips;
+  mips.emplace_back(texels.begin(), texels.end());
+
+  Plane current = decode(texels, width, height, settings.filter);
+
+  const bool keepCoverage = settings.alphaCutoff >= 0.0f;
+  const float targetCoverage =
+    keepCoverage ? get_alpha_coverage(current, settings.alphaCutoff, 1.0f) : 0.0f;
+
+  while (current.width > 1 || current.height > 1)
+  {
+    const uint32_t dstWidth = std::max(current.width / 2, 1u);
+    const uint32_t dstHeight = std::max(current.height / 2, 1u);
+
+    const auto horizontalWeights =
+      compute_axis_weights(current.width, dstWidth, settings.kernel, settings.wrap);
+    const auto verticalWeights =
+      compute_axis_weights(current.height, dstHeight, settings.kernel, settings.wrap);
+
+    // Separable filtering, first along rows and then along columns
+    Plane horizontal{
+      .width = dstWidth,
+      .height = current.height,
+      .texels = std::vector<float>(size_t{dstWidth} * current.height * 4),
+    };
+    parallel_for(current.height, settings.threadCount, [&](uint32_t begin, uint32_t end) {
+      filter_horizontal(current, horizontal, horizontalWeights, begin, end);
+    });
+
+    Plane next{
+      .width = dstWidth,
+      .height = dstHeight,
+      .texels = std::vector<float>(size_t{dstWidth} * dstHeight * 4),
+    };
+    parallel_for(dstHeight, settings.threadCount, [&](uint32_t begin, uint32_t end) {
+      filter_vertical(horizontal, next, verticalWeights, begin, end);
+    });
+
+    const float alphaScale =
+      keepCoverage ? fit_alpha_scale(next, settings.alphaCutoff, targetCoverage) : 1.0f;
+    mips.push_back(encode(next, settings.filter, alphaScale));
+
+    current = std::move(next);
+  }
+
+  return mips;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+
+enum class MipFilter
+{
+  // RGB is sRGB encoded and averaged in linear space
+  Color,
+  // All channels are averaged as is, e.g. metalness and roughness
+  Linear,
+  // RGB is a tangent space normal, which is renormalized after averaging
+  Normal,
+};
+
+enum class MipKernel
+{
+  // 2x2 average, matches what linear blits do
+  Box,
+  // Kaiser windowed sinc, keeps distant mips noticeably sharper without ringing much
+  Kaiser,
+};
+
+struct MipChainSettings
+{
+  MipFilter filter = MipFilter::Color;
+  MipKernel kernel = MipKernel::Kaiser;
+  // Texels outside of the image are fetched from the opposite edge, as for repeating samplers
+  bool wrap = true;
+  // Alpha test threshold whose coverage is kept the same in every mip, so that alpha tested
+  // foliage doesn't thin out in the distance. Negative values disable it.
+  float alphaCutoff = -1.0f;
+  // Rows of every mip are filtered on this many threads
+  uint32_t threadCount = 1;
+};
+
+// Builds the full mip chain of tightly packed RGBA8 texels. The first element is a copy of the
+// source texels. Every mip is filtered from the previous one in linear float precision and is
+// only quantized to RGBA8 on output, so rounding errors don't accumulate down the chain.
+std::vector<std::vector<std::byte>> generate_mip_chain(
+  std::span<const std::byte> texels,
+  uint32_t width,
+  uint32_t height,
+  const MipChainSettings& settings);
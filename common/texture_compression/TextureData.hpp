@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <etna/Vulkan.hpp>
+
+
+/**
+ * A 2D texture with its mip chain in host memory, as read from or written to a KTX2 file.
+ * Every mip is tightly packed, block compressed mips are made of whole 4x4 blocks.
+ */
+struct TextureData
+{
+  vk::Format format = vk::Format::eUndefined;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<std::vector<std::byte>> mips;
+};
@@ -1,18 +1,151 @@
 #include "EnvironmentManager.hpp"
 
-#include "render_utils/Utils.hpp"
-
 #include <etna/Etna.hpp>
 #include <etna/GlobalContext.hpp>
 #include <etna/PipelineManager.hpp>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <future>
+
+#include <glm/gtc/packing.hpp>
+#include <spdlog/spdlog.h>
+#include <fmt/std.h>
 #include <stb_image.h>
 
+
+namespace
+{
+
+// One region per mip, covering all layers, tightly packed in mip-major order
+std::vector<vk::BufferImageCopy> get_mip_copy_regions(
+  const IBLCache::Image& image, vk::DeviceSize& total_size)
+{
+  std::vector<vk::BufferImageCopy> regions;
+  total_size = 0;
+
+  for (uint32_t mip = 0; mip < image.mips; ++mip)
+  {
+    const uint32_t width = std::max(image.extent.width >> mip, 1U);
+    const uint32_t height = std::max(image.extent.height >> mip, 1U);
+
+    regions.push_back(vk::BufferImageCopy{
+      .bufferOffset = total_size,
+      .bufferRowLength = 0,
+      .bufferImageHeight = 0,
+      .imageSubresource =
+        vk::ImageSubresourceLayers{
+          .aspectMask = vk::ImageAspectFlagBits::eColor,
+          .mipLevel = mip,
+          .baseArrayLayer = 0,
+          .layerCount = image.layers,
+        },
+      .imageOffset = vk::Offset3D{0, 0, 0},
+      .imageExtent = vk::Extent3D{width, height, 1},
+    });
+
+    total_size += vk::DeviceSize{width} * height * image.layers * vk::blockSize(image.format);
+  }
+
+  return regions;
+}
+
+bool is_environment_format(vk::Format format)
+{
+  return format == vk::Format::eR32G32B32A32Sfloat || format == vk::Format::eR16G16B16A16Sfloat ||
+    format == vk::Format::eB10G11R11UfloatPack32 || format == vk::Format::eE5B9G9R9UfloatPack32;
+}
+
+vk::Format pick_environment_format(
+  vk::Format requested, vk::FormatFeatureFlags required_features, const char* image_name)
+{
+  ETNA_VERIFY(is_environment_format(requested));
+
+  const auto properties = etna::get_context().getPhysicalDevice().getFormatProperties(requested);
+  if ((properties.optimalTilingFeatures & required_features) == required_features)
+    return requested;
+
+  const auto fallback = EnvironmentManager::FALLBACK_ENVIRONMENT_FORMAT;
+  spdlog::warn(
+    "EnvironmentManager: {} can't be used for {}, falling back to {}",
+    vk::to_string(requested),
+    image_name,
+    vk::to_string(fallback));
+
+  return fallback;
+}
+
+// Packs RGBA32F texels into one of the environment formats.
+// Returns the mean relative luminance error introduced by the packing.
+float pack_environment_texels(
+  std::span<const float> rgba, vk::Format format, std::vector<std::byte>& packed)
+{
+  const size_t texelCount = rgba.size() / 4;
+  const size_t texelSize = vk::blockSize(format);
+  packed.resize(texelCount * texelSize);
+
+  const glm::vec3 luminanceWeights = {0.2126f, 0.7152f, 0.0722f};
+  double errorSum = 0.0;
+
+  for (size_t i = 0; i < texelCount; ++i)
+  {
+    const glm::vec4 texel = {rgba[4 * i + 0], rgba[4 * i + 1], rgba[4 * i + 2], rgba[4 * i + 3]};
+    std::byte* dst = packed.data() + i * texelSize;
+
+    glm::vec3 unpacked;
+    switch (format)
+    {
+    case vk::Format::eR16G16B16A16Sfloat: {
+      const glm::uint64 bits = glm::packHalf4x16(texel);
+      std::memcpy(dst, &bits, sizeof(bits));
+      unpacked = glm::vec3(glm::unpackHalf4x16(bits));
+      break;
+    }
+    case vk::Format::eB10G11R11UfloatPack32: {
+      const glm::uint32 bits = glm::packF2x11_1x10(glm::vec3(texel));
+      std::memcpy(dst, &bits, sizeof(bits));
+      unpacked = glm::unpackF2x11_1x10(bits);
+      break;
+    }
+    case vk::Format::eE5B9G9R9UfloatPack32: {
+      const glm::uint32 bits = glm::packF3x9_E1x5(glm::vec3(texel));
+      std::memcpy(dst, &bits, sizeof(bits));
+      unpacked = glm::unpackF3x9_E1x5(bits);
+      break;
+    }
+    default:
+      std::memcpy(dst, &texel, sizeof(texel));
+      unpacked = glm::vec3(texel);
+      break;
+    }
+
+    const float luminance = glm::dot(glm::vec3(texel), luminanceWeights);
+    const float error = std::abs(glm::dot(unpacked, luminanceWeights) - luminance);
+    errorSum += error / std::max(luminance, 1e-4f);
+  }
+
+  return texelCount > 0 ? static_cast<float>(errorSum / static_cast<double>(texelCount)) : 0.0f;
+}
+
+} // namespace
+
 EnvironmentManager::EnvironmentManager(const Info& info)
   : resolution(info.cubemapResolution)
   , prefilteredEnvMapMips(info.prefilteredEnvMapMips)
+  , equirectFormat(info.equirectFormat)
+  , cubemapFormat(info.cubemapFormat)
+  , prefilteredEnvMapFormat(info.prefilteredEnvMapFormat)
+  , irradianceBake(info.irradianceBake)
+  , validateIrradianceBake(info.validateIrradianceBake)
+  , prefilterMode(info.prefilterMode)
+  , cubemapMipGeneration(info.cubemapMipGeneration)
+  , cache(
+      info.cacheDirectory.empty() ? std::nullopt
+                                  : std::optional<IBLCache>(std::in_place, info.cacheDirectory))
+  , environmentMemoryBudget(info.environmentMemoryBudget)
   , oneShotCommands{etna::get_context().createOneShotCmdMgr()}
-  , transferHelper{etna::BlockingTransferHelper::CreateInfo{.stagingSize = 4096 * 4096 * 12}}
+  , transferHelper{etna::BlockingTransferHelper::CreateInfo{.stagingSize = 4096 * 2048 * 16}}
 {
 }
 
@@ -22,13 +155,39 @@ void EnvironmentManager::loadShaders() const
 
   etna::create_program(
     "bake_diffuse_irradiance", {DEMO_SHADERS_ROOT "bake_diffuse_irradiance.comp.spv"});
+  etna::create_program(
+    "bake_diffuse_irradiance_reduce",
+    {DEMO_SHADERS_ROOT "bake_diffuse_irradiance_reduce.comp.spv"});
 
   etna::create_program("prefilter_envmap", {DEMO_SHADERS_ROOT "prefilter_envmap.comp.spv"});
+  etna::create_program(
+    "prefilter_envmap_table", {DEMO_SHADERS_ROOT "prefilter_envmap_table.comp.spv"});
   etna::create_program("compute_env_brdf", {DEMO_SHADERS_ROOT "compute_env_brdf.comp.spv"});
 }
 
 void EnvironmentManager::allocateResources()
 {
+  using Feature = vk::FormatFeatureFlagBits;
+
+  const vk::FormatFeatureFlags sampled =
+    Feature::eSampledImage | Feature::eSampledImageFilterLinear;
+  const vk::FormatFeatureFlags cached = Feature::eTransferSrc | Feature::eTransferDst;
+
+  equirectFormat =
+    pick_environment_format(equirectFormat, sampled | Feature::eTransferDst, "environmentRect");
+
+  // Written by convert_cubemap.comp, then mipmapped by MipGenerator, which falls back to blits
+  cubemapFormat = pick_environment_format(
+    cubemapFormat,
+    sampled | cached | Feature::eStorageImage | Feature::eBlitSrc | Feature::eBlitDst,
+    "cubemap");
+
+  // Mip 0 is blitted from the cubemap, the rest are written by prefilter_envmap.comp
+  prefilteredEnvMapFormat = pick_environment_format(
+    prefilteredEnvMapFormat,
+    sampled | cached | Feature::eStorageImage | Feature::eBlitDst,
+    "prefilteredEnvMap");
+
   linearSamplerRepeat = etna::Sampler(etna::Sampler::CreateInfo{
     .filter = vk::Filter::eLinear,
     .addressMode = vk::SamplerAddressMode::eRepeat,
@@ -44,30 +203,83 @@ void EnvironmentManager::allocateResources()
     .minLod = 0.0f,
     .maxLod = 0.0f,
   });
+
+  prefilterSampleTable = build_prefilter_sample_table(
+    static_cast<uint32_t>(prefilteredEnvMapMips), resolution.x, getCubemapLayout().mips);
+
+  prefilterSampleBuffer = etna::get_context().createBuffer(etna::Buffer::CreateInfo{
+    .size = std::max<size_t>(prefilterSampleTable.samples.size(), 1) * sizeof(glm::vec4),
+    .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer,
+    .memoryUsage = VMA_MEMORY_USAGE_CPU_ONLY,
+    .name = "EnvironmentManager::prefilterSampleBuffer",
+  });
+
+  std::memcpy(
+    prefilterSampleBuffer.map(),
+    prefilterSampleTable.samples.data(),
+    prefilterSampleTable.samples.size() * sizeof(glm::vec4));
+  prefilterSampleBuffer.unmap();
 }
 
 void EnvironmentManager::setupPipelines()
 {
-  auto& pipelineManager = etna::get_context().getPipelineManager();
+  auto& ctx = etna::get_context();
+  auto& pipelineManager = ctx.getPipelineManager();
+
+  // The irradiance bake reduces its partial sums with subgroup arithmetic
+  auto propertiesChain = ctx.getPhysicalDevice()
+                           .getProperties2<
+                             vk::PhysicalDeviceProperties2,
+                             vk::PhysicalDeviceSubgroupProperties>();
+  const auto& subgroupProperties = propertiesChain.get<vk::PhysicalDeviceSubgroupProperties>();
+  ETNA_VERIFY(
+    (subgroupProperties.supportedOperations & vk::SubgroupFeatureFlagBits::eArithmetic) &&
+    (subgroupProperties.supportedStages & vk::ShaderStageFlagBits::eCompute));
 
   convertCubemapPipeline = pipelineManager.createComputePipeline("convert_cubemap", {});
 
   bakeDiffuseIrradianceSHPipeline =
     pipelineManager.createComputePipeline("bake_diffuse_irradiance", {});
+  bakeDiffuseIrradianceSHReducePipeline =
+    pipelineManager.createComputePipeline("bake_diffuse_irradiance_reduce", {});
 
   prefilterEnvMapPipeline = pipelineManager.createComputePipeline("prefilter_envmap", {});
+  prefilterEnvMapTablePipeline =
+    pipelineManager.createComputePipeline("prefilter_envmap_table", {});
   computeEnvBRDFPipeline = pipelineManager.createComputePipeline("compute_env_brdf", {});
+
+  mipGenerator = std::make_unique<MipGenerator>();
 }
 
 void EnvironmentManager::computeEnvBRDF()
 {
   auto& ctx = etna::get_context();
 
+  const vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eStorage |
+    vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc;
+
+  const IBLCache::Image layout{
+    .format = vk::Format::eR16G16Sfloat,
+    .extent = vk::Extent2D{ENV_BRDF_RESOLUTION.x, ENV_BRDF_RESOLUTION.y},
+  };
+
+  IBLCache::Key cacheKey = IBLCache::combine(BAKE_CACHE_VERSION, ENV_BRDF_RESOLUTION.x);
+  cacheKey = IBLCache::combine(cacheKey, ENV_BRDF_RESOLUTION.y);
+
+  if (cache)
+  {
+    if (auto entry = cache->load(cacheKey); entry && entry->images.size() == 1)
+    {
+      envBRDF = uploadImage(entry->images[0], "EnvironmentManager::envBRDF", usage);
+      return;
+    }
+  }
+
   envBRDF = ctx.createImage(etna::Image::CreateInfo{
     .extent = vk::Extent3D{ENV_BRDF_RESOLUTION.x, ENV_BRDF_RESOLUTION.y, 1},
     .name = "EnvironmentManager::envBRDF",
-    .format = vk::Format::eR16G16Sfloat,
-    .imageUsage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled,
+    .format = layout.format,
+    .imageUsage = usage,
   });
 
   auto cmdBuffer = oneShotCommands->start();
@@ -106,23 +318,290 @@ void EnvironmentManager::computeEnvBRDF()
 
   ETNA_CHECK_VK_RESULT(cmdBuffer.end());
   oneShotCommands->submitAndWait(std::move(cmdBuffer));
+
+  if (cache)
+    cache->store(cacheKey, IBLCache::Entry{.images = {downloadImage(envBRDF, layout)}});
+}
+
+size_t EnvironmentManager::addEnvironment(std::filesystem::path path)
+{
+  environments.push_back(EnvironmentSlot{.path = std::move(path)});
+  return environments.size() - 1;
+}
+
+void EnvironmentManager::requestEnvironment(size_t idx)
+{
+  auto& slot = environments[idx];
+  if (slot.environment || slot.pending.valid() || slot.failed)
+    return;
+
+  slot.requestTime = std::chrono::steady_clock::now();
+  slot.pending = std::async(
+    std::launch::async, [this, path = slot.path]() { return decodeEnvironment(path); });
+}
+
+void EnvironmentManager::waitForEnvironment(size_t idx)
+{
+  requestEnvironment(idx);
+
+  auto& slot = environments[idx];
+  if (slot.pending.valid())
+    finishLoading(slot);
+}
+
+bool EnvironmentManager::isEnvironmentLoading(size_t idx) const
+{
+  return environments[idx].pending.valid();
 }
 
-void EnvironmentManager::loadEnvironment(const std::filesystem::path& path)
+void EnvironmentManager::update()
+{
+  ++frameIdx;
+
+  // Uploading or baking still blocks on the GPU, so spread the finished loads over frames
+  for (auto& slot : environments)
+  {
+    if (
+      slot.pending.valid() &&
+      slot.pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+      finishLoading(slot);
+      break;
+    }
+  }
+
+  evictEnvironments();
+}
+
+EnvironmentManager::DecodedEnvironment EnvironmentManager::decodeEnvironment(
+  const std::filesystem::path& path) const
+{
+  DecodedEnvironment decoded;
+
+  if (cache)
+  {
+    decoded.cacheKey = getEnvironmentCacheKey(path);
+    decoded.cached = cache->load(decoded.cacheKey);
+    if (decoded.cached && decoded.cached->images.size() == 2 && decoded.cached->floats.size() == 27)
+      return decoded;
+
+    decoded.cached.reset();
+  }
+
+  int width, height, nrComponents;
+  float* data = stbi_loadf(path.string().c_str(), &width, &height, &nrComponents, 4);
+  if (data == nullptr)
+  {
+    spdlog::error("Failed to load environment '{}': {}", path, stbi_failure_reason());
+    return decoded;
+  }
+
+  decoded.width = static_cast<uint32_t>(width);
+  decoded.height = static_cast<uint32_t>(height);
+
+  // The CPU projection only needs the decoded equirect, so it stays off the main thread as well
+  if (irradianceBake == IrradianceBake::eCpu || validateIrradianceBake)
+    decoded.cpuIrradiance = project_irradiance_sh(data, decoded.width, decoded.height);
+
+  decoded.quantizationError = pack_environment_texels(
+    std::span(data, static_cast<size_t>(width) * height * 4U), equirectFormat, decoded.equirect);
+
+  stbi_image_free(data);
+
+  return decoded;
+}
+
+void EnvironmentManager::finishLoading(EnvironmentSlot& slot)
+{
+  const auto decoded = slot.pending.get();
+
+  float prefilterMs = -1.0f;
+  if (decoded.cached)
+  {
+    slot.environment = uploadEnvironment(*decoded.cached);
+  }
+  else if (!decoded.equirect.empty())
+  {
+    slot.environment = bakeEnvironment(slot.path, decoded, prefilterMs);
+  }
+  else
+  {
+    slot.failed = true;
+    return;
+  }
+
+  slot.lastUsedFrame = frameIdx;
+
+  const auto elapsed = std::chrono::duration<float, std::milli>(
+    std::chrono::steady_clock::now() - slot.requestTime);
+  spdlog::info(
+    "{} environment '{}' in {:.1f} ms, {:.1f} MiB resident",
+    decoded.cached ? "Loaded cached" : "Baked",
+    slot.path,
+    elapsed.count(),
+    static_cast<float>(getEnvironmentMemorySize()) / (1 << 20));
+
+  slot.loadStats = LoadStats{
+    .cached = decoded.cached.has_value(),
+    .loadMs = elapsed.count(),
+    .residentBytes = getEnvironmentMemorySize(),
+    .equirectFormat = equirectFormat,
+    .cubemapFormat = cubemapFormat,
+    .prefilteredEnvMapFormat = prefilteredEnvMapFormat,
+    .prefilterMode = prefilterMode,
+    .quantizationError = decoded.cached ? -1.0f : decoded.quantizationError,
+    .prefilterMs = prefilterMs,
+  };
+
+  if (!decoded.cached)
+  {
+    spdlog::info(
+      "Environment '{}' stored as {}, mean relative luminance error {:.2e}",
+      slot.path,
+      vk::to_string(equirectFormat),
+      decoded.quantizationError);
+  }
+}
+
+EnvironmentManager::Environment EnvironmentManager::uploadEnvironment(
+  const IBLCache::Entry& entry)
+{
+  const vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eSampled |
+    vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferSrc;
+
+  Environment environment;
+  environment.cubemap =
+    uploadImage(entry.images[0], "cubemap", usage, vk::ImageCreateFlagBits::eCubeCompatible);
+  environment.prefilteredEnvMap = uploadImage(
+    entry.images[1], "prefilteredEnvMap", usage, vk::ImageCreateFlagBits::eCubeCompatible);
+
+  std::copy_n(entry.floats.begin(), 27, environment.irradianceSHCoefficientArray.begin());
+  environment.irradianceSHCoefficientBuffer =
+    uploadDiffuseIrradiance(environment.irradianceSHCoefficientArray);
+
+  return environment;
+}
+
+EnvironmentManager::Environment EnvironmentManager::bakeEnvironment(
+  const std::filesystem::path& path, const DecodedEnvironment& decoded, float& prefilter_ms)
 {
   Environment environment;
-  environment.cubemap = loadCubemap(path);
+  environment.cubemap = loadCubemap(decoded.equirect, decoded.width, decoded.height);
+
+  if (irradianceBake == IrradianceBake::eGpu || validateIrradianceBake)
+  {
+    environment.irradianceSHCoefficientBuffer = bakeDiffuseIrradiance(environment.cubemap);
+
+    auto* src = environment.irradianceSHCoefficientBuffer.map();
+    auto* dst = environment.irradianceSHCoefficientArray.data();
+    std::memcpy(dst, src, 27 * sizeof(float));
+    environment.irradianceSHCoefficientBuffer.unmap();
+  }
+
+  if (decoded.cpuIrradiance)
+  {
+    const auto& coefficients = *decoded.cpuIrradiance;
 
-  environment.irradianceSHCoefficientBuffer = bakeDiffuseIrradiance(environment.cubemap);
+    if (validateIrradianceBake)
+    {
+      float maxError = 0.0f;
+      for (size_t i = 0; i < coefficients.size(); ++i)
+      {
+        const float gpu = environment.irradianceSHCoefficientArray[i];
+        const float error = std::abs(coefficients[i] - gpu) / std::max(std::abs(gpu), 1e-3f);
+        maxError = std::max(maxError, error);
+      }
 
-  auto* src = environment.irradianceSHCoefficientBuffer.map();
-  auto* dst = environment.irradianceSHCoefficientArray.data();
-  std::memcpy(dst, src, 27 * sizeof(float));
-  environment.irradianceSHCoefficientBuffer.unmap();
+      spdlog::info("Irradiance SH of '{}': max relative CPU/GPU difference {:.3e}", path, maxError);
+    }
 
-  environment.prefilteredEnvMap = prefilterEnvMap(environment.cubemap);
+    if (irradianceBake == IrradianceBake::eCpu)
+    {
+      environment.irradianceSHCoefficientArray = coefficients;
+      environment.irradianceSHCoefficientBuffer = uploadDiffuseIrradiance(coefficients);
+    }
+  }
 
-  environments.push_back(std::move(environment));
+  environment.prefilteredEnvMap = prefilterEnvMap(environment.cubemap, prefilter_ms);
+
+  if (cache)
+  {
+    const auto& coefficients = environment.irradianceSHCoefficientArray;
+    cache->store(
+      decoded.cacheKey,
+      IBLCache::Entry{
+        .images =
+          {
+            downloadImage(environment.cubemap, getCubemapLayout()),
+            downloadImage(environment.prefilteredEnvMap, getPrefilteredEnvMapLayout()),
+          },
+        .floats = std::vector<float>(coefficients.begin(), coefficients.end()),
+      });
+  }
+
+  return environment;
+}
+
+void EnvironmentManager::evictEnvironments()
+{
+  const vk::DeviceSize environmentSize = getEnvironmentMemorySize();
+
+  const auto residentCount = std::ranges::count_if(
+    environments, [](const EnvironmentSlot& slot) { return slot.environment.has_value(); });
+  vk::DeviceSize residentSize = static_cast<vk::DeviceSize>(residentCount) * environmentSize;
+
+  // Frames still in flight might be sampling an environment, so only evict ones older than that
+  const uint64_t framesInFlight = etna::get_context().getMainWorkCount();
+
+  while (residentSize > environmentMemoryBudget)
+  {
+    EnvironmentSlot* victim = nullptr;
+    for (auto& slot : environments)
+    {
+      if (
+        slot.environment && frameIdx - slot.lastUsedFrame > framesInFlight &&
+        (victim == nullptr || slot.lastUsedFrame < victim->lastUsedFrame))
+      {
+        victim = &slot;
+      }
+    }
+
+    if (victim == nullptr)
+      break;
+
+    spdlog::info("Evicting environment '{}'", victim->path);
+    victim->environment.reset();
+    residentSize -= environmentSize;
+  }
+}
+
+IBLCache::Image EnvironmentManager::getCubemapLayout() const
+{
+  return IBLCache::Image{
+    .format = cubemapFormat,
+    .extent = vk::Extent2D{resolution.x, resolution.y},
+    .layers = 6,
+    .mips = static_cast<uint32_t>(std::floor(std::log2(std::max(resolution.x, resolution.y)))) + 1,
+  };
+}
+
+IBLCache::Image EnvironmentManager::getPrefilteredEnvMapLayout() const
+{
+  auto layout = getCubemapLayout();
+  layout.format = prefilteredEnvMapFormat;
+  layout.mips = static_cast<uint32_t>(prefilteredEnvMapMips);
+  return layout;
+}
+
+vk::DeviceSize EnvironmentManager::getEnvironmentMemorySize() const
+{
+  vk::DeviceSize cubemapSize = 0;
+  get_mip_copy_regions(getCubemapLayout(), cubemapSize);
+
+  vk::DeviceSize prefilteredEnvMapSize = 0;
+  get_mip_copy_regions(getPrefilteredEnvMapLayout(), prefilteredEnvMapSize);
+
+  return cubemapSize + prefilteredEnvMapSize;
 }
 
 glm::uvec2 EnvironmentManager::getCubemapResolution() const
@@ -135,9 +614,20 @@ int32_t EnvironmentManager::getPrefilteredEnvMapMips() const
   return prefilteredEnvMapMips;
 }
 
-std::span<const EnvironmentManager::Environment> EnvironmentManager::getEnvironments() const
+const EnvironmentManager::Environment* EnvironmentManager::getEnvironment(size_t idx)
+{
+  auto& slot = environments[idx];
+  if (!slot.environment)
+    return nullptr;
+
+  slot.lastUsedFrame = frameIdx;
+  return &*slot.environment;
+}
+
+const EnvironmentManager::LoadStats* EnvironmentManager::getLoadStats(size_t idx) const
 {
-  return environments;
+  const auto& stats = environments[idx].loadStats;
+  return stats ? &*stats : nullptr;
 }
 
 etna::Image& EnvironmentManager::getEnvBRDF()
@@ -145,17 +635,39 @@ etna::Image& EnvironmentManager::getEnvBRDF()
   return envBRDF;
 }
 
-etna::Image EnvironmentManager::loadCubemap(const std::filesystem::path& path)
+void EnvironmentManager::reportMemory(GpuMemoryTracker::Collector& collector)
 {
-  int width, height, nrComponents;
-  float* data = stbi_loadf(path.string().c_str(), &width, &height, &nrComponents, 4);
+  using Category = GpuMemoryTracker::Category;
+
+  for (const auto& slot : environments)
+  {
+    if (!slot.environment.has_value())
+      continue;
+
+    const auto name = slot.path.filename().string();
+    collector.add(Category::eEnvironment, name + "::cubemap", slot.environment->cubemap);
+    collector.add(
+      Category::eEnvironment,
+      name + "::irradianceSH",
+      slot.environment->irradianceSHCoefficientBuffer);
+    collector.add(
+      Category::eEnvironment, name + "::prefilteredEnvMap", slot.environment->prefilteredEnvMap);
+  }
+
+  collector.add(Category::eEnvironment, "EnvironmentManager::envBRDF", envBRDF);
+  collector.add(
+    Category::eEnvironment, "EnvironmentManager::prefilterSampleBuffer", prefilterSampleBuffer);
+}
 
+etna::Image EnvironmentManager::loadCubemap(
+  std::span<const std::byte> equirect, uint32_t width, uint32_t height)
+{
   auto& ctx = etna::get_context();
 
   auto environmentRect = ctx.createImage(etna::Image::CreateInfo{
-    .extent = vk::Extent3D{static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1},
+    .extent = vk::Extent3D{width, height, 1},
     .name = "environmentRect",
-    .format = vk::Format::eR32G32B32A32Sfloat,
+    .format = equirectFormat,
     .imageUsage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc |
       vk::ImageUsageFlagBits::eTransferDst,
     .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
@@ -165,13 +677,12 @@ etna::Image EnvironmentManager::loadCubemap(const std::filesystem::path& path)
     .samples = vk::SampleCountFlagBits::e1,
   });
 
-  auto mips =
-    static_cast<uint32_t>(std::floor(std::log2(std::max(resolution.x, resolution.y)))) + 1;
+  const auto mips = getCubemapLayout().mips;
 
   auto cubemap = ctx.createImage(etna::Image::CreateInfo{
     .extent = vk::Extent3D{resolution.x, resolution.y, 1},
     .name = "cubemap",
-    .format = vk::Format::eR32G32B32A32Sfloat,
+    .format = cubemapFormat,
     .imageUsage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage |
       vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst,
     .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
@@ -183,16 +694,15 @@ etna::Image EnvironmentManager::loadCubemap(const std::filesystem::path& path)
     .flags = vk::ImageCreateFlagBits::eCubeCompatible,
   });
 
-  transferHelper.uploadImage(
-    *oneShotCommands,
-    environmentRect,
-    0,
-    0,
-    std::span<std::byte const>(
-      reinterpret_cast<const std::byte*>(data), width * height * 4U * sizeof(float)));
+  transferHelper.uploadImage(*oneShotCommands, environmentRect, 0, 0, equirect);
+
+  // Timestamps around the mip generation, for comparing MipGenerator methods
+  auto timestamps = etna::unwrap_vk_result(ctx.getDevice().createQueryPoolUnique(
+    vk::QueryPoolCreateInfo{.queryType = vk::QueryType::eTimestamp, .queryCount = 2}));
 
   auto cmdBuffer = oneShotCommands->start();
   ETNA_CHECK_VK_RESULT(cmdBuffer.begin(vk::CommandBufferBeginInfo{}));
+  cmdBuffer.resetQueryPool(timestamps.get(), 0, 2);
 
   auto programInfo = etna::get_shader_program("convert_cubemap");
   auto descriptorSet = etna::create_descriptor_set(
@@ -201,7 +711,8 @@ etna::Image EnvironmentManager::loadCubemap(const std::filesystem::path& path)
     {
       etna::Binding(
         0,
-        environmentRect.genBinding(linearSamplerRepeat.get(), vk::ImageLayout::eShaderReadOnlyOptimal)),
+        environmentRect.genBinding(
+          linearSamplerRepeat.get(), vk::ImageLayout::eShaderReadOnlyOptimal)),
 
       etna::Binding(
         1,
@@ -240,7 +751,11 @@ etna::Image EnvironmentManager::loadCubemap(const std::filesystem::path& path)
 
   cmdBuffer.dispatch((resolution.x + 15) / 16, (resolution.y + 15) / 16, 6);
 
-  generate_mips(cmdBuffer, cubemap, 6);
+  // Starts once convert_cubemap.comp is done, which the mip generation has to wait for anyway
+  cmdBuffer.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timestamps.get(), 0);
+  mipGenerator->generate(
+    cmdBuffer, cubemap, 6, MipGenerator::Filter::eLinear, cubemapMipGeneration);
+  cmdBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestamps.get(), 1);
 
   etna::set_state(
     cmdBuffer,
@@ -254,6 +769,25 @@ etna::Image EnvironmentManager::loadCubemap(const std::filesystem::path& path)
   ETNA_CHECK_VK_RESULT(cmdBuffer.end());
   oneShotCommands->submitAndWait(std::move(cmdBuffer));
 
+  std::array<uint64_t, 2> ticks{};
+  const auto result = ctx.getDevice().getQueryPoolResults(
+    timestamps.get(),
+    0,
+    2,
+    sizeof(ticks),
+    ticks.data(),
+    sizeof(uint64_t),
+    vk::QueryResultFlagBits::e64);
+
+  if (result == vk::Result::eSuccess)
+  {
+    const float periodMs = ctx.getPhysicalDevice().getProperties().limits.timestampPeriod * 1e-6f;
+    spdlog::info(
+      "Cubemap mips generated in {:.3f} ms on the GPU ({})",
+      static_cast<float>(ticks[1] - ticks[0]) * periodMs,
+      cubemapMipGeneration == MipGenerator::Method::eCompute ? "compute" : "blit");
+  }
+
   return cubemap;
 }
 
@@ -261,6 +795,9 @@ etna::Buffer EnvironmentManager::bakeDiffuseIrradiance(etna::Image& cubemap)
 {
   auto& ctx = etna::get_context();
 
+  const glm::uvec2 groups = (resolution + SH_BAKE_TILE_SIZE - 1U) / SH_BAKE_TILE_SIZE;
+  const uint32_t groupCount = groups.x * groups.y * 6U;
+
   auto coeffBuffer = ctx.createBuffer(etna::Buffer::CreateInfo{
     .size = 27 * sizeof(float),
     .bufferUsage =
@@ -269,42 +806,113 @@ etna::Buffer EnvironmentManager::bakeDiffuseIrradiance(etna::Image& cubemap)
     .name = "cubemapDiffuseIrradianceCoeffs",
   });
 
+  // 9 coefficients per workgroup, each padded to a vec4
+  auto partialSumsBuffer = ctx.createBuffer(etna::Buffer::CreateInfo{
+    .size = groupCount * 9U * sizeof(glm::vec4),
+    .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+    .name = "cubemapDiffuseIrradiancePartialSums",
+  });
+
   auto cmdBuffer = oneShotCommands->start();
   ETNA_CHECK_VK_RESULT(cmdBuffer.begin(vk::CommandBufferBeginInfo{}));
 
-  auto programInfo = etna::get_shader_program("bake_diffuse_irradiance");
-  auto descriptorSet = etna::create_descriptor_set(
-    programInfo.getDescriptorLayoutId(0),
-    cmdBuffer,
+  /* Project tiles of the cubemap onto SH */
+  {
+    auto programInfo = etna::get_shader_program("bake_diffuse_irradiance");
+    auto descriptorSet = etna::create_descriptor_set(
+      programInfo.getDescriptorLayoutId(0),
+      cmdBuffer,
+      {
+        etna::Binding(
+          0,
+          cubemap.genBinding(
+            pointSampler.get(),
+            vk::ImageLayout::eShaderReadOnlyOptimal,
+            etna::Image::ViewParams{
+              0,
+              1,
+              0,
+              6,
+              {},
+              vk::ImageViewType::eCube,
+            })),
+
+        etna::Binding(1, partialSumsBuffer.genBinding()),
+      });
+    etna::flush_barriers(cmdBuffer);
+
+    cmdBuffer.bindPipeline(
+      vk::PipelineBindPoint::eCompute, bakeDiffuseIrradianceSHPipeline.getVkPipeline());
+    cmdBuffer.bindDescriptorSets(
+      vk::PipelineBindPoint::eCompute,
+      bakeDiffuseIrradianceSHPipeline.getVkPipelineLayout(),
+      0,
+      {descriptorSet.getVkSet()},
+      {});
+
+    struct PushConstant
     {
-      etna::Binding(
-        0,
-        cubemap.genBinding(
-          pointSampler.get(),
-          vk::ImageLayout::eShaderReadOnlyOptimal,
-          etna::Image::ViewParams{
-            0,
-            1,
-            0,
-            6,
-            {},
-            vk::ImageViewType::eCube,
-          })),
+      glm::uvec2 resolution;
+      glm::vec2 invResolution;
+    } pushConst{
+      .resolution = resolution,
+      .invResolution = 1.0f / glm::vec2(resolution),
+    };
 
-      etna::Binding(1, coeffBuffer.genBinding()),
-    });
-  etna::flush_barriers(cmdBuffer);
+    cmdBuffer.pushConstants<PushConstant>(
+      programInfo.getPipelineLayout(), vk::ShaderStageFlagBits::eCompute, 0, {pushConst});
 
-  cmdBuffer.bindPipeline(
-    vk::PipelineBindPoint::eCompute, bakeDiffuseIrradianceSHPipeline.getVkPipeline());
-  cmdBuffer.bindDescriptorSets(
-    vk::PipelineBindPoint::eCompute,
-    bakeDiffuseIrradianceSHPipeline.getVkPipelineLayout(),
-    0,
-    {descriptorSet.getVkSet()},
+    cmdBuffer.dispatch(groups.x, groups.y, 6);
+  }
+
+  cmdBuffer.pipelineBarrier(
+    vk::PipelineStageFlagBits::eComputeShader,
+    vk::PipelineStageFlagBits::eComputeShader,
+    {},
+    vk::MemoryBarrier{
+      .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+      .dstAccessMask = vk::AccessFlagBits::eShaderRead,
+    },
+    {},
     {});
 
-  cmdBuffer.dispatch(1, 1, 1);
+  /* Reduce the partial sums and convolve with the cosine lobe */
+  {
+    auto programInfo = etna::get_shader_program("bake_diffuse_irradiance_reduce");
+    auto descriptorSet = etna::create_descriptor_set(
+      programInfo.getDescriptorLayoutId(0),
+      cmdBuffer,
+      {
+        etna::Binding(0, partialSumsBuffer.genBinding()),
+        etna::Binding(1, coeffBuffer.genBinding()),
+      });
+
+    cmdBuffer.bindPipeline(
+      vk::PipelineBindPoint::eCompute, bakeDiffuseIrradianceSHReducePipeline.getVkPipeline());
+    cmdBuffer.bindDescriptorSets(
+      vk::PipelineBindPoint::eCompute,
+      bakeDiffuseIrradianceSHReducePipeline.getVkPipelineLayout(),
+      0,
+      {descriptorSet.getVkSet()},
+      {});
+
+    cmdBuffer.pushConstants<uint32_t>(
+      programInfo.getPipelineLayout(), vk::ShaderStageFlagBits::eCompute, 0, {groupCount});
+
+    cmdBuffer.dispatch(1, 1, 1);
+  }
+
+  cmdBuffer.pipelineBarrier(
+    vk::PipelineStageFlagBits::eComputeShader,
+    vk::PipelineStageFlagBits::eHost,
+    {},
+    vk::MemoryBarrier{
+      .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+      .dstAccessMask = vk::AccessFlagBits::eHostRead,
+    },
+    {},
+    {});
 
   ETNA_CHECK_VK_RESULT(cmdBuffer.end());
   oneShotCommands->submitAndWait(std::move(cmdBuffer));
@@ -312,16 +920,32 @@ etna::Buffer EnvironmentManager::bakeDiffuseIrradiance(etna::Image& cubemap)
   return coeffBuffer;
 }
 
-etna::Image EnvironmentManager::prefilterEnvMap(etna::Image& cubemap)
+etna::Buffer EnvironmentManager::uploadDiffuseIrradiance(
+  const Environment::SHCoefficientArray& coefficients)
+{
+  auto coeffBuffer = etna::get_context().createBuffer(etna::Buffer::CreateInfo{
+    .size = 27 * sizeof(float),
+    .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer,
+    .memoryUsage = VMA_MEMORY_USAGE_CPU_ONLY,
+    .name = "cubemapDiffuseIrradianceCoeffs",
+  });
+
+  std::memcpy(coeffBuffer.map(), coefficients.data(), 27 * sizeof(float));
+  coeffBuffer.unmap();
+
+  return coeffBuffer;
+}
+
+etna::Image EnvironmentManager::prefilterEnvMap(etna::Image& cubemap, float& elapsed_ms)
 {
   auto& ctx = etna::get_context();
 
   auto prefilteredEnvMap = ctx.createImage(etna::Image::CreateInfo{
     .extent = vk::Extent3D{resolution.x, resolution.y, 1},
     .name = "prefilteredEnvMap",
-    .format = vk::Format::eR32G32B32A32Sfloat,
+    .format = prefilteredEnvMapFormat,
     .imageUsage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage |
-      vk::ImageUsageFlagBits::eTransferDst,
+      vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst,
     .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
     .tiling = vk::ImageTiling::eOptimal,
     .layers = 6U,
@@ -334,8 +958,12 @@ etna::Image EnvironmentManager::prefilterEnvMap(etna::Image& cubemap)
   auto cmdBuffer = oneShotCommands->start();
   ETNA_CHECK_VK_RESULT(cmdBuffer.begin(vk::CommandBufferBeginInfo{}));
 
-  auto programInfo = etna::get_shader_program("prefilter_envmap");
-  cmdBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, prefilterEnvMapPipeline.getVkPipeline());
+  const bool useSampleTable = prefilterMode == PrefilterMode::eSampleTable;
+  auto& pipeline = useSampleTable ? prefilterEnvMapTablePipeline : prefilterEnvMapPipeline;
+  auto programInfo =
+    etna::get_shader_program(useSampleTable ? "prefilter_envmap_table" : "prefilter_envmap");
+
+  cmdBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.getVkPipeline());
 
   etna::set_state(
     cmdBuffer,
@@ -392,63 +1020,91 @@ etna::Image EnvironmentManager::prefilterEnvMap(etna::Image& cubemap)
 
   /* Calculate others */
   for (int32_t mip = 1; mip < prefilteredEnvMapMips; ++mip) {
-    auto descriptorSet = etna::create_descriptor_set(
-      programInfo.getDescriptorLayoutId(0),
-      cmdBuffer,
-      {
-        etna::Binding(
-          0,
-          cubemap.genBinding(
-            linearSamplerRepeat.get(),
-            vk::ImageLayout::eShaderReadOnlyOptimal,
-            etna::Image::ViewParams{
-              0,
-              vk::RemainingMipLevels,
-              0,
-              vk::RemainingArrayLayers,
-              {},
-              vk::ImageViewType::eCube,
-            })),
+    std::vector<etna::Binding> bindings = {
+      etna::Binding(
+        0,
+        cubemap.genBinding(
+          linearSamplerRepeat.get(),
+          vk::ImageLayout::eShaderReadOnlyOptimal,
+          etna::Image::ViewParams{
+            0,
+            vk::RemainingMipLevels,
+            0,
+            vk::RemainingArrayLayers,
+            {},
+            vk::ImageViewType::eCube,
+          })),
 
-        etna::Binding(
-          1,
-          prefilteredEnvMap.genBinding(
-            linearSamplerRepeat.get(),
-            vk::ImageLayout::eGeneral,
-            etna::Image::ViewParams{
-              static_cast<uint32_t>(mip),
-              1,
-              0,
-              vk::RemainingArrayLayers,
-              {},
-              vk::ImageViewType::eCube,
-            })),
-      });
+      etna::Binding(
+        1,
+        prefilteredEnvMap.genBinding(
+          linearSamplerRepeat.get(),
+          vk::ImageLayout::eGeneral,
+          etna::Image::ViewParams{
+            static_cast<uint32_t>(mip),
+            1,
+            0,
+            vk::RemainingArrayLayers,
+            {},
+            vk::ImageViewType::eCube,
+          })),
+    };
+
+    if (useSampleTable)
+      bindings.emplace_back(2, prefilterSampleBuffer.genBinding());
+
+    auto descriptorSet = etna::create_descriptor_set(
+      programInfo.getDescriptorLayoutId(0), cmdBuffer, std::move(bindings));
 
     cmdBuffer.bindDescriptorSets(
       vk::PipelineBindPoint::eCompute,
-      prefilterEnvMapPipeline.getVkPipelineLayout(),
+      pipeline.getVkPipelineLayout(),
       0,
       {descriptorSet.getVkSet()},
       {});
 
     glm::uvec2 res = {resolution.x >> mip, resolution.y >> mip};
 
-    struct PushConstant
+    if (useSampleTable)
     {
-      glm::uvec2 resolution;
-      glm::vec2 invResolution;
-      int32_t mip;
-      float roughness;
-    } pushConst{
-      .resolution = res,
-      .invResolution = 1.0f / glm::vec2(res),
-      .mip = mip,
-      .roughness = static_cast<float>(mip) / (prefilteredEnvMapMips - 1.0f),
-    };
+      const auto& range = prefilterSampleTable.mips[static_cast<size_t>(mip)];
 
-    cmdBuffer.pushConstants<PushConstant>(
-      programInfo.getPipelineLayout(), vk::ShaderStageFlagBits::eCompute, 0, {pushConst});
+      struct PushConstant
+      {
+        glm::uvec2 resolution;
+        glm::vec2 invResolution;
+        uint32_t sampleOffset;
+        uint32_t sampleCount;
+        float invWeightSum;
+      } pushConst{
+        .resolution = res,
+        .invResolution = 1.0f / glm::vec2(res),
+        .sampleOffset = range.offset,
+        .sampleCount = range.count,
+        .invWeightSum = range.invWeightSum,
+      };
+
+      cmdBuffer.pushConstants<PushConstant>(
+        programInfo.getPipelineLayout(), vk::ShaderStageFlagBits::eCompute, 0, {pushConst});
+    }
+    else
+    {
+      struct PushConstant
+      {
+        glm::uvec2 resolution;
+        glm::vec2 invResolution;
+        int32_t mip;
+        float roughness;
+      } pushConst{
+        .resolution = res,
+        .invResolution = 1.0f / glm::vec2(res),
+        .mip = mip,
+        .roughness = static_cast<float>(mip) / (prefilteredEnvMapMips - 1.0f),
+      };
+
+      cmdBuffer.pushConstants<PushConstant>(
+        programInfo.getPipelineLayout(), vk::ShaderStageFlagBits::eCompute, 0, {pushConst});
+    }
 
     cmdBuffer.dispatch((res.x + 15) / 16, (res.y + 15) / 16, 6);
   }
@@ -464,7 +1120,158 @@ etna::Image EnvironmentManager::prefilterEnvMap(etna::Image& cubemap)
   etna::flush_barriers(cmdBuffer);
 
   ETNA_CHECK_VK_RESULT(cmdBuffer.end());
+
+  const auto startTime = std::chrono::steady_clock::now();
   oneShotCommands->submitAndWait(std::move(cmdBuffer));
+  const auto elapsed =
+    std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime);
+  elapsed_ms = elapsed.count();
+
+  spdlog::info(
+    "Prefiltered env map in {:.1f} ms ({})",
+    elapsed.count(),
+    useSampleTable ? "sample table" : "reference");
 
   return prefilteredEnvMap;
 }
+
+IBLCache::Key EnvironmentManager::getEnvironmentCacheKey(const std::filesystem::path& path) const
+{
+  IBLCache::Key key = IBLCache::hashFile(path);
+  key = IBLCache::combine(key, BAKE_CACHE_VERSION);
+  key = IBLCache::combine(key, resolution.x);
+  key = IBLCache::combine(key, resolution.y);
+  key = IBLCache::combine(key, static_cast<uint64_t>(prefilteredEnvMapMips));
+  key = IBLCache::combine(key, static_cast<uint64_t>(irradianceBake));
+  key = IBLCache::combine(key, static_cast<uint64_t>(prefilterMode));
+  key = IBLCache::combine(key, static_cast<uint64_t>(equirectFormat));
+  key = IBLCache::combine(key, static_cast<uint64_t>(cubemapFormat));
+  key = IBLCache::combine(key, static_cast<uint64_t>(prefilteredEnvMapFormat));
+  return key;
+}
+
+IBLCache::Image EnvironmentManager::downloadImage(
+  etna::Image& image, const IBLCache::Image& layout)
+{
+  vk::DeviceSize size;
+  const auto regions = get_mip_copy_regions(layout, size);
+
+  auto readbackBuffer = etna::get_context().createBuffer(etna::Buffer::CreateInfo{
+    .size = size,
+    .bufferUsage = vk::BufferUsageFlagBits::eTransferDst,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_TO_CPU,
+    .name = "iblCacheReadback",
+  });
+
+  auto cmdBuffer = oneShotCommands->start();
+  ETNA_CHECK_VK_RESULT(cmdBuffer.begin(vk::CommandBufferBeginInfo{}));
+
+  etna::set_state(
+    cmdBuffer,
+    image.get(),
+    vk::PipelineStageFlagBits2::eTransfer,
+    vk::AccessFlagBits2::eTransferRead,
+    vk::ImageLayout::eTransferSrcOptimal,
+    vk::ImageAspectFlagBits::eColor);
+  etna::flush_barriers(cmdBuffer);
+
+  cmdBuffer.copyImageToBuffer(
+    image.get(), vk::ImageLayout::eTransferSrcOptimal, readbackBuffer.get(), regions);
+
+  cmdBuffer.pipelineBarrier(
+    vk::PipelineStageFlagBits::eTransfer,
+    vk::PipelineStageFlagBits::eHost,
+    {},
+    vk::MemoryBarrier{
+      .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+      .dstAccessMask = vk::AccessFlagBits::eHostRead,
+    },
+    {},
+    {});
+
+  etna::set_state(
+    cmdBuffer,
+    image.get(),
+    vk::PipelineStageFlagBits2::eFragmentShader,
+    vk::AccessFlagBits2::eShaderSampledRead,
+    vk::ImageLayout::eShaderReadOnlyOptimal,
+    vk::ImageAspectFlagBits::eColor);
+  etna::flush_barriers(cmdBuffer);
+
+  ETNA_CHECK_VK_RESULT(cmdBuffer.end());
+  oneShotCommands->submitAndWait(std::move(cmdBuffer));
+
+  IBLCache::Image result = layout;
+  result.data.resize(size);
+  std::memcpy(result.data.data(), readbackBuffer.map(), size);
+  readbackBuffer.unmap();
+
+  return result;
+}
+
+etna::Image EnvironmentManager::uploadImage(
+  const IBLCache::Image& src,
+  const char* name,
+  vk::ImageUsageFlags usage,
+  vk::ImageCreateFlags flags)
+{
+  auto& ctx = etna::get_context();
+
+  vk::DeviceSize size;
+  const auto regions = get_mip_copy_regions(src, size);
+  ETNA_VERIFY(size == src.data.size());
+
+  auto image = ctx.createImage(etna::Image::CreateInfo{
+    .extent = vk::Extent3D{src.extent.width, src.extent.height, 1},
+    .name = name,
+    .format = src.format,
+    .imageUsage = usage | vk::ImageUsageFlagBits::eTransferDst,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+    .tiling = vk::ImageTiling::eOptimal,
+    .layers = src.layers,
+    .mipLevels = src.mips,
+    .samples = vk::SampleCountFlagBits::e1,
+    .type = vk::ImageType::e2D,
+    .flags = flags,
+  });
+
+  // All mips and layers go in a single copy, unlike BlockingTransferHelper which
+  // would submit and wait once per subresource
+  auto stagingBuffer = ctx.createBuffer(etna::Buffer::CreateInfo{
+    .size = size,
+    .bufferUsage = vk::BufferUsageFlagBits::eTransferSrc,
+    .memoryUsage = VMA_MEMORY_USAGE_CPU_ONLY,
+    .name = "iblCacheStaging",
+  });
+  std::memcpy(stagingBuffer.map(), src.data.data(), size);
+  stagingBuffer.unmap();
+
+  auto cmdBuffer = oneShotCommands->start();
+  ETNA_CHECK_VK_RESULT(cmdBuffer.begin(vk::CommandBufferBeginInfo{}));
+
+  etna::set_state(
+    cmdBuffer,
+    image.get(),
+    vk::PipelineStageFlagBits2::eTransfer,
+    vk::AccessFlagBits2::eTransferWrite,
+    vk::ImageLayout::eTransferDstOptimal,
+    vk::ImageAspectFlagBits::eColor);
+  etna::flush_barriers(cmdBuffer);
+
+  cmdBuffer.copyBufferToImage(
+    stagingBuffer.get(), image.get(), vk::ImageLayout::eTransferDstOptimal, regions);
+
+  etna::set_state(
+    cmdBuffer,
+    image.get(),
+    vk::PipelineStageFlagBits2::eFragmentShader,
+    vk::AccessFlagBits2::eShaderSampledRead,
+    vk::ImageLayout::eShaderReadOnlyOptimal,
+    vk::ImageAspectFlagBits::eColor);
+  etna::flush_barriers(cmdBuffer);
+
+  ETNA_CHECK_VK_RESULT(cmdBuffer.end());
+  oneShotCommands->submitAndWait(std::move(cmdBuffer));
+
+  return image;
+}
@@ -7,12 +7,21 @@
 #include <etna/ComputePipeline.hpp>
 #include <glm/glm.hpp>
 
+#include <chrono>
+#include <future>
+
+#include "render_utils/GpuMemoryTracker.hpp"
+#include "render_utils/MipGenerator.hpp"
+#include "IBLCache.hpp"
+#include "PrefilterSampleTable.hpp"
+#include "SHProjection.hpp"
+
 class EnvironmentManager
 {
 public:
   struct Environment
   {
-    using SHCoefficientArray = std::array<float, 27>;
+    using SHCoefficientArray = ::SHCoefficientArray;
 
     etna::Image cubemap;
 
@@ -25,14 +34,73 @@ public:
     etna::Image prefilteredEnvMap;
   };
 
+  enum class IrradianceBake
+  {
+    eGpu,  // bake_diffuse_irradiance.comp on the cubemap, read back through a mapped buffer
+    eCpu,  // project_irradiance_sh on the decoded equirect, runs alongside the GPU work
+  };
+
+  enum class PrefilterMode
+  {
+    eReference,    // prefilter_envmap.comp, 4096 GGX samples generated per texel for every mip
+    eSampleTable,  // prefilter_envmap_table.comp, precomputed samples with a per-mip count
+  };
+
   struct Info
   {
     glm::uvec2 cubemapResolution{512, 512};
     int32_t prefilteredEnvMapMips{6};
+    PrefilterMode prefilterMode{PrefilterMode::eSampleTable};
+
+    // Storage formats, one of eR32G32B32A32Sfloat, eR16G16B16A16Sfloat, eB10G11R11UfloatPack32 or
+    // eE5B9G9R9UfloatPack32. Formats the device can't use for an image fall back to RGBA16F.
+    vk::Format equirectFormat{vk::Format::eE5B9G9R9UfloatPack32};
+    vk::Format cubemapFormat{vk::Format::eR16G16B16A16Sfloat};
+    vk::Format prefilteredEnvMapFormat{vk::Format::eB10G11R11UfloatPack32};
+
+    IrradianceBake irradianceBake{IrradianceBake::eCpu};
+
+    // The GPU time of the cubemap mips is logged for every baked environment
+    MipGenerator::Method cubemapMipGeneration{MipGenerator::Method::eCompute};
+
+    // Bake irradiance both ways and log the difference between the two
+    bool validateIrradianceBake{false};
+
+    // Where baked environments and the env BRDF LUT are stored between runs, empty disables caching
+    std::filesystem::path cacheDirectory{GRAPHICS_COURSE_ROOT "/build/ibl_cache"};
+
+    // Environments that were not used for a while are evicted once the resident ones exceed this
+    vk::DeviceSize environmentMemoryBudget{256ULL << 20};
+  };
+
+  // How an environment was loaded, for comparing the storage formats and prefilter modes
+  struct LoadStats
+  {
+    bool cached = false;
+    float loadMs = 0.0f;
+    vk::DeviceSize residentBytes = 0;
+
+    // After the fallbacks of allocateResources
+    vk::Format equirectFormat = vk::Format::eUndefined;
+    vk::Format cubemapFormat = vk::Format::eUndefined;
+    vk::Format prefilteredEnvMapFormat = vk::Format::eUndefined;
+    PrefilterMode prefilterMode = PrefilterMode::eSampleTable;
+
+    // Only measured when baking, negative for cached environments
+    float quantizationError = -1.0f;
+    float prefilterMs = -1.0f;
   };
 
   constexpr static glm::uvec2 ENV_BRDF_RESOLUTION = {512, 512};
 
+  // Must match TILE_SIZE in bake_diffuse_irradiance.comp
+  constexpr static uint32_t SH_BAKE_TILE_SIZE = 32;
+
+  // Bump whenever any of the bake shaders changes its output, invalidates the whole cache
+  constexpr static uint32_t BAKE_CACHE_VERSION = 1;
+
+  constexpr static vk::Format FALLBACK_ENVIRONMENT_FORMAT = vk::Format::eR16G16B16A16Sfloat;
+
   explicit EnvironmentManager(const Info& info);
 
   void loadShaders() const;
@@ -40,22 +108,96 @@ public:
   void setupPipelines();
 
   void computeEnvBRDF();
-  void loadEnvironment(const std::filesystem::path& path);
+
+  // Environments are only registered up front and get loaded on the first request
+  size_t addEnvironment(std::filesystem::path path);
+
+  // Starts decoding the environment on a worker thread, unless it is resident or loading already
+  void requestEnvironment(size_t idx);
+  void waitForEnvironment(size_t idx);
+  bool isEnvironmentLoading(size_t idx) const;
+
+  // Finishes at most one background load and evicts environments over the budget.
+  // Must be called once per frame, before any getEnvironment.
+  void update();
 
   glm::uvec2 getCubemapResolution() const;
   int32_t getPrefilteredEnvMapMips() const;
 
-  std::span<const Environment> getEnvironments() const;
+  // Returns nullptr if the environment is not resident, otherwise marks it as used this frame
+  const Environment* getEnvironment(size_t idx);
+  // Returns nullptr until the environment has been loaded once
+  const LoadStats* getLoadStats(size_t idx) const;
   etna::Image& getEnvBRDF();
 
+  void reportMemory(GpuMemoryTracker::Collector& collector);
+
 private:
-  etna::Image loadCubemap(const std::filesystem::path& path);
+  // CPU side of loading an environment, produced on a worker thread
+  struct DecodedEnvironment
+  {
+    IBLCache::Key cacheKey = 0;
+    std::optional<IBLCache::Entry> cached;
+
+    // Already packed into equirectFormat
+    std::vector<std::byte> equirect;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    float quantizationError = 0.0f;
+    std::optional<SHCoefficientArray> cpuIrradiance;
+  };
+
+  struct EnvironmentSlot
+  {
+    std::filesystem::path path;
+    std::optional<Environment> environment;
+
+    std::future<DecodedEnvironment> pending;
+    std::chrono::steady_clock::time_point requestTime;
+    bool failed = false;
+    std::optional<LoadStats> loadStats;
+
+    uint64_t lastUsedFrame = 0;
+  };
+
+  DecodedEnvironment decodeEnvironment(const std::filesystem::path& path) const;
+  void finishLoading(EnvironmentSlot& slot);
+  Environment uploadEnvironment(const IBLCache::Entry& entry);
+  Environment bakeEnvironment(
+    const std::filesystem::path& path, const DecodedEnvironment& decoded, float& prefilter_ms);
+  void evictEnvironments();
+
+  IBLCache::Image getCubemapLayout() const;
+  IBLCache::Image getPrefilteredEnvMapLayout() const;
+  vk::DeviceSize getEnvironmentMemorySize() const;
+
+  etna::Image loadCubemap(std::span<const std::byte> equirect, uint32_t width, uint32_t height);
   etna::Buffer bakeDiffuseIrradiance(etna::Image& cubemap);
-  etna::Image prefilterEnvMap(etna::Image& cubemap);
+  etna::Buffer uploadDiffuseIrradiance(const Environment::SHCoefficientArray& coefficients);
+  etna::Image prefilterEnvMap(etna::Image& cubemap, float& elapsed_ms);
+
+  IBLCache::Key getEnvironmentCacheKey(const std::filesystem::path& path) const;
+  IBLCache::Image downloadImage(etna::Image& image, const IBLCache::Image& layout);
+  etna::Image uploadImage(
+    const IBLCache::Image& src,
+    const char* name,
+    vk::ImageUsageFlags usage,
+    vk::ImageCreateFlags flags = {});
 
 private:
   glm::uvec2 resolution;
   int32_t prefilteredEnvMapMips;
+  vk::Format equirectFormat;
+  vk::Format cubemapFormat;
+  vk::Format prefilteredEnvMapFormat;
+  IrradianceBake irradianceBake;
+  bool validateIrradianceBake;
+  PrefilterMode prefilterMode;
+  MipGenerator::Method cubemapMipGeneration;
+
+  std::optional<IBLCache> cache;
+  vk::DeviceSize environmentMemoryBudget;
+  uint64_t frameIdx = 0;
 
   std::unique_ptr<etna::OneShotCmdMgr> oneShotCommands;
   etna::BlockingTransferHelper transferHelper;
@@ -63,11 +205,17 @@ private:
   etna::Sampler linearSamplerRepeat;
   etna::Sampler pointSampler;
 
+  PrefilterSampleTable prefilterSampleTable;
+  etna::Buffer prefilterSampleBuffer;
+
   etna::ComputePipeline convertCubemapPipeline;
   etna::ComputePipeline bakeDiffuseIrradianceSHPipeline;
+  etna::ComputePipeline bakeDiffuseIrradianceSHReducePipeline;
   etna::ComputePipeline prefilterEnvMapPipeline;
+  etna::ComputePipeline prefilterEnvMapTablePipeline;
   etna::ComputePipeline computeEnvBRDFPipeline;
+  std::unique_ptr<MipGenerator> mipGenerator;
 
-  std::vector<Environment> environments;
+  std::vector<EnvironmentSlot> environments;
   etna::Image envBRDF;
 };
@@ -1,5 +1,8 @@
 #include "HiZPass.hpp"
 
+#include <array>
+#include <numeric>
+
 #include <etna/RenderTargetStates.hpp>
 #include <etna/GlobalContext.hpp>
 #include <etna/PipelineManager.hpp>
@@ -41,6 +44,16 @@ void HiZPass::allocateResources(glm::uvec2 target_resolution, uint32_t mip_level
 void HiZPass::setupPipelines()
 {
   pipeline = etna::get_context().getPipelineManager().createComputePipeline("hiz", {});
+
+  permutations = PipelinePermutations("hiz", DEMO_SHADERS_ROOT "hiz.comp.spv", ToggleCount);
+  std::array<uint32_t, 1U << ToggleCount> allToggles;
+  std::iota(allToggles.begin(), allToggles.end(), 0U);
+  permutations.prewarm(allToggles);
+}
+
+void HiZPass::waitPendingPipelines()
+{
+  permutations.waitPending();
 }
 
 etna::Image& HiZPass::getHiZ()
@@ -48,32 +61,25 @@ etna::Image& HiZPass::getHiZ()
   return hiz;
 }
 
+void HiZPass::addToGraph(FrameGraph& graph, etna::Image& depth)
+{
+  const auto depthId = graph.importImage("depth", depth.get(), vk::ImageAspectFlagBits::eDepth);
+  const auto hizId = graph.importImage("HiZ", hiz.get(), vk::ImageAspectFlagBits::eColor);
+
+  /* Every mip is transitioned to sampled right after it is written, the graph only sees the
+   * state of the whole image before and after the pass */
+  graph.addPass("HiZ", [this, &depth](vk::CommandBuffer cmd_buf) { execute(cmd_buf, depth); })
+    .read(depthId, FrameGraph::SAMPLED_COMPUTE)
+    .write(hizId, FrameGraph::STORAGE_WRITE_COMPUTE)
+    .leaves(hizId, FrameGraph::SAMPLED_COMPUTE)
+    .computeOnly();
+}
+
 void HiZPass::execute(vk::CommandBuffer cmds, etna::Image& depth)
 {
   ETNA_PROFILE_GPU(cmds, HiZPass);
 
   auto programInfo = etna::get_shader_program("hiz");
-  cmds.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.getVkPipeline());
-
-  /* Transition depth to sampled */
-  etna::set_state(
-    cmds,
-    depth.get(),
-    vk::PipelineStageFlagBits2::eComputeShader,
-    vk::AccessFlagBits2::eShaderSampledRead,
-    vk::ImageLayout::eShaderReadOnlyOptimal,
-    vk::ImageAspectFlagBits::eDepth);
-
-  /* Transition HiZ mips [0, mipLevels - 1] to compute shader write */
-  etna::set_state(
-    cmds,
-    hiz.get(),
-    vk::PipelineStageFlagBits2::eComputeShader,
-    vk::AccessFlagBits2::eShaderStorageWrite,
-    vk::ImageLayout::eGeneral,
-    vk::ImageAspectFlagBits::eColor);
-
-  etna::flush_barriers(cmds);
 
   for (uint32_t mip = 0; mip < mipLevels; ++mip)
   {
@@ -112,6 +118,15 @@ void HiZPass::execute(vk::CommandBuffer cmds, etna::Image& depth)
       },
       BarrierBehavoir::eSuppressBarriers);
 
+    bool extraSrcColumn = ((srcResolution.x & 1) != 0) && (srcResolution.x != 1);
+    bool extraSrcRow = ((srcResolution.y & 1) != 0) && (srcResolution.y != 1);
+
+    const uint32_t toggles = (static_cast<uint32_t>(mip == 0) << ToggleMip0) |
+      (static_cast<uint32_t>(extraSrcColumn) << ToggleExtraSrcColumn) |
+      (static_cast<uint32_t>(extraSrcRow) << ToggleExtraSrcRow);
+    cmds.bindPipeline(
+      vk::PipelineBindPoint::eCompute, permutations.get(toggles, pipeline.getVkPipeline()));
+
     cmds.bindDescriptorSets(
       vk::PipelineBindPoint::eCompute,
       pipeline.getVkPipelineLayout(),
@@ -119,9 +134,6 @@ void HiZPass::execute(vk::CommandBuffer cmds, etna::Image& depth)
       {descriptorSet.getVkSet()},
       {});
 
-    bool extraSrcColumn = ((srcResolution.x & 1) != 0) && (srcResolution.x != 1);
-    bool extraSrcRow = ((srcResolution.y & 1) != 0) && (srcResolution.y != 1);
-
     struct PushConstant
     {
       glm::ivec2 srcResolution;
@@ -172,11 +184,4 @@ void HiZPass::execute(vk::CommandBuffer cmds, etna::Image& depth)
       {},
       barrier);
   }
-
-  /* Set state explicitly for subsequent HiZ usages with auto state tracking system to be valid */
-  etna::set_state_external(
-    hiz.get(),
-    vk::PipelineStageFlagBits2::eComputeShader,
-    vk::AccessFlagBits2::eShaderSampledRead,
-    vk::ImageLayout::eShaderReadOnlyOptimal);
 }
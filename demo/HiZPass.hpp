@@ -5,6 +5,9 @@
 #include <etna/ComputePipeline.hpp>
 #include <glm/glm.hpp>
 
+#include "render_utils/FrameGraph.hpp"
+#include "render_utils/PipelinePermutations.hpp"
+
 
 class HiZPass
 {
@@ -14,16 +17,33 @@ public:
   void loadShaders();
   void allocateResources(glm::uvec2 target_resolution, uint32_t mip_levels);
   void setupPipelines();
+  void waitPendingPipelines();
 
   etna::Image& getHiZ();
 
-  void execute(vk::CommandBuffer cmd_buf, etna::Image& depth);
+  void addToGraph(FrameGraph& graph, etna::Image& depth);
 
 private:
   static constexpr size_t GROUP_SIZE = 8;
 
+  // Bits of the permutations, must match the specialization constants of hiz.comp
+  enum Toggle : uint32_t
+  {
+    ToggleMip0,
+    ToggleExtraSrcColumn,
+    ToggleExtraSrcRow,
+
+    ToggleCount
+  };
+
+private:
+  void execute(vk::CommandBuffer cmd_buf, etna::Image& depth);
+
 private:
   etna::ComputePipeline pipeline;
+  // Mips alternate between the permutations with the size of their source, so all of them are
+  // compiled upfront
+  PipelinePermutations permutations;
   etna::Image hiz;
   etna::Sampler sampler;
 
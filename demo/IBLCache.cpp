@@ -0,0 +1,194 @@
+#include "IBLCache.hpp"
+
+#include <array>
+#include <fstream>
+
+#include <spdlog/spdlog.h>
+#include <fmt/std.h>
+
+
+namespace
+{
+
+constexpr std::array<char, 4> MAGIC = {'I', 'B', 'L', 'C'};
+constexpr uint32_t CONTAINER_VERSION = 1;
+
+struct FileHeader
+{
+  std::array<char, 4> magic;
+  uint32_t version;
+  uint32_t imageCount;
+  uint32_t floatCount;
+};
+
+struct ImageHeader
+{
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t layers;
+  uint32_t mips;
+  uint32_t _pad0;
+  uint64_t byteSize;
+};
+
+template <typename T>
+bool read_pod(std::istream& stream, T& value)
+{
+  stream.read(reinterpret_cast<char*>(&value), sizeof(T));
+  return stream.good();
+}
+
+template <typename T>
+void write_pod(std::ostream& stream, const T& value)
+{
+  stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+} // namespace
+
+IBLCache::IBLCache(std::filesystem::path dir)
+  : directory(std::move(dir))
+{
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  if (error)
+    spdlog::warn("IBL cache: failed to create '{}': {}", directory, error.message());
+}
+
+IBLCache::Key IBLCache::hashFile(const std::filesystem::path& path)
+{
+  // FNV-1a
+  Key hash = 0xcbf29ce484222325ULL;
+
+  std::ifstream file(path, std::ios::binary);
+  std::vector<char> chunk(1 << 20);
+  while (file)
+  {
+    file.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+    const auto bytesRead = static_cast<size_t>(file.gcount());
+    for (size_t i = 0; i < bytesRead; ++i)
+    {
+      hash ^= static_cast<uint8_t>(chunk[i]);
+      hash *= 0x100000001b3ULL;
+    }
+  }
+
+  return hash;
+}
+
+IBLCache::Key IBLCache::combine(Key seed, uint64_t value)
+{
+  return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+std::optional<IBLCache::Entry> IBLCache::load(Key key) const
+{
+  std::ifstream file(getEntryPath(key), std::ios::binary);
+  if (!file)
+    return std::nullopt;
+
+  FileHeader header;
+  if (!read_pod(file, header) || header.magic != MAGIC || header.version != CONTAINER_VERSION)
+  {
+    spdlog::warn("IBL cache: entry {:016x} is corrupted or outdated, ignoring it", key);
+    return std::nullopt;
+  }
+
+  Entry entry;
+  entry.images.resize(header.imageCount);
+  for (auto& image : entry.images)
+  {
+    ImageHeader imageHeader;
+    if (!read_pod(file, imageHeader))
+      return std::nullopt;
+
+    image.format = static_cast<vk::Format>(imageHeader.format);
+    image.extent = vk::Extent2D{imageHeader.width, imageHeader.height};
+    image.layers = imageHeader.layers;
+    image.mips = imageHeader.mips;
+    image.data.resize(imageHeader.byteSize);
+
+    file.read(
+      reinterpret_cast<char*>(image.data.data()),
+      static_cast<std::streamsize>(imageHeader.byteSize));
+  }
+
+  entry.floats.resize(header.floatCount);
+  file.read(
+    reinterpret_cast<char*>(entry.floats.data()),
+    static_cast<std::streamsize>(entry.floats.size() * sizeof(float)));
+
+  if (!file)
+  {
+    spdlog::warn("IBL cache: entry {:016x} is truncated, ignoring it", key);
+    return std::nullopt;
+  }
+
+  return entry;
+}
+
+void IBLCache::store(Key key, const Entry& entry) const
+{
+  // Write to a temporary file first, so that an interrupted write never leaves a broken entry
+  const auto path = getEntryPath(key);
+  auto tmpPath = path;
+  tmpPath += ".tmp";
+
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+      spdlog::warn("IBL cache: failed to open '{}' for writing", tmpPath);
+      return;
+    }
+
+    write_pod(
+      file,
+      FileHeader{
+        .magic = MAGIC,
+        .version = CONTAINER_VERSION,
+        .imageCount = static_cast<uint32_t>(entry.images.size()),
+        .floatCount = static_cast<uint32_t>(entry.floats.size()),
+      });
+
+    for (const auto& image : entry.images)
+    {
+      write_pod(
+        file,
+        ImageHeader{
+          .format = static_cast<uint32_t>(image.format),
+          .width = image.extent.width,
+          .height = image.extent.height,
+          .layers = image.layers,
+          .mips = image.mips,
+          ._pad0 = 0,
+          .byteSize = image.data.size(),
+        });
+
+      file.write(
+        reinterpret_cast<const char*>(image.data.data()),
+        static_cast<std::streamsize>(image.data.size()));
+    }
+
+    file.write(
+      reinterpret_cast<const char*>(entry.floats.data()),
+      static_cast<std::streamsize>(entry.floats.size() * sizeof(float)));
+
+    if (!file)
+    {
+      spdlog::warn("IBL cache: failed to write '{}'", tmpPath);
+      return;
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tmpPath, path, error);
+  if (error)
+    spdlog::warn("IBL cache: failed to store entry {:016x}: {}", key, error.message());
+}
+
+std::filesystem::path IBLCache::getEntryPath(Key key) const
+{
+  return directory / fmt::format("{:016x}.iblc", key);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+#include <etna/Vulkan.hpp>
+
+
+/**
+ * On-disk cache for baked image based lighting data. Every entry is stored as a simple binary
+ * container holding a list of images (with all of their mips and layers) and a list of floats.
+ * Entries are addressed by a 64-bit key, which the user builds from everything the bake depends on.
+ */
+class IBLCache
+{
+public:
+  using Key = uint64_t;
+
+  struct Image
+  {
+    vk::Format format = vk::Format::eUndefined;
+    vk::Extent2D extent = {};
+    uint32_t layers = 1;
+    uint32_t mips = 1;
+
+    // Mip-major, each mip stores all of its layers tightly packed
+    std::vector<std::byte> data;
+  };
+
+  struct Entry
+  {
+    std::vector<Image> images;
+    std::vector<float> floats;
+  };
+
+  explicit IBLCache(std::filesystem::path directory);
+
+  static Key hashFile(const std::filesystem::path& path);
+  static Key combine(Key seed, uint64_t value);
+
+  std::optional<Entry> load(Key key) const;
+  void store(Key key, const Entry& entry) const;
+
+private:
+  std::filesystem::path getEntryPath(Key key) const;
+
+private:
+  std::filesystem::path directory;
+};
@@ -0,0 +1,105 @@
+#include "PrefilterSampleTable.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include <glm/gtc/constants.hpp>
+
+
+namespace
+{
+
+// Must match Hammersley in Random.glsl
+glm::vec2 hammersley(uint32_t i, uint32_t sample_count)
+{
+  uint32_t bits = i;
+  bits = (bits << 16U) | (bits >> 16U);
+  bits = ((bits & 0x55555555U) << 1U) | ((bits & 0xAAAAAAAAU) >> 1U);
+  bits = ((bits & 0x33333333U) << 2U) | ((bits & 0xCCCCCCCCU) >> 2U);
+  bits = ((bits & 0x0F0F0F0FU) << 4U) | ((bits & 0xF0F0F0F0U) >> 4U);
+  bits = ((bits & 0x00FF00FFU) << 8U) | ((bits & 0xFF00FF00U) >> 8U);
+
+  return {
+    static_cast<float>(bits) * 2.3283064365386963e-10f,
+    static_cast<float>(i) / static_cast<float>(sample_count),
+  };
+}
+
+// Must match NDF_TRGGX in PBR.glsl
+float ndf_trggx(float no_h, float roughness)
+{
+  const float alpha = roughness * roughness;
+  const float alpha2 = alpha * alpha;
+
+  const float denominator = no_h * no_h * (alpha2 - 1.0f) + 1.0f;
+  return alpha2 / (glm::pi<float>() * denominator * denominator);
+}
+
+} // namespace
+
+uint32_t get_prefilter_sample_count(float roughness)
+{
+  // The reference prefilter takes 4096 samples at any roughness
+  const auto count = static_cast<uint32_t>(1024.0f * roughness * roughness);
+  return std::clamp(std::bit_ceil(count), 16U, 1024U);
+}
+
+PrefilterSampleTable build_prefilter_sample_table(
+  uint32_t prefiltered_mips, uint32_t cubemap_resolution, uint32_t cubemap_mips)
+{
+  constexpr float PI = glm::pi<float>();
+
+  PrefilterSampleTable table;
+  table.mips.push_back({.offset = 0, .count = 0, .invWeightSum = 0.0f});
+
+  // Solid angle of a texel of the source cubemap mip 0
+  const float omegaTexel =
+    4.0f * PI / (6.0f * static_cast<float>(cubemap_resolution) * cubemap_resolution);
+  const float maxLod = static_cast<float>(cubemap_mips - 1);
+
+  for (uint32_t mip = 1; mip < prefiltered_mips; ++mip)
+  {
+    const float roughness = static_cast<float>(mip) / (static_cast<float>(prefiltered_mips) - 1.0f);
+    const float alpha2 = std::pow(roughness, 4.0f);
+    const uint32_t sampleCount = get_prefilter_sample_count(roughness);
+
+    PrefilterSampleTable::MipRange range{
+      .offset = static_cast<uint32_t>(table.samples.size()),
+      .count = 0,
+      .invWeightSum = 0.0f,
+    };
+
+    float weightSum = 0.0f;
+    for (uint32_t i = 0; i < sampleCount; ++i)
+    {
+      // Same as ImportanceSampleGGX in PBR.glsl with v == n == +z
+      const glm::vec2 uniformSample = hammersley(i, sampleCount);
+      const float phiH = 2.0f * PI * uniformSample.y;
+      const float cosThetaH =
+        std::sqrt((1.0f - uniformSample.x) / (1.0f + (alpha2 - 1.0f) * uniformSample.x));
+      const float sinThetaH = std::sqrt(1.0f - cosThetaH * cosThetaH);
+
+      const glm::vec3 h = {std::cos(phiH) * sinThetaH, std::sin(phiH) * sinThetaH, cosThetaH};
+      const glm::vec3 l = 2.0f * h.z * h - glm::vec3(0.0f, 0.0f, 1.0f);
+
+      const float noL = l.z;
+      if (noL <= 0.0f)
+        continue;
+
+      // Pick the source mip whose texels match the solid angle covered by the sample
+      const float pdf = ndf_trggx(cosThetaH, roughness) * cosThetaH / (4.0f * noL);
+      const float omegaSample = 1.0f / (pdf * static_cast<float>(sampleCount));
+      const float lod = std::clamp(0.5f * std::log2(omegaSample / omegaTexel), 0.0f, maxLod);
+
+      table.samples.emplace_back(l, lod);
+      weightSum += noL;
+      ++range.count;
+    }
+
+    range.invWeightSum = weightSum > 0.0f ? 1.0f / weightSum : 0.0f;
+    table.mips.push_back(range);
+  }
+
+  return table;
+}
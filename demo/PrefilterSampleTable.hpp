@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+
+/**
+ * Precomputed GGX importance samples for prefilter_envmap_table.comp. Every prefiltered mip gets
+ * its own range of samples, with fewer samples for lower roughness, since the lobe is narrow and
+ * each sample already reads from a prefiltered source mip covering its solid angle.
+ */
+struct PrefilterSampleTable
+{
+  struct MipRange
+  {
+    uint32_t offset;
+    uint32_t count;
+    float invWeightSum;
+  };
+
+  // xyz - light direction in tangent space (normal along +z, so NoL == z), w - source mip
+  std::vector<glm::vec4> samples;
+
+  // Indexed by the prefiltered env map mip, mip 0 is an empty range as it is a plain copy
+  std::vector<MipRange> mips;
+};
+
+uint32_t get_prefilter_sample_count(float roughness);
+
+PrefilterSampleTable build_prefilter_sample_table(
+  uint32_t prefiltered_mips, uint32_t cubemap_resolution, uint32_t cubemap_mips);
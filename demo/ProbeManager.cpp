@@ -0,0 +1,831 @@
+#include "ProbeManager.hpp"
+
+#include <bit>
+#include <cstring>
+
+#include <etna/GlobalContext.hpp>
+#include <etna/PipelineManager.hpp>
+#include <etna/Profiling.hpp>
+
+#include "scene/Camera.hpp"
+#include "shaders/CameraData.h"
+
+
+namespace
+{
+
+constexpr float STEP_COST_SMOOTHING = 0.1f;
+
+// Matches the SH bake tile of bake_diffuse_irradiance.comp
+constexpr uint32_t SH_BAKE_TILE_SIZE = 32;
+
+struct CaptureFace
+{
+  glm::vec3 forward;
+  glm::vec3 up;
+};
+
+// In the order of the cubemap layers
+constexpr std::array<CaptureFace, 6> CAPTURE_FACES = {{
+  {{+1.0f, 0.0f, 0.0f}, {0.0f, +1.0f, 0.0f}},
+  {{-1.0f, 0.0f, 0.0f}, {0.0f, +1.0f, 0.0f}},
+  {{0.0f, +1.0f, 0.0f}, {0.0f, 0.0f, -1.0f}},
+  {{0.0f, -1.0f, 0.0f}, {0.0f, 0.0f, +1.0f}},
+  {{0.0f, 0.0f, +1.0f}, {0.0f, +1.0f, 0.0f}},
+  {{0.0f, 0.0f, -1.0f}, {0.0f, +1.0f, 0.0f}},
+}};
+
+constexpr std::array STEP_KIND_NAMES = {
+  "Capture face",
+  "Generate mips",
+  "Prefilter mip 0",
+  "Prefilter mip 1",
+  "Prefilter mip 2",
+  "Prefilter mip 3",
+  "Prefilter mip 4",
+  "Bake SH",
+  "Publish",
+};
+
+static_assert(STEP_KIND_NAMES.size() == ProbeManager::STEP_KIND_COUNT);
+
+} // namespace
+
+ProbeManager::ProbeManager(Info info)
+  : probes(std::move(info.probes))
+  , gpuBudgetMs(info.gpuBudgetMs)
+  , timer(STEP_COUNT)
+  , recordedStepKinds(
+      etna::get_context().getMainWorkCount(), [](std::size_t) { return std::vector<uint32_t>{}; })
+{
+  ETNA_VERIFY(probes.size() <= MAX_PROBES);
+  stepCosts.fill(-1.0f);
+}
+
+void ProbeManager::allocateResources()
+{
+  auto& ctx = etna::get_context();
+
+  linearSampler = etna::Sampler(etna::Sampler::CreateInfo{
+    .filter = vk::Filter::eLinear,
+    .addressMode = vk::SamplerAddressMode::eRepeat,
+    .name = "ProbeManager::linearSampler",
+    .minLod = 0.0f,
+    .maxLod = vk::LodClampNone,
+  });
+
+  pointSampler = etna::Sampler(etna::Sampler::CreateInfo{
+    .filter = vk::Filter::eNearest,
+    .addressMode = vk::SamplerAddressMode::eRepeat,
+    .name = "ProbeManager::pointSampler",
+    .minLod = 0.0f,
+    .maxLod = 0.0f,
+  });
+
+  /* Capture */
+  const vk::Extent3D captureExtent{PROBE_RESOLUTION, PROBE_RESOLUTION, 1};
+
+  gBufferAlbedo = ctx.createImage(etna::Image::CreateInfo{
+    .extent = captureExtent,
+    .name = "ProbeManager::gBufferAlbedo",
+    .format = RenderView::GBUFFER_ALBEDO_FORMAT,
+    .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
+  });
+
+  gBufferMetalnessRoughness = ctx.createImage(etna::Image::CreateInfo{
+    .extent = captureExtent,
+    .name = "ProbeManager::gBufferMetalnessRoughness",
+    .format = RenderView::GBUFFER_METALNESS_ROUGHNESS_FORMAT,
+    .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
+  });
+
+  gBufferNorm = ctx.createImage(etna::Image::CreateInfo{
+    .extent = captureExtent,
+    .name = "ProbeManager::gBufferNorm",
+    .format = RenderView::GBUFFER_NORM_FORMAT,
+    .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
+  });
+
+  motionVectors = ctx.createImage(etna::Image::CreateInfo{
+    .extent = captureExtent,
+    .name = "ProbeManager::motionVectors",
+    .format = RenderView::MOTION_VECTORS_FORMAT,
+    .imageUsage = vk::ImageUsageFlagBits::eColorAttachment,
+  });
+
+  depth = ctx.createImage(etna::Image::CreateInfo{
+    .extent = captureExtent,
+    .name = "ProbeManager::depth",
+    .format = RenderView::DEPTH_FORMAT,
+    .imageUsage =
+      vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled,
+  });
+
+  captureTarget = ctx.createImage(etna::Image::CreateInfo{
+    .extent = captureExtent,
+    .name = "ProbeManager::captureTarget",
+    .format = RenderView::TARGET_FORMAT,
+    .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eStorage |
+      vk::ImageUsageFlagBits::eTransferSrc,
+  });
+
+  /* Relighting */
+  const auto radianceMips = static_cast<uint32_t>(std::bit_width(PROBE_RESOLUTION));
+
+  radianceCube = ctx.createImage(etna::Image::CreateInfo{
+    .extent = captureExtent,
+    .name = "ProbeManager::radianceCube",
+    .format = PROBE_FORMAT,
+    .imageUsage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage |
+      vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+    .tiling = vk::ImageTiling::eOptimal,
+    .layers = 6U,
+    .mipLevels = radianceMips,
+    .samples = vk::SampleCountFlagBits::e1,
+    .type = vk::ImageType::e2D,
+    .flags = vk::ImageCreateFlagBits::eCubeCompatible,
+  });
+
+  prefilteredCube = ctx.createImage(etna::Image::CreateInfo{
+    .extent = captureExtent,
+    .name = "ProbeManager::prefilteredCube",
+    .format = PROBE_FORMAT,
+    .imageUsage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferSrc |
+      vk::ImageUsageFlagBits::eTransferDst,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+    .tiling = vk::ImageTiling::eOptimal,
+    .layers = 6U,
+    .mipLevels = PROBE_MIPS,
+    .samples = vk::SampleCountFlagBits::e1,
+    .type = vk::ImageType::e2D,
+    .flags = vk::ImageCreateFlagBits::eCubeCompatible,
+  });
+
+  const uint32_t shGroups = (PROBE_RESOLUTION + SH_BAKE_TILE_SIZE - 1) / SH_BAKE_TILE_SIZE;
+
+  // 9 coefficients per workgroup, each padded to a vec4
+  irradianceSHPartialSums = ctx.createBuffer(etna::Buffer::CreateInfo{
+    .size = shGroups * shGroups * 6U * 9U * sizeof(glm::vec4),
+    .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+    .name = "ProbeManager::irradianceSHPartialSums",
+  });
+
+  irradianceSHScratch = ctx.createBuffer(etna::Buffer::CreateInfo{
+    .size = 27 * sizeof(float),
+    .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+    .name = "ProbeManager::irradianceSHScratch",
+  });
+
+  prefilterSampleTable = build_prefilter_sample_table(PROBE_MIPS, PROBE_RESOLUTION, radianceMips);
+
+  prefilterSampleBuffer = ctx.createBuffer(etna::Buffer::CreateInfo{
+    .size = std::max<size_t>(prefilterSampleTable.samples.size(), 1) * sizeof(glm::vec4),
+    .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer,
+    .memoryUsage = VMA_MEMORY_USAGE_CPU_ONLY,
+    .name = "ProbeManager::prefilterSampleBuffer",
+  });
+
+  std::memcpy(
+    prefilterSampleBuffer.map(),
+    prefilterSampleTable.samples.data(),
+    prefilterSampleTable.samples.size() * sizeof(glm::vec4));
+  prefilterSampleBuffer.unmap();
+
+  /* Published probes */
+  prefilteredAtlas = ctx.createImage(etna::Image::CreateInfo{
+    .extent = captureExtent,
+    .name = "ProbeManager::prefilteredAtlas",
+    .format = PROBE_FORMAT,
+    .imageUsage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+    .tiling = vk::ImageTiling::eOptimal,
+    .layers = 6U * MAX_PROBES,
+    .mipLevels = PROBE_MIPS,
+    .samples = vk::SampleCountFlagBits::e1,
+    .type = vk::ImageType::e2D,
+    .flags = vk::ImageCreateFlagBits::eCubeCompatible,
+  });
+
+  irradianceSHBuffer = ctx.createBuffer(etna::Buffer::CreateInfo{
+    .size = MAX_PROBES * 27 * sizeof(float),
+    .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+    .name = "ProbeManager::irradianceSHBuffer",
+  });
+
+  // xyz - position, w - radius
+  probeBuffer = ctx.createBuffer(etna::Buffer::CreateInfo{
+    .size = MAX_PROBES * sizeof(glm::vec4),
+    .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer,
+    .memoryUsage = VMA_MEMORY_USAGE_CPU_ONLY,
+    .name = "ProbeManager::probeBuffer",
+  });
+
+  uploadProbes();
+}
+
+void ProbeManager::setProbes(std::vector<Probe> new_probes)
+{
+  ETNA_VERIFY(new_probes.size() <= MAX_PROBES);
+  probes = std::move(new_probes);
+
+  currentProbe = 0;
+  currentStep = 0;
+  publishedMask = 0;
+
+  uploadProbes();
+}
+
+void ProbeManager::uploadProbes()
+{
+  auto& ctx = etna::get_context();
+
+  // Probes are static until they are replaced, so are the cameras of their faces
+  Camera faceCamera;
+  faceCamera.fov = 90.0f;
+  captureProj = faceCamera.projTm(1.0f);
+
+  faceCameras.clear();
+  faceCameras.reserve(probes.size() * 6);
+  for (size_t probeIdx = 0; probeIdx < probes.size(); ++probeIdx)
+  {
+    for (size_t face = 0; face < 6; ++face)
+    {
+      const auto& [forward, up] = CAPTURE_FACES[face];
+      faceCamera.lookAt(probes[probeIdx].position, probes[probeIdx].position + forward, up);
+
+      CameraData cameraData{};
+      cameraData.view = faceCamera.viewTm();
+      cameraData.proj = captureProj;
+      cameraData.projView = captureProj * cameraData.view;
+      cameraData.wsPos = faceCamera.position;
+      cameraData.wsForward = faceCamera.forward();
+      cameraData.wsRight = faceCamera.right();
+      cameraData.wsUp = faceCamera.up();
+      cameraData.jitterNDC = glm::vec2(0.0f);
+      cameraData.jitterPixels = glm::vec2(0.0f);
+
+      auto& buffer = faceCameras.emplace_back(ctx.createBuffer(etna::Buffer::CreateInfo{
+        .size = sizeof(CameraData),
+        .bufferUsage = vk::BufferUsageFlagBits::eUniformBuffer,
+        .memoryUsage = VMA_MEMORY_USAGE_CPU_ONLY,
+        .name = "ProbeManager::faceCamera[" + std::to_string(probeIdx) + "][" +
+          std::to_string(face) + "]",
+      }));
+
+      std::memcpy(buffer.map(), &cameraData, sizeof(cameraData));
+      buffer.unmap();
+    }
+  }
+
+  auto* probeData = reinterpret_cast<glm::vec4*>(probeBuffer.map());
+  for (size_t probeIdx = 0; probeIdx < probes.size(); ++probeIdx)
+    probeData[probeIdx] = glm::vec4(probes[probeIdx].position, probes[probeIdx].radius);
+  probeBuffer.unmap();
+}
+
+void ProbeManager::setupPipelines()
+{
+  // The programs are created by EnvironmentManager, probes are relit with the same shaders
+  auto& pipelineManager = etna::get_context().getPipelineManager();
+
+  prefilterPipeline = pipelineManager.createComputePipeline("prefilter_envmap_table", {});
+  bakeSHPipeline = pipelineManager.createComputePipeline("bake_diffuse_irradiance", {});
+  bakeSHReducePipeline =
+    pipelineManager.createComputePipeline("bake_diffuse_irradiance_reduce", {});
+
+  mipGenerator = std::make_unique<MipGenerator>();
+}
+
+void ProbeManager::execute(vk::CommandBuffer cmd_buf, const CaptureFn& capture)
+{
+  ETNA_PROFILE_GPU(cmd_buf, probeUpdate);
+
+  timer.beginFrame(cmd_buf);
+
+  // Results come back for the steps recorded the last time this frame slot was used
+  auto& stepKinds = recordedStepKinds.get();
+  const auto timings = timer.getResults();
+  if (timings.size() == stepKinds.size())
+  {
+    for (size_t i = 0; i < stepKinds.size(); ++i)
+    {
+      float& cost = stepCosts[stepKinds[i]];
+      cost = cost < 0.0f ? timings[i] : glm::mix(cost, timings[i], STEP_COST_SMOOTHING);
+    }
+  }
+  stepKinds.clear();
+
+  if (!enabled || probes.empty())
+    return;
+
+  // Always make progress, even if a single step does not fit into the budget
+  float plannedMs = 0.0f;
+  while (stepKinds.size() < STEP_COUNT)
+  {
+    const uint32_t kind = getStepKind(currentStep);
+
+    // Steps that were never measured are assumed to take the whole budget
+    const float cost = stepCosts[kind] < 0.0f ? gpuBudgetMs : stepCosts[kind];
+    if (!stepKinds.empty() && plannedMs + cost > gpuBudgetMs)
+      break;
+
+    const uint32_t scope = timer.begin(cmd_buf);
+    runStep(cmd_buf, currentStep, capture);
+    timer.end(cmd_buf, scope);
+
+    stepKinds.push_back(kind);
+    plannedMs += cost;
+
+    if (++currentStep == STEP_COUNT)
+    {
+      currentStep = 0;
+      currentProbe = (currentProbe + 1) % static_cast<uint32_t>(probes.size());
+    }
+  }
+}
+
+uint32_t ProbeManager::getProbeCount() const
+{
+  return static_cast<uint32_t>(probes.size());
+}
+
+uint32_t ProbeManager::getPublishedMask() const
+{
+  return publishedMask;
+}
+
+etna::Image& ProbeManager::getPrefilteredAtlas()
+{
+  return prefilteredAtlas;
+}
+
+etna::Buffer& ProbeManager::getIrradianceSHBuffer()
+{
+  return irradianceSHBuffer;
+}
+
+etna::Buffer& ProbeManager::getProbeBuffer()
+{
+  return probeBuffer;
+}
+
+void ProbeManager::reportMemory(GpuMemoryTracker::Collector& collector)
+{
+  using Category = GpuMemoryTracker::Category;
+
+  for (const auto& faceCamera : faceCameras)
+    collector.add(Category::ePasses, "ProbeManager::faceCamera", faceCamera);
+  collector.add(Category::ePasses, "ProbeManager::gBufferAlbedo", gBufferAlbedo);
+  collector.add(
+    Category::ePasses, "ProbeManager::gBufferMetalnessRoughness", gBufferMetalnessRoughness);
+  collector.add(Category::ePasses, "ProbeManager::gBufferNorm", gBufferNorm);
+  collector.add(Category::ePasses, "ProbeManager::motionVectors", motionVectors);
+  collector.add(Category::ePasses, "ProbeManager::depth", depth);
+  collector.add(Category::ePasses, "ProbeManager::captureTarget", captureTarget);
+
+  collector.add(Category::eEnvironment, "ProbeManager::radianceCube", radianceCube);
+  collector.add(Category::eEnvironment, "ProbeManager::prefilteredCube", prefilteredCube);
+  collector.add(
+    Category::eEnvironment, "ProbeManager::irradianceSHPartialSums", irradianceSHPartialSums);
+  collector.add(Category::eEnvironment, "ProbeManager::irradianceSHScratch", irradianceSHScratch);
+  collector.add(
+    Category::eEnvironment, "ProbeManager::prefilterSampleBuffer", prefilterSampleBuffer);
+  collector.add(Category::eEnvironment, "ProbeManager::prefilteredAtlas", prefilteredAtlas);
+  collector.add(Category::eEnvironment, "ProbeManager::irradianceSHBuffer", irradianceSHBuffer);
+  collector.add(Category::eEnvironment, "ProbeManager::probeBuffer", probeBuffer);
+}
+
+bool& ProbeManager::getEnabled()
+{
+  return enabled;
+}
+
+float& ProbeManager::getGpuBudgetMs()
+{
+  return gpuBudgetMs;
+}
+
+MipGenerator::Method& ProbeManager::getMipGeneration()
+{
+  return mipGeneration;
+}
+
+std::span<const float> ProbeManager::getStepCosts() const
+{
+  return stepCosts;
+}
+
+const char* ProbeManager::getStepKindName(uint32_t kind)
+{
+  return STEP_KIND_NAMES[kind];
+}
+
+uint32_t ProbeManager::getStepKind(uint32_t step)
+{
+  return step < STEP_GENERATE_MIPS ? 0 : step - STEP_GENERATE_MIPS + 1;
+}
+
+void ProbeManager::runStep(vk::CommandBuffer cmd_buf, uint32_t step, const CaptureFn& capture)
+{
+  if (step < STEP_GENERATE_MIPS)
+    captureFace(cmd_buf, step - STEP_CAPTURE_FIRST, capture);
+  else if (step == STEP_GENERATE_MIPS)
+    generateMips(cmd_buf);
+  else if (step < STEP_BAKE_SH)
+    prefilterMip(cmd_buf, step - STEP_PREFILTER_FIRST);
+  else if (step == STEP_BAKE_SH)
+    bakeIrradianceSH(cmd_buf);
+  else
+    publish(cmd_buf);
+}
+
+void ProbeManager::captureFace(vk::CommandBuffer cmd_buf, uint32_t face, const CaptureFn& capture)
+{
+  ETNA_PROFILE_GPU(cmd_buf, probeCaptureFace);
+
+  // The probe is static, so the previous camera is the current one and motion is zero
+  auto& camera = faceCameras[currentProbe * 6 + face];
+
+  capture(
+    cmd_buf,
+    RenderView{
+      .extent = {PROBE_RESOLUTION, PROBE_RESOLUTION},
+      .prevCamera = camera,
+      .currCamera = camera,
+      .proj = captureProj,
+      .gBufferAlbedo = &gBufferAlbedo,
+      .gBufferMetalnessRoughness = &gBufferMetalnessRoughness,
+      .gBufferNorm = &gBufferNorm,
+      .motionVectors = motionVectors,
+      .depth = depth,
+      .target = captureTarget,
+      .sampleProbes = false,
+    });
+
+  etna::set_state(
+    cmd_buf,
+    captureTarget.get(),
+    vk::PipelineStageFlagBits2::eTransfer,
+    vk::AccessFlagBits2::eTransferRead,
+    vk::ImageLayout::eTransferSrcOptimal,
+    vk::ImageAspectFlagBits::eColor);
+
+  etna::set_state(
+    cmd_buf,
+    radianceCube.get(),
+    vk::PipelineStageFlagBits2::eTransfer,
+    vk::AccessFlagBits2::eTransferWrite,
+    vk::ImageLayout::eTransferDstOptimal,
+    vk::ImageAspectFlagBits::eColor);
+
+  etna::flush_barriers(cmd_buf);
+
+  // Screen space x of the capture runs opposite to the cubemap face u, hence the mirrored blit
+  constexpr auto RES = static_cast<int32_t>(PROBE_RESOLUTION);
+
+  vk::ImageBlit blit;
+  blit.srcOffsets[0] = vk::Offset3D{0, 0, 0};
+  blit.srcOffsets[1] = vk::Offset3D{RES, RES, 1};
+  blit.dstOffsets[0] = vk::Offset3D{RES, 0, 0};
+  blit.dstOffsets[1] = vk::Offset3D{0, RES, 1};
+  blit.setSrcSubresource({vk::ImageAspectFlagBits::eColor, 0, 0, 1});
+  blit.setDstSubresource({vk::ImageAspectFlagBits::eColor, 0, face, 1});
+
+  cmd_buf.blitImage(
+    captureTarget.get(),
+    vk::ImageLayout::eTransferSrcOptimal,
+    radianceCube.get(),
+    vk::ImageLayout::eTransferDstOptimal,
+    blit,
+    vk::Filter::eNearest);
+}
+
+void ProbeManager::generateMips(vk::CommandBuffer cmd_buf)
+{
+  ETNA_PROFILE_GPU(cmd_buf, probeGenerateMips);
+
+  mipGenerator->generate(
+    cmd_buf, radianceCube, 6, MipGenerator::Filter::eLinear, mipGeneration);
+}
+
+void ProbeManager::prefilterMip(vk::CommandBuffer cmd_buf, uint32_t mip)
+{
+  ETNA_PROFILE_GPU(cmd_buf, probePrefilterMip);
+
+  /* Mip 0 is a plain copy of the radiance */
+  if (mip == 0)
+  {
+    etna::set_state(
+      cmd_buf,
+      radianceCube.get(),
+      vk::PipelineStageFlagBits2::eTransfer,
+      vk::AccessFlagBits2::eTransferRead,
+      vk::ImageLayout::eTransferSrcOptimal,
+      vk::ImageAspectFlagBits::eColor);
+
+    etna::set_state(
+      cmd_buf,
+      prefilteredCube.get(),
+      vk::PipelineStageFlagBits2::eTransfer,
+      vk::AccessFlagBits2::eTransferWrite,
+      vk::ImageLayout::eTransferDstOptimal,
+      vk::ImageAspectFlagBits::eColor);
+
+    etna::flush_barriers(cmd_buf);
+
+    const vk::ImageCopy region{
+      .srcSubresource = {vk::ImageAspectFlagBits::eColor, 0, 0, 6},
+      .srcOffset = {0, 0, 0},
+      .dstSubresource = {vk::ImageAspectFlagBits::eColor, 0, 0, 6},
+      .dstOffset = {0, 0, 0},
+      .extent = {PROBE_RESOLUTION, PROBE_RESOLUTION, 1},
+    };
+
+    cmd_buf.copyImage(
+      radianceCube.get(),
+      vk::ImageLayout::eTransferSrcOptimal,
+      prefilteredCube.get(),
+      vk::ImageLayout::eTransferDstOptimal,
+      region);
+
+    return;
+  }
+
+  etna::set_state(
+    cmd_buf,
+    radianceCube.get(),
+    vk::PipelineStageFlagBits2::eComputeShader,
+    vk::AccessFlagBits2::eShaderSampledRead,
+    vk::ImageLayout::eShaderReadOnlyOptimal,
+    vk::ImageAspectFlagBits::eColor);
+
+  etna::set_state(
+    cmd_buf,
+    prefilteredCube.get(),
+    vk::PipelineStageFlagBits2::eComputeShader,
+    vk::AccessFlagBits2::eShaderStorageWrite,
+    vk::ImageLayout::eGeneral,
+    vk::ImageAspectFlagBits::eColor);
+
+  etna::flush_barriers(cmd_buf);
+
+  auto programInfo = etna::get_shader_program("prefilter_envmap_table");
+  auto descriptorSet = etna::create_descriptor_set(
+    programInfo.getDescriptorLayoutId(0),
+    cmd_buf,
+    {
+      etna::Binding(
+        0,
+        radianceCube.genBinding(
+          linearSampler.get(),
+          vk::ImageLayout::eShaderReadOnlyOptimal,
+          etna::Image::ViewParams{
+            0,
+            vk::RemainingMipLevels,
+            0,
+            vk::RemainingArrayLayers,
+            {},
+            vk::ImageViewType::eCube,
+          })),
+
+      etna::Binding(
+        1,
+        prefilteredCube.genBinding(
+          nullptr,
+          vk::ImageLayout::eGeneral,
+          etna::Image::ViewParams{
+            mip,
+            1,
+            0,
+            vk::RemainingArrayLayers,
+            {},
+            vk::ImageViewType::eCube,
+          })),
+
+      etna::Binding(2, prefilterSampleBuffer.genBinding()),
+    });
+
+  cmd_buf.bindPipeline(vk::PipelineBindPoint::eCompute, prefilterPipeline.getVkPipeline());
+  cmd_buf.bindDescriptorSets(
+    vk::PipelineBindPoint::eCompute,
+    prefilterPipeline.getVkPipelineLayout(),
+    0,
+    {descriptorSet.getVkSet()},
+    {});
+
+  const glm::uvec2 res = glm::uvec2(PROBE_RESOLUTION >> mip);
+  const auto& range = prefilterSampleTable.mips[mip];
+
+  struct PushConstant
+  {
+    glm::uvec2 resolution;
+    glm::vec2 invResolution;
+    uint32_t sampleOffset;
+    uint32_t sampleCount;
+    float invWeightSum;
+  } pushConst{
+    .resolution = res,
+    .invResolution = 1.0f / glm::vec2(res),
+    .sampleOffset = range.offset,
+    .sampleCount = range.count,
+    .invWeightSum = range.invWeightSum,
+  };
+
+  cmd_buf.pushConstants<PushConstant>(
+    programInfo.getPipelineLayout(), vk::ShaderStageFlagBits::eCompute, 0, {pushConst});
+
+  cmd_buf.dispatch((res.x + 15) / 16, (res.y + 15) / 16, 6);
+}
+
+void ProbeManager::bakeIrradianceSH(vk::CommandBuffer cmd_buf)
+{
+  ETNA_PROFILE_GPU(cmd_buf, probeBakeSH);
+
+  const uint32_t groups = (PROBE_RESOLUTION + SH_BAKE_TILE_SIZE - 1) / SH_BAKE_TILE_SIZE;
+  const uint32_t groupCount = groups * groups * 6U;
+
+  etna::set_state(
+    cmd_buf,
+    radianceCube.get(),
+    vk::PipelineStageFlagBits2::eComputeShader,
+    vk::AccessFlagBits2::eShaderSampledRead,
+    vk::ImageLayout::eShaderReadOnlyOptimal,
+    vk::ImageAspectFlagBits::eColor);
+
+  etna::flush_barriers(cmd_buf);
+
+  // The previous bake may still be reading the partial sums and publishing the result
+  cmd_buf.pipelineBarrier(
+    vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+    vk::PipelineStageFlagBits::eComputeShader,
+    {},
+    vk::MemoryBarrier{
+      .srcAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferRead,
+      .dstAccessMask = vk::AccessFlagBits::eShaderWrite,
+    },
+    {},
+    {});
+
+  /* Project tiles of the radiance onto SH */
+  {
+    auto programInfo = etna::get_shader_program("bake_diffuse_irradiance");
+    auto descriptorSet = etna::create_descriptor_set(
+      programInfo.getDescriptorLayoutId(0),
+      cmd_buf,
+      {
+        etna::Binding(
+          0,
+          radianceCube.genBinding(
+            pointSampler.get(),
+            vk::ImageLayout::eShaderReadOnlyOptimal,
+            etna::Image::ViewParams{
+              0,
+              1,
+              0,
+              6,
+              {},
+              vk::ImageViewType::eCube,
+            })),
+
+        etna::Binding(1, irradianceSHPartialSums.genBinding()),
+      });
+
+    cmd_buf.bindPipeline(vk::PipelineBindPoint::eCompute, bakeSHPipeline.getVkPipeline());
+    cmd_buf.bindDescriptorSets(
+      vk::PipelineBindPoint::eCompute,
+      bakeSHPipeline.getVkPipelineLayout(),
+      0,
+      {descriptorSet.getVkSet()},
+      {});
+
+    struct PushConstant
+    {
+      glm::uvec2 resolution;
+      glm::vec2 invResolution;
+    } pushConst{
+      .resolution = glm::uvec2(PROBE_RESOLUTION),
+      .invResolution = glm::vec2(1.0f / static_cast<float>(PROBE_RESOLUTION)),
+    };
+
+    cmd_buf.pushConstants<PushConstant>(
+      programInfo.getPipelineLayout(), vk::ShaderStageFlagBits::eCompute, 0, {pushConst});
+
+    cmd_buf.dispatch(groups, groups, 6);
+  }
+
+  cmd_buf.pipelineBarrier(
+    vk::PipelineStageFlagBits::eComputeShader,
+    vk::PipelineStageFlagBits::eComputeShader,
+    {},
+    vk::MemoryBarrier{
+      .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+      .dstAccessMask = vk::AccessFlagBits::eShaderRead,
+    },
+    {},
+    {});
+
+  /* Reduce the partial sums and convolve with the cosine lobe */
+  {
+    auto programInfo = etna::get_shader_program("bake_diffuse_irradiance_reduce");
+    auto descriptorSet = etna::create_descriptor_set(
+      programInfo.getDescriptorLayoutId(0),
+      cmd_buf,
+      {
+        etna::Binding(0, irradianceSHPartialSums.genBinding()),
+        etna::Binding(1, irradianceSHScratch.genBinding()),
+      });
+
+    cmd_buf.bindPipeline(vk::PipelineBindPoint::eCompute, bakeSHReducePipeline.getVkPipeline());
+    cmd_buf.bindDescriptorSets(
+      vk::PipelineBindPoint::eCompute,
+      bakeSHReducePipeline.getVkPipelineLayout(),
+      0,
+      {descriptorSet.getVkSet()},
+      {});
+
+    cmd_buf.pushConstants<uint32_t>(
+      programInfo.getPipelineLayout(), vk::ShaderStageFlagBits::eCompute, 0, {groupCount});
+
+    cmd_buf.dispatch(1, 1, 1);
+  }
+}
+
+void ProbeManager::publish(vk::CommandBuffer cmd_buf)
+{
+  ETNA_PROFILE_GPU(cmd_buf, probePublish);
+
+  etna::set_state(
+    cmd_buf,
+    prefilteredCube.get(),
+    vk::PipelineStageFlagBits2::eTransfer,
+    vk::AccessFlagBits2::eTransferRead,
+    vk::ImageLayout::eTransferSrcOptimal,
+    vk::ImageAspectFlagBits::eColor);
+
+  etna::set_state(
+    cmd_buf,
+    prefilteredAtlas.get(),
+    vk::PipelineStageFlagBits2::eTransfer,
+    vk::AccessFlagBits2::eTransferWrite,
+    vk::ImageLayout::eTransferDstOptimal,
+    vk::ImageAspectFlagBits::eColor);
+
+  etna::flush_barriers(cmd_buf);
+
+  // Waits for the SH reduction and for the deferred passes still reading the published SH
+  cmd_buf.pipelineBarrier(
+    vk::PipelineStageFlagBits::eComputeShader,
+    vk::PipelineStageFlagBits::eTransfer,
+    {},
+    vk::MemoryBarrier{
+      .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+      .dstAccessMask = vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite,
+    },
+    {},
+    {});
+
+  std::array<vk::ImageCopy, PROBE_MIPS> regions;
+  for (uint32_t mip = 0; mip < PROBE_MIPS; ++mip)
+  {
+    regions[mip] = vk::ImageCopy{
+      .srcSubresource = {vk::ImageAspectFlagBits::eColor, mip, 0, 6},
+      .srcOffset = {0, 0, 0},
+      .dstSubresource = {vk::ImageAspectFlagBits::eColor, mip, currentProbe * 6, 6},
+      .dstOffset = {0, 0, 0},
+      .extent = {PROBE_RESOLUTION >> mip, PROBE_RESOLUTION >> mip, 1},
+    };
+  }
+
+  cmd_buf.copyImage(
+    prefilteredCube.get(),
+    vk::ImageLayout::eTransferSrcOptimal,
+    prefilteredAtlas.get(),
+    vk::ImageLayout::eTransferDstOptimal,
+    regions);
+
+  cmd_buf.copyBuffer(
+    irradianceSHScratch.get(),
+    irradianceSHBuffer.get(),
+    vk::BufferCopy{
+      .srcOffset = 0,
+      .dstOffset = currentProbe * 27 * sizeof(float),
+      .size = 27 * sizeof(float),
+    });
+
+  cmd_buf.pipelineBarrier(
+    vk::PipelineStageFlagBits::eTransfer,
+    vk::PipelineStageFlagBits::eComputeShader,
+    {},
+    vk::MemoryBarrier{
+      .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+      .dstAccessMask = vk::AccessFlagBits::eShaderRead,
+    },
+    {},
+    {});
+
+  publishedMask |= 1U << currentProbe;
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include <etna/Image.hpp>
+#include <etna/Sampler.hpp>
+#include <etna/Buffer.hpp>
+#include <etna/ComputePipeline.hpp>
+#include <etna/GpuSharedResource.hpp>
+#include <glm/glm.hpp>
+
+#include "render_utils/GpuMemoryTracker.hpp"
+#include "render_utils/GpuTimer.hpp"
+#include "render_utils/MipGenerator.hpp"
+#include "PrefilterSampleTable.hpp"
+#include "RenderView.hpp"
+
+
+/**
+ * Local reflection probes, which are recaptured from the scene and relit continuously.
+ *
+ * Updating a probe is split into small steps: capturing each face, generating mips, prefiltering
+ * each mip, baking the irradiance SH and publishing. Every frame runs as many steps as fit into a
+ * GPU time budget, using per-step costs measured with timestamp queries. Finished probes are
+ * published into a cubemap array and an SH buffer sampled by the deferred pass, so a probe never
+ * shows up half updated.
+ */
+class ProbeManager
+{
+public:
+  struct Probe
+  {
+    glm::vec3 position;
+    float radius;
+  };
+
+  struct Info
+  {
+    std::vector<Probe> probes;
+    float gpuBudgetMs{0.5f};
+  };
+
+  // Renders the scene into the view, i.e. runs the geometry, deferred and forward passes
+  using CaptureFn = std::function<void(vk::CommandBuffer, const RenderView&)>;
+
+  constexpr static uint32_t MAX_PROBES = 8;
+  constexpr static uint32_t PROBE_RESOLUTION = 128;
+  constexpr static uint32_t PROBE_MIPS = 5;
+  constexpr static vk::Format PROBE_FORMAT = vk::Format::eR16G16B16A16Sfloat;
+
+  constexpr static uint32_t STEP_CAPTURE_FIRST = 0;
+  constexpr static uint32_t STEP_GENERATE_MIPS = STEP_CAPTURE_FIRST + 6;
+  constexpr static uint32_t STEP_PREFILTER_FIRST = STEP_GENERATE_MIPS + 1;
+  constexpr static uint32_t STEP_BAKE_SH = STEP_PREFILTER_FIRST + PROBE_MIPS;
+  constexpr static uint32_t STEP_PUBLISH = STEP_BAKE_SH + 1;
+  constexpr static uint32_t STEP_COUNT = STEP_PUBLISH + 1;
+
+  // All face captures share a single cost estimate
+  constexpr static uint32_t STEP_KIND_COUNT = STEP_COUNT - 5;
+
+  explicit ProbeManager(Info info);
+
+  void allocateResources();
+  void setupPipelines();
+
+  // Replaces the probes, e.g. when a scene is loaded. Nothing is published until the new ones are
+  // captured. The GPU must not use the previous probes anymore.
+  void setProbes(std::vector<Probe> new_probes);
+
+  void execute(vk::CommandBuffer cmd_buf, const CaptureFn& capture);
+
+  uint32_t getProbeCount() const;
+  uint32_t getPublishedMask() const;
+
+  etna::Image& getPrefilteredAtlas();
+  etna::Buffer& getIrradianceSHBuffer();
+  etna::Buffer& getProbeBuffer();
+
+  // Capture targets count as passes, the rest as environment lighting
+  void reportMemory(GpuMemoryTracker::Collector& collector);
+
+  bool& getEnabled();
+  float& getGpuBudgetMs();
+  // Switching it shows up in the "Generate mips" step cost after a few updates
+  MipGenerator::Method& getMipGeneration();
+
+  // Exponential moving average of the GPU time of each step kind in ms, negative if unknown yet
+  std::span<const float> getStepCosts() const;
+  static const char* getStepKindName(uint32_t kind);
+
+private:
+  static uint32_t getStepKind(uint32_t step);
+
+  // Writes the face cameras and the probe buffer
+  void uploadProbes();
+
+  void runStep(vk::CommandBuffer cmd_buf, uint32_t step, const CaptureFn& capture);
+
+  void captureFace(vk::CommandBuffer cmd_buf, uint32_t face, const CaptureFn& capture);
+  void generateMips(vk::CommandBuffer cmd_buf);
+  void prefilterMip(vk::CommandBuffer cmd_buf, uint32_t mip);
+  void bakeIrradianceSH(vk::CommandBuffer cmd_buf);
+  void publish(vk::CommandBuffer cmd_buf);
+
+private:
+  std::vector<Probe> probes;
+  float gpuBudgetMs;
+  bool enabled = true;
+  MipGenerator::Method mipGeneration = MipGenerator::Method::eCompute;
+
+  uint32_t currentProbe = 0;
+  uint32_t currentStep = 0;
+  uint32_t publishedMask = 0;
+
+  GpuTimer timer;
+  etna::GpuSharedResource<std::vector<uint32_t>> recordedStepKinds;
+  std::array<float, STEP_KIND_COUNT> stepCosts;
+
+  /* Capture */
+  glm::mat4 captureProj;
+  std::vector<etna::Buffer> faceCameras;
+
+  etna::Image gBufferAlbedo;
+  etna::Image gBufferMetalnessRoughness;
+  etna::Image gBufferNorm;
+  etna::Image motionVectors;
+  etna::Image depth;
+  etna::Image captureTarget;
+
+  /* Relighting of the probe being updated */
+  etna::Image radianceCube;
+  etna::Image prefilteredCube;
+  etna::Buffer irradianceSHPartialSums;
+  etna::Buffer irradianceSHScratch;
+
+  PrefilterSampleTable prefilterSampleTable;
+  etna::Buffer prefilterSampleBuffer;
+
+  etna::ComputePipeline prefilterPipeline;
+  etna::ComputePipeline bakeSHPipeline;
+  etna::ComputePipeline bakeSHReducePipeline;
+  std::unique_ptr<MipGenerator> mipGenerator;
+
+  etna::Sampler linearSampler;
+  etna::Sampler pointSampler;
+
+  /* Published probes */
+  etna::Image prefilteredAtlas;
+  etna::Buffer irradianceSHBuffer;
+  etna::Buffer probeBuffer;
+};
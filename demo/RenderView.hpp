@@ -0,0 +1,41 @@
+#pragma once
+
+#include <etna/Buffer.hpp>
+#include <etna/Image.hpp>
+#include <glm/glm.hpp>
+
+
+/**
+ * Everything the geometry, deferred and forward passes need to render the scene from a single
+ * viewpoint. The main view and the reflection probe captures only differ in this.
+ */
+struct RenderView
+{
+  constexpr static vk::Format GBUFFER_ALBEDO_FORMAT = vk::Format::eR8G8B8A8Unorm;
+  constexpr static vk::Format GBUFFER_METALNESS_ROUGHNESS_FORMAT = vk::Format::eR8G8B8A8Unorm;
+  constexpr static vk::Format GBUFFER_NORM_FORMAT = vk::Format::eA2R10G10B10UnormPack32;
+  constexpr static vk::Format GBUFFER_PACKED_FORMAT = vk::Format::eR32G32Uint;
+  constexpr static vk::Format MOTION_VECTORS_FORMAT = vk::Format::eR16G16Sfloat;
+  constexpr static vk::Format DEPTH_FORMAT = vk::Format::eD32Sfloat;
+  constexpr static vk::Format TARGET_FORMAT = vk::Format::eR8G8B8A8Unorm;
+
+  glm::uvec2 extent;
+
+  etna::Buffer& prevCamera;
+  etna::Buffer& currCamera;
+  glm::mat4 proj;
+
+  // Either the three images of the standard G-buffer layout or the single packed one are set, see
+  // GBuffer.glsl
+  etna::Image* gBufferAlbedo = nullptr;
+  etna::Image* gBufferMetalnessRoughness = nullptr;
+  etna::Image* gBufferNorm = nullptr;
+  etna::Image* gBufferPacked = nullptr;
+
+  etna::Image& motionVectors;
+  etna::Image& depth;
+  etna::Image& target;
+
+  // Probe captures must not sample the probes they are about to replace
+  bool sampleProbes;
+};
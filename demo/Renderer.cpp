@@ -1,5 +1,10 @@
 #include "Renderer.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <optional>
+
+#include <etna/Assert.hpp>
 #include <etna/GlobalContext.hpp>
 #include <etna/Etna.hpp>
 #include <etna/RenderTargetStates.hpp>
@@ -10,6 +15,64 @@
 #include <gui/ImGuiRenderer.hpp>
 
 
+namespace
+{
+
+// Replace with an index if the preferred GPU is detected incorrectly
+constexpr std::optional<uint32_t> PHYSICAL_DEVICE_INDEX_OVERRIDE = {};
+
+// Optional capabilities of the picked device, which are only enabled when it supports them
+struct DeviceSupport
+{
+  uint32_t physicalDeviceIndex = 0;
+  bool textureCompressionBC = false;
+  bool memoryBudget = false;
+};
+
+} // namespace
+
+static DeviceSupport query_device_support()
+{
+  // etna only exposes the physical device once the logical one is created, so the device is picked
+  // and queried through a throwaway instance and then handed over to etna
+  VULKAN_HPP_DEFAULT_DISPATCHER.init();
+  const vk::ApplicationInfo appInfo{.apiVersion = VK_API_VERSION_1_3};
+  auto instance = etna::unwrap_vk_result(
+    vk::createInstanceUnique(vk::InstanceCreateInfo{.pApplicationInfo = &appInfo}));
+  VULKAN_HPP_DEFAULT_DISPATCHER.init(instance.get());
+
+  const auto devices = etna::unwrap_vk_result(instance->enumeratePhysicalDevices());
+  ETNA_VERIFY(!devices.empty());
+
+  DeviceSupport support;
+  if (PHYSICAL_DEVICE_INDEX_OVERRIDE.has_value())
+  {
+    support.physicalDeviceIndex = *PHYSICAL_DEVICE_INDEX_OVERRIDE;
+  }
+  else
+  {
+    // Prefer a discrete GPU, otherwise take the first one
+    const auto it =
+      std::find_if(devices.begin(), devices.end(), [](const vk::PhysicalDevice& device) {
+        return device.getProperties().deviceType == vk::PhysicalDeviceType::eDiscreteGpu;
+      });
+    if (it != devices.end())
+      support.physicalDeviceIndex = static_cast<uint32_t>(it - devices.begin());
+  }
+  ETNA_VERIFY(support.physicalDeviceIndex < devices.size());
+
+  const vk::PhysicalDevice device = devices[support.physicalDeviceIndex];
+  support.textureCompressionBC = device.getFeatures().textureCompressionBC == vk::True;
+
+  const auto extensions = etna::unwrap_vk_result(device.enumerateDeviceExtensionProperties());
+  support.memoryBudget =
+    std::any_of(extensions.begin(), extensions.end(), [](const vk::ExtensionProperties& ext) {
+      return std::strcmp(ext.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0;
+    });
+
+  return support;
+}
+
 Renderer::Renderer(glm::uvec2 res)
   : resolution{res}
 {
@@ -22,10 +85,16 @@ void Renderer::initVulkan(std::span<const char*> instance_extensions)
   for (auto ext : instance_extensions)
     instanceExtensions.push_back(ext);
 
+  const DeviceSupport support = query_device_support();
+  memoryBudgetSupported = support.memoryBudget;
+
   std::vector<const char*> deviceExtensions;
 
   deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
   deviceExtensions.push_back(VK_EXT_SCALAR_BLOCK_LAYOUT_EXTENSION_NAME);
+  // Heap usage and budgets for the GPU memory panel
+  if (memoryBudgetSupported)
+    deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
 
   vk::PhysicalDeviceVulkan12Features device12Features;
   device12Features.scalarBlockLayout = vk::True;
@@ -35,9 +104,22 @@ void Renderer::initVulkan(std::span<const char*> instance_extensions)
     .applicationVersion = VK_MAKE_VERSION(0, 1, 0),
     .instanceExtensions = instanceExtensions,
     .deviceExtensions = deviceExtensions,
-    .features = vk::PhysicalDeviceFeatures2{.pNext = &device12Features, .features = {}},
-    // Replace with an index if etna detects your preferred GPU incorrectly
-    .physicalDeviceIndexOverride = {},
+    .features =
+      vk::PhysicalDeviceFeatures2{
+        .pNext = &device12Features,
+        // Environment maps are written through formatless storage images, reflection probes are
+        // sampled from a cubemap array and the geometry pass writes texture streaming feedback.
+        // Material textures are BC compressed where supported, SceneManager falls back otherwise.
+        .features =
+          {
+            .imageCubeArray = vk::True,
+            .textureCompressionBC = support.textureCompressionBC ? vk::True : vk::False,
+            .fragmentStoresAndAtomics = vk::True,
+            .shaderStorageImageWriteWithoutFormat = vk::True,
+          },
+      },
+    // The device the capabilities were queried for
+    .physicalDeviceIndexOverride = support.physicalDeviceIndex,
     // How much frames we buffer on the GPU without waiting for their completion on the CPU
     .numFramesInFlight = 2,
   });
@@ -60,7 +142,7 @@ void Renderer::initFrameDelivery(vk::UniqueSurfaceKHR a_surface, ResolutionProvi
   });
   resolution = {w, h};
 
-  worldRenderer = std::make_unique<WorldRenderer>();
+  worldRenderer = std::make_unique<WorldRenderer>(memoryBudgetSupported);
   worldRenderer->allocateResources(resolution);
   worldRenderer->loadShaders();
   worldRenderer->setupPipelines(window->getCurrentFormat());
@@ -105,7 +187,10 @@ void Renderer::debugInput(const Keyboard& kb)
     else
     {
       ETNA_CHECK_VK_RESULT(etna::get_context().getDevice().waitIdle());
+      worldRenderer->waitPendingPipelines();
       etna::reload_shaders();
+      // Specialized permutations are compiled from the SPIR-V outside of etna
+      worldRenderer->setupPipelines(window->getCurrentFormat());
       spdlog::info("Successfully reloaded shaders!");
     }
   }
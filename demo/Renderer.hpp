@@ -46,6 +46,8 @@ private:
   std::unique_ptr<etna::PerFrameCmdMgr> commandManager;
 
   glm::uvec2 resolution;
+  // Whether VK_EXT_memory_budget was enabled on the device
+  bool memoryBudgetSupported = false;
   std::unique_ptr<ImGuiRenderer> guiRenderer;
 
   std::unique_ptr<WorldRenderer> worldRenderer;
@@ -0,0 +1,260 @@
+#include "SHProjection.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include <glm/gtc/constants.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SH_PROJECTION_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(SH_PROJECTION_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SH_PROJECTION_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define SH_PROJECTION_TARGET_AVX2
+#endif
+
+
+namespace
+{
+
+constexpr size_t SH_COUNT = 9;
+
+// Must match A_l in SphericalHarmonics.glsl
+constexpr std::array<float, SH_COUNT> A_L = {
+  3.141593f,
+  2.094395f,
+  2.094395f,
+  2.094395f,
+  0.785398f,
+  0.785398f,
+  0.785398f,
+  0.785398f,
+  0.785398f,
+};
+
+// RGB partial sums for all 9 coefficients
+using RowSums = std::array<float, 3 * SH_COUNT>;
+using ThreadSums = std::array<double, 3 * SH_COUNT>;
+
+struct RowParams
+{
+  const float* texels;
+  const float* cosPhi;
+  const float* sinPhi;
+  uint32_t width;
+  float sinTheta;
+  float cosTheta;
+};
+
+void project_row_scalar(const RowParams& row, uint32_t first_column, RowSums& sums)
+{
+  const float dy = row.cosTheta;
+
+  for (uint32_t x = first_column; x < row.width; ++x)
+  {
+    const float dx = row.sinTheta * row.cosPhi[x];
+    const float dz = row.sinTheta * row.sinPhi[x];
+
+    // Must match EvaluateSH9 in SphericalHarmonics.glsl
+    const std::array<float, SH_COUNT> yLm = {
+      0.282095f,
+      0.488603f * dx,
+      0.488603f * dz,
+      0.488603f * dy,
+      1.092548f * dx * dz,
+      1.092548f * dy * dz,
+      1.092548f * dy * dx,
+      0.946176f * dz * dz - 0.315392f,
+      0.546274f * (dx * dx - dy * dy),
+    };
+
+    const float* texel = row.texels + 4U * x;
+    for (size_t i = 0; i < SH_COUNT; ++i)
+    {
+      sums[3 * i + 0] += texel[0] * yLm[i];
+      sums[3 * i + 1] += texel[1] * yLm[i];
+      sums[3 * i + 2] += texel[2] * yLm[i];
+    }
+  }
+}
+
+#ifdef SH_PROJECTION_X86
+bool cpu_supports_avx2()
+{
+#if defined(_MSC_VER)
+  std::array<int, 4> info;
+  __cpuid(info.data(), 0);
+  if (info[0] < 7)
+    return false;
+
+  __cpuid(info.data(), 1);
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  const bool fma = (info[2] & (1 << 12)) != 0;
+  if (!osxsave || !fma || (_xgetbv(0) & 0x6) != 0x6)
+    return false;
+
+  __cpuidex(info.data(), 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+SH_PROJECTION_TARGET_AVX2 float horizontal_sum(__m256 v)
+{
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  sum = _mm_hadd_ps(sum, sum);
+  sum = _mm_hadd_ps(sum, sum);
+  return _mm_cvtss_f32(sum);
+}
+
+// Processes the row in batches of 8 texels, returns the first column left unprocessed.
+SH_PROJECTION_TARGET_AVX2 uint32_t project_row_avx2(const RowParams& row, RowSums& sums)
+{
+  // Deinterleaves 8 RGBA texels into channels
+  const __m256i gatherIndices = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+
+  const __m256 sinTheta = _mm256_set1_ps(row.sinTheta);
+  const float dy = row.cosTheta;
+
+  // Basis functions (or their factors) that only depend on the row
+  const __m256 y0 = _mm256_set1_ps(0.282095f);
+  const __m256 y3 = _mm256_set1_ps(0.488603f * dy);
+  const __m256 c1 = _mm256_set1_ps(0.488603f);
+  const __m256 c4 = _mm256_set1_ps(1.092548f);
+  const __m256 c56 = _mm256_set1_ps(1.092548f * dy);
+  const __m256 c7 = _mm256_set1_ps(0.946176f);
+  const __m256 c7Bias = _mm256_set1_ps(-0.315392f);
+  const __m256 c8 = _mm256_set1_ps(0.546274f);
+  const __m256 dy2 = _mm256_set1_ps(dy * dy);
+
+  // Plain arrays, GCC drops the alignment attributes of __m256 as a template argument
+  __m256 acc[3 * SH_COUNT];
+  for (auto& a : acc)
+    a = _mm256_setzero_ps();
+
+  uint32_t x = 0;
+  for (; x + 8 <= row.width; x += 8)
+  {
+    const float* texels = row.texels + 4U * x;
+    const __m256 r = _mm256_i32gather_ps(texels + 0, gatherIndices, 4);
+    const __m256 g = _mm256_i32gather_ps(texels + 1, gatherIndices, 4);
+    const __m256 b = _mm256_i32gather_ps(texels + 2, gatherIndices, 4);
+
+    const __m256 dx = _mm256_mul_ps(sinTheta, _mm256_loadu_ps(row.cosPhi + x));
+    const __m256 dz = _mm256_mul_ps(sinTheta, _mm256_loadu_ps(row.sinPhi + x));
+
+    const __m256 yLm[SH_COUNT] = {
+      y0,
+      _mm256_mul_ps(c1, dx),
+      _mm256_mul_ps(c1, dz),
+      y3,
+      _mm256_mul_ps(c4, _mm256_mul_ps(dx, dz)),
+      _mm256_mul_ps(c56, dz),
+      _mm256_mul_ps(c56, dx),
+      _mm256_fmadd_ps(c7, _mm256_mul_ps(dz, dz), c7Bias),
+      _mm256_mul_ps(c8, _mm256_sub_ps(_mm256_mul_ps(dx, dx), dy2)),
+    };
+
+    for (size_t i = 0; i < SH_COUNT; ++i)
+    {
+      acc[3 * i + 0] = _mm256_fmadd_ps(r, yLm[i], acc[3 * i + 0]);
+      acc[3 * i + 1] = _mm256_fmadd_ps(g, yLm[i], acc[3 * i + 1]);
+      acc[3 * i + 2] = _mm256_fmadd_ps(b, yLm[i], acc[3 * i + 2]);
+    }
+  }
+
+  for (size_t i = 0; i < 3 * SH_COUNT; ++i)
+    sums[i] += horizontal_sum(acc[i]);
+
+  return x;
+}
+#endif
+
+} // namespace
+
+SHCoefficientArray project_irradiance_sh(const float* rgba, uint32_t width, uint32_t height)
+{
+  constexpr float PI = glm::pi<float>();
+
+#ifdef SH_PROJECTION_X86
+  const bool useAvx2 = cpu_supports_avx2();
+#endif
+
+  // Same mapping as convert_cubemap.comp: u = atan(z, x) / 2pi, v = acos(y) / pi
+  std::vector<float> cosPhi(width);
+  std::vector<float> sinPhi(width);
+  for (uint32_t x = 0; x < width; ++x)
+  {
+    const float phi = 2.0f * PI * (static_cast<float>(x) + 0.5f) / static_cast<float>(width);
+    cosPhi[x] = std::cos(phi);
+    sinPhi[x] = std::sin(phi);
+  }
+
+  const uint32_t threadCount = std::clamp(std::thread::hardware_concurrency(), 1U, height);
+  std::vector<ThreadSums> threadSums(threadCount, ThreadSums{});
+
+  const auto projectRows = [&](uint32_t thread_idx) {
+    const uint32_t firstRow = thread_idx * height / threadCount;
+    const uint32_t lastRow = (thread_idx + 1) * height / threadCount;
+
+    for (uint32_t y = firstRow; y < lastRow; ++y)
+    {
+      const double theta0 = PI * static_cast<double>(y) / height;
+      const double theta1 = PI * static_cast<double>(y + 1) / height;
+      const float theta = PI * (static_cast<float>(y) + 0.5f) / static_cast<float>(height);
+
+      // Exact solid angle of every texel of the row
+      const double solidAngle = 2.0 * PI / width * (std::cos(theta0) - std::cos(theta1));
+
+      const RowParams row{
+        .texels = rgba + 4ULL * width * y,
+        .cosPhi = cosPhi.data(),
+        .sinPhi = sinPhi.data(),
+        .width = width,
+        .sinTheta = std::sin(theta),
+        .cosTheta = std::cos(theta),
+      };
+
+      RowSums rowSums{};
+      uint32_t firstColumn = 0;
+
+#ifdef SH_PROJECTION_X86
+      if (useAvx2)
+        firstColumn = project_row_avx2(row, rowSums);
+#endif
+
+      project_row_scalar(row, firstColumn, rowSums);
+
+      for (size_t i = 0; i < rowSums.size(); ++i)
+        threadSums[thread_idx][i] += solidAngle * rowSums[i];
+    }
+  };
+
+  {
+    std::vector<std::jthread> threads;
+    threads.reserve(threadCount);
+    for (uint32_t threadIdx = 0; threadIdx < threadCount; ++threadIdx)
+      threads.emplace_back(projectRows, threadIdx);
+  }
+
+  SHCoefficientArray result{};
+  for (size_t i = 0; i < result.size(); ++i)
+  {
+    double lLm = 0.0;
+    for (const auto& sums : threadSums)
+      lLm += sums[i];
+
+    result[i] = static_cast<float>(lLm) * A_L[i / 3];
+  }
+
+  return result;
+}
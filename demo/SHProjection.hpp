@@ -0,0 +1,17 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+
+using SHCoefficientArray = std::array<float, 27>;
+
+/**
+ * Projects an equirectangular RGBA32F environment (as returned by stbi_loadf with 4 channels)
+ * onto the 9 irradiance SH coefficients on the CPU. Each texel is weighted by its exact solid
+ * angle. The result is already convolved with the clamped cosine lobe and laid out exactly like
+ * the output of bake_diffuse_irradiance.comp, i.e. 9 tightly packed RGB triplets.
+ *
+ * Uses AVX2 when the CPU supports it and splits the rows between all hardware threads.
+ */
+SHCoefficientArray project_irradiance_sh(const float* rgba, uint32_t width, uint32_t height);
@@ -1,35 +1,66 @@
 #include "TAAPass.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <utility>
+
 #include <etna/GlobalContext.hpp>
 #include <etna/PipelineManager.hpp>
+#include <etna/RenderTargetStates.hpp>
+
+
+static constexpr float halton(uint32_t index, uint32_t base)
+{
+  float result = 0.0f;
+  float fraction = 1.0f;
+  for (; index > 0; index /= base)
+  {
+    fraction /= static_cast<float>(base);
+    result += fraction * static_cast<float>(index % base);
+  }
+  return result;
+}
+
+template <size_t... Indices>
+static constexpr auto make_halton_sequence(std::index_sequence<Indices...>)
+{
+  return std::array{glm::vec2(halton(Indices + 1, 2), halton(Indices + 1, 3))...};
+}
+
+// Long enough for the maximum number of samples per output pixel at half the output resolution
+static constexpr auto HALTON_SEQUENCE =
+  make_halton_sequence(std::make_index_sequence<4 * TAAPass::MAX_JITTER_SAMPLE_COUNT>{});
 
+constexpr std::array RESOLVE_MODE_NAMES = {"Classic", "High Quality", "Split"};
+static_assert(RESOLVE_MODE_NAMES.size() == TAAPass::ResolveModeCount);
 
-static constexpr std::array HALTON_SEQUENCE = {
-  glm::vec2(0.510000f, 0.333333f),
-  glm::vec2(0.250000f, 0.666667f),
-  glm::vec2(0.750000f, 0.111111f),
-  glm::vec2(0.125000f, 0.444444f),
-  glm::vec2(0.625000f, 0.777778f),
-  glm::vec2(0.375000f, 0.222222f),
-  glm::vec2(0.875000f, 0.555556f),
-  glm::vec2(0.062500f, 0.888889f),
-  glm::vec2(0.562500f, 0.037037f),
-  glm::vec2(0.312500f, 0.370370f),
-  glm::vec2(0.812500f, 0.703704f),
-  glm::vec2(0.187500f, 0.148148f),
-  glm::vec2(0.687500f, 0.481481f),
-  glm::vec2(0.437500f, 0.814815f),
-  glm::vec2(0.937500f, 0.259259f),
-  glm::vec2(0.031250f, 0.592593f),
-};
+constexpr float RESOLVE_COST_SMOOTHING = 0.1f;
+
+TAAPass::TAAPass()
+  : jitterSampleCount(MAX_JITTER_SAMPLE_COUNT)
+  , timer(1)
+  , recordedModes(
+      etna::get_context().getMainWorkCount(),
+      [](std::size_t) { return std::optional<ResolveMode>{}; })
+{
+  resolveCosts.fill(-1.0f);
+}
 
 void TAAPass::loadShaders()
 {
   etna::create_program("taa_resolve", {DEMO_SHADERS_ROOT "taa_resolve.comp.spv"});
+  etna::create_program(
+    "taa_present",
+    {DEMO_SHADERS_ROOT "fullscreen.vert.spv", DEMO_SHADERS_ROOT "taa_present.frag.spv"});
 }
 
-void TAAPass::allocateResources(glm::uvec2 target_resolution, vk::Format format)
+void TAAPass::allocateResources(
+  glm::uvec2 render_extent, glm::uvec2 target_resolution, vk::Format format)
 {
+  renderExtent = render_extent;
+  renderResolution = render_extent;
+  prevRenderResolution = render_extent;
   resolution = target_resolution;
 
   auto& ctx = etna::get_context();
@@ -51,7 +82,7 @@ void TAAPass::allocateResources(glm::uvec2 target_resolution, vk::Format format)
   });
 
   currentTarget = ctx.createImage(etna::Image::CreateInfo{
-    .extent = vk::Extent3D{resolution.x, resolution.y, 1},
+    .extent = vk::Extent3D{renderExtent.x, renderExtent.y, 1},
     .name = "TAAPass::currentTarget",
     .format = format,
     .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eStorage |
@@ -61,7 +92,7 @@ void TAAPass::allocateResources(glm::uvec2 target_resolution, vk::Format format)
   for (size_t i = 0; i < motionVectors.size(); ++i)
   {
     motionVectors[i] = ctx.createImage(etna::Image::CreateInfo{
-      .extent = vk::Extent3D{resolution.x, resolution.y, 1},
+      .extent = vk::Extent3D{renderExtent.x, renderExtent.y, 1},
       .name = "TAAPass::motionVectors[" + std::to_string(i) + "]",
       .format = vk::Format::eR16G16Sfloat,
       .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
@@ -78,11 +109,54 @@ void TAAPass::allocateResources(glm::uvec2 target_resolution, vk::Format format)
         vk::ImageUsageFlagBits::eTransferSrc,
     });
   }
+
+  output = ctx.createImage(etna::Image::CreateInfo{
+    .extent = vk::Extent3D{resolution.x, resolution.y, 1},
+    .name = "TAAPass::output",
+    .format = format,
+    .imageUsage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage,
+  });
 }
 
-void TAAPass::setupPipelines()
+void TAAPass::setupPipelines(vk::Format present_format)
 {
-  pipeline = etna::get_context().getPipelineManager().createComputePipeline("taa_resolve", {});
+  auto& pipelineManager = etna::get_context().getPipelineManager();
+
+  pipeline = pipelineManager.createComputePipeline("taa_resolve", {});
+
+  // There are few enough of them to have every toggle ready before it is flipped
+  resolvePermutations =
+    PipelinePermutations("taa_resolve", DEMO_SHADERS_ROOT "taa_resolve.comp.spv", ToggleCount);
+  std::array<uint32_t, 1U << ToggleCount> allToggles;
+  std::iota(allToggles.begin(), allToggles.end(), 0U);
+  resolvePermutations.prewarm(allToggles);
+
+  presentPipeline = pipelineManager.createGraphicsPipeline(
+    "taa_present",
+    etna::GraphicsPipeline::CreateInfo{
+      .vertexShaderInput = {},
+      .rasterizationConfig =
+        vk::PipelineRasterizationStateCreateInfo{
+          .polygonMode = vk::PolygonMode::eFill,
+          .cullMode = vk::CullModeFlagBits::eNone,
+          .frontFace = vk::FrontFace::eCounterClockwise,
+          .lineWidth = 1.f,
+        },
+      .fragmentShaderOutput =
+        {
+          .colorAttachmentFormats = {present_format},
+        },
+    });
+}
+
+void TAAPass::waitPendingPipelines()
+{
+  resolvePermutations.waitPending();
+}
+
+void TAAPass::setRenderResolution(glm::uvec2 render_resolution)
+{
+  renderResolution = glm::clamp(render_resolution, glm::uvec2(1), renderExtent);
 }
 
 etna::Image& TAAPass::getCurrentTarget()
@@ -102,7 +176,8 @@ etna::Image& TAAPass::getMotionVectors()
 
 glm::vec2 TAAPass::getJitter()
 {
-  return jitterScale * (HALTON_SEQUENCE[curJitterIdx] - 0.5f) / glm::vec2(resolution);
+  const auto& sample = HALTON_SEQUENCE[curJitterIdx % getJitterPhaseCount()];
+  return jitterScale * (sample - 0.5f) / glm::vec2(renderResolution);
 }
 
 float& TAAPass::getJitterScale()
@@ -110,50 +185,88 @@ float& TAAPass::getJitterScale()
   return jitterScale;
 }
 
-void TAAPass::resolve(vk::CommandBuffer cmd_buf, bool filter_history)
+int32_t& TAAPass::getJitterSampleCount()
 {
-  etna::set_state(
-    cmd_buf,
-    motionVectors.getPrevious().get(),
-    vk::PipelineStageFlagBits2::eComputeShader,
-    vk::AccessFlagBits2::eShaderSampledRead,
-    vk::ImageLayout::eShaderReadOnlyOptimal,
-    vk::ImageAspectFlagBits::eColor);
+  return jitterSampleCount;
+}
 
-  etna::set_state(
-    cmd_buf,
-    motionVectors.getCurrent().get(),
-    vk::PipelineStageFlagBits2::eComputeShader,
-    vk::AccessFlagBits2::eShaderSampledRead,
-    vk::ImageLayout::eShaderReadOnlyOptimal,
-    vk::ImageAspectFlagBits::eColor);
+size_t TAAPass::getJitterPhaseCount() const
+{
+  // Every output pixel should still receive as many samples as without upscaling
+  const float upscale = static_cast<float>(resolution.x) / static_cast<float>(renderResolution.x);
+  const auto count = std::ceil(static_cast<float>(jitterSampleCount) * upscale * upscale);
+  return std::clamp(static_cast<size_t>(count), size_t{1}, HALTON_SEQUENCE.size());
+}
 
-  etna::set_state(
-    cmd_buf,
-    getHistory().get(),
-    vk::PipelineStageFlagBits2::eComputeShader,
-    vk::AccessFlagBits2::eShaderSampledRead,
-    vk::ImageLayout::eShaderReadOnlyOptimal,
-    vk::ImageAspectFlagBits::eColor);
+TAAPass::ResolveMode& TAAPass::getResolveMode()
+{
+  return resolveMode;
+}
 
-  etna::set_state(
-    cmd_buf,
-    getCurrentTarget().get(),
-    vk::PipelineStageFlagBits2::eComputeShader,
-    vk::AccessFlagBits2::eShaderSampledRead,
-    vk::ImageLayout::eShaderReadOnlyOptimal,
-    vk::ImageAspectFlagBits::eColor);
+std::span<const char* const> TAAPass::getResolveModeNames()
+{
+  return RESOLVE_MODE_NAMES;
+}
 
-  etna::set_state(
-    cmd_buf,
-    getResolveTarget().get(),
-    vk::PipelineStageFlagBits2::eComputeShader,
-    vk::AccessFlagBits2::eShaderStorageWrite,
-    vk::ImageLayout::eGeneral,
-    vk::ImageAspectFlagBits::eColor);
+std::span<const float> TAAPass::getResolveCosts() const
+{
+  return resolveCosts;
+}
 
-  etna::flush_barriers(cmd_buf);
+float& TAAPass::getSharpenAmount()
+{
+  return sharpenAmount;
+}
+
+void TAAPass::addToGraph(
+  FrameGraph& graph, etna::Image& depth, bool filter_history, bool accumulate)
+{
+  constexpr auto COLOR = vk::ImageAspectFlagBits::eColor;
+
+  const auto prevMotionVectors =
+    graph.importImage("TAAPass::prevMotionVectors", motionVectors.getPrevious().get(), COLOR);
+  const auto currMotionVectors =
+    graph.importImage("TAAPass::motionVectors", motionVectors.getCurrent().get(), COLOR);
+  const auto history = graph.importImage("TAAPass::history", getHistory().get(), COLOR);
+  const auto target = graph.importImage("TAAPass::currentTarget", getCurrentTarget().get(), COLOR);
+  const auto depthId = graph.importImage("depth", depth.get(), vk::ImageAspectFlagBits::eDepth);
+  const auto resolveTarget =
+    graph.importImage("TAAPass::resolveTarget", getResolveTarget().get(), COLOR);
+  const auto outputId = graph.importImage("TAAPass::output", output.get(), COLOR);
+
+  graph
+    .addPass(
+      "TAA",
+      [this, &depth, filter_history, accumulate](vk::CommandBuffer cmd_buf) {
+        resolve(cmd_buf, depth, filter_history, accumulate);
+      })
+    .read(prevMotionVectors, FrameGraph::SAMPLED_COMPUTE)
+    .read(currMotionVectors, FrameGraph::SAMPLED_COMPUTE)
+    .read(history, FrameGraph::SAMPLED_COMPUTE)
+    .read(target, FrameGraph::SAMPLED_COMPUTE)
+    .read(depthId, FrameGraph::SAMPLED_COMPUTE)
+    .write(resolveTarget, FrameGraph::STORAGE_WRITE_COMPUTE)
+    .write(outputId, FrameGraph::STORAGE_WRITE_COMPUTE)
+    .sideEffect()
+    .computeOnly();
+}
+
+void TAAPass::resolve(
+  vk::CommandBuffer cmd_buf, etna::Image& depth, bool filter_history, bool accumulate)
+{
+  timer.beginFrame(cmd_buf);
+
+  // Results come back for the mode recorded the last time this frame slot was used
+  auto& recordedMode = recordedModes.get();
+  const auto timings = timer.getResults();
+  if (recordedMode.has_value() && !timings.empty())
+  {
+    float& cost = resolveCosts[*recordedMode];
+    cost = cost < 0.0f ? timings[0] : glm::mix(cost, timings[0], RESOLVE_COST_SMOOTHING);
+  }
+  recordedMode = resolveMode;
 
+  // Barriers are placed by the frame graph
   auto programInfo = etna::get_shader_program("taa_resolve");
   auto descriptorSet = etna::create_descriptor_set(
     programInfo.getDescriptorLayoutId(0),
@@ -183,9 +296,21 @@ void TAAPass::resolve(vk::CommandBuffer cmd_buf, bool filter_history)
         4,
         getResolveTarget().genBinding(
           nullptr, vk::ImageLayout::eGeneral, etna::Image::ViewParams{})),
-    });
 
-  cmd_buf.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.getVkPipeline());
+      etna::Binding(
+        5,
+        depth.genBinding(
+          pointSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal, etna::Image::ViewParams{})),
+
+      etna::Binding(
+        6, output.genBinding(nullptr, vk::ImageLayout::eGeneral, etna::Image::ViewParams{})),
+    },
+    BarrierBehavoir::eSuppressBarriers);
+
+  const uint32_t toggles = (static_cast<uint32_t>(filter_history) << ToggleCatmullRom) |
+    (static_cast<uint32_t>(accumulate) << ToggleAccumulate);
+  cmd_buf.bindPipeline(
+    vk::PipelineBindPoint::eCompute, resolvePermutations.get(toggles, pipeline.getVkPipeline()));
   cmd_buf.bindDescriptorSets(
     vk::PipelineBindPoint::eCompute,
     pipeline.getVkPipelineLayout(),
@@ -193,26 +318,108 @@ void TAAPass::resolve(vk::CommandBuffer cmd_buf, bool filter_history)
     {descriptorSet.getVkSet()},
     {});
 
+  // The vectors go first, so that they are 8 byte aligned in the std430 layout of the shader
   struct PushConstant
   {
     glm::uvec2 resolution;
     glm::vec2 invResolution;
+    glm::uvec2 renderResolution;
+    glm::vec2 jitterPixels;
+    glm::vec2 prevMotionVectorsUVScale;
     uint32_t filterHistory;
+    uint32_t accumulate;
+    uint32_t resolveMode;
+    float sharpenAmount;
   } pushConst{
     .resolution = resolution,
     .invResolution = 1.0f / glm::vec2(resolution),
+    .renderResolution = renderResolution,
+    .jitterPixels = (getJitter() / 2.0f) * glm::vec2(renderResolution),
+    .prevMotionVectorsUVScale = glm::vec2(prevRenderResolution) / glm::vec2(renderExtent),
     .filterHistory = filter_history,
+    .accumulate = accumulate,
+    .resolveMode = resolveMode,
+    .sharpenAmount = sharpenAmount,
   };
 
   cmd_buf.pushConstants<PushConstant>(
     programInfo.getPipelineLayout(), vk::ShaderStageFlagBits::eCompute, 0, {pushConst});
 
+  const uint32_t scope = timer.begin(cmd_buf);
   cmd_buf.dispatch(
     (resolution.x + GROUP_SIZE - 1) / GROUP_SIZE, (resolution.y + GROUP_SIZE - 1) / GROUP_SIZE, 1);
+  timer.end(cmd_buf, scope);
 
+  prevRenderResolution = renderResolution;
   motionVectors.proceed();
   resolveTargets.proceed();
-  curJitterIdx = (curJitterIdx + 1) % HALTON_SEQUENCE.size();
+  curJitterIdx = (curJitterIdx + 1) % getJitterPhaseCount();
+}
+
+void TAAPass::addPresentToGraph(
+  FrameGraph& graph, vk::Image target_image, vk::ImageView target_view)
+{
+  constexpr auto COLOR = vk::ImageAspectFlagBits::eColor;
+
+  const auto outputId = graph.importImage("TAAPass::output", output.get(), COLOR);
+  const auto targetId = graph.importImage("swapchain", target_image, COLOR);
+
+  graph
+    .addPass(
+      "Present",
+      [this, target_image, target_view](vk::CommandBuffer cmd_buf) {
+        present(cmd_buf, target_image, target_view);
+      })
+    .read(outputId, FrameGraph::SAMPLED_FRAGMENT)
+    .write(targetId, FrameGraph::COLOR_ATTACHMENT);
+}
+
+void TAAPass::present(vk::CommandBuffer cmd_buf, vk::Image target_image, vk::ImageView target_view)
+{
+  auto programInfo = etna::get_shader_program("taa_present");
+  auto descriptorSet = etna::create_descriptor_set(
+    programInfo.getDescriptorLayoutId(0),
+    cmd_buf,
+    {
+      etna::Binding(
+        0,
+        output.genBinding(
+          pointSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal, etna::Image::ViewParams{})),
+    },
+    BarrierBehavoir::eSuppressBarriers);
+
+  // Every pixel is overwritten, the previous contents of the swapchain image are irrelevant
+  etna::RenderTargetState renderTargets(
+    cmd_buf,
+    {{0, 0}, {resolution.x, resolution.y}},
+    {{
+      .image = target_image,
+      .view = target_view,
+      .loadOp = vk::AttachmentLoadOp::eDontCare,
+    }},
+    {});
+
+  cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, presentPipeline.getVkPipeline());
+  cmd_buf.bindDescriptorSets(
+    vk::PipelineBindPoint::eGraphics,
+    presentPipeline.getVkPipelineLayout(),
+    0,
+    {descriptorSet.getVkSet()},
+    {});
+
+  cmd_buf.draw(3, 1, 0, 0);
+}
+
+void TAAPass::reportMemory(GpuMemoryTracker::Collector& collector)
+{
+  using Category = GpuMemoryTracker::Category;
+
+  for (const auto& image : motionVectors)
+    collector.add(Category::ePasses, "TAAPass::motionVectors", image);
+  collector.add(Category::ePasses, "TAAPass::currentTarget", currentTarget);
+  for (const auto& image : resolveTargets)
+    collector.add(Category::ePasses, "TAAPass::resolveTarget", image);
+  collector.add(Category::ePasses, "TAAPass::output", output);
 }
 
 etna::Image& TAAPass::getHistory()
@@ -1,20 +1,52 @@
 #pragma once
 
+#include <array>
+#include <optional>
+#include <span>
+
+#include <etna/GpuSharedResource.hpp>
 #include <etna/Image.hpp>
 #include <etna/Sampler.hpp>
 #include <etna/ComputePipeline.hpp>
 #include <etna/GraphicsPipeline.hpp>
 #include <glm/glm.hpp>
 
+#include "render_utils/FrameGraph.hpp"
+#include "render_utils/GpuMemoryTracker.hpp"
+#include "render_utils/GpuTimer.hpp"
+#include "render_utils/PipelinePermutations.hpp"
 #include "Temporal.hpp"
 
 
 class TAAPass
 {
 public:
+  enum ResolveMode : uint32_t {
+    // Fixed history weight, AABB clamping and motion vector rejection
+    ResolveModeClassic,
+    // Closest depth velocity dilation, YCoCg variance clipping, luminance weighting and a history
+    // weight driven by how many frames were accumulated
+    ResolveModeHighQuality,
+    // Classic on the left half of the screen and high quality on the right one
+    ResolveModeSplit,
+
+    ResolveModeCount
+  };
+
+  static constexpr int32_t MAX_JITTER_SAMPLE_COUNT = 16;
+
+  TAAPass();
+
   void loadShaders();
-  void allocateResources(glm::uvec2 target_resolution, vk::Format format);
-  void setupPipelines();
+  // The current target and motion vectors are allocated with the render extent, the history and
+  // the output with the target resolution
+  void allocateResources(glm::uvec2 render_extent, glm::uvec2 target_resolution, vk::Format format);
+  void setupPipelines(vk::Format present_format);
+  void waitPendingPipelines();
+
+  // The scene is rendered into the top left corner of the render extent, its size may change every
+  // frame. Must be set before getJitter.
+  void setRenderResolution(glm::uvec2 render_resolution);
 
   etna::Image& getCurrentTarget();
   etna::Image& getResolveTarget();
@@ -22,29 +54,69 @@ public:
   glm::vec2 getJitter();
 
   float& getJitterScale();
-
-  void resolve(vk::CommandBuffer cmd_buf, bool filter_history);
+  // Samples per output pixel, the jitter sequence is lengthened by the square of the upscale ratio
+  int32_t& getJitterSampleCount();
+  ResolveMode& getResolveMode();
+  static std::span<const char* const> getResolveModeNames();
+  // GPU time of the resolve in ms per mode, negative until measured
+  std::span<const float> getResolveCosts() const;
+  float& getSharpenAmount();
+
+  void reportMemory(GpuMemoryTracker::Collector& collector);
+
+  // The resolve always runs, as it advances the history and the jitter, without accumulation the
+  // current frame is passed through as is. The depth is used for velocity dilation. The same
+  // dispatch sharpens the resolved frame into the output.
+  void addToGraph(FrameGraph& graph, etna::Image& depth, bool filter_history, bool accumulate);
+  // Copies the output into the presented image with a fullscreen triangle, as the swapchain can't
+  // be a storage image
+  void addPresentToGraph(FrameGraph& graph, vk::Image target_image, vk::ImageView target_view);
 
 private:
   static constexpr size_t GROUP_SIZE = 8;
 
+  // Bits of the resolve permutations, must match the specialization constants of taa_resolve.comp
+  enum Toggle : uint32_t
+  {
+    ToggleCatmullRom,
+    ToggleAccumulate,
+
+    ToggleCount
+  };
+
 private:
   etna::Image& getHistory();
+  size_t getJitterPhaseCount() const;
+  void resolve(vk::CommandBuffer cmd_buf, etna::Image& depth, bool filter_history, bool accumulate);
+  void present(vk::CommandBuffer cmd_buf, vk::Image target_image, vk::ImageView target_view);
 
 private:
   etna::ComputePipeline pipeline;
+  PipelinePermutations resolvePermutations;
+  etna::GraphicsPipeline presentPipeline;
 
   etna::Sampler linearSampler;
   etna::Sampler pointSampler;
 
+  glm::uvec2 renderExtent;
+  glm::uvec2 renderResolution;
+  glm::uvec2 prevRenderResolution;
   glm::uvec2 resolution;
 
   Temporal<etna::Image> motionVectors;
 
   etna::Image currentTarget;
   Temporal<etna::Image> resolveTargets;
+  etna::Image output;
 
   size_t curJitterIdx = 0;
 
   float jitterScale = 2.0f;
+  int32_t jitterSampleCount;
+
+  ResolveMode resolveMode = ResolveModeHighQuality;
+  GpuTimer timer;
+  etna::GpuSharedResource<std::optional<ResolveMode>> recordedModes;
+  std::array<float, ResolveModeCount> resolveCosts;
+  float sharpenAmount = 0.2f;
 };
@@ -2,12 +2,19 @@
 
 #include "shaders/CameraData.h"
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include <etna/Assert.hpp>
+#include <etna/Etna.hpp>
 #include <etna/GlobalContext.hpp>
 #include <etna/PipelineManager.hpp>
 #include <etna/RenderTargetStates.hpp>
 #include <etna/Profiling.hpp>
 #include <glm/ext.hpp>
 #include <imgui.h>
+#include <spdlog/spdlog.h>
 
 
 constexpr std::array ENVIRONMENT_NAMES = {
@@ -22,9 +29,76 @@ constexpr std::array ENVIRONMENT_FILEPATHS = {
   GRAPHICS_COURSE_RESOURCES_ROOT "/textures/small_cathedral_2k.hdr",
 };
 
-WorldRenderer::WorldRenderer()
+// The classification pass followed by the shading variants in the order of the tile classes, see
+// DeferredShading.glsl. The versions reading the packed G-buffer have a suffix.
+constexpr std::array DEFERRED_PROGRAMS = {
+  "deferred_classify",
+  "deferred_sky",
+  "deferred_emissive",
+  "deferred_simple",
+  "deferred_complex",
+};
+
+static std::string get_deferred_program(const char* name, bool packed_gbuffer)
+{
+  return packed_gbuffer ? std::string(name) + "_packed" : std::string(name);
+}
+
+constexpr float MIN_PROBE_CELL_SIZE = 1.0f;
+static_assert(ProbeManager::MAX_PROBES >= 8);
+
+// Reflection probes in the centers of a grid of up to 2x2x2 cells covering the scene bounds, each
+// probe reaches the corners of its cell
+static std::vector<ProbeManager::Probe> place_reflection_probes(const BoundingBox& bounds)
+{
+  if (bounds.isEmpty())
+    return {};
+
+  const glm::vec3 extent = bounds.max - bounds.min;
+  // Axes too thin to be split get a single layer of cells
+  const glm::uvec3 cells =
+    glm::uvec3(1U) + glm::uvec3(glm::greaterThan(extent, glm::vec3(2.0f * MIN_PROBE_CELL_SIZE)));
+  const glm::vec3 cellSize = extent / glm::vec3(cells);
+
+  std::vector<ProbeManager::Probe> probes;
+  for (uint32_t z = 0; z < cells.z; ++z)
+  {
+    for (uint32_t y = 0; y < cells.y; ++y)
+    {
+      for (uint32_t x = 0; x < cells.x; ++x)
+      {
+        probes.push_back(ProbeManager::Probe{
+          .position = bounds.min + (glm::vec3(x, y, z) + 0.5f) * cellSize,
+          .radius = std::max(0.5f * glm::length(cellSize), MIN_PROBE_CELL_SIZE),
+        });
+      }
+    }
+  }
+
+  return probes;
+}
+
+static void buffer_barrier(
+  vk::CommandBuffer cmd_buf,
+  vk::Buffer buffer,
+  vk::PipelineStageFlags src_stage,
+  vk::AccessFlags src_access,
+  vk::PipelineStageFlags dst_stage,
+  vk::AccessFlags dst_access)
+{
+  vk::BufferMemoryBarrier barrier;
+  barrier.setSrcAccessMask(src_access);
+  barrier.setDstAccessMask(dst_access);
+  barrier.setBuffer(buffer);
+  barrier.setSize(vk::WholeSize);
+
+  cmd_buf.pipelineBarrier(src_stage, dst_stage, {}, {}, barrier, {});
+}
+
+WorldRenderer::WorldRenderer(bool memory_budget_supported)
   : sceneMgr{std::make_unique<SceneManager>()}
   , environmentManager({})
+  , probeManager({})
   , shadowCameraBuffer(
       etna::get_context().getMainWorkCount(),
       [](std::size_t fif) {
@@ -75,7 +149,17 @@ WorldRenderer::WorldRenderer()
     buffer.map();
     return buffer;
   })
+  , memoryTracker(memory_budget_supported)
 {
+  memoryTracker.addSource(
+    [this](GpuMemoryTracker::Collector& collector) { sceneMgr->reportMemory(collector); });
+  memoryTracker.addSource([this](GpuMemoryTracker::Collector& collector) {
+    environmentManager.reportMemory(collector);
+  });
+  memoryTracker.addSource(
+    [this](GpuMemoryTracker::Collector& collector) { probeManager.reportMemory(collector); });
+  memoryTracker.addSource(
+    [this](GpuMemoryTracker::Collector& collector) { reportMemory(collector); });
 }
 
 void WorldRenderer::allocateResources(glm::uvec2 swapchain_resolution)
@@ -84,8 +168,6 @@ void WorldRenderer::allocateResources(glm::uvec2 swapchain_resolution)
 
   resolution = swapchain_resolution;
 
-  recreateMaterialTextureSampler();
-
   linearSamplerRepeat = etna::Sampler(etna::Sampler::CreateInfo{
     .filter = vk::Filter::eLinear,
     .addressMode = vk::SamplerAddressMode::eRepeat,
@@ -111,9 +193,7 @@ void WorldRenderer::allocateResources(glm::uvec2 swapchain_resolution)
   });
 
   environmentManager.allocateResources();
-  hizPass.allocateResources(swapchain_resolution, HiZPass::FULL_MIPCHAIN);
-  taaPass.allocateResources(swapchain_resolution, vk::Format::eR8G8B8A8Unorm);
-  sharpenPass.allocateResources(swapchain_resolution, vk::Format::eR8G8B8A8Unorm);
+  probeManager.allocateResources();
 
   /* Shadow Pass */
   shadowMap = ctx.createImage(etna::Image::CreateInfo{
@@ -124,51 +204,132 @@ void WorldRenderer::allocateResources(glm::uvec2 swapchain_resolution)
       vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled,
   });
 
+  allocateRenderTargets();
+}
+
+glm::uvec2 WorldRenderer::getRenderExtent() const
+{
+  return getScaledResolution(renderScale);
+}
+
+glm::uvec2 WorldRenderer::getScaledResolution(float scale) const
+{
+  const auto scaled = glm::round(glm::vec2(resolution) * scale);
+  return glm::max(glm::uvec2(scaled), glm::uvec2(1));
+}
+
+void WorldRenderer::allocateRenderTargets()
+{
+  auto& ctx = etna::get_context();
+
+  renderExtent = getRenderExtent();
+  renderResolution = renderExtent;
+  dynamicResolution.reset();
+
+  // Textures are sampled at the output resolution's rate once the samples of several frames are
+  // accumulated, so their mips are biased accordingly
+  recreateMaterialTextureSampler();
+
+  hizPass.allocateResources(renderExtent, HiZPass::FULL_MIPCHAIN);
+
+  taaPass.allocateResources(renderExtent, resolution, vk::Format::eR8G8B8A8Unorm);
+
   /* Geometry Pass */
   depth = ctx.createImage(etna::Image::CreateInfo{
-    .extent = vk::Extent3D{resolution.x, resolution.y, 1},
+    .extent = vk::Extent3D{renderExtent.x, renderExtent.y, 1},
     .name = "depth",
-    .format = vk::Format::eD32Sfloat,
+    .format = RenderView::DEPTH_FORMAT,
     .imageUsage =
       vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled,
   });
 
-  gBufferAlbedo = ctx.createImage(etna::Image::CreateInfo{
-    .extent = vk::Extent3D{resolution.x, resolution.y, 1},
-    .name = "gBufferAlbedo",
-    .format = GBUFFER_ALBEDO_FORMAT,
-    .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
-  });
+  // Only the images of the selected layout are allocated
+  gBufferIsPacked = packGBuffer;
+  gBufferAlbedo = {};
+  gBufferMetalnessRoughness = {};
+  gBufferNorm = {};
+  gBufferPacked = {};
+  if (gBufferIsPacked)
+  {
+    gBufferPacked = ctx.createImage(etna::Image::CreateInfo{
+      .extent = vk::Extent3D{renderExtent.x, renderExtent.y, 1},
+      .name = "gBufferPacked",
+      .format = RenderView::GBUFFER_PACKED_FORMAT,
+      .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
+    });
+  }
+  else
+  {
+    gBufferAlbedo = ctx.createImage(etna::Image::CreateInfo{
+      .extent = vk::Extent3D{renderExtent.x, renderExtent.y, 1},
+      .name = "gBufferAlbedo",
+      .format = RenderView::GBUFFER_ALBEDO_FORMAT,
+      .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
+    });
 
-  gBufferMetalnessRoughness = ctx.createImage(etna::Image::CreateInfo{
-    .extent = vk::Extent3D{resolution.x, resolution.y, 1},
-    .name = "gBufferMetalnessRoughness",
-    .format = GBUFFER_METALNESS_ROUGHNESS_FORMAT,
-    .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
-  });
+    gBufferMetalnessRoughness = ctx.createImage(etna::Image::CreateInfo{
+      .extent = vk::Extent3D{renderExtent.x, renderExtent.y, 1},
+      .name = "gBufferMetalnessRoughness",
+      .format = RenderView::GBUFFER_METALNESS_ROUGHNESS_FORMAT,
+      .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
+    });
 
-  gBufferNorm = ctx.createImage(etna::Image::CreateInfo{
-    .extent = vk::Extent3D{resolution.x, resolution.y, 1},
-    .name = "gBufferNorm",
-    .format = GBUFFER_NORM_FORMAT,
-    .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
+    gBufferNorm = ctx.createImage(etna::Image::CreateInfo{
+      .extent = vk::Extent3D{renderExtent.x, renderExtent.y, 1},
+      .name = "gBufferNorm",
+      .format = RenderView::GBUFFER_NORM_FORMAT,
+      .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
+    });
+  }
+
+  /* Deferred Pass */
+  // Reflection probes are shaded with the same lists, so they have to fit their tiles as well
+  const auto maxTileCounts =
+    (glm::max(renderExtent, glm::uvec2(ProbeManager::PROBE_RESOLUTION)) + DEFERRED_TILE_SIZE - 1U) /
+    DEFERRED_TILE_SIZE;
+  deferredTileListStride = maxTileCounts.x * maxTileCounts.y;
+  deferredTileLists = ctx.createBuffer(etna::Buffer::CreateInfo{
+    .size = DEFERRED_TILE_CLASS_COUNT *
+      (sizeof(vk::DispatchIndirectCommand) + deferredTileListStride * sizeof(uint32_t)),
+    .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer |
+      vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+    .name = "deferredTileLists",
   });
 }
 
 void WorldRenderer::loadScene(std::filesystem::path path)
 {
   sceneMgr->selectScene(path);
+  probeManager.setProbes(place_reflection_probes(sceneMgr->getSceneBounds()));
 
   environmentManager.computeEnvBRDF();
 
+  // Only the initially selected environment is loaded up front, the rest are loaded on demand
   for (const auto& envPath : ENVIRONMENT_FILEPATHS)
   {
-    environmentManager.loadEnvironment(envPath);
+    environmentManager.addEnvironment(envPath);
   }
 
+  // Rendering and the GUI need a resident environment from the very first frame
+  environmentManager.waitForEnvironment(environmentIdx);
+  if (environmentManager.getEnvironment(environmentIdx) == nullptr)
+    ETNA_PANIC(
+      "Failed to load the initial environment '{}'", ENVIRONMENT_FILEPATHS[environmentIdx]);
+  displayedEnvironmentIdx = environmentIdx;
+
   auto instancesCount = sceneMgr->getInstanceMatrices().size();
   transforms.getPrevious().resize(instancesCount);
   transforms.getCurrent().resize(instancesCount);
+
+  // Reloading scenes should keep these flat, growth points to leaked resources
+  memoryTracker.update();
+  const auto& memory = memoryTracker.getSnapshot();
+  spdlog::info(
+    "GPU memory after loading '{}': {:.1f} MiB tracked, {:.1f} MiB untracked",
+    path.string(),
+    static_cast<double>(memory.tracked) / (1 << 20),
+    static_cast<double>(memory.untracked) / (1 << 20));
 }
 
 void WorldRenderer::loadShaders()
@@ -179,7 +340,19 @@ void WorldRenderer::loadShaders()
     "geometry_pass",
     {DEMO_SHADERS_ROOT "geometry_pass.vert.spv", DEMO_SHADERS_ROOT "geometry_pass.frag.spv"});
 
-  etna::create_program("deferred_pass", {DEMO_SHADERS_ROOT "deferred_pass.comp.spv"});
+  etna::create_program(
+    "geometry_pass_packed",
+    {DEMO_SHADERS_ROOT "geometry_pass.vert.spv",
+     DEMO_SHADERS_ROOT "geometry_pass_packed.frag.spv"});
+
+  for (const bool packedGBuffer : {false, true})
+  {
+    for (const char* name : DEFERRED_PROGRAMS)
+    {
+      const auto program = get_deferred_program(name, packedGBuffer);
+      etna::create_program(program, {DEMO_SHADERS_ROOT + program + ".comp.spv"});
+    }
+  }
 
   etna::create_program(
     "render_cubemap", {DEMO_SHADERS_ROOT "cubemap.vert.spv", DEMO_SHADERS_ROOT "cubemap.frag.spv"});
@@ -187,7 +360,6 @@ void WorldRenderer::loadShaders()
   environmentManager.loadShaders();
   hizPass.loadShaders();
   taaPass.loadShaders();
-  sharpenPass.loadShaders();
 }
 
 void WorldRenderer::setupPipelines(vk::Format swapchain_format)
@@ -231,37 +403,61 @@ void WorldRenderer::setupPipelines(vk::Format swapchain_format)
       vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA,
   };
 
-  geometryPassPipeline = pipelineManager.createGraphicsPipeline(
+  auto createGeometryPassPipeline = [&](const char* program, std::vector<vk::Format> formats) {
+    return pipelineManager.createGraphicsPipeline(
+      program,
+      etna::GraphicsPipeline::CreateInfo{
+        .vertexShaderInput = sceneVertexInputDesc,
+        .rasterizationConfig =
+          vk::PipelineRasterizationStateCreateInfo{
+            .polygonMode = vk::PolygonMode::eFill,
+            .cullMode = vk::CullModeFlagBits::eBack,
+            .frontFace = vk::FrontFace::eCounterClockwise,
+            .lineWidth = 1.f,
+          },
+        .blendingConfig =
+          {
+            .attachments =
+              std::vector<vk::PipelineColorBlendAttachmentState>(formats.size(), BLEND_STATE),
+            .logicOpEnable = false,
+            .logicOp = vk::LogicOp::eAnd,
+          },
+        .fragmentShaderOutput =
+          {
+            .colorAttachmentFormats = formats,
+            .depthAttachmentFormat = RenderView::DEPTH_FORMAT,
+          },
+      });
+  };
+
+  geometryPassPipeline = createGeometryPassPipeline(
     "geometry_pass",
-    etna::GraphicsPipeline::CreateInfo{
-      .vertexShaderInput = sceneVertexInputDesc,
-      .rasterizationConfig =
-        vk::PipelineRasterizationStateCreateInfo{
-          .polygonMode = vk::PolygonMode::eFill,
-          .cullMode = vk::CullModeFlagBits::eBack,
-          .frontFace = vk::FrontFace::eCounterClockwise,
-          .lineWidth = 1.f,
-        },
-      .blendingConfig =
-        {
-          .attachments = {BLEND_STATE, BLEND_STATE, BLEND_STATE, BLEND_STATE},
-          .logicOpEnable = false,
-          .logicOp = vk::LogicOp::eAnd,
-        },
-      .fragmentShaderOutput =
-        {
-          .colorAttachmentFormats =
-            {
-              GBUFFER_ALBEDO_FORMAT,
-              GBUFFER_METALNESS_ROUGHNESS_FORMAT,
-              GBUFFER_NORM_FORMAT,
-              vk::Format::eR16G16Sfloat,
-            },
-          .depthAttachmentFormat = vk::Format::eD32Sfloat,
-        },
+    {
+      RenderView::GBUFFER_ALBEDO_FORMAT,
+      RenderView::GBUFFER_METALNESS_ROUGHNESS_FORMAT,
+      RenderView::GBUFFER_NORM_FORMAT,
+      RenderView::MOTION_VECTORS_FORMAT,
+    });
+  geometryPassPackedPipeline = createGeometryPassPipeline(
+    "geometry_pass_packed",
+    {
+      RenderView::GBUFFER_PACKED_FORMAT,
+      RenderView::MOTION_VECTORS_FORMAT,
     });
 
-  deferredPassPipeline = pipelineManager.createComputePipeline("deferred_pass", {});
+  for (const bool packedGBuffer : {false, true})
+  {
+    auto& pipelines = deferredPipelines[packedGBuffer ? 1 : 0];
+    pipelines.classify = pipelineManager.createComputePipeline(
+      get_deferred_program(DEFERRED_PROGRAMS[0], packedGBuffer), {});
+    for (uint32_t i = 0; i < DEFERRED_TILE_CLASS_COUNT; ++i)
+    {
+      const auto program = get_deferred_program(DEFERRED_PROGRAMS[i + 1], packedGBuffer);
+      pipelines.shade[i] = pipelineManager.createComputePipeline(program, {});
+      pipelines.shadePermutations[i] = PipelinePermutations(
+        program, DEMO_SHADERS_ROOT + program + ".comp.spv", DeferredToggleCount);
+    }
+  }
 
   renderCubemapPipeline = pipelineManager.createGraphicsPipeline(
     "render_cubemap",
@@ -291,15 +487,27 @@ void WorldRenderer::setupPipelines(vk::Format swapchain_format)
 
       .fragmentShaderOutput =
         {
-          .colorAttachmentFormats = {vk::Format::eR8G8B8A8Unorm},
-          .depthAttachmentFormat = vk::Format::eD32Sfloat,
+          .colorAttachmentFormats = {RenderView::TARGET_FORMAT},
+          .depthAttachmentFormat = RenderView::DEPTH_FORMAT,
         },
     });
 
   environmentManager.setupPipelines();
+  probeManager.setupPipelines();
   hizPass.setupPipelines();
-  taaPass.setupPipelines();
-  sharpenPass.setupPipelines();
+  taaPass.setupPipelines(swapchain_format);
+}
+
+void WorldRenderer::waitPendingPipelines()
+{
+  for (auto& pipelines : deferredPipelines)
+  {
+    for (auto& permutations : pipelines.shadePermutations)
+      permutations.waitPending();
+  }
+
+  hizPass.waitPendingPipelines();
+  taaPass.waitPendingPipelines();
 }
 
 void WorldRenderer::debugInput(const Keyboard& kb)
@@ -315,6 +523,37 @@ void WorldRenderer::update(const FramePacket& packet)
 {
   ZoneScoped;
 
+  updateDeferredBenchmark();
+
+  if (getRenderExtent() != renderExtent || packGBuffer != gBufferIsPacked)
+  {
+    ETNA_CHECK_VK_RESULT(etna::get_context().getDevice().waitIdle());
+    allocateRenderTargets();
+  }
+
+  // The render scale caps the dynamic one, so the targets never have to be reallocated for it
+  if (enableDynamicResolution)
+  {
+    dynamicResolution.getMaxScale() = renderScale;
+    dynamicResolution.getMinScale() = std::min(dynamicResolution.getMinScale(), renderScale);
+    const float scale = dynamicResolution.update(frameGraph.getGpuTimeMs());
+    renderResolution = glm::min(getScaledResolution(scale), renderExtent);
+  }
+  else
+  {
+    renderResolution = renderExtent;
+  }
+  taaPass.setRenderResolution(renderResolution);
+
+  // Keep displaying the previous environment until the selected one becomes resident
+  {
+    environmentManager.update();
+    environmentManager.requestEnvironment(environmentIdx);
+
+    if (environmentManager.getEnvironment(environmentIdx) != nullptr)
+      displayedEnvironmentIdx = environmentIdx;
+  }
+
   // update light data
   {
     auto* dst = lightBuffer.get().data();
@@ -368,15 +607,10 @@ void WorldRenderer::update(const FramePacket& packet)
     mainCamera.wsRight = packet.mainCam.right();
     mainCamera.wsUp = packet.mainCam.up();
     mainCamera.jitterNDC = jitter;
-    mainCamera.jitterPixels = (jitter / 2.0f) * glm::vec2(resolution);
+    mainCamera.jitterPixels = (jitter / 2.0f) * glm::vec2(renderResolution);
 
     std::memcpy(currCameraBuffer.get().data(), &cameraData.getCurrent(), sizeof(CameraData));
     std::memcpy(prevCameraBuffer.get().data(), &cameraData.getPrevious(), sizeof(CameraData));
-
-    pushConstDeferredPass.proj22 = proj[2][2];
-    pushConstDeferredPass.proj23 = proj[3][2];
-    pushConstDeferredPass.invProj00 = 1.0f / proj[0][0];
-    pushConstDeferredPass.invProj11 = 1.0f / proj[1][1];
   }
 
   // update transforms
@@ -411,6 +645,106 @@ void WorldRenderer::update(const FramePacket& packet)
   }
 }
 
+uint32_t WorldRenderer::getDeferredToggles(uint32_t tile_class) const
+{
+  // Sky tiles aren't lit, emissive ones only emit and only complex ones have point lights, so the
+  // toggles a variant doesn't read are left out of its key instead of compiling duplicates
+  constexpr uint32_t ALL_TOGGLES = (1U << DeferredToggleCount) - 1U;
+  constexpr std::array<uint32_t, DEFERRED_TILE_CLASS_COUNT> TILE_CLASS_TOGGLES = {
+    0U,
+    1U << DeferredToggleEmission,
+    ALL_TOGGLES & ~(1U << DeferredTogglePointLights),
+    ALL_TOGGLES,
+  };
+
+  const auto toggle = [](shader_bool enabled, DeferredToggle bit) {
+    return enabled != 0 ? 1U << bit : 0U;
+  };
+
+  const uint32_t toggles = toggle(pushConstDeferredPass.enableEmission, DeferredToggleEmission) |
+    toggle(pushConstDeferredPass.enableDiffuseIBL, DeferredToggleDiffuseIBL) |
+    toggle(pushConstDeferredPass.enableSpecularIBL, DeferredToggleSpecularIBL) |
+    toggle(pushConstDeferredPass.enableDirectionalLight, DeferredToggleDirectionalLight) |
+    toggle(pushConstDeferredPass.enablePointLights, DeferredTogglePointLights);
+
+  return toggles & TILE_CLASS_TOGGLES[tile_class];
+}
+
+static void apply_deferred_benchmark_config(uint32_t config, bool& swizzle, bool& pack)
+{
+  swizzle = (config & 1U) != 0;
+  pack = (config & 2U) != 0;
+}
+
+void WorldRenderer::startDeferredBenchmark()
+{
+  auto& benchmark = deferredBenchmark;
+  benchmark.running = true;
+  benchmark.config = 0;
+  benchmark.frame = 0;
+  benchmark.totalMs = 0.0f;
+  benchmark.measuredFrames = 0;
+  benchmark.averageMs.fill(-1.0f);
+  benchmark.prevSwizzle = swizzleDeferredTiles;
+  benchmark.prevPack = packGBuffer;
+  benchmark.prevDynamicResolution = enableDynamicResolution;
+
+  enableDynamicResolution = false;
+  apply_deferred_benchmark_config(0, swizzleDeferredTiles, packGBuffer);
+}
+
+void WorldRenderer::updateDeferredBenchmark()
+{
+  // Timings come back with the latency of the frames in flight, and the first frames after a
+  // switch of the layout pay for the reallocation, so they are skipped
+  constexpr uint32_t WARMUP_FRAMES = 8;
+  constexpr uint32_t MEASURED_FRAMES = 120;
+
+  auto& benchmark = deferredBenchmark;
+  if (!benchmark.running)
+    return;
+
+  if (benchmark.frame >= WARMUP_FRAMES)
+  {
+    for (const auto& timing : frameGraph.getPassTimings())
+    {
+      if (timing.name == "Deferred" && timing.ms >= 0.0f)
+      {
+        benchmark.totalMs += timing.ms;
+        ++benchmark.measuredFrames;
+      }
+    }
+  }
+
+  if (++benchmark.frame < WARMUP_FRAMES + MEASURED_FRAMES)
+    return;
+
+  const uint32_t config = benchmark.config;
+  if (benchmark.measuredFrames > 0)
+    benchmark.averageMs[config] = benchmark.totalMs / static_cast<float>(benchmark.measuredFrames);
+  spdlog::info(
+    "Deferred benchmark: swizzle {}, packed {}: {:.3f} ms over {} frames",
+    (config & 1U) != 0,
+    (config & 2U) != 0,
+    benchmark.averageMs[config],
+    benchmark.measuredFrames);
+
+  benchmark.frame = 0;
+  benchmark.totalMs = 0.0f;
+  benchmark.measuredFrames = 0;
+
+  if (++benchmark.config < DeferredBenchmark::CONFIG_COUNT)
+  {
+    apply_deferred_benchmark_config(benchmark.config, swizzleDeferredTiles, packGBuffer);
+    return;
+  }
+
+  benchmark.running = false;
+  swizzleDeferredTiles = benchmark.prevSwizzle;
+  packGBuffer = benchmark.prevPack;
+  enableDynamicResolution = benchmark.prevDynamicResolution;
+}
+
 void WorldRenderer::recreateMaterialTextureSampler()
 {
   const vk::SamplerCreateInfo createInfo {
@@ -420,7 +754,7 @@ void WorldRenderer::recreateMaterialTextureSampler()
     .addressModeU = vk::SamplerAddressMode::eRepeat,
     .addressModeV = vk::SamplerAddressMode::eRepeat,
     .addressModeW = vk::SamplerAddressMode::eRepeat,
-    .mipLodBias = materialTextureMipBias,
+    .mipLodBias = materialTextureMipBias + std::log2(renderScale),
     .maxAnisotropy = 1.0f,
     .minLod = 0.0f,
     .maxLod = vk::LodClampNone,
@@ -468,6 +802,7 @@ void WorldRenderer::renderScene(
         float metalness;
         float roughness;
         shader_bool unjitterTextureUVs;
+        uint32_t materialIdx;
       } pushConst {
         .prevModel = transforms.getPrevious()[instIdx],
         .currModel = transforms.getCurrent()[instIdx],
@@ -476,6 +811,7 @@ void WorldRenderer::renderScene(
         .metalness = relem.material->metalness,
         .roughness = relem.material->roughness,
         .unjitterTextureUVs = static_cast<shader_bool>(unjitterTextureUVs),
+        .materialIdx = static_cast<uint32_t>(relem.material - sceneMgr->getMaterials().data()),
       };
 
       cmd_buf.pushConstants<PushConstant>(
@@ -526,372 +862,515 @@ void WorldRenderer::renderScene(
   }
 }
 
-void WorldRenderer::renderWorld(
-  vk::CommandBuffer cmd_buf,
-  [[maybe_unused]] vk::Image target_image,
-  [[maybe_unused]] vk::ImageView target_image_view)
+void WorldRenderer::geometryPass(vk::CommandBuffer cmd_buf, const RenderView& view)
 {
-  ETNA_PROFILE_GPU(cmd_buf, renderWorld);
-
-  auto& environment = environmentManager.getEnvironments()[environmentIdx];
+  ETNA_PROFILE_GPU(cmd_buf, geometryPass);
+
+  const bool packedGBuffer = view.gBufferPacked != nullptr;
+  auto geometryPassInfo =
+    etna::get_shader_program(packedGBuffer ? "geometry_pass_packed" : "geometry_pass");
+  const auto& pipeline = packedGBuffer ? geometryPassPackedPipeline : geometryPassPipeline;
+  auto cameraSet = etna::create_descriptor_set(
+    geometryPassInfo.getDescriptorLayoutId(0),
+    cmd_buf,
+    {
+      etna::Binding{0, view.prevCamera.genBinding()},
+      etna::Binding{1, view.currCamera.genBinding()},
+      etna::Binding{2, sceneMgr->getTextureStreamer().getFeedbackBuffer().genBinding()},
+    });
 
-  // Shadow Pass
+  // In the order of the outputs of GeometryPass.glsl
+  std::vector<etna::RenderTargetState::AttachmentParams> colorAttachments;
+  for (etna::Image* image :
+       {view.gBufferAlbedo,
+        view.gBufferMetalnessRoughness,
+        view.gBufferNorm,
+        view.gBufferPacked,
+        &view.motionVectors})
   {
-    ETNA_PROFILE_GPU(cmd_buf, shadowPass);
-
-    auto shadowPassInfo = etna::get_shader_program("shadow_pass");
-    auto cameraSet = etna::create_descriptor_set(
-      shadowPassInfo.getDescriptorLayoutId(0),
-      cmd_buf,
-      {
-        etna::Binding{0, shadowCameraBuffer.get().genBinding()},
-        etna::Binding{1, shadowCameraBuffer.get().genBinding()},
+    if (image != nullptr)
+    {
+      colorAttachments.push_back({
+        .image = image->get(),
+        .view = image->getView({}),
+        .clearColorValue = {0.0f, 0.0f, 0.0f, 0.0f},
       });
+    }
+  }
 
-    etna::RenderTargetState renderTargets(
-      cmd_buf,
-      {{0, 0}, {2048, 2048}},
-      {},
-      {.image = shadowMap.get(), .view = shadowMap.getView({})});
-
-    cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, shadowPassPipeline.getVkPipeline());
-    cmd_buf.bindDescriptorSets(
-      vk::PipelineBindPoint::eGraphics,
-      shadowPassPipeline.getVkPipelineLayout(),
-      0,
-      {cameraSet.getVkSet()},
-      {});
+  etna::RenderTargetState renderTargets(
+    cmd_buf,
+    {{0, 0}, {view.extent.x, view.extent.y}},
+    colorAttachments,
+    {.image = view.depth.get(), .view = view.depth.getView({})});
+
+  cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.getVkPipeline());
+  cmd_buf.bindDescriptorSets(
+    vk::PipelineBindPoint::eGraphics,
+    pipeline.getVkPipelineLayout(),
+    0,
+    {cameraSet.getVkSet()},
+    {});
+
+  renderScene(cmd_buf, geometryPassInfo, true);
+}
 
-    renderScene(cmd_buf, shadowPassInfo, false);
+void WorldRenderer::deferredPass(
+  vk::CommandBuffer cmd_buf,
+  const RenderView& view,
+  const EnvironmentManager::Environment& environment)
+{
+  ETNA_PROFILE_GPU(cmd_buf, deferredPass);
+
+  etna::set_state(
+    cmd_buf,
+    view.target.get(),
+    vk::PipelineStageFlagBits2::eComputeShader,
+    vk::AccessFlagBits2::eShaderStorageWrite,
+    vk::ImageLayout::eGeneral,
+    vk::ImageAspectFlagBits::eColor);
+
+  const bool packedGBuffer = view.gBufferPacked != nullptr;
+  const std::array gBuffer = {
+    view.gBufferAlbedo, view.gBufferMetalnessRoughness, view.gBufferNorm, view.gBufferPacked};
+  for (etna::Image* image : gBuffer)
+  {
+    if (image != nullptr)
+    {
+      etna::set_state(
+        cmd_buf,
+        image->get(),
+        vk::PipelineStageFlagBits2::eComputeShader,
+        vk::AccessFlagBits2::eShaderSampledRead,
+        vk::ImageLayout::eShaderReadOnlyOptimal,
+        vk::ImageAspectFlagBits::eColor);
+    }
   }
 
-  // Geometry Pass
+  etna::set_state(
+    cmd_buf,
+    view.depth.get(),
+    vk::PipelineStageFlagBits2::eComputeShader,
+    vk::AccessFlagBits2::eShaderSampledRead,
+    vk::ImageLayout::eShaderReadOnlyOptimal,
+    vk::ImageAspectFlagBits::eDepth);
+
+  etna::set_state(
+    cmd_buf,
+    shadowMap.get(),
+    vk::PipelineStageFlagBits2::eComputeShader,
+    vk::AccessFlagBits2::eShaderSampledRead,
+    vk::ImageLayout::eShaderReadOnlyOptimal,
+    vk::ImageAspectFlagBits::eDepth);
+
+  etna::set_state(
+    cmd_buf,
+    probeManager.getPrefilteredAtlas().get(),
+    vk::PipelineStageFlagBits2::eComputeShader,
+    vk::AccessFlagBits2::eShaderSampledRead,
+    vk::ImageLayout::eShaderReadOnlyOptimal,
+    vk::ImageAspectFlagBits::eColor);
+
+  etna::flush_barriers(cmd_buf);
+
+  // Every variant includes the declarations of the classification pass, so they share its layout
+  auto deferredPassInfo =
+    etna::get_shader_program(get_deferred_program("deferred_classify", packedGBuffer));
+  const auto& pipelines = deferredPipelines[packedGBuffer];
+
+  auto cameraSet = etna::create_descriptor_set(
+    deferredPassInfo.getDescriptorLayoutId(0),
+    cmd_buf,
+    {
+      etna::Binding{0, view.currCamera.genBinding()},
+    });
+
+  std::vector<etna::Binding> bindings = {
+    etna::Binding(0, view.target.genBinding(nullptr, vk::ImageLayout::eGeneral)),
+  };
+  // The packed layout takes the binding of the albedo, see DeferredShading.glsl
+  uint32_t gBufferBinding = 1;
+  for (etna::Image* image : gBuffer)
   {
-    ETNA_PROFILE_GPU(cmd_buf, geometryPass);
+    if (image != nullptr)
+    {
+      bindings.emplace_back(
+        gBufferBinding++,
+        image->genBinding(pointSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal));
+    }
+  }
 
-    auto geometryPassInfo = etna::get_shader_program("geometry_pass");
-    auto cameraSet = etna::create_descriptor_set(
-      geometryPassInfo.getDescriptorLayoutId(0),
-      cmd_buf,
-      {
-        etna::Binding{0, prevCameraBuffer.get().genBinding()},
-        etna::Binding{1, currCameraBuffer.get().genBinding()},
-      });
+  bindings.insert(
+    bindings.end(),
+    {
+      etna::Binding(
+        4, view.depth.genBinding(pointSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)),
+      etna::Binding(
+        5, shadowMap.genBinding(pointSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)),
+      etna::Binding(
+        6,
+        environment.prefilteredEnvMap.genBinding(
+          linearSamplerRepeat.get(),
+          vk::ImageLayout::eShaderReadOnlyOptimal,
+          etna::Image::ViewParams{
+            0,
+            vk::RemainingMipLevels,
+            0,
+            vk::RemainingArrayLayers,
+            {},
+            vk::ImageViewType::eCube,
+          })),
+      etna::Binding(
+        7,
+        environmentManager.getEnvBRDF().genBinding(
+          linearSamplerClampToEdge.get(), vk::ImageLayout::eShaderReadOnlyOptimal)),
+
+      etna::Binding(8, shadowCameraBuffer.get().genBinding()),
+      etna::Binding(9, lightBuffer.get().genBinding()),
+      etna::Binding(10, environment.irradianceSHCoefficientBuffer.genBinding()),
+
+      etna::Binding(
+        11,
+        probeManager.getPrefilteredAtlas().genBinding(
+          linearSamplerRepeat.get(),
+          vk::ImageLayout::eShaderReadOnlyOptimal,
+          etna::Image::ViewParams{
+            0,
+            vk::RemainingMipLevels,
+            0,
+            vk::RemainingArrayLayers,
+            {},
+            vk::ImageViewType::eCubeArray,
+          })),
+      etna::Binding(12, probeManager.getIrradianceSHBuffer().genBinding()),
+      etna::Binding(13, probeManager.getProbeBuffer().genBinding()),
+      etna::Binding(14, deferredTileLists.genBinding()),
+    });
 
-    etna::RenderTargetState renderTargets(
-      cmd_buf,
-      {{0, 0}, {resolution.x, resolution.y}},
+  auto resourceSet = etna::create_descriptor_set(
+    deferredPassInfo.getDescriptorLayoutId(1), cmd_buf, std::move(bindings));
+
+  // The lists are reused by every view of the frame and by the next frame
+  buffer_barrier(
+    cmd_buf,
+    deferredTileLists.get(),
+    vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eComputeShader,
+    vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eShaderRead,
+    vk::PipelineStageFlagBits::eTransfer,
+    vk::AccessFlagBits::eTransferWrite);
+
+  std::array<vk::DispatchIndirectCommand, DEFERRED_TILE_CLASS_COUNT> emptyDispatches;
+  emptyDispatches.fill(vk::DispatchIndirectCommand{0, 1, 1});
+  cmd_buf.updateBuffer<vk::DispatchIndirectCommand>(deferredTileLists.get(), 0, emptyDispatches);
+
+  buffer_barrier(
+    cmd_buf,
+    deferredTileLists.get(),
+    vk::PipelineStageFlagBits::eTransfer,
+    vk::AccessFlagBits::eTransferWrite,
+    vk::PipelineStageFlagBits::eComputeShader,
+    vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+
+  // The variants are compatible with the layout, so the sets and push constants stay bound
+  cmd_buf.bindPipeline(vk::PipelineBindPoint::eCompute, pipelines.classify.getVkPipeline());
+  cmd_buf.bindDescriptorSets(
+    vk::PipelineBindPoint::eCompute,
+    pipelines.classify.getVkPipelineLayout(),
+    0,
+    {cameraSet.getVkSet(), resourceSet.getVkSet()},
+    {});
+
+  // Lighting toggles come from the GUI, the rest depends on the view
+  auto pushConst = pushConstDeferredPass;
+  pushConst.resolution = view.extent;
+  pushConst.invResolution = 1.0f / glm::vec2(view.extent);
+  pushConst.proj22 = view.proj[2][2];
+  pushConst.proj23 = view.proj[3][2];
+  pushConst.invProj00 = 1.0f / view.proj[0][0];
+  pushConst.invProj11 = 1.0f / view.proj[1][1];
+  pushConst.envMapMips = environmentManager.getPrefilteredEnvMapMips();
+  pushConst.probeCount = probeManager.getProbeCount();
+  pushConst.probeMask =
+    view.sampleProbes && enableProbes ? probeManager.getPublishedMask() : 0U;
+  pushConst.probeMips = ProbeManager::PROBE_MIPS;
+  pushConst.tileListStride = deferredTileListStride;
+  pushConst.swizzleTiles = swizzleDeferredTiles;
+
+  cmd_buf.pushConstants<PushConstantDeferredPass>(
+    deferredPassInfo.getPipelineLayout(), vk::ShaderStageFlagBits::eCompute, 0, {pushConst});
+
+  const auto tileCounts = (view.extent + DEFERRED_TILE_SIZE - 1U) / DEFERRED_TILE_SIZE;
+  cmd_buf.dispatch(tileCounts.x, tileCounts.y, 1);
+
+  buffer_barrier(
+    cmd_buf,
+    deferredTileLists.get(),
+    vk::PipelineStageFlagBits::eComputeShader,
+    vk::AccessFlagBits::eShaderWrite,
+    vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eComputeShader,
+    vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eShaderRead);
+
+  for (uint32_t i = 0; i < DEFERRED_TILE_CLASS_COUNT; ++i)
+  {
+    const vk::Pipeline pipeline =
+      pipelines.shadePermutations[i].get(getDeferredToggles(i), pipelines.shade[i].getVkPipeline());
+    cmd_buf.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+    cmd_buf.dispatchIndirect(deferredTileLists.get(), i * sizeof(vk::DispatchIndirectCommand));
+  }
+}
 
-      {
-        {
-          .image = gBufferAlbedo.get(),
-          .view = gBufferAlbedo.getView({}),
-          .clearColorValue = {0.0f, 0.0f, 0.0f, 0.0f},
-        },
-        {
-          .image = gBufferMetalnessRoughness.get(),
-          .view = gBufferMetalnessRoughness.getView({}),
-          .clearColorValue = {0.0f, 0.0f, 0.0f, 0.0f},
-        },
-        {
-          .image = gBufferNorm.get(),
-          .view = gBufferNorm.getView({}),
-          .clearColorValue = {0.0f, 0.0f, 0.0f, 0.0f},
-        },
-        {
-          .image = taaPass.getMotionVectors().get(),
-          .view = taaPass.getMotionVectors().getView({}),
-          .clearColorValue = {0.0f, 0.0f, 0.0f, 0.0f},
-        },
-      },
+void WorldRenderer::forwardPass(
+  vk::CommandBuffer cmd_buf,
+  const RenderView& view,
+  const EnvironmentManager::Environment& environment,
+  uint32_t environment_mip)
+{
+  ETNA_PROFILE_GPU(cmd_buf, forwardPass);
 
-      {.image = depth.get(), .view = depth.getView({})});
+  auto renderCubemapInfo = etna::get_shader_program("render_cubemap");
+  auto cubemapSet = etna::create_descriptor_set(
+    renderCubemapInfo.getDescriptorLayoutId(1),
+    cmd_buf,
+    {
+      etna::Binding{
+        0,
+        environment.prefilteredEnvMap.genBinding(
+          linearSamplerRepeat.get(),
+          vk::ImageLayout::eShaderReadOnlyOptimal,
+          etna::Image::ViewParams{
+            environment_mip,
+            1,
+            0,
+            vk::RemainingArrayLayers,
+            {},
+            vk::ImageViewType::eCube,
+          })},
+    });
 
-    cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, geometryPassPipeline.getVkPipeline());
-    cmd_buf.bindDescriptorSets(
-      vk::PipelineBindPoint::eGraphics,
-      geometryPassPipeline.getVkPipelineLayout(),
-      0,
-      {cameraSet.getVkSet()},
-      {});
+  etna::set_state(
+    cmd_buf,
+    view.target.get(),
+    vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+    vk::AccessFlagBits2::eColorAttachmentRead | vk::AccessFlagBits2::eColorAttachmentWrite,
+    vk::ImageLayout::eColorAttachmentOptimal,
+    vk::ImageAspectFlagBits::eColor);
+
+  etna::set_state(
+    cmd_buf,
+    view.depth.get(),
+    vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+      vk::PipelineStageFlagBits2::eLateFragmentTests,
+    vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+      vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+    vk::ImageLayout::eDepthStencilAttachmentOptimal,
+    vk::ImageAspectFlagBits::eDepth);
+
+  etna::flush_barriers(cmd_buf);
+
+  etna::RenderTargetState renderTargets(
+    cmd_buf,
+    {{0, 0}, {view.extent.x, view.extent.y}},
+
+    {{
+      .image = view.target.get(),
+      .view = view.target.getView({}),
+      .loadOp = vk::AttachmentLoadOp::eLoad,
+    }},
 
-    renderScene(cmd_buf, geometryPassInfo, true);
-  }
+    {
+      .image = view.depth.get(),
+      .view = view.depth.getView({}),
+      .loadOp = vk::AttachmentLoadOp::eLoad,
+    });
 
-  auto& deferredTarget = taaPass.getCurrentTarget();
+  auto cameraSet = etna::create_descriptor_set(
+    renderCubemapInfo.getDescriptorLayoutId(0),
+    cmd_buf,
+    {
+      etna::Binding{0, view.currCamera.genBinding()},
+    });
 
-  // Deferred Pass
-  {
-    ETNA_PROFILE_GPU(cmd_buf, deferredPass);
-
-    etna::set_state(
-      cmd_buf,
-      deferredTarget.get(),
-      vk::PipelineStageFlagBits2::eComputeShader,
-      vk::AccessFlagBits2::eShaderStorageWrite,
-      vk::ImageLayout::eGeneral,
-      vk::ImageAspectFlagBits::eColor);
-
-    etna::set_state(
-      cmd_buf,
-      gBufferAlbedo.get(),
-      vk::PipelineStageFlagBits2::eComputeShader,
-      vk::AccessFlagBits2::eShaderSampledRead,
-      vk::ImageLayout::eShaderReadOnlyOptimal,
-      vk::ImageAspectFlagBits::eColor);
-
-    etna::set_state(
-      cmd_buf,
-      gBufferMetalnessRoughness.get(),
-      vk::PipelineStageFlagBits2::eComputeShader,
-      vk::AccessFlagBits2::eShaderSampledRead,
-      vk::ImageLayout::eShaderReadOnlyOptimal,
-      vk::ImageAspectFlagBits::eColor);
-
-    etna::set_state(
-      cmd_buf,
-      gBufferNorm.get(),
-      vk::PipelineStageFlagBits2::eComputeShader,
-      vk::AccessFlagBits2::eShaderSampledRead,
-      vk::ImageLayout::eShaderReadOnlyOptimal,
-      vk::ImageAspectFlagBits::eColor);
-
-    etna::set_state(
-      cmd_buf,
-      depth.get(),
-      vk::PipelineStageFlagBits2::eComputeShader,
-      vk::AccessFlagBits2::eShaderSampledRead,
-      vk::ImageLayout::eShaderReadOnlyOptimal,
-      vk::ImageAspectFlagBits::eDepth);
-
-    etna::set_state(
-      cmd_buf,
-      shadowMap.get(),
-      vk::PipelineStageFlagBits2::eComputeShader,
-      vk::AccessFlagBits2::eShaderSampledRead,
-      vk::ImageLayout::eShaderReadOnlyOptimal,
-      vk::ImageAspectFlagBits::eDepth);
-
-    etna::flush_barriers(cmd_buf);
-
-    auto deferredPassInfo = etna::get_shader_program("deferred_pass");
-
-    auto cameraSet = etna::create_descriptor_set(
-      deferredPassInfo.getDescriptorLayoutId(0),
-      cmd_buf,
-      {
-        etna::Binding{0, currCameraBuffer.get().genBinding()},
-      });
+  cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, renderCubemapPipeline.getVkPipeline());
+  cmd_buf.bindDescriptorSets(
+    vk::PipelineBindPoint::eGraphics,
+    renderCubemapPipeline.getVkPipelineLayout(),
+    0,
+    {
+      cameraSet.getVkSet(),
+      cubemapSet.getVkSet(),
+    },
+    {});
 
-    auto resourceSet = etna::create_descriptor_set(
-      deferredPassInfo.getDescriptorLayoutId(1),
-      cmd_buf,
-      {
-        etna::Binding(0, deferredTarget.genBinding(nullptr, vk::ImageLayout::eGeneral)),
-        etna::Binding(
-          1, gBufferAlbedo.genBinding(pointSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)),
-        etna::Binding(
-          2,
-          gBufferMetalnessRoughness.genBinding(
-            pointSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)),
-        etna::Binding(
-          3, gBufferNorm.genBinding(pointSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)),
-        etna::Binding(
-          4, depth.genBinding(pointSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)),
-        etna::Binding(
-          5, shadowMap.genBinding(pointSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)),
-        etna::Binding(
-          6,
-          environment.prefilteredEnvMap.genBinding(
-            linearSamplerRepeat.get(),
-            vk::ImageLayout::eShaderReadOnlyOptimal,
-            etna::Image::ViewParams{
-              0,
-              vk::RemainingMipLevels,
-              0,
-              vk::RemainingArrayLayers,
-              {},
-              vk::ImageViewType::eCube,
-            })),
-        etna::Binding(
-          7,
-          environmentManager.getEnvBRDF().genBinding(
-            linearSamplerClampToEdge.get(), vk::ImageLayout::eShaderReadOnlyOptimal)),
-
-        etna::Binding(8, shadowCameraBuffer.get().genBinding()),
-        etna::Binding(9, lightBuffer.get().genBinding()),
-        etna::Binding(10, environment.irradianceSHCoefficientBuffer.genBinding()),
-      });
+  cmd_buf.draw(36, 1, 0, 0);
+}
 
-    cmd_buf.bindPipeline(vk::PipelineBindPoint::eCompute, deferredPassPipeline.getVkPipeline());
-    cmd_buf.bindDescriptorSets(
-      vk::PipelineBindPoint::eCompute,
-      deferredPassPipeline.getVkPipelineLayout(),
-      0,
-      {cameraSet.getVkSet(), resourceSet.getVkSet()},
-      {});
+void WorldRenderer::reportMemory(GpuMemoryTracker::Collector& collector)
+{
+  using Category = GpuMemoryTracker::Category;
 
-    pushConstDeferredPass.resolution = resolution;
-    pushConstDeferredPass.invResolution = 1.0f / glm::vec2(resolution);
-    pushConstDeferredPass.envMapMips = environmentManager.getPrefilteredEnvMapMips();
+  const auto framesInFlight =
+    static_cast<uint32_t>(etna::get_context().getMainWorkCount().multiBufferingCount());
 
-    cmd_buf.pushConstants<PushConstantDeferredPass>(
-      deferredPassInfo.getPipelineLayout(),
-      vk::ShaderStageFlagBits::eCompute,
-      0,
-      {pushConstDeferredPass});
+  collector.add(Category::ePasses, "shadowMap", shadowMap);
+  collector.add(Category::ePasses, "depth", depth);
 
-    cmd_buf.dispatch((resolution.x + 15) / 16, (resolution.y + 15) / 16, 1);
-  }
+  collector.add(Category::ePasses, "shadowCamera", shadowCameraBuffer.get(), framesInFlight);
+  collector.add(Category::ePasses, "prevCameraData", prevCameraBuffer.get(), framesInFlight);
+  collector.add(Category::ePasses, "currCameraData", currCameraBuffer.get(), framesInFlight);
+  collector.add(Category::ePasses, "lightData", lightBuffer.get(), framesInFlight);
+  collector.add(Category::ePasses, "deferredTileLists", deferredTileLists);
 
-  // Forward Pass
+  if (gBufferIsPacked)
   {
-    ETNA_PROFILE_GPU(cmd_buf, forwardPass);
+    collector.add(Category::ePasses, "gBufferPacked", gBufferPacked);
+  }
+  else
+  {
+    collector.add(Category::ePasses, "gBufferAlbedo", gBufferAlbedo);
+    collector.add(Category::ePasses, "gBufferMetalnessRoughness", gBufferMetalnessRoughness);
+    collector.add(Category::ePasses, "gBufferNorm", gBufferNorm);
+  }
 
-    auto renderCubemapInfo = etna::get_shader_program("render_cubemap");
-    auto cubemapSet = etna::create_descriptor_set(
-      renderCubemapInfo.getDescriptorLayoutId(1),
-      cmd_buf,
-      {
-        etna::Binding{
-          0,
-          environment.prefilteredEnvMap.genBinding(
-            linearSamplerRepeat.get(),
-            vk::ImageLayout::eShaderReadOnlyOptimal,
-            etna::Image::ViewParams{
-              static_cast<uint32_t>(renderEnvironmentMip),
-              1,
-              0,
-              vk::RemainingArrayLayers,
-              {},
-              vk::ImageViewType::eCube,
-            })},
-      });
+  taaPass.reportMemory(collector);
+  collector.add(Category::ePasses, "HiZPass::hiz", hizPass.getHiZ());
+}
 
-    etna::set_state(
-      cmd_buf,
-      deferredTarget.get(),
-      vk::PipelineStageFlagBits2::eColorAttachmentOutput,
-      vk::AccessFlagBits2::eColorAttachmentRead |
-        vk::AccessFlagBits2::eColorAttachmentWrite,
-      vk::ImageLayout::eColorAttachmentOptimal,
-      vk::ImageAspectFlagBits::eColor);
-
-    etna::set_state(
-      cmd_buf,
-      depth.get(),
-      vk::PipelineStageFlagBits2::eEarlyFragmentTests,
-      vk::AccessFlagBits2::eDepthStencilAttachmentRead |
-        vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
-      vk::ImageLayout::eDepthStencilAttachmentOptimal,
-      vk::ImageAspectFlagBits::eDepth);
-
-    etna::flush_barriers(cmd_buf);
-
-    etna::RenderTargetState renderTargets(
-      cmd_buf,
-      {{0, 0}, {resolution.x, resolution.y}},
-
-      {{
-        .image = deferredTarget.get(),
-        .view = deferredTarget.getView({}),
-        .loadOp = vk::AttachmentLoadOp::eLoad,
-      }},
+void WorldRenderer::renderWorld(
+  vk::CommandBuffer cmd_buf, vk::Image target_image, vk::ImageView target_image_view)
+{
+  ETNA_PROFILE_GPU(cmd_buf, renderWorld);
 
-      {
-        .image = depth.get(),
-        .view = depth.getView({}),
-        .loadOp = vk::AttachmentLoadOp::eLoad,
-      });
+  const auto& environment = *environmentManager.getEnvironment(displayedEnvironmentIdx);
 
-    auto cameraSet = etna::create_descriptor_set(
-      renderCubemapInfo.getDescriptorLayoutId(0),
-      cmd_buf,
-      {
-        etna::Binding{0, currCameraBuffer.get().genBinding()},
-      });
+  // Clears the texture feedback, which every geometry pass of this frame writes to
+  sceneMgr->getTextureStreamer().beginFrame(cmd_buf);
 
-    cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, renderCubemapPipeline.getVkPipeline());
-    cmd_buf.bindDescriptorSets(
-      vk::PipelineBindPoint::eGraphics,
-      renderCubemapPipeline.getVkPipelineLayout(),
-      0,
-      {
-        cameraSet.getVkSet(),
-        cubemapSet.getVkSet(),
-      },
-      {});
+  constexpr auto COLOR = vk::ImageAspectFlagBits::eColor;
+  constexpr auto DEPTH = vk::ImageAspectFlagBits::eDepth;
+
+  auto& deferredTarget = taaPass.getCurrentTarget();
+
+  const RenderView mainView{
+    .extent = renderResolution,
+    .prevCamera = prevCameraBuffer.get(),
+    .currCamera = currCameraBuffer.get(),
+    .proj = cameraData.getCurrent().proj,
+    .gBufferAlbedo = gBufferIsPacked ? nullptr : &gBufferAlbedo,
+    .gBufferMetalnessRoughness = gBufferIsPacked ? nullptr : &gBufferMetalnessRoughness,
+    .gBufferNorm = gBufferIsPacked ? nullptr : &gBufferNorm,
+    .gBufferPacked = gBufferIsPacked ? &gBufferPacked : nullptr,
+    .motionVectors = taaPass.getMotionVectors(),
+    .depth = depth,
+    .target = deferredTarget,
+    .sampleProbes = true,
+  };
 
-    cmd_buf.draw(36, 1, 0, 0);
+  frameGraph.reset();
+
+  const auto shadowMapId = frameGraph.importImage("shadowMap", shadowMap.get(), DEPTH);
+  const auto probeAtlasId = frameGraph.importImage(
+    "ProbeManager::prefilteredAtlas", probeManager.getPrefilteredAtlas().get(), COLOR);
+  std::vector<FrameGraph::ResourceId> gBufferIds;
+  for (const auto& [name, image] :
+       {std::pair{"gBufferAlbedo", mainView.gBufferAlbedo},
+        std::pair{"gBufferMetalnessRoughness", mainView.gBufferMetalnessRoughness},
+        std::pair{"gBufferNorm", mainView.gBufferNorm},
+        std::pair{"gBufferPacked", mainView.gBufferPacked}})
+  {
+    if (image != nullptr)
+      gBufferIds.push_back(frameGraph.importImage(name, image->get(), COLOR));
   }
+  const auto motionVectorsId =
+    frameGraph.importImage("TAAPass::motionVectors", mainView.motionVectors.get(), COLOR);
+  const auto depthId = frameGraph.importImage("depth", depth.get(), DEPTH);
+  const auto targetId =
+    frameGraph.importImage("TAAPass::currentTarget", deferredTarget.get(), COLOR);
+  const auto swapchainId = frameGraph.importImage("swapchain", target_image, COLOR);
+  frameGraph.exportImage(swapchainId);
+
+  frameGraph
+    .addPass(
+      "Shadow",
+      [&](vk::CommandBuffer cmd) {
+        ETNA_PROFILE_GPU(cmd, shadowPass);
+
+        auto shadowPassInfo = etna::get_shader_program("shadow_pass");
+        auto cameraSet = etna::create_descriptor_set(
+          shadowPassInfo.getDescriptorLayoutId(0),
+          cmd,
+          {
+            etna::Binding{0, shadowCameraBuffer.get().genBinding()},
+            etna::Binding{1, shadowCameraBuffer.get().genBinding()},
+          });
 
-  auto& resolveTarget = enableTAA ? taaPass.getResolveTarget() : deferredTarget;
+        etna::RenderTargetState renderTargets(
+          cmd,
+          {{0, 0}, {2048, 2048}},
+          {},
+          {.image = shadowMap.get(), .view = shadowMap.getView({})});
 
-  taaPass.resolve(cmd_buf, filterHistory);
-  sharpenPass.execute(cmd_buf, resolveTarget, pointSampler);
-  hizPass.execute(cmd_buf, depth);
+        cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, shadowPassPipeline.getVkPipeline());
+        cmd.bindDescriptorSets(
+          vk::PipelineBindPoint::eGraphics,
+          shadowPassPipeline.getVkPipelineLayout(),
+          0,
+          {cameraSet.getVkSet()},
+          {});
 
-  // Blit from target to swapchain image
-  {
-    etna::set_state(
-      cmd_buf,
-      sharpenPass.getTarget().get(),
-      vk::PipelineStageFlagBits2::eTransfer,
-      vk::AccessFlagBits2::eTransferRead,
-      vk::ImageLayout::eTransferSrcOptimal,
-      vk::ImageAspectFlagBits::eColor);
-
-    etna::set_state(
-      cmd_buf,
-      target_image,
-      vk::PipelineStageFlagBits2::eTransfer,
-      vk::AccessFlagBits2::eTransferWrite,
-      vk::ImageLayout::eTransferDstOptimal,
-      vk::ImageAspectFlagBits::eColor);
-
-    etna::flush_barriers(cmd_buf);
-
-    vk::ImageBlit blitInfo{
-      .srcSubresource =
-        {
-          .aspectMask = vk::ImageAspectFlagBits::eColor,
-          .mipLevel = 0,
-          .baseArrayLayer = 0,
-          .layerCount = 1,
-        },
-      .srcOffsets = {{
-        {{0, 0, 0}, {static_cast<int32_t>(resolution.x), static_cast<int32_t>(resolution.y), 1}},
-      }},
-      .dstSubresource =
-        {
-          .aspectMask = vk::ImageAspectFlagBits::eColor,
-          .mipLevel = 0,
-          .baseArrayLayer = 0,
-          .layerCount = 1,
-        },
-      .dstOffsets = {{
-        {{0, 0, 0}, {static_cast<int32_t>(resolution.x), static_cast<int32_t>(resolution.y), 1}},
-      }},
-    };
+        renderScene(cmd, shadowPassInfo, false);
+      })
+    .write(shadowMapId, FrameGraph::DEPTH_ATTACHMENT);
+
+  // Reflection probes are captured with the same passes as the main view, into images of their own
+  frameGraph
+    .addPass(
+      "Probes",
+      [&](vk::CommandBuffer cmd) {
+        probeManager.execute(cmd, [&](vk::CommandBuffer probe_cmd, const RenderView& view) {
+          geometryPass(probe_cmd, view);
+          deferredPass(probe_cmd, view, environment);
+          forwardPass(probe_cmd, view, environment, 0);
+        });
+      })
+    .read(shadowMapId, FrameGraph::SAMPLED_COMPUTE)
+    .writeUntracked(probeAtlasId)
+    .sideEffect();
+
+  auto geometry =
+    frameGraph.addPass("Geometry", [&](vk::CommandBuffer cmd) { geometryPass(cmd, mainView); });
+  for (const auto gBufferId : gBufferIds)
+    geometry.write(gBufferId, FrameGraph::COLOR_ATTACHMENT);
+  geometry.write(motionVectorsId, FrameGraph::COLOR_ATTACHMENT)
+    .write(depthId, FrameGraph::DEPTH_ATTACHMENT);
+
+  // Only needs the depth of the geometry pass, as the sky drawn by the forward pass is at the far
+  // plane. Nothing reads the HiZ within the frame, it is kept for the next one.
+  const auto hizId = frameGraph.importImage("HiZ", hizPass.getHiZ().get(), COLOR);
+  frameGraph.exportImage(hizId);
+  hizPass.addToGraph(frameGraph, depth);
+
+  auto deferred = frameGraph.addPass(
+    "Deferred", [&](vk::CommandBuffer cmd) { deferredPass(cmd, mainView, environment); });
+  for (const auto gBufferId : gBufferIds)
+    deferred.read(gBufferId, FrameGraph::SAMPLED_COMPUTE);
+  deferred.read(depthId, FrameGraph::SAMPLED_COMPUTE)
+    .read(shadowMapId, FrameGraph::SAMPLED_COMPUTE)
+    .read(probeAtlasId, FrameGraph::SAMPLED_COMPUTE)
+    .write(targetId, FrameGraph::STORAGE_WRITE_COMPUTE)
+    .computeOnly();
+
+  frameGraph
+    .addPass(
+      "Forward",
+      [&](vk::CommandBuffer cmd) {
+        forwardPass(cmd, mainView, environment, static_cast<uint32_t>(renderEnvironmentMip));
+      })
+    .write(targetId, FrameGraph::COLOR_ATTACHMENT)
+    .write(depthId, FrameGraph::DEPTH_ATTACHMENT);
 
-    cmd_buf.blitImage(
-      sharpenPass.getTarget().get(),
-      vk::ImageLayout::eTransferSrcOptimal,
-      target_image,
-      vk::ImageLayout::eTransferDstOptimal,
-      blitInfo,
-      vk::Filter::eNearest);
-
-    etna::set_state(
-      cmd_buf,
-      target_image,
-      vk::PipelineStageFlagBits2::eColorAttachmentOutput,
-      vk::AccessFlagBits2::eColorAttachmentRead,
-      vk::ImageLayout::eColorAttachmentOptimal,
-      vk::ImageAspectFlagBits::eColor);
-
-    etna::flush_barriers(cmd_buf);
-  }
+  taaPass.addToGraph(frameGraph, depth, filterHistory, enableTAA);
+
+  taaPass.addPresentToGraph(frameGraph, target_image, target_image_view);
 
   // Debug Preview Pass
   {
@@ -902,12 +1381,13 @@ void WorldRenderer::renderWorld(
         return &shadowMap;
       case DebugPreviewDepth:
         return &depth;
+      // The packed G-buffer can't be previewed as is
       case DebugPreviewGBufferAlbedo:
-        return &gBufferAlbedo;
+        return mainView.gBufferAlbedo;
       case DebugPreviewGBufferMetalnessRoughness:
-        return &gBufferMetalnessRoughness;
+        return mainView.gBufferMetalnessRoughness;
       case DebugPreviewGBufferNorm:
-        return &gBufferNorm;
+        return mainView.gBufferNorm;
       default:
         return nullptr;
       }
@@ -916,11 +1396,40 @@ void WorldRenderer::renderWorld(
     if (auto* debugPreviewTexture = selectDebugPreviewTexture(debugPreviewMode);
         debugPreviewTexture)
     {
-      debugPreviewRenderer->render(
-        cmd_buf, target_image, target_image_view, *debugPreviewTexture, linearSamplerClampToEdge);
+      const bool isDepth =
+        debugPreviewMode == DebugPreviewShadowMap || debugPreviewMode == DebugPreviewDepth;
+      const auto previewId = frameGraph.importImage(
+        "debugPreview", debugPreviewTexture->get(), isDepth ? DEPTH : COLOR);
+
+      frameGraph
+        .addPass(
+          "DebugPreview",
+          [&, debugPreviewTexture](vk::CommandBuffer cmd) {
+            debugPreviewRenderer->render(
+              cmd, target_image, target_image_view, *debugPreviewTexture, linearSamplerClampToEdge);
+          })
+        .read(previewId, FrameGraph::SAMPLED_FRAGMENT)
+        .write(swapchainId, FrameGraph::COLOR_ATTACHMENT);
     }
   }
 
+  frameGraph.compile();
+  frameGraph.execute(cmd_buf);
+
+  // Both the probe captures and the main view write the texture feedback, in whatever order
+  sceneMgr->getTextureStreamer().endFrame(cmd_buf);
+
+  // The GUI is drawn over the swapchain image after this
+  etna::set_state(
+    cmd_buf,
+    target_image,
+    vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+    vk::AccessFlagBits2::eColorAttachmentRead,
+    vk::ImageLayout::eColorAttachmentOptimal,
+    vk::ImageAspectFlagBits::eColor);
+
+  etna::flush_barriers(cmd_buf);
+
   cameraData.proceed();
   transforms.proceed();
 }
@@ -936,8 +1445,45 @@ void WorldRenderer::drawGui()
     ImGui::SliderFloat("Jitter scale", &taaPass.getJitterScale(), 0.0f, 2.0f, "%.1f");
     ImGui::Checkbox("Unjitter Texture UVs", &unjitterTextureUVs);
     ImGui::Checkbox("Filter History", &filterHistory);
+    ImGui::SliderInt(
+      "Jitter samples", &taaPass.getJitterSampleCount(), 1, TAAPass::MAX_JITTER_SAMPLE_COUNT);
+    // Below 100% the scene is rendered at a lower resolution and upscaled by TAA
+    ImGui::SliderFloat("Render Scale", &renderScale, 0.5f, 1.0f, "%.2f");
+    ImGui::Checkbox("Dynamic Resolution", &enableDynamicResolution);
+    if (enableDynamicResolution)
+    {
+      ImGui::SliderFloat(
+        "Target frame time", &dynamicResolution.getTargetFrameMs(), 4.0f, 33.0f, "%.1f ms");
+      ImGui::SliderFloat(
+        "Min dynamic scale", &dynamicResolution.getMinScale(), 0.25f, renderScale, "%.2f");
+      ImGui::Text(
+        "Dynamic scale: %.2f (%ux%u), GPU %.2f ms",
+        dynamicResolution.getScale(),
+        renderResolution.x,
+        renderResolution.y,
+        dynamicResolution.getSmoothedFrameMs());
+    }
+
+    // Compare both resolves side by side, the costs of each are measured while it runs alone
+    auto resolveMode = static_cast<int32_t>(taaPass.getResolveMode());
+    const auto resolveModeNames = TAAPass::getResolveModeNames();
+    if (ImGui::Combo(
+          "TAA Resolve",
+          &resolveMode,
+          resolveModeNames.data(),
+          static_cast<int32_t>(resolveModeNames.size())))
+      taaPass.getResolveMode() = static_cast<TAAPass::ResolveMode>(resolveMode);
+
+    const auto resolveCosts = taaPass.getResolveCosts();
+    for (uint32_t mode = 0; mode < TAAPass::ResolveModeSplit; ++mode)
+    {
+      if (resolveCosts[mode] < 0.0f)
+        ImGui::Text("%s resolve: n/a", resolveModeNames[mode]);
+      else
+        ImGui::Text("%s resolve: %.3f ms", resolveModeNames[mode], resolveCosts[mode]);
+    }
     ImGui::SliderFloat("Mip Bias", &newMaterialTextureMipBias, -4.0f, 4.0f, "%.1f");
-    ImGui::SliderFloat("Sharpen Multiplier", &sharpenPass.getAmount(), 0.0f, 1.0f, "%.1f");
+    ImGui::SliderFloat("Sharpen Multiplier", &taaPass.getSharpenAmount(), 0.0f, 1.0f, "%.1f");
 
     if (newMaterialTextureMipBias != materialTextureMipBias)
     {
@@ -955,12 +1501,46 @@ void WorldRenderer::drawGui()
       ENVIRONMENT_NAMES.data(),
       static_cast<int32_t>(ENVIRONMENT_NAMES.size()));
 
+    if (environmentManager.isEnvironmentLoading(environmentIdx))
+    {
+      ImGui::SameLine();
+      ImGui::TextDisabled("(loading...)");
+    }
+
     ImGui::SliderInt(
       "Render mip",
       &renderEnvironmentMip,
       0,
       environmentManager.getPrefilteredEnvMapMips() - 1);
 
+    // Formats and prefilter modes are picked at startup, the stats of each run can be compared
+    if (const auto* stats = environmentManager.getLoadStats(environmentIdx))
+    {
+      ImGui::Text(
+        "%s in %.1f ms, %.1f MiB resident",
+        stats->cached ? "Loaded from cache" : "Baked",
+        stats->loadMs,
+        static_cast<double>(stats->residentBytes) / (1 << 20));
+      ImGui::Text(
+        "Formats: equirect %s, cubemap %s, prefiltered %s",
+        vk::to_string(stats->equirectFormat).c_str(),
+        vk::to_string(stats->cubemapFormat).c_str(),
+        vk::to_string(stats->prefilteredEnvMapFormat).c_str());
+
+      const char* prefilterModeName =
+        stats->prefilterMode == EnvironmentManager::PrefilterMode::eSampleTable ? "sample table"
+                                                                                : "reference";
+      if (stats->cached)
+      {
+        ImGui::TextDisabled("Prefiltered with the %s, measured only when baked", prefilterModeName);
+      }
+      else
+      {
+        ImGui::Text("Equirect mean relative luminance error: %.2e", stats->quantizationError);
+        ImGui::Text("Prefiltered with the %s in %.1f ms", prefilterModeName, stats->prefilterMs);
+      }
+    }
+
     ImGui::NewLine();
 
     ImGui::Text("Irradiance SH Coefficients:");
@@ -994,8 +1574,8 @@ void WorldRenderer::drawGui()
         ImGui::TableSetColumnIndex(0);
         ImGui::Text("%s", ROW_NAMES[row]);
 
-        const auto* coeffs = &environmentManager.getEnvironments()[environmentIdx]
-                                .irradianceSHCoefficientArray[3U * row];
+        const auto* coeffs = &environmentManager.getEnvironment(displayedEnvironmentIdx)
+                                ->irradianceSHCoefficientArray[3U * row];
 
         for (size_t column = 0; column < 3; ++column)
         {
@@ -1027,6 +1607,92 @@ void WorldRenderer::drawGui()
     pushConstDeferredPass.enablePointLights = static_cast<shader_bool>(enablePointLights);
 
     ImGui::NewLine();
+
+    ImGui::SeparatorText("Deferred Pass");
+
+    ImGui::BeginDisabled(deferredBenchmark.running);
+    ImGui::Checkbox("Swizzle Tiles", &swizzleDeferredTiles);
+    ImGui::Checkbox("Packed G-buffer", &packGBuffer);
+    if (ImGui::Button("Benchmark"))
+      startDeferredBenchmark();
+    ImGui::EndDisabled();
+
+    for (const auto& timing : frameGraph.getPassTimings())
+    {
+      if (timing.name == "Deferred")
+        ImGui::Text("GPU time: %.3f ms", timing.ms);
+    }
+
+    uint32_t compiledPermutations = 0;
+    uint32_t pendingPermutations = 0;
+    for (const auto& pipelines : deferredPipelines)
+    {
+      for (const auto& permutations : pipelines.shadePermutations)
+      {
+        compiledPermutations += permutations.getCompiledCount();
+        pendingPermutations += permutations.getPendingCount();
+      }
+    }
+    ImGui::Text(
+      "Permutations: %u compiled, %u compiling", compiledPermutations, pendingPermutations);
+
+    for (uint32_t config = 0; config < DeferredBenchmark::CONFIG_COUNT; ++config)
+    {
+      if (deferredBenchmark.averageMs[config] < 0.0f)
+        continue;
+
+      ImGui::Text(
+        "%s, %s: %.3f ms",
+        (config & 1U) != 0 ? "swizzled" : "row-major",
+        (config & 2U) != 0 ? "packed" : "standard",
+        deferredBenchmark.averageMs[config]);
+    }
+
+    ImGui::NewLine();
+
+    ImGui::SeparatorText("Reflection Probes");
+
+    ImGui::Checkbox("Enable Reflection Probes", &enableProbes);
+    ImGui::Checkbox("Update Probes", &probeManager.getEnabled());
+    ImGui::SliderFloat("GPU Budget", &probeManager.getGpuBudgetMs(), 0.05f, 4.0f, "%.2f ms");
+
+    bool computeMips = probeManager.getMipGeneration() == MipGenerator::Method::eCompute;
+    if (ImGui::Checkbox("Compute Mip Generation", &computeMips))
+      probeManager.getMipGeneration() =
+        computeMips ? MipGenerator::Method::eCompute : MipGenerator::Method::eBlit;
+
+    ImGui::Text(
+      "Published: %d / %u",
+      std::popcount(probeManager.getPublishedMask()),
+      probeManager.getProbeCount());
+
+    const auto stepCosts = probeManager.getStepCosts();
+    for (uint32_t kind = 0; kind < stepCosts.size(); ++kind)
+    {
+      if (stepCosts[kind] < 0.0f)
+        ImGui::Text("%s: n/a", ProbeManager::getStepKindName(kind));
+      else
+        ImGui::Text("%s: %.3f ms", ProbeManager::getStepKindName(kind), stepCosts[kind]);
+    }
+
+    ImGui::NewLine();
+
+    ImGui::SeparatorText("Texture Streaming");
+
+    auto& streamer = sceneMgr->getTextureStreamer();
+    const auto streamingStats = streamer.getStats();
+
+    int budgetMiB = static_cast<int>(streamer.getMemoryBudget() >> 20);
+    if (ImGui::SliderInt("Memory Budget", &budgetMiB, 16, 4096, "%d MiB"))
+      streamer.getMemoryBudget() = static_cast<vk::DeviceSize>(budgetMiB) << 20;
+
+    ImGui::Text(
+      "Resident: %.1f MiB, %u loads pending",
+      static_cast<double>(streamingStats.residentBytes) / (1 << 20),
+      streamingStats.pendingLoads);
+    ImGui::Text("Loads: %u, evictions: %u", streamingStats.loads, streamingStats.evictions);
+
+    ImGui::NewLine();
   }
 
   if (ImGui::CollapsingHeader("Materials", ImGuiTreeNodeFlags_DefaultOpen))
@@ -1050,4 +1716,84 @@ void WorldRenderer::drawGui()
     ImGui::SliderFloat("Roughness", &materials[materialIdx].roughness, 0.0f, 1.0f, "r = %.3f");
     ImGui::SliderFloat("Metalness", &materials[materialIdx].metalness, 0.0f, 1.0f, "m = %.3f");
   }
+
+  if (ImGui::CollapsingHeader("Frame Graph"))
+  {
+    const auto graphStats = frameGraph.getStats();
+    ImGui::Text(
+      "Passes: %u, culled: %u, interleaved: %u",
+      graphStats.passes,
+      graphStats.culled,
+      graphStats.interleavedPasses);
+    ImGui::Text(
+      "Transitions: %u in %u batches, %u dropped",
+      graphStats.transitions,
+      graphStats.barrierBatches,
+      graphStats.droppedTransitions);
+
+    ImGui::Text("GPU time: %.2f ms", frameGraph.getGpuTimeMs());
+    for (const auto& timing : frameGraph.getPassTimings())
+      ImGui::Text("  %s: %.3f ms", timing.name.c_str(), timing.ms);
+
+    if (ImGui::Button("Dump Schedule"))
+      spdlog::info("{}", frameGraph.dump());
+  }
+
+  if (ImGui::CollapsingHeader("GPU Memory"))
+  {
+    // Walks over every resource, so it only runs while the panel is open
+    memoryTracker.update();
+
+    const auto& snapshot = memoryTracker.getSnapshot();
+    const auto& peaks = memoryTracker.getPeaks();
+    const auto toMiB = [](vk::DeviceSize size) { return static_cast<double>(size) / (1 << 20); };
+
+    constexpr ImGuiTableFlags FLAGS = ImGuiTableFlags_BordersOuter | ImGuiTableFlags_BordersV;
+    if (ImGui::BeginTable("gpuMemory", 3, FLAGS))
+    {
+      ImGui::TableSetupColumn("Category");
+      ImGui::TableSetupColumn("Current, MiB");
+      ImGui::TableSetupColumn("Peak, MiB");
+      ImGui::TableHeadersRow();
+
+      const auto row = [](const char* name, double current, double peak) {
+        ImGui::TableNextRow();
+        ImGui::TableSetColumnIndex(0);
+        ImGui::Text("%s", name);
+        ImGui::TableSetColumnIndex(1);
+        ImGui::Text("%.1f", current);
+        ImGui::TableSetColumnIndex(2);
+        ImGui::Text("%.1f", peak);
+      };
+
+      for (uint32_t category = 0; category < GpuMemoryTracker::CATEGORY_COUNT; ++category)
+        row(
+          GpuMemoryTracker::getCategoryName(static_cast<GpuMemoryTracker::Category>(category)),
+          toMiB(snapshot.totals[category]),
+          toMiB(peaks[category]));
+      row("Total", toMiB(snapshot.tracked), toMiB(memoryTracker.getPeakTracked()));
+
+      ImGui::EndTable();
+    }
+
+    if (memoryTracker.hasMemoryBudget())
+    {
+      ImGui::Text("Untracked: %.1f MiB", toMiB(snapshot.untracked));
+      for (std::size_t heapIdx = 0; heapIdx < snapshot.heaps.size(); ++heapIdx)
+      {
+        const auto& heap = snapshot.heaps[heapIdx];
+        ImGui::Text(
+          "Heap %zu%s: %.1f / %.1f MiB budget",
+          heapIdx,
+          heap.deviceLocal ? " (device local)" : "",
+          toMiB(heap.usage),
+          toMiB(heap.budget));
+      }
+    }
+    else
+      ImGui::TextDisabled("Heap usage needs VK_EXT_memory_budget");
+
+    if (ImGui::Button("Write Report"))
+      memoryTracker.writeReport("gpu_memory_report.json");
+  }
 }
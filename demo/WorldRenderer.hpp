@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+
 #include <etna/Image.hpp>
 #include <etna/Sampler.hpp>
 #include <etna/Buffer.hpp>
@@ -8,15 +10,20 @@
 #include <glm/glm.hpp>
 
 #include "scene/SceneManager.hpp"
+#include "render_utils/DynamicResolution.hpp"
+#include "render_utils/FrameGraph.hpp"
+#include "render_utils/GpuMemoryTracker.hpp"
+#include "render_utils/PipelinePermutations.hpp"
 #include "render_utils/QuadRenderer.hpp"
 #include "wsi/Keyboard.hpp"
 
 #include "shaders/CameraData.h"
 #include "FramePacket.hpp"
 #include "EnvironmentManager.hpp"
+#include "ProbeManager.hpp"
+#include "RenderView.hpp"
 #include "HiZPass.hpp"
 #include "TAAPass.hpp"
-#include "SharpenPass.hpp"
 
 
 /**
@@ -26,13 +33,16 @@
 class WorldRenderer
 {
 public:
-  WorldRenderer();
+  // VK_EXT_memory_budget is only enabled where supported, the memory panel needs to know
+  explicit WorldRenderer(bool memory_budget_supported);
 
   void loadScene(std::filesystem::path path);
 
   void loadShaders();
   void allocateResources(glm::uvec2 swapchain_resolution);
   void setupPipelines(vk::Format swapchain_format);
+  // Must be called before etna::reload_shaders, see PipelinePermutations::waitPending
+  void waitPendingPipelines();
 
   void debugInput(const Keyboard& kb);
   void update(const FramePacket& packet);
@@ -41,10 +51,34 @@ public:
     vk::CommandBuffer cmd_buf, vk::Image target_image, vk::ImageView target_image_view);
 
 private:
+  // Everything sized by the render extent, recreated when the render scale changes
+  void allocateRenderTargets();
+  glm::uvec2 getRenderExtent() const;
+  glm::uvec2 getScaledResolution(float scale) const;
+
+  // The lighting toggles of the GUI as permutation bits of a tile class, see DeferredToggle
+  uint32_t getDeferredToggles(uint32_t tile_class) const;
+
+  void startDeferredBenchmark();
+  void updateDeferredBenchmark();
+
   void recreateMaterialTextureSampler();
 
   void renderScene(vk::CommandBuffer cmd_buf, etna::ShaderProgramInfo info, bool material_pass);
 
+  void geometryPass(vk::CommandBuffer cmd_buf, const RenderView& view);
+  void deferredPass(
+    vk::CommandBuffer cmd_buf,
+    const RenderView& view,
+    const EnvironmentManager::Environment& environment);
+  void forwardPass(
+    vk::CommandBuffer cmd_buf,
+    const RenderView& view,
+    const EnvironmentManager::Environment& environment,
+    uint32_t environment_mip);
+
+  void reportMemory(GpuMemoryTracker::Collector& collector);
+
 private:
   enum DebugPreviewMode : uint32_t {
     DebugPreviewDisabled,
@@ -57,10 +91,6 @@ private:
     DebugPreviewModeCount
   };
 
-  constexpr static vk::Format GBUFFER_ALBEDO_FORMAT = vk::Format::eR8G8B8A8Unorm;
-  constexpr static vk::Format GBUFFER_METALNESS_ROUGHNESS_FORMAT = vk::Format::eR8G8B8A8Unorm;
-  constexpr static vk::Format GBUFFER_NORM_FORMAT = vk::Format::eA2R10G10B10UnormPack32;
-
   // FIXME (tralf-strues): upload light data each frame using a dedicated transfer
   // instead of just mapping the buffer... could get quite large in the future, and not
   // all of us have amd gpus :)
@@ -74,13 +104,28 @@ private:
 
   vk::UniqueSampler materialTextureSampler;
 
+  // The swapchain resolution, the scene is rendered at the render resolution and upscaled by TAA.
+  // Render targets are allocated with the render extent, with dynamic resolution only the top left
+  // corner of them is rendered to.
   glm::uvec2 resolution;
+  glm::uvec2 renderExtent;
+  glm::uvec2 renderResolution;
+  float renderScale = 1.0f;
+
+  // Lowers the render resolution below the render scale when the GPU misses the frame time target
+  bool enableDynamicResolution = false;
+  DynamicResolution dynamicResolution{{.targetFrameMs = 16.0f, .minScale = 0.5f, .maxScale = 1.0f}};
 
   /* Environment */
   EnvironmentManager environmentManager;
   int32_t environmentIdx = 2;
+  int32_t displayedEnvironmentIdx = 2;
   int32_t renderEnvironmentMip = 0;
 
+  /* Reflection Probes */
+  ProbeManager probeManager;
+  bool enableProbes = true;
+
   /* Shadow Pass */
   etna::GraphicsPipeline shadowPassPipeline;
 
@@ -89,6 +134,7 @@ private:
 
   /* Geometry Pass */
   etna::GraphicsPipeline geometryPassPipeline;
+  etna::GraphicsPipeline geometryPassPackedPipeline;
 
   etna::GpuSharedResource<etna::Buffer> prevCameraBuffer;
   etna::GpuSharedResource<etna::Buffer> currCameraBuffer;
@@ -101,9 +147,63 @@ private:
   etna::Image gBufferAlbedo;
   etna::Image gBufferMetalnessRoughness;
   etna::Image gBufferNorm;
+  etna::Image gBufferPacked;
+  // The packed layout is read with a single fetch, switching the layout reallocates the G-buffer
+  bool packGBuffer = false;
+  bool gBufferIsPacked = false;
 
   /* Deferred Pass */
-  etna::ComputePipeline deferredPassPipeline;
+  // Must match DeferredShading.glsl
+  constexpr static uint32_t DEFERRED_TILE_SIZE = 16;
+  constexpr static uint32_t DEFERRED_TILE_CLASS_COUNT = 4;
+
+  // Bits of the shading permutations, must match the specialization constants of
+  // DeferredShading.glsl
+  enum DeferredToggle : uint32_t
+  {
+    DeferredToggleEmission,
+    DeferredToggleDiffuseIBL,
+    DeferredToggleSpecularIBL,
+    DeferredToggleDirectionalLight,
+    DeferredTogglePointLights,
+
+    DeferredToggleCount
+  };
+
+  // Tiles are sorted into lists by the lighting they need, then every list is shaded by a variant
+  // of its own with an indirect dispatch. The variants are specialized for the lighting toggles,
+  // the plain pipelines read them from the push constants until a permutation is compiled.
+  struct DeferredPipelines
+  {
+    etna::ComputePipeline classify;
+    std::array<etna::ComputePipeline, DEFERRED_TILE_CLASS_COUNT> shade;
+    std::array<PipelinePermutations, DEFERRED_TILE_CLASS_COUNT> shadePermutations;
+  };
+  // Indexed by whether the G-buffer is packed
+  std::array<DeferredPipelines, 2> deferredPipelines;
+  etna::Buffer deferredTileLists;
+  uint32_t deferredTileListStride = 0;
+  bool swizzleDeferredTiles = true;
+
+  // Runs the deferred pass of the main view in every combination of tile swizzling and G-buffer
+  // layout for a number of frames, and logs the average GPU time of each. The dynamic resolution
+  // is paused meanwhile, so that every combination shades the same number of pixels.
+  struct DeferredBenchmark
+  {
+    // Bit 0 swizzles the tiles, bit 1 packs the G-buffer
+    constexpr static uint32_t CONFIG_COUNT = 4;
+
+    bool running = false;
+    uint32_t config = 0;
+    uint32_t frame = 0;
+    float totalMs = 0.0f;
+    uint32_t measuredFrames = 0;
+    // Negative until measured
+    std::array<float, CONFIG_COUNT> averageMs{-1.0f, -1.0f, -1.0f, -1.0f};
+    bool prevSwizzle = true;
+    bool prevPack = false;
+    bool prevDynamicResolution = false;
+  } deferredBenchmark;
 
   etna::GpuSharedResource<etna::Buffer> lightBuffer;
 
@@ -122,6 +222,13 @@ private:
     shader_bool enableSpecularIBL;
     shader_bool enableDirectionalLight;
     shader_bool enablePointLights;
+
+    uint32_t probeCount;
+    uint32_t probeMask;
+    uint32_t probeMips;
+
+    uint32_t tileListStride;
+    shader_bool swizzleTiles;
   } pushConstDeferredPass;
 
   /* Forward Pass */
@@ -137,10 +244,13 @@ private:
   bool filterHistory = true;
   float materialTextureMipBias = 0.0f;
 
-  /* Sharpen Pass */
-  SharpenPass sharpenPass;
-
   /* Debug Preview Pass */
   std::unique_ptr<QuadRenderer> debugPreviewRenderer;
   DebugPreviewMode debugPreviewMode = DebugPreviewDisabled;
+
+  /* Frame Graph, rebuilt every frame */
+  FrameGraph frameGraph;
+
+  /* GPU Memory */
+  GpuMemoryTracker memoryTracker;
 };
@@ -0,0 +1,111 @@
+#ifndef DEFERRED_CLASSIFY_GLSL_INCLUDED
+#define DEFERRED_CLASSIFY_GLSL_INCLUDED
+
+#include "DeferredShading.glsl"
+
+// Sorts the tiles of the view into the lists of the shading variants. A tile is complex as soon as
+// a single point light or probe might reach it, which is tested against the world space bounds of
+// the tile between its closest and farthest surfaces.
+
+shared uint tileHasSurface;
+shared uint tileMinDepth; // Bits of the depth, which orders the same as the float does as it's >= 0
+shared uint tileMaxDepth;
+shared uint tileIsComplex;
+
+bool SphereIntersectsBox(vec3 center, float radius, vec3 boxMin, vec3 boxMax)
+{
+  vec3 offset = center - clamp(center, boxMin, boxMax);
+  return dot(offset, offset) < radius * radius;
+}
+
+layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE, local_size_z = 1) in;
+void main()
+{
+  uint  groupIdx   = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+  uvec2 tileCounts = (params.resolution + TILE_SIZE - 1u) / TILE_SIZE;
+  uvec2 tile       = SwizzleTile(groupIdx, tileCounts);
+
+  if (gl_LocalInvocationIndex == 0)
+  {
+    tileHasSurface = 0u;
+    tileMinDepth   = floatBitsToUint(1.0f);
+    tileMaxDepth   = 0u;
+    tileIsComplex  = 0u;
+  }
+  barrier();
+
+  uvec2 coord = tile * TILE_SIZE + gl_LocalInvocationID.xy;
+  if (coord.x < params.resolution.x && coord.y < params.resolution.y)
+  {
+    float depth = texelFetch(depthBuffer, ivec2(coord), 0).r;
+    if (depth != 1.0f)
+    {
+      atomicOr(tileHasSurface, 1u);
+      atomicMin(tileMinDepth, floatBitsToUint(depth));
+      atomicMax(tileMaxDepth, floatBitsToUint(depth));
+    }
+  }
+  barrier();
+
+  bool hasSurface = tileHasSurface != 0u;
+  bool isLit      = hasSurface && AnyLitTermEnabled();
+
+  // Every thread tests at most a light and a probe, there are fewer of them than threads
+  if (isLit)
+  {
+    uvec2 tileMinCoord = tile * TILE_SIZE;
+    uvec2 tileMaxCoord = min(tileMinCoord + TILE_SIZE, params.resolution);
+    vec2  tileMinUV    = vec2(tileMinCoord) * params.invResolution;
+    vec2  tileMaxUV    = vec2(tileMaxCoord) * params.invResolution;
+
+    vec3 boxMin = vec3(1e30f);
+    vec3 boxMax = vec3(-1e30f);
+    for (uint corner = 0; corner < 8; ++corner)
+    {
+      vec2  uv    = vec2((corner & 1u) != 0u ? tileMaxUV.x : tileMinUV.x,
+                         (corner & 2u) != 0u ? tileMaxUV.y : tileMinUV.y);
+      float depth = uintBitsToFloat((corner & 4u) != 0u ? tileMaxDepth : tileMinDepth);
+
+      vec3 position = ReconstructPosition(uv, depth);
+      boxMin = min(boxMin, position);
+      boxMax = max(boxMax, position);
+    }
+
+    uint idx = gl_LocalInvocationIndex;
+
+    if (PointLightsEnabled() && idx < pointLightCount)
+    {
+      PointLight pointLight = pointLights[idx];
+      if (SphereIntersectsBox(pointLight.position, pointLight.radius, boxMin, boxMax))
+      {
+        atomicOr(tileIsComplex, 1u);
+      }
+    }
+
+    bool probeSampled = (DiffuseIBLEnabled() || SpecularIBLEnabled()) &&
+                        idx < params.probeCount && (params.probeMask & (1u << idx)) != 0u;
+    if (probeSampled && SphereIntersectsBox(probes[idx].xyz, probes[idx].w, boxMin, boxMax))
+    {
+      atomicOr(tileIsComplex, 1u);
+    }
+  }
+  barrier();
+
+  if (gl_LocalInvocationIndex == 0)
+  {
+    uint tileClass = TILE_CLASS_SKY;
+    if (isLit)
+    {
+      tileClass = tileIsComplex != 0u ? TILE_CLASS_COMPLEX : TILE_CLASS_SIMPLE;
+    }
+    else if (hasSurface)
+    {
+      tileClass = TILE_CLASS_EMISSIVE;
+    }
+
+    uint tileIdx = atomicAdd(tileDispatches[tileClass].x, 1u);
+    tiles[tileClass * params.tileListStride + tileIdx] = tile.x | (tile.y << 16);
+  }
+}
+
+#endif // DEFERRED_CLASSIFY_GLSL_INCLUDED
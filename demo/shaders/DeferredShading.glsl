@@ -0,0 +1,438 @@
+#ifndef DEFERRED_SHADING_GLSL_INCLUDED
+#define DEFERRED_SHADING_GLSL_INCLUDED
+
+// The resources and lighting of the deferred pass. The classification pass and every shading
+// variant include the same declarations, so they share a single descriptor set and push constants.
+// Variants define DEFERRED_TILE_CLASS before including this file, and PACKED_GBUFFER to read the
+// packed G-buffer layout.
+
+#include "Light.h"
+#include "CameraData.h"
+#include "GBuffer.glsl"
+#include "PBR.glsl"
+#include "SphericalHarmonics.glsl"
+
+//==================================================================================================
+// Descriptor bindings / push constants
+//--------------------------------------------------------------------------------------------------
+layout(set = 0, binding = 0) uniform camera_data_t
+{
+  CameraData camera;
+};
+
+layout(set = 1, binding = 0, rgba8) uniform writeonly image2D out_color;
+
+#ifdef PACKED_GBUFFER
+layout(set = 1, binding = 1) uniform usampler2D gbufferPacked;
+#else
+layout(set = 1, binding = 1) uniform sampler2D gbufferAlbedo;
+layout(set = 1, binding = 2) uniform sampler2D gbufferMetalnessRoughness;
+layout(set = 1, binding = 3) uniform sampler2D gbufferWsNorm;
+#endif
+layout(set = 1, binding = 4) uniform sampler2D depthBuffer;
+layout(set = 1, binding = 5) uniform sampler2D shadowMap;
+layout(set = 1, binding = 6) uniform samplerCube texPrefilteredEnvMap;
+layout(set = 1, binding = 7) uniform sampler2D texEnvBRDF;
+
+layout(set = 1, binding = 8) uniform shadow_camera_data_t
+{
+  CameraData shadowCamera;
+};
+
+layout(set = 1, binding = 9, std430) readonly buffer light_data_t
+{
+  DirectionalLight dirLight;
+
+  uint pointLightCount;
+  uint _pad0[3];
+
+  PointLight pointLights[];
+};
+
+layout(set = 1, binding = 10, scalar) readonly buffer DiffuseIrradianceSH {
+  vec3 E_lm[9];
+};
+
+// Reflection probes, see ProbeManager.hpp. Probe i owns the cube layers [6 * i, 6 * i + 6) and
+// the SH coefficients [9 * i, 9 * i + 9).
+layout(set = 1, binding = 11) uniform samplerCubeArray texProbePrefilteredEnvMaps;
+
+layout(set = 1, binding = 12, scalar) readonly buffer ProbeDiffuseIrradianceSH {
+  vec3 probeE_lm[];
+};
+
+layout(set = 1, binding = 13, std430) readonly buffer ProbeData {
+  vec4 probes[]; // xyz - position, w - radius of influence
+};
+
+// Must match WorldRenderer::DEFERRED_TILE_*
+const uint TILE_SIZE = 16;
+
+const uint TILE_CLASS_SKY      = 0; // Only the far plane, cleared to black
+const uint TILE_CLASS_EMISSIVE = 1; // Every lighting term but emission is disabled
+const uint TILE_CLASS_SIMPLE   = 2; // No point light or probe reaches the tile
+const uint TILE_CLASS_COMPLEX  = 3;
+const uint TILE_CLASS_COUNT    = 4;
+
+struct DispatchIndirectCommand
+{
+  uint x;
+  uint y;
+  uint z;
+};
+
+// Filled by the classification pass, the tiles of class i are stored at [i * tileListStride, ...).
+// Every tile is packed as x | y << 16.
+layout(set = 1, binding = 14, std430) buffer TileLists {
+  DispatchIndirectCommand tileDispatches[TILE_CLASS_COUNT];
+  uint tiles[];
+};
+
+layout(push_constant) uniform params_t
+{
+  uvec2 resolution;
+  vec2 invResolution;
+
+  float proj22;
+  float proj23;
+  float invProj00; // Precomputed coefficient, 1 / proj[0][0]
+  float invProj11; // Precomputed coefficient, 1 / proj[1][1]
+
+  uint envMapMips;
+  shader_bool enableEmission;
+  shader_bool enableDiffuseIBL;
+  shader_bool enableSpecularIBL;
+  shader_bool enableDirectionalLight;
+  shader_bool enablePointLights;
+
+  uint probeCount;
+  uint probeMask;  // Probes which have been published at least once
+  uint probeMips;
+
+  uint tileListStride;
+  shader_bool swizzleTiles;
+} params;
+
+// The lighting toggles of the shading variants are specialized by PipelinePermutations, so that
+// the disabled terms are compiled out. Unspecialized pipelines read them from the push constants.
+// Must match DeferredToggle in WorldRenderer.hpp
+layout(constant_id = 0) const bool SPEC_ENABLE_EMISSION          = false;
+layout(constant_id = 1) const bool SPEC_ENABLE_DIFFUSE_IBL       = false;
+layout(constant_id = 2) const bool SPEC_ENABLE_SPECULAR_IBL      = false;
+layout(constant_id = 3) const bool SPEC_ENABLE_DIRECTIONAL_LIGHT = false;
+layout(constant_id = 4) const bool SPEC_ENABLE_POINT_LIGHTS      = false;
+layout(constant_id = 5) const bool SPECIALIZED                   = false;
+//==================================================================================================
+
+bool EmissionEnabled()
+{
+  return SPECIALIZED ? SPEC_ENABLE_EMISSION : params.enableEmission;
+}
+
+bool DiffuseIBLEnabled()
+{
+  return SPECIALIZED ? SPEC_ENABLE_DIFFUSE_IBL : params.enableDiffuseIBL;
+}
+
+bool SpecularIBLEnabled()
+{
+  return SPECIALIZED ? SPEC_ENABLE_SPECULAR_IBL : params.enableSpecularIBL;
+}
+
+bool DirectionalLightEnabled()
+{
+  return SPECIALIZED ? SPEC_ENABLE_DIRECTIONAL_LIGHT : params.enableDirectionalLight;
+}
+
+bool PointLightsEnabled()
+{
+  return SPECIALIZED ? SPEC_ENABLE_POINT_LIGHTS : params.enablePointLights;
+}
+
+bool AnyLitTermEnabled()
+{
+  return DiffuseIBLEnabled() || SpecularIBLEnabled() || DirectionalLightEnabled() ||
+         PointLightsEnabled();
+}
+
+// Reconstructs the world space position of a pixel from its depth.
+// Inspired by: https://mynameismjp.wordpress.com/2010/09/05/position-from-depth-3/
+vec3 ReconstructPosition(vec2 uv, float depth)
+{
+  vec2  ndcXY = 2.0f * uv - 1.0f;
+  float vsZ   = params.proj23 / (depth - params.proj22);
+  return camera.wsPos + vsZ * (camera.wsForward -
+                               camera.wsRight * ndcXY.x * params.invProj00 +
+                               camera.wsUp    * ndcXY.y * params.invProj11);
+}
+
+// Consecutive workgroups walk down vertical strips of tiles instead of whole rows of the screen,
+// so that the tiles in flight at once stay close to each other
+uvec2 SwizzleTile(uint groupIdx, uvec2 tileCounts)
+{
+  const uint STRIP_WIDTH = 8;
+
+  if (!params.swizzleTiles)
+  {
+    return uvec2(groupIdx % tileCounts.x, groupIdx / tileCounts.x);
+  }
+
+  uint strip      = groupIdx / (STRIP_WIDTH * tileCounts.y);
+  uint stripIdx   = groupIdx % (STRIP_WIDTH * tileCounts.y);
+  uint stripWidth = min(STRIP_WIDTH, tileCounts.x - strip * STRIP_WIDTH);
+  return uvec2(strip * STRIP_WIDTH + stripIdx % stripWidth, stripIdx / stripWidth);
+}
+
+// Maps the invocation index within a tile onto a Z-order curve, so that every subgroup covers a
+// square block of pixels instead of a couple of rows
+uvec2 SwizzleInvocation(uint invocationIdx)
+{
+  if (!params.swizzleTiles)
+  {
+    return uvec2(invocationIdx % TILE_SIZE, invocationIdx / TILE_SIZE);
+  }
+
+  uvec2 coord = uvec2(invocationIdx, invocationIdx >> 1) & 0x55u;
+  coord       = (coord | (coord >> 1)) & 0x33u;
+  coord       = (coord | (coord >> 2)) & 0x0Fu;
+  return coord;
+}
+
+#ifdef DEFERRED_TILE_CLASS
+
+// No probe reaches the tiles of the simpler classes
+uint ShadedProbeCount()
+{
+  return DEFERRED_TILE_CLASS == TILE_CLASS_COMPLEX ? params.probeCount : 0u;
+}
+
+// Weight of the probe at a point, fading out linearly towards the radius of influence
+float ProbeWeight(uint probe, vec3 position)
+{
+  if ((params.probeMask & (1u << probe)) == 0u)
+  {
+    return 0.0f;
+  }
+
+  vec4 probeData = probes[probe];
+  return clamp(1.0f - distance(position, probeData.xyz) / probeData.w, 0.0f, 1.0f);
+}
+
+// The environment fills in whatever weight the probes leave, so that it only shows up where no
+// probe fully covers the point.
+float EnvironmentWeight(float probeWeightSum)
+{
+  return max(1.0f - probeWeightSum, 0.0f);
+}
+
+vec3 Irradiance(SurfacePoint point)
+{
+  float Y_lm[SH_COEFFICIENT_COUNT];
+  EvaluateSH9(point.normal, Y_lm);
+
+  vec3  probeE         = vec3(0.0f);
+  float probeWeightSum = 0.0f;
+  for (uint probe = 0; probe < ShadedProbeCount(); ++probe)
+  {
+    float weight = ProbeWeight(probe, point.position);
+    if (weight == 0.0f)
+    {
+      continue;
+    }
+
+    vec3 E = vec3(0.0f);
+    for (uint i = 0; i < SH_COEFFICIENT_COUNT; ++i)
+    {
+      E += probeE_lm[SH_COEFFICIENT_COUNT * probe + i] * Y_lm[i];
+    }
+
+    probeE         += weight * E;
+    probeWeightSum += weight;
+  }
+
+  vec3 E = vec3(0.0f);
+  for (uint i = 0; i < SH_COEFFICIENT_COUNT; ++i)
+  {
+    E += E_lm[i] * Y_lm[i];
+  }
+
+  float environmentWeight = EnvironmentWeight(probeWeightSum);
+  return (probeE + environmentWeight * E) / max(probeWeightSum + environmentWeight, 1e-4f);
+}
+
+vec3 PrefilteredRadiance(vec3 position, vec3 R, float roughness)
+{
+  vec3  probeL         = vec3(0.0f);
+  float probeWeightSum = 0.0f;
+  for (uint probe = 0; probe < ShadedProbeCount(); ++probe)
+  {
+    float weight = ProbeWeight(probe, position);
+    if (weight == 0.0f)
+    {
+      continue;
+    }
+
+    float mip       = roughness * float(params.probeMips - 1);
+    vec3  L         = textureLod(texProbePrefilteredEnvMaps, vec4(R, float(probe)), mip).rgb;
+    probeL         += weight * L;
+    probeWeightSum += weight;
+  }
+
+  float mip               = roughness * float(params.envMapMips - 1);
+  vec3  L                 = textureLod(texPrefilteredEnvMap, R, mip).rgb;
+  float environmentWeight = EnvironmentWeight(probeWeightSum);
+
+  return (probeL + environmentWeight * L) / max(probeWeightSum + environmentWeight, 1e-4f);
+}
+
+vec3 SpecularIBL(SurfacePoint point)
+{
+  float NoV = clamp(dot(point.normal, point.toCam), 0.5f / 512.0f, 1.0f);
+  vec3 R = reflect(-point.toCam, point.normal);
+
+  // Some remapping found in moving frostbite to PBR,
+  // yet to be understood :)
+  float smoothness = clamp(1.0f - point.roughness, 0.0f, 1.0f);
+  float lerpFactor = smoothness * (sqrt(smoothness) + point.roughness);
+  R = mix(point.normal, R, lerpFactor);
+
+  vec3 prefilteredColor = PrefilteredRadiance(point.position, R, point.roughness);
+
+  vec2 envBrdf = texture(texEnvBRDF, vec2(NoV, point.roughness)).rg;
+
+  vec3 F = FresnelSchlick(point.normal, point.toCam, point.f0);
+
+  // return vec3(envBrdf.r, envBrdf.g, 0.0f);
+  return prefilteredColor * (F * envBrdf.r + envBrdf.g);
+}
+
+GBufferSample FetchGBuffer(ivec2 coord)
+{
+#ifdef PACKED_GBUFFER
+  return UnpackGBuffer(texelFetch(gbufferPacked, coord, 0).xy);
+#else
+  vec4 albedoEmissiveR              = texelFetch(gbufferAlbedo, coord, 0);
+  vec4 metalnessRoughnessEmissiveGB = texelFetch(gbufferMetalnessRoughness, coord, 0);
+  vec3 normal                       = texelFetch(gbufferWsNorm, coord, 0).xyz;
+
+  GBufferSample s;
+  s.albedo    = albedoEmissiveR.rgb;
+  s.metalness = metalnessRoughnessEmissiveGB.r;
+  s.roughness = metalnessRoughnessEmissiveGB.g;
+  s.emissive  = vec3(albedoEmissiveR.a, metalnessRoughnessEmissiveGB.ba);
+  s.normal    = normalize(255.0f / 127.0f * normal - 128.0f / 127.0f);
+  return s;
+#endif
+}
+
+void ShadePixel(uvec2 coord)
+{
+  if (coord.x >= params.resolution.x || coord.y >= params.resolution.y)
+  {
+    return;
+  }
+
+  vec2  uv    = (vec2(coord) + 0.5f) * params.invResolution;
+  float depth = texelFetch(depthBuffer, ivec2(coord), 0).r;
+
+  // Tiles which are partially covered by the sky still skip it per pixel
+  if (DEFERRED_TILE_CLASS == TILE_CLASS_SKY || depth == 1.0f)
+  {
+    imageStore(out_color, ivec2(coord), vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    return;
+  }
+
+  /* Unpacking the surface point properties */
+  GBufferSample gbuffer = FetchGBuffer(ivec2(coord));
+
+  SurfacePoint point;
+  point.albedo      = gbuffer.albedo;
+  point.metalness   = gbuffer.metalness;
+  point.roughness   = gbuffer.roughness;
+  point.f0          = vec3(0.04f);
+  point.f0          = mix(point.f0, point.albedo, point.metalness);
+
+  point.position    = ReconstructPosition(uv, depth);
+
+  point.normal      = gbuffer.normal;
+  point.toCam       = normalize(camera.wsPos - point.position);
+
+  /* Lighting */
+  vec3 L0 = vec3(0.0f);
+
+  // Emission
+  if (EmissionEnabled())
+  {
+    L0 += gbuffer.emissive;
+  }
+
+  if (DEFERRED_TILE_CLASS == TILE_CLASS_EMISSIVE)
+  {
+    imageStore(out_color, ivec2(coord), vec4(L0, 1.0f));
+    return;
+  }
+
+  // Diffuse IBL
+  if (DiffuseIBLEnabled())
+  {
+    L0 += Irradiance(point) * LambertianDiffuseBRDF(point);
+  }
+
+  // Specular IBL
+  if (SpecularIBLEnabled())
+  {
+    L0 += SpecularIBL(point);
+  }
+
+  // Directional light
+  if (DirectionalLightEnabled())
+  {
+    LightSample dirLightSample;
+    dirLightSample.toLight    = -dirLight.direction;
+    dirLightSample.halfVector = normalize(point.toCam + dirLightSample.toLight);
+    dirLightSample.radiance   = dirLight.radiance;
+
+    L0 += CalculateRadiance(point, dirLightSample);
+  }
+
+  // Point lights
+  if (DEFERRED_TILE_CLASS == TILE_CLASS_COMPLEX && PointLightsEnabled())
+  {
+    for (uint i = 0; i < pointLightCount; ++i)
+    {
+      PointLight pointLight = pointLights[i];
+
+      LightSample pointLightSample;
+      pointLightSample.toLight    = normalize(pointLight.position - point.position);
+      pointLightSample.halfVector = normalize(point.toCam + pointLightSample.toLight);
+      pointLightSample.radiance   = pointLight.radiance;
+
+      // Attenuation with the fallof exactly at the light's radius.
+      // Borrowed from: https://lisyarus.github.io/blog/posts/point-light-attenuation.html
+      float dist                  = length(pointLight.position - point.position) / pointLight.radius;
+      float dist2                 = dist * dist;
+      float numerator             = max(1.0f - dist2, 0.0f);
+      numerator                  *= numerator;
+      float attenuation           = numerator / (1.0f + 4.0f * dist2);
+      pointLightSample.radiance  *= attenuation;
+
+      L0 += CalculateRadiance(point, pointLightSample);
+    }
+  }
+
+  imageStore(out_color, ivec2(coord), vec4(L0, 1.0f));
+}
+
+// One workgroup shades one tile of the list of its class
+layout(local_size_x = TILE_SIZE * TILE_SIZE, local_size_y = 1, local_size_z = 1) in;
+void main()
+{
+  uint  tile      = tiles[DEFERRED_TILE_CLASS * params.tileListStride + gl_WorkGroupID.x];
+  uvec2 tileCoord = uvec2(tile & 0xFFFFu, tile >> 16);
+
+  ShadePixel(tileCoord * TILE_SIZE + SwizzleInvocation(gl_LocalInvocationIndex));
+}
+
+#endif // DEFERRED_TILE_CLASS
+
+#endif // DEFERRED_SHADING_GLSL_INCLUDED
@@ -0,0 +1,70 @@
+#ifndef GBUFFER_GLSL_INCLUDED
+#define GBUFFER_GLSL_INCLUDED
+
+// The material of a pixel as written by the geometry pass
+struct GBufferSample
+{
+  vec3  albedo;
+  float metalness;
+  float roughness;
+  vec3  emissive;
+  vec3  normal;
+};
+
+// Octahedral mapping of a unit vector onto [-1, 1]^2
+vec2 EncodeOctahedron(vec3 n)
+{
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  if (n.z >= 0.0f)
+  {
+    return n.xy;
+  }
+
+  return (1.0f - abs(n.yx)) * mix(vec2(-1.0f), vec2(1.0f), greaterThanEqual(n.xy, vec2(0.0f)));
+}
+
+vec3 DecodeOctahedron(vec2 e)
+{
+  vec3  n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0f);
+  n.xy   += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0f)));
+  return normalize(n);
+}
+
+// The packed layout keeps the whole material of a pixel in a single RG32_UINT texel, so the
+// deferred pass reads 8 bytes with one fetch instead of 12 with three. To fit, metalness and
+// emissive lose precision, which glTF materials rarely need: metalness is almost always 0 or 1,
+// and emissive is only visible on its own.
+// - x: albedo rgb, roughness (unorm8 each)
+// - y: bits 0-19 world-space normal, octahedral (unorm10 each), bits 20-23 metalness (unorm4),
+//      bits 24-31 emissive rgb (unorm3, unorm3, unorm2)
+uvec2 PackGBuffer(GBufferSample s)
+{
+  uvec2 normal    = uvec2(round((EncodeOctahedron(s.normal) * 0.5f + 0.5f) * 1023.0f));
+  uint  metalness = uint(round(clamp(s.metalness, 0.0f, 1.0f) * 15.0f));
+  uvec3 emissive  = uvec3(round(clamp(s.emissive, 0.0f, 1.0f) * vec3(7.0f, 7.0f, 3.0f)));
+
+  return uvec2(
+    packUnorm4x8(vec4(s.albedo, s.roughness)),
+    normal.x | (normal.y << 10) | (metalness << 20) | (emissive.r << 24) | (emissive.g << 27) |
+      (emissive.b << 30));
+}
+
+GBufferSample UnpackGBuffer(uvec2 texel)
+{
+  vec4 albedoRoughness = unpackUnorm4x8(texel.x);
+  vec2 normal = vec2(bitfieldExtract(texel.y, 0, 10), bitfieldExtract(texel.y, 10, 10)) / 1023.0f;
+
+  GBufferSample s;
+  s.albedo    = albedoRoughness.rgb;
+  s.metalness = float(bitfieldExtract(texel.y, 20, 4)) / 15.0f;
+  s.roughness = albedoRoughness.a;
+  s.emissive  = vec3(
+    float(bitfieldExtract(texel.y, 24, 3)) / 7.0f,
+    float(bitfieldExtract(texel.y, 27, 3)) / 7.0f,
+    float(bitfieldExtract(texel.y, 30, 2)) / 3.0f);
+  s.normal    = DecodeOctahedron(normal * 2.0f - 1.0f);
+  return s;
+}
+
+#endif // GBUFFER_GLSL_INCLUDED
@@ -0,0 +1,162 @@
+#ifndef GEOMETRY_PASS_GLSL_INCLUDED
+#define GEOMETRY_PASS_GLSL_INCLUDED
+
+// The fragment stage of the geometry pass, which writes the standard G-buffer layout, or the
+// packed one when PACKED_GBUFFER is defined before including this file
+
+#include "GBuffer.glsl"
+#include "NormalPerturbation.glsl"
+#include "CameraData.h"
+
+//==================================================================================================
+// Descriptor bindings / push constants
+//--------------------------------------------------------------------------------------------------
+layout(set = 0, binding = 0) uniform prev_camera_data_t
+{
+  CameraData prevCamera;
+};
+
+layout(set = 0, binding = 1) uniform curr_camera_data_t
+{
+  CameraData currCamera;
+};
+
+// Finest mip level of a 1x1 texture each material is sampled at, see TextureStreamer
+layout(set = 0, binding = 2) buffer texture_feedback_t
+{
+  uint requestedLods[];
+};
+
+layout(set = 1, binding = 0) uniform sampler2D texAlbedo;
+layout(set = 1, binding = 1) uniform sampler2D texMetalnessRoughness;
+layout(set = 1, binding = 2) uniform sampler2D texNorm;
+layout(set = 1, binding = 3) uniform sampler2D texEmissive;
+
+layout(push_constant) uniform params_t
+{
+  mat4 prevModel;
+  mat4 currModel;
+  mat3 normalMatrix;
+
+  vec3 albedo;
+  float metalness;
+  float roughness;
+  bool unjitterTextureUVs;
+  uint materialIdx;
+} params;
+//==================================================================================================
+
+//==================================================================================================
+// Stage linkage
+//--------------------------------------------------------------------------------------------------
+// The feedback atomics would otherwise move the depth test after the shader, so hidden fragments
+// would shade and report their textures too. Nothing is discarded, so this changes nothing else.
+layout(early_fragment_tests) in;
+
+layout(location = 0) in vs_out_t
+{
+  vec3 wsPos;
+  vec3 wsNorm;
+  vec2 texCoord;
+
+  vec4 prevPosClip;
+  vec4 currPosClip;
+} vertex;
+
+#ifdef PACKED_GBUFFER
+// R32G32_UINT, see GBuffer.glsl
+layout(location = 0) out uvec2 out_gbuffer;
+
+// R16G16
+layout(location = 1) out vec2 out_motionVectors;
+#else
+// R8G8B8A8_UNORM
+// - R8G8B8: albedo
+// - A8:     emissive r channel
+layout(location = 0) out vec4 out_albedoEmissiveR;
+
+// R8G8B8A8_UNORM
+// - R8: metalness
+// - G8: roughness
+// - B8: emissive g channel
+// - A8: emissive b channel
+layout(location = 1) out vec4 out_metalnessRoughnessEmissiveGB;
+
+// R10G10B10A2
+// - R10G10B10: world-space normal
+// - A2:        reserved for future use
+layout(location = 2) out vec4 out_wsNorm;
+
+// R16G16
+layout(location = 3) out vec2 out_motionVectors;
+#endif
+//==================================================================================================
+
+// Must match TextureStreamer::FEEDBACK_*
+const float FEEDBACK_LOD_OFFSET = 32.0f;
+const float FEEDBACK_LOD_SCALE = 16.0f;
+
+// Reports the mip level the material textures are sampled at to the TextureStreamer. Only every
+// 16th pixel writes, which is plenty for a per material value and keeps the atomics cheap.
+void WriteTextureFeedback(vec2 uv)
+{
+  // Derivatives are taken before the branch, as helper invocations must still be running
+  float lod = log2(max(length(dFdx(uv)), length(dFdy(uv))));
+
+  if (any(notEqual(ivec2(gl_FragCoord.xy) & 3, ivec2(0))))
+    return;
+
+  uint encoded = uint(max(lod + FEEDBACK_LOD_OFFSET, 0.0f) * FEEDBACK_LOD_SCALE);
+  atomicMin(requestedLods[params.materialIdx], encoded);
+}
+
+vec2 UnjitterTextureUV(vec2 uv)
+{
+  if (params.unjitterTextureUVs)
+  {
+    return uv - dFdx(uv) * currCamera.jitterPixels.x + dFdy(uv) * currCamera.jitterPixels.y;
+  }
+
+  return uv;
+}
+
+void main()
+{
+  vec2 texCoord = UnjitterTextureUV(vertex.texCoord);
+  WriteTextureFeedback(texCoord);
+
+  GBufferSample gbuffer;
+  gbuffer.emissive = texture(texEmissive, texCoord).rgb;
+
+  /* Albedo */
+  gbuffer.albedo = texture(texAlbedo, texCoord).rgb * params.albedo;
+
+  /* Metalness & Roughness */
+  vec2 metalnessRoughness = texture(texMetalnessRoughness, texCoord).bg;
+  gbuffer.metalness       = metalnessRoughness.x * params.metalness;
+  gbuffer.roughness       = metalnessRoughness.y * params.roughness;
+
+  /* Normal */
+  gbuffer.normal = PerturbNormal(texNorm, normalize(vertex.wsNorm), vertex.wsPos, texCoord);
+
+#ifdef PACKED_GBUFFER
+  out_gbuffer = PackGBuffer(gbuffer);
+#else
+  out_albedoEmissiveR = vec4(gbuffer.albedo, gbuffer.emissive.r);
+  out_metalnessRoughnessEmissiveGB =
+    vec4(gbuffer.metalness, gbuffer.roughness, gbuffer.emissive.gb);
+  out_wsNorm = vec4(0.5f * gbuffer.normal + 0.5f, 0.0f);
+#endif
+
+  /* Motion Vectors */
+  vec2 prevPosNDC = vertex.prevPosClip.xy / vertex.prevPosClip.w; // Perspective divide
+  vec2 currPosNDC = vertex.currPosClip.xy / vertex.currPosClip.w;
+
+  vec2 motionVectorUV = 0.5f * (prevPosNDC - currPosNDC);
+  motionVectorUV -= 0.5f * prevCamera.jitterNDC;
+  motionVectorUV += 0.5f * currCamera.jitterNDC;
+
+  out_motionVectors = motionVectorUV;
+}
+
+#endif // GEOMETRY_PASS_GLSL_INCLUDED
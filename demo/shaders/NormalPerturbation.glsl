@@ -20,9 +20,11 @@ mat3 ConstructCotangentFrame(vec3 wsNorm, vec3 wsPos, vec2 texCoord)
 
 // Normal perturbation without precomputed tangents.
 // Borrowed from: http://www.thetenthplanet.de/archives/1180
+// Only xy of the normal map is used, so that it can be stored as two channel BC5.
 vec3 PerturbNormal(sampler2D texNorm, vec3 wsNorm, vec3 wsPos, vec2 texCoord)
 {
-  vec3 map = 255.0f / 127.0f * texture(texNorm, texCoord).xyz - 128.0f / 127.0f;
+  vec2 xy = 255.0f / 127.0f * texture(texNorm, texCoord).xy - 128.0f / 127.0f;
+  vec3 map = vec3(xy, sqrt(max(1.0f - dot(xy, xy), 0.0f)));
   mat3 tbn = ConstructCotangentFrame(wsNorm, wsPos, texCoord);
   return normalize(tbn * map);
 }
@@ -0,0 +1,54 @@
+#ifndef SPHERICAL_HARMONICS_GLSL_INCLUDED
+#define SPHERICAL_HARMONICS_GLSL_INCLUDED
+
+const uint SH_COEFFICIENT_COUNT = 9;
+
+// Convolution of the clamped cosine lobe with the SH basis, one per coefficient.
+const float A_l[SH_COEFFICIENT_COUNT] = {
+    // l = 0, for m = 0
+    3.141593,
+
+    // l = 1, for m = -1..1
+    2.094395,
+    2.094395,
+    2.094395,
+
+    // l = 2, for m = -2..2
+    0.785398,
+    0.785398,
+    0.785398,
+    0.785398,
+    0.785398,
+};
+
+void EvaluateSH9(vec3 dir, out float Y_lm[SH_COEFFICIENT_COUNT])
+{
+  Y_lm[0] = 0.282095;
+  Y_lm[1] = 0.488603 * dir.x;
+  Y_lm[2] = 0.488603 * dir.z;
+  Y_lm[3] = 0.488603 * dir.y;
+  Y_lm[4] = 1.092548 * dir.x * dir.z;
+  Y_lm[5] = 1.092548 * dir.y * dir.z;
+  Y_lm[6] = 1.092548 * dir.y * dir.x;
+  Y_lm[7] = 0.946176 * dir.z * dir.z - 0.315392;
+  Y_lm[8] = 0.546274 * (dir.x * dir.x - dir.y * dir.y);
+}
+
+// Exact solid angle of a cubemap texel.
+// Reference: http://www.rorydriscoll.com/2012/01/15/cubemap-texel-solid-angle/
+float CubemapAreaElement(float x, float y)
+{
+  return atan(x * y, sqrt(x * x + y * y + 1.0f));
+}
+
+// uv is the texel center in [-1, 1], halfTexelSize is half of the texel size in the same units.
+float CubemapTexelSolidAngle(vec2 uv, vec2 halfTexelSize)
+{
+  vec2 uv0 = uv - halfTexelSize;
+  vec2 uv1 = uv + halfTexelSize;
+
+  return CubemapAreaElement(uv0.x, uv0.y) - CubemapAreaElement(uv0.x, uv1.y) -
+         CubemapAreaElement(uv1.x, uv0.y) + CubemapAreaElement(uv1.x, uv1.y);
+}
+
+#endif // SPHERICAL_HARMONICS_GLSL_INCLUDED
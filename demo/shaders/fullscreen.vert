@@ -0,0 +1,11 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+out gl_PerVertex { vec4 gl_Position; };
+
+/* A single triangle covering the whole viewport, drawn with 3 vertices and no vertex buffer */
+void main()
+{
+  vec2 xy = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+  gl_Position = vec4(xy * 2.0f - 1.0f, 0.0f, 1.0f);
+}
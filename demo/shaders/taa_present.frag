@@ -0,0 +1,13 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/* The swapchain can't be written from compute, so the sharpened output is copied into it by the
+ * fullscreen triangle instead */
+layout(set = 0, binding = 0) uniform sampler2D texInput;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+  outColor = vec4(texelFetch(texInput, ivec2(gl_FragCoord.xy), 0).rgb, 1.0f);
+}
@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+#include <fmt/std.h>
+#include <tiny_gltf.h>
+#include <stb_image.h>
+
+#include "texture_compression/BlockCompression.hpp"
+#include "texture_compression/Ktx2.hpp"
+#include "texture_compression/MipChain.hpp"
+
+
+// Writes a BC compressed KTX2 copy with a full mip chain next to every image of a glTF scene,
+// which SceneManager picks up instead of the source image.
+
+namespace
+{
+
+struct Options
+{
+  std::filesystem::path scene;
+  // BC1/BC3 instead of BC7 for color textures, which encodes a lot faster
+  bool fast = false;
+  // Recompress images whose compressed copy is up to date
+  bool force = false;
+};
+
+struct Job
+{
+  const tinygltf::Image* image;
+  std::filesystem::path sourcePath;
+  std::filesystem::path outputPath;
+  MipFilter filter;
+  float alphaCutoff;
+};
+
+struct ImageRole
+{
+  MipFilter filter;
+  float alphaCutoff;
+};
+
+// Same rules as SceneManager: the first material referencing an image decides its role
+std::vector<std::optional<ImageRole>> resolve_image_roles(const tinygltf::Model& model)
+{
+  std::vector<std::optional<ImageRole>> roles(model.images.size());
+
+  const auto useImage = [&model, &roles](int texture_idx, MipFilter filter, float alpha_cutoff) {
+    if (texture_idx < 0)
+      return;
+    auto& role = roles[model.textures[texture_idx].source];
+    if (!role.has_value())
+      role = ImageRole{filter, alpha_cutoff};
+  };
+
+  for (const auto& material : model.materials)
+  {
+    const auto& pbr = material.pbrMetallicRoughness;
+    const float alphaCutoff =
+      material.alphaMode == "MASK" ? static_cast<float>(material.alphaCutoff) : -1.0f;
+
+    useImage(pbr.baseColorTexture.index, MipFilter::Color, alphaCutoff);
+    useImage(pbr.metallicRoughnessTexture.index, MipFilter::Linear, -1.0f);
+    useImage(material.normalTexture.index, MipFilter::Normal, -1.0f);
+    useImage(material.emissiveTexture.index, MipFilter::Color, -1.0f);
+  }
+
+  return roles;
+}
+
+vk::Format choose_format(MipFilter filter, bool has_alpha, bool fast)
+{
+  switch (filter)
+  {
+  case MipFilter::Color:
+    if (!fast)
+      return vk::Format::eBc7SrgbBlock;
+    return has_alpha ? vk::Format::eBc3SrgbBlock : vk::Format::eBc1RgbSrgbBlock;
+  case MipFilter::Linear:
+    // Metalness and roughness live in .bg, which BC5 can't hold without a swizzle
+    return vk::Format::eBc1RgbUnormBlock;
+  case MipFilter::Normal:
+    // z is rebuilt in the shader
+    return vk::Format::eBc5UnormBlock;
+  }
+  return vk::Format::eUndefined;
+}
+
+bool compress_image(const Job& job, bool fast, uint32_t mip_thread_count)
+{
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  stbi_uc* data = stbi_load_from_memory(
+    job.image->image.data(),
+    static_cast<int>(job.image->image.size()),
+    &width,
+    &height,
+    &channels,
+    4);
+
+  if (data == nullptr)
+  {
+    spdlog::error("Failed to decode '{}': {}", job.sourcePath, stbi_failure_reason());
+    return false;
+  }
+
+  std::vector<std::byte> texels(static_cast<size_t>(width) * height * 4);
+  std::memcpy(texels.data(), data, texels.size());
+  stbi_image_free(data);
+
+  bool hasAlpha = false;
+  for (size_t i = 3; i < texels.size() && !hasAlpha; i += 4)
+    hasAlpha = texels[i] != std::byte{0xff};
+
+  TextureData texture{
+    .format = choose_format(job.filter, hasAlpha, fast),
+    .width = static_cast<uint32_t>(width),
+    .height = static_cast<uint32_t>(height),
+    .mips = {},
+  };
+
+  auto mips = generate_mip_chain(
+    texels,
+    texture.width,
+    texture.height,
+    {.filter = job.filter, .alphaCutoff = job.alphaCutoff, .threadCount = mip_thread_count});
+  texture.mips.reserve(mips.size());
+  for (uint32_t mip = 0; mip < mips.size(); ++mip)
+    texture.mips.push_back(compress_rgba8(
+      texture.format,
+      mips[mip],
+      std::max(texture.width >> mip, 1u),
+      std::max(texture.height >> mip, 1u)));
+
+  if (!write_ktx2(job.outputPath, texture))
+    return false;
+
+  spdlog::info(
+    "{} -> {} ({}x{}, {} mips)",
+    job.sourcePath,
+    vk::to_string(texture.format),
+    texture.width,
+    texture.height,
+    texture.mips.size());
+  return true;
+}
+
+// Images are decoded by compress_image on worker threads, tinygltf only keeps the encoded bytes
+bool keep_encoded_image(
+  tinygltf::Image* image,
+  const int /*image_idx*/,
+  std::string* /*error*/,
+  std::string* /*warning*/,
+  int /*req_width*/,
+  int /*req_height*/,
+  const unsigned char* bytes,
+  int size,
+  void* /*user_data*/)
+{
+  image->image.assign(bytes, bytes + size);
+  image->as_is = true;
+  return true;
+}
+
+std::optional<Options> parse_options(int argc, char** argv)
+{
+  Options options;
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string_view arg = argv[i];
+    if (arg == "--fast")
+      options.fast = true;
+    else if (arg == "--force")
+      options.force = true;
+    else if (options.scene.empty() && !arg.starts_with("--"))
+      options.scene = arg;
+    else
+      return std::nullopt;
+  }
+
+  if (options.scene.empty())
+    return std::nullopt;
+
+  return options;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  const auto options = parse_options(argc, argv);
+  if (!options.has_value())
+  {
+    spdlog::error("Usage: texture_compressor <scene.gltf> [--fast] [--force]");
+    return 1;
+  }
+
+  tinygltf::TinyGLTF loader;
+  loader.SetImageLoader(&keep_encoded_image, nullptr);
+
+  tinygltf::Model model;
+  std::string error;
+  std::string warning;
+  const bool success = options->scene.extension() == ".glb"
+    ? loader.LoadBinaryFromFile(&model, &error, &warning, options->scene.string())
+    : loader.LoadASCIIFromFile(&model, &error, &warning, options->scene.string());
+
+  if (!warning.empty())
+    spdlog::warn("glTF: {}", warning);
+  if (!success)
+  {
+    spdlog::error("glTF: Failed to load '{}': {}", options->scene, error);
+    return 1;
+  }
+
+  const auto sceneDir = options->scene.parent_path();
+  const auto roles = resolve_image_roles(model);
+
+  std::vector<Job> jobs;
+  for (size_t imageIdx = 0; imageIdx < model.images.size(); ++imageIdx)
+  {
+    const auto& image = model.images[imageIdx];
+    if (!roles[imageIdx].has_value())
+      continue;
+
+    if (image.uri.empty() || image.uri.starts_with("data:"))
+    {
+      spdlog::warn("Image '{}' is embedded into the scene, skipping it", image.name);
+      continue;
+    }
+
+    Job job{
+      .image = &image,
+      .sourcePath = sceneDir / image.uri,
+      .outputPath = sceneDir / image.uri,
+      .filter = roles[imageIdx]->filter,
+      .alphaCutoff = roles[imageIdx]->alphaCutoff,
+    };
+    job.outputPath += ".ktx2";
+
+    std::error_code errorCode;
+    if (
+      !options->force && std::filesystem::exists(job.outputPath, errorCode) &&
+      std::filesystem::last_write_time(job.outputPath, errorCode) >=
+        std::filesystem::last_write_time(job.sourcePath, errorCode))
+      continue;
+
+    jobs.push_back(std::move(job));
+  }
+
+  const auto startTime = std::chrono::steady_clock::now();
+
+  std::atomic<size_t> nextJob = 0;
+  std::atomic<uint32_t> failures = 0;
+  {
+    const auto threadCount = static_cast<uint32_t>(std::clamp<size_t>(
+      std::thread::hardware_concurrency(), 1, std::max<size_t>(jobs.size(), 1)));
+    const uint32_t mipThreadCount = std::max(std::thread::hardware_concurrency() / threadCount, 1u);
+
+    std::vector<std::jthread> workers;
+    workers.reserve(threadCount);
+    for (uint32_t threadIdx = 0; threadIdx < threadCount; ++threadIdx)
+      workers.emplace_back([&] {
+        for (size_t jobIdx = nextJob++; jobIdx < jobs.size(); jobIdx = nextJob++)
+          if (!compress_image(jobs[jobIdx], options->fast, mipThreadCount))
+            ++failures;
+      });
+  }
+
+  spdlog::info(
+    "Compressed {} images in {:.1f} s, {} failed",
+    jobs.size(),
+    std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count(),
+    failures.load());
+
+  return failures == 0 ? 0 : 1;
+}